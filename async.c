@@ -239,6 +239,9 @@ static void
 aio_ctx_finalize(GSource     *source)
 {
     AioContext *ctx = (AioContext *) source;
+#ifdef CONFIG_LINUX_IO_URING
+    int i;
+#endif
 
     qemu_bh_delete(ctx->notify_dummy_bh);
     thread_pool_free(ctx->thread_pool);
@@ -251,6 +254,16 @@ aio_ctx_finalize(GSource     *source)
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    for (i = 0; i < ARRAY_SIZE(ctx->linux_io_uring); i++) {
+        if (ctx->linux_io_uring[i]) {
+            luring_detach_aio_context(ctx->linux_io_uring[i], ctx);
+            luring_cleanup(ctx->linux_io_uring[i]);
+            ctx->linux_io_uring[i] = NULL;
+        }
+    }
+#endif
+
     qemu_mutex_lock(&ctx->bh_lock);
     while (ctx->first_bh) {
         QEMUBH *next = ctx->first_bh->next;
@@ -263,7 +276,7 @@ aio_ctx_finalize(GSource     *source)
     }
     qemu_mutex_unlock(&ctx->bh_lock);
 
-    aio_set_event_notifier(ctx, &ctx->notifier, false, NULL);
+    aio_set_event_notifier(ctx, &ctx->notifier, false, NULL, NULL);
     event_notifier_cleanup(&ctx->notifier);
     rfifolock_destroy(&ctx->lock);
     qemu_mutex_destroy(&ctx->bh_lock);
@@ -291,6 +304,25 @@ ThreadPool *aio_get_thread_pool(AioContext *ctx)
     return ctx->thread_pool;
 }
 
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp)
+{
+    if (min > max || max <= 0 || max > INT_MAX) {
+        error_setg(errp, "thread-pool-min (%" PRId64 ") must not be greater "
+                   "than thread-pool-max (%" PRId64 "), which must be in "
+                   "range [1, %d]", min, max, INT_MAX);
+        return;
+    }
+
+    aio_context_acquire(ctx);
+    ctx->thread_pool_min = min;
+    ctx->thread_pool_max = max;
+    if (ctx->thread_pool) {
+        thread_pool_update_params(ctx->thread_pool, ctx);
+    }
+    aio_context_release(ctx);
+}
+
 #ifdef CONFIG_LINUX_AIO
 LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 {
@@ -302,6 +334,19 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+LuringState *aio_get_linux_io_uring(AioContext *ctx, bool sqpoll)
+{
+    if (!ctx->linux_io_uring[sqpoll]) {
+        ctx->linux_io_uring[sqpoll] = luring_init(sqpoll);
+        if (ctx->linux_io_uring[sqpoll]) {
+            luring_attach_aio_context(ctx->linux_io_uring[sqpoll], ctx);
+        }
+    }
+    return ctx->linux_io_uring[sqpoll];
+}
+#endif
+
 void aio_notify(AioContext *ctx)
 {
     /* Write e.g. bh->scheduled before reading ctx->notify_me.  Pairs
@@ -343,6 +388,15 @@ static void event_notifier_dummy_cb(EventNotifier *e)
 {
 }
 
+/* Returns true if aio_notify() was called (e.g. a BH was scheduled) */
+static bool event_notifier_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    AioContext *ctx = container_of(e, AioContext, notifier);
+
+    return atomic_read(&ctx->notified);
+}
+
 AioContext *aio_context_new(Error **errp)
 {
     int ret;
@@ -360,11 +414,22 @@ AioContext *aio_context_new(Error **errp)
     aio_set_event_notifier(ctx, &ctx->notifier,
                            false,
                            (EventNotifierHandler *)
-                           event_notifier_dummy_cb);
+                           event_notifier_dummy_cb,
+                           event_notifier_poll);
 #ifdef CONFIG_LINUX_AIO
     ctx->linux_aio = NULL;
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    ctx->linux_io_uring[0] = NULL;
+    ctx->linux_io_uring[1] = NULL;
 #endif
     ctx->thread_pool = NULL;
+    ctx->thread_pool_min = 0;
+    ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    ctx->poll_ns = 0;
+    ctx->poll_max_ns = 0;
+    ctx->poll_grow = 0;
+    ctx->poll_shrink = 0;
     qemu_mutex_init(&ctx->bh_lock);
     rfifolock_init(&ctx->lock, aio_rfifolock_cb, ctx);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
@@ -0,0 +1,469 @@
+/*
+ * Linux io_uring support.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "block/block.h"
+#include "block/raw-aio.h"
+#include "qemu/event_notifier.h"
+#include "qemu/coroutine.h"
+
+#include <liburing.h>
+
+/*
+ * Ring size (per AioContext). Requests that do not fit in the submission
+ * ring wait in io_q and are moved in as completions free entries.
+ */
+#define MAX_ENTRIES 128
+
+/* Registered file table of a ring, shared by the images of the AioContext */
+#define MAX_FILES   64
+
+/* Idle time before the SQPOLL kernel thread goes to sleep, in ms */
+#define SQ_THREAD_IDLE 1000
+
+typedef struct LuringAIOCB {
+    Coroutine *co;
+    struct io_uring_sqe sqeq;
+    ssize_t ret;
+    QEMUIOVector *qiov;
+    bool is_read;
+    QSIMPLEQ_ENTRY(LuringAIOCB) next;
+
+    /* Buffered reads may be short before EOF, the rest is read again */
+    int total_read;
+    QEMUIOVector resubmit_qiov;
+} LuringAIOCB;
+
+typedef struct LuringQueue {
+    int plugged;
+    unsigned int in_queue;
+    unsigned int in_ring;   /* head of submit_queue already in the SQ ring */
+    unsigned int in_flight;
+    bool blocked;
+    int error;              /* submission failed for good, see ioq_fail() */
+    QSIMPLEQ_HEAD(, LuringAIOCB) submit_queue;
+} LuringQueue;
+
+struct LuringState {
+    AioContext *aio_context;
+
+    struct io_uring ring;
+    EventNotifier e;
+
+    /* io queue for submit at batch */
+    LuringQueue io_q;
+
+    /* I/O completion processing */
+    QEMUBH *completion_bh;
+
+    bool files_registered;
+    int files[MAX_FILES];       /* -1 if the slot is free */
+};
+
+static void ioq_submit(LuringState *s);
+
+static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
+{
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+}
+
+static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
+                                       int nread)
+{
+    QEMUIOVector *resubmit_qiov = &luringcb->resubmit_qiov;
+    size_t remaining;
+
+    if (luringcb->total_read) {
+        qemu_iovec_reset(resubmit_qiov);
+    } else {
+        qemu_iovec_init(resubmit_qiov, luringcb->qiov->niov);
+    }
+    luringcb->total_read += nread;
+    remaining = luringcb->qiov->size - luringcb->total_read;
+    qemu_iovec_concat(resubmit_qiov, luringcb->qiov, luringcb->total_read,
+                      remaining);
+
+    luringcb->sqeq.off += nread;
+    luringcb->sqeq.addr = (__u64)(uintptr_t)resubmit_qiov->iov;
+    luringcb->sqeq.len = resubmit_qiov->niov;
+
+    luring_resubmit(s, luringcb);
+}
+
+/*
+ * Completes a request and enters its coroutine.
+ */
+static void luring_process_completion(LuringAIOCB *luringcb, int ret)
+{
+    size_t size = luringcb->qiov->size;
+
+    if (ret >= 0) {
+        if (luringcb->is_read) {
+            size_t total = luringcb->total_read + ret;
+
+            /* Short read at EOF, pad with zeros. */
+            if (total < size) {
+                qemu_iovec_memset(luringcb->qiov, total, 0, size - total);
+            }
+            ret = 0;
+        } else {
+            ret = ret == size ? 0 : -ENOSPC;
+        }
+    }
+
+    if (luringcb->total_read) {
+        qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    }
+
+    luringcb->ret = ret;
+    qemu_coroutine_enter(luringcb->co);
+}
+
+/* Completions are reaped from the completion ring in the AioContext. Like in
+ * linux-aio, the BH is rescheduled while completions are processed so that
+ * nested event loops started by a request callback see the rest.
+ */
+static void luring_process_completions(LuringState *s)
+{
+    struct io_uring_cqe *cqe;
+
+    /* Reschedule so nested event loops see currently pending completions */
+    qemu_bh_schedule(s->completion_bh);
+
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0 && cqe) {
+        LuringAIOCB *luringcb = io_uring_cqe_get_data(cqe);
+        int ret = cqe->res;
+
+        io_uring_cqe_seen(&s->ring, cqe);
+        s->io_q.in_flight--;
+
+        if (ret == -EINTR || ret == -EAGAIN) {
+            luring_resubmit(s, luringcb);
+            continue;
+        }
+        if (ret > 0 && luringcb->is_read &&
+            luringcb->total_read + ret < luringcb->qiov->size) {
+            luring_resubmit_short_read(s, luringcb, ret);
+            continue;
+        }
+
+        luring_process_completion(luringcb, ret);
+    }
+
+    qemu_bh_cancel(s->completion_bh);
+
+    if (!s->io_q.plugged && s->io_q.in_queue) {
+        ioq_submit(s);
+    }
+}
+
+static void luring_completion_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    /* Also retries a refused submission, see ioq_submit() */
+    luring_process_completions(s);
+}
+
+static void luring_completion_cb(EventNotifier *e)
+{
+    LuringState *s = container_of(e, LuringState, e);
+
+    if (event_notifier_test_and_clear(&s->e)) {
+        luring_process_completions(s);
+    }
+}
+
+/* Busy polling callback, the completion ring is read from userspace */
+static bool luring_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    LuringState *s = container_of(e, LuringState, e);
+
+    if (!io_uring_cq_ready(&s->ring)) {
+        return false;
+    }
+
+    luring_process_completions(s);
+    return true;
+}
+
+static void ioq_init(LuringQueue *io_q)
+{
+    QSIMPLEQ_INIT(&io_q->submit_queue);
+    io_q->plugged = 0;
+    io_q->in_queue = 0;
+    io_q->in_ring = 0;
+    io_q->in_flight = 0;
+    io_q->blocked = false;
+    io_q->error = 0;
+}
+
+/* The ring refused the submission with an error other than a lack of
+ * resources. The SQEs left in the ring are never submitted, so all queued
+ * requests are failed with 'ret', and so are the later ones.
+ */
+static void ioq_fail(LuringState *s, int ret)
+{
+    LuringAIOCB *luringcb;
+
+    s->io_q.error = ret;
+    s->io_q.in_ring = 0;
+    s->io_q.blocked = false;
+
+    while ((luringcb = QSIMPLEQ_FIRST(&s->io_q.submit_queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+        s->io_q.in_queue--;
+        luring_process_completion(luringcb, ret);
+    }
+}
+
+/* Moves the waiting requests into the submission ring and submits them with
+ * one io_uring_enter(). With SQPOLL the kernel thread picks them up and the
+ * syscall is only made to wake it up. Requests leave submit_queue once the
+ * kernel has taken their SQE, which it does in ring order.
+ */
+static void ioq_submit(LuringState *s)
+{
+    unsigned int i;
+    int ret;
+
+    if (s->io_q.error) {
+        ioq_fail(s, s->io_q.error);
+        return;
+    }
+
+    while (s->io_q.in_queue > 0) {
+        LuringAIOCB *luringcb;
+
+        i = 0;
+        QSIMPLEQ_FOREACH(luringcb, &s->io_q.submit_queue, next) {
+            struct io_uring_sqe *sqe;
+
+            if (i++ < s->io_q.in_ring) {
+                continue;
+            }
+            sqe = io_uring_get_sqe(&s->ring);
+            if (!sqe) {
+                break;
+            }
+            *sqe = luringcb->sqeq;
+            s->io_q.in_ring++;
+        }
+
+        ret = io_uring_submit(&s->ring);
+        if (ret == -EINTR) {
+            continue;
+        }
+        if (ret == -EAGAIN || ret == -EBUSY || ret == 0) {
+            /* Retried when completions free resources */
+            break;
+        }
+        if (ret < 0) {
+            ioq_fail(s, ret);
+            return;
+        }
+
+        for (i = 0; i < ret; i++) {
+            QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+        }
+        s->io_q.in_ring -= ret;
+        s->io_q.in_flight += ret;
+        s->io_q.in_queue -= ret;
+    }
+
+    s->io_q.blocked = (s->io_q.in_queue > 0);
+    if (s->io_q.blocked && !s->io_q.in_flight) {
+        /* No completion is coming to retry the submission */
+        qemu_bh_schedule(s->completion_bh);
+    }
+}
+
+void luring_io_plug(BlockDriverState *bs, LuringState *s)
+{
+    s->io_q.plugged++;
+}
+
+void luring_io_unplug(BlockDriverState *bs, LuringState *s)
+{
+    assert(s->io_q.plugged);
+    if (--s->io_q.plugged == 0 &&
+        !s->io_q.blocked && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+}
+
+static int luring_do_submit(int fd, int fixed, LuringAIOCB *luringcb,
+                            LuringState *s, uint64_t offset, int type)
+{
+    struct io_uring_sqe *sqe = &luringcb->sqeq;
+    QEMUIOVector *qiov = luringcb->qiov;
+
+    switch (type) {
+    case QEMU_AIO_WRITE:
+        io_uring_prep_writev(sqe, fd, qiov->iov, qiov->niov, offset);
+        break;
+    case QEMU_AIO_READ:
+        io_uring_prep_readv(sqe, fd, qiov->iov, qiov->niov, offset);
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        return -EIO;
+    }
+    if (s->io_q.error) {
+        return s->io_q.error;
+    }
+    if (fixed >= 0) {
+        sqe->fd = fixed;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    io_uring_sqe_set_data(sqe, luringcb);
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+    if (!s->io_q.blocked &&
+        (!s->io_q.plugged ||
+         s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES)) {
+        ioq_submit(s);
+    }
+
+    return 0;
+}
+
+int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s,
+                                  int fd, int fixed, uint64_t offset,
+                                  QEMUIOVector *qiov, int type)
+{
+    int ret;
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+        .qiov       = qiov,
+        .is_read    = (type == QEMU_AIO_READ),
+    };
+
+    ret = luring_do_submit(fd, fixed, &luringcb, s, offset, type);
+    if (ret < 0) {
+        return ret;
+    }
+
+    qemu_coroutine_yield();
+    return luringcb.ret;
+}
+
+/* Returns the slot of fd in the registered file table, -1 if the table is
+ * full or not available. Requests then use the plain file descriptor.
+ */
+int luring_register_file(LuringState *s, int fd)
+{
+    int i;
+
+    if (!s->files_registered) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FILES; i++) {
+        if (s->files[i] == -1) {
+            if (io_uring_register_files_update(&s->ring, i, &fd, 1) < 0) {
+                return -1;
+            }
+            s->files[i] = fd;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void luring_unregister_file(LuringState *s, int fixed)
+{
+    int fd = -1;
+
+    assert(fixed >= 0 && fixed < MAX_FILES && s->files[fixed] != -1);
+    io_uring_register_files_update(&s->ring, fixed, &fd, 1);
+    s->files[fixed] = -1;
+}
+
+void luring_detach_aio_context(LuringState *s, AioContext *old_context)
+{
+    aio_set_event_notifier(old_context, &s->e, false, NULL, NULL);
+    qemu_bh_delete(s->completion_bh);
+    s->aio_context = NULL;
+}
+
+void luring_attach_aio_context(LuringState *s, AioContext *new_context)
+{
+    s->aio_context = new_context;
+    s->completion_bh = aio_bh_new(new_context, luring_completion_bh, s);
+    aio_set_event_notifier(new_context, &s->e, false,
+                           luring_completion_cb, luring_poll_cb);
+}
+
+LuringState *luring_init(bool sqpoll)
+{
+    LuringState *s;
+    struct io_uring_params p;
+    int i;
+
+    s = g_malloc0(sizeof(*s));
+    if (event_notifier_init(&s->e, false) < 0) {
+        goto out_free_state;
+    }
+
+    memset(&p, 0, sizeof(p));
+    if (sqpoll) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = SQ_THREAD_IDLE;
+    }
+    if (io_uring_queue_init_params(MAX_ENTRIES, &s->ring, &p) < 0) {
+        goto out_close_efd;
+    }
+
+    /* Before Linux 5.11 the polling thread only takes registered files */
+#ifdef IORING_FEAT_SQPOLL_NONFIXED
+    if (sqpoll && !(p.features & IORING_FEAT_SQPOLL_NONFIXED)) {
+        goto out_exit;
+    }
+#else
+    if (sqpoll) {
+        goto out_exit;
+    }
+#endif
+
+    if (io_uring_register_eventfd(&s->ring, event_notifier_get_fd(&s->e))) {
+        goto out_exit;
+    }
+
+    /* Sparse table, images fill it in when they ask for registered files */
+    for (i = 0; i < MAX_FILES; i++) {
+        s->files[i] = -1;
+    }
+    s->files_registered =
+        io_uring_register_files(&s->ring, s->files, MAX_FILES) == 0;
+
+    ioq_init(&s->io_q);
+
+    return s;
+
+out_exit:
+    io_uring_queue_exit(&s->ring);
+out_close_efd:
+    event_notifier_cleanup(&s->e);
+out_free_state:
+    g_free(s);
+    return NULL;
+}
+
+void luring_cleanup(LuringState *s)
+{
+    io_uring_queue_exit(&s->ring);
+    event_notifier_cleanup(&s->e);
+    g_free(s);
+}
@@ -145,6 +145,11 @@ typedef struct BDRVRawState {
     bool discard_zeroes:1;
     bool has_fallocate;
     bool needs_alignment;
+#ifdef CONFIG_LINUX_IO_URING
+    bool io_uring_sqpoll;
+    bool io_uring_fixed_files;
+    int io_uring_fixed;         /* registered file slot, -1 if none */
+#endif
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -367,6 +372,42 @@ static void raw_parse_flags(int bdrv_flags, int *open_flags)
     }
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static LuringState *raw_get_io_uring(BlockDriverState *bs, AioContext *ctx)
+{
+    BDRVRawState *s = bs->opaque;
+
+    return aio_get_linux_io_uring(ctx, s->io_uring_sqpoll);
+}
+
+/* The file is registered in the ring of the AioContext, it moves with the
+ * BDS and follows the fd across reopen
+ */
+static void raw_io_uring_register(BlockDriverState *bs, AioContext *ctx)
+{
+    BDRVRawState *s = bs->opaque;
+    LuringState *aio;
+
+    if (!s->io_uring_fixed_files || s->io_uring_fixed >= 0) {
+        return;
+    }
+    aio = raw_get_io_uring(bs, ctx);
+    if (aio) {
+        s->io_uring_fixed = luring_register_file(aio, s->fd);
+    }
+}
+
+static void raw_io_uring_unregister(BlockDriverState *bs, AioContext *ctx)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->io_uring_fixed >= 0) {
+        luring_unregister_file(raw_get_io_uring(bs, ctx), s->io_uring_fixed);
+        s->io_uring_fixed = -1;
+    }
+}
+#endif
+
 #ifdef CONFIG_LINUX_AIO
 static bool raw_use_aio(int bdrv_flags)
 {
@@ -399,6 +440,16 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "File name of the image",
         },
+        {
+            .name = "io-uring-sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "Submit with a kernel polling thread (aio=io_uring)",
+        },
+        {
+            .name = "io-uring-fixed-files",
+            .type = QEMU_OPT_BOOL,
+            .help = "Register the file in the ring (aio=io_uring)",
+        },
         { /* end of list */ }
     },
 };
@@ -459,6 +510,31 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
+#ifdef CONFIG_LINUX_IO_URING
+    s->io_uring_fixed = -1;
+    if (bdrv_flags & BDRV_O_IO_URING) {
+        s->io_uring_sqpoll = qemu_opt_get_bool(opts, "io-uring-sqpoll", false);
+        s->io_uring_fixed_files = qemu_opt_get_bool(opts,
+                                                    "io-uring-fixed-files",
+                                                    false);
+        if (!raw_get_io_uring(bs, bdrv_get_aio_context(bs))) {
+            error_setg(errp, "aio=io_uring was specified, but the io_uring "
+                             "could not be set up%s.",
+                       s->io_uring_sqpoll ?
+                       " (io-uring-sqpoll needs Linux 5.11)" : "");
+            ret = -EINVAL;
+            goto fail;
+        }
+    }
+#else
+    if (bdrv_flags & BDRV_O_IO_URING) {
+        error_setg(errp, "aio=io_uring was specified, but is not supported "
+                         "in this build.");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif /* !defined(CONFIG_LINUX_IO_URING) */
+
     s->has_discard = true;
     s->has_write_zeroes = true;
     bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP;
@@ -511,6 +587,10 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    raw_io_uring_register(bs, bdrv_get_aio_context(bs));
+#endif
+
     ret = 0;
 fail:
     if (filename && (bdrv_flags & BDRV_O_TEMPORARY)) {
@@ -617,8 +697,14 @@ static void raw_reopen_commit(BDRVReopenState *state)
 
     s->open_flags = raw_s->open_flags;
 
+#ifdef CONFIG_LINUX_IO_URING
+    raw_io_uring_unregister(state->bs, bdrv_get_aio_context(state->bs));
+#endif
     qemu_close(s->fd);
     s->fd = raw_s->fd;
+#ifdef CONFIG_LINUX_IO_URING
+    raw_io_uring_register(state->bs, bdrv_get_aio_context(state->bs));
+#endif
 
     g_free(state->opaque);
     state->opaque = NULL;
@@ -1264,6 +1350,19 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
         }
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    /* Unlike linux-aio, io_uring is also asynchronous for buffered files */
+    if (!(type & QEMU_AIO_MISALIGNED) && (bs->open_flags & BDRV_O_IO_URING)) {
+        LuringState *aio = raw_get_io_uring(bs, bdrv_get_aio_context(bs));
+
+        if (aio) {
+            assert(qiov->size == bytes);
+            return luring_co_submit(bs, aio, s->fd, s->io_uring_fixed,
+                                    offset, qiov, type);
+        }
+    }
+#endif
+
     return paio_submit_co(bs, s->fd, offset, qiov, bytes, type);
 }
 
@@ -1290,6 +1389,14 @@ static void raw_aio_plug(BlockDriverState *bs)
         laio_io_plug(bs, aio);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (bs->open_flags & BDRV_O_IO_URING) {
+        LuringState *aio = raw_get_io_uring(bs, bdrv_get_aio_context(bs));
+        if (aio) {
+            luring_io_plug(bs, aio);
+        }
+    }
+#endif
 }
 
 static void raw_aio_unplug(BlockDriverState *bs)
@@ -1300,6 +1407,29 @@ static void raw_aio_unplug(BlockDriverState *bs)
         laio_io_unplug(bs, aio);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (bs->open_flags & BDRV_O_IO_URING) {
+        LuringState *aio = raw_get_io_uring(bs, bdrv_get_aio_context(bs));
+        if (aio) {
+            luring_io_unplug(bs, aio);
+        }
+    }
+#endif
+}
+
+static void raw_detach_aio_context(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    raw_io_uring_unregister(bs, bdrv_get_aio_context(bs));
+#endif
+}
+
+static void raw_attach_aio_context(BlockDriverState *bs,
+                                   AioContext *new_context)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    raw_io_uring_register(bs, new_context);
+#endif
 }
 
 static BlockAIOCB *raw_aio_flush(BlockDriverState *bs,
@@ -1317,6 +1447,9 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    raw_io_uring_unregister(bs, bdrv_get_aio_context(bs));
+#endif
     if (s->fd >= 0) {
         qemu_close(s->fd);
         s->fd = -1;
@@ -1868,6 +2001,8 @@ BlockDriver bdrv_file = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_attach_aio_context = raw_attach_aio_context,
 
     .bdrv_truncate = raw_truncate,
     .bdrv_getlength = raw_getlength,
@@ -2311,6 +2446,8 @@ static BlockDriver bdrv_host_device = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_attach_aio_context = raw_attach_aio_context,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength	= raw_getlength,
@@ -2432,6 +2569,8 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_attach_aio_context = raw_attach_aio_context,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -2562,6 +2701,8 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_attach_aio_context = raw_attach_aio_context,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -812,7 +812,7 @@ ETEXI
 
 STEXI
 @item ox-info-debug
-Display the status of debugging in ox
+Display the status of debugging in ox, for each ox-ctrl device
 ETEXI
 
     {
@@ -822,6 +822,33 @@ ETEXI
        .help       = "Show the status of debugging in ox",
        .mhandler.cmd = hmp_info_ox_debug,
    },
+
+STEXI
+@item info ox [@var{id}]
+Display the OX controller state: multi-queues, channels, GC and VOLT memory.
+@var{id} selects the ox-ctrl device when several are present
+ETEXI
+
+    {
+        .name       = "ox",
+        .args_type  = "id:s?",
+        .params     = "[id]",
+        .help       = "show the OX controller queues, channels and GC state",
+        .mhandler.cmd = hmp_info_ox,
+    },
+
+STEXI
+@item info ox_lat [-j]
+Display the OX per-stage latency histograms, as JSON with -j
+ETEXI
+
+    {
+        .name       = "ox_lat",
+        .args_type  = "json:-j",
+        .params     = "[-j]",
+        .help       = "show OX per-stage latency histograms (-j: JSON)",
+        .mhandler.cmd = hmp_info_ox_lat,
+    },
 STEXI
 @item info hotpluggable-cpus
 @findex hotpluggable-cpus
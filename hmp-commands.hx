@@ -1745,7 +1745,7 @@ ETEXI
 
 STEXI
 @item ox-debug
-Prints Enables or disables debugging of ox (on/off)
+Prints Enables or disables debugging of ox (on/off) in all ox-ctrl devices
 ETEXI
 
     {
@@ -1755,6 +1755,20 @@ ETEXI
        .help       = "Enables or disables debugging of ox (on/off)",
        .mhandler.cmd = hmp_ox_debug,
    },
+
+STEXI
+@item ox_lat on|off|reset|json @var{file}
+Enables, disables or resets the OX latency tracing, or writes the latency
+histograms to @var{file} as JSON
+ETEXI
+
+    {
+        .name       = "ox_lat",
+        .args_type  = "action:s,file:s?",
+        .params     = "on|off|reset|json [file]",
+        .help       = "control OX latency tracing or export it as JSON",
+        .mhandler.cmd = hmp_ox_lat,
+    },
 STEXI
 @item qom-set @var{path} @var{property} @var{value}
 Set QOM property @var{property} of object at location @var{path} to value @var{value}
@@ -2033,8 +2033,11 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     IOThreadInfoList *info;
 
     for (info = info_list; info; info = info->next) {
-        monitor_printf(mon, "%s: thread_id=%" PRId64 "\n",
-                       info->value->id, info->value->thread_id);
+        monitor_printf(mon, "%s: thread_id=%" PRId64 " poll-max-ns=%" PRId64
+                       " poll-grow=%" PRId64 " poll-shrink=%" PRId64 "\n",
+                       info->value->id, info->value->thread_id,
+                       info->value->poll_max_ns, info->value->poll_grow,
+                       info->value->poll_shrink);
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -2449,14 +2452,29 @@ void hmp_hotpluggable_cpus(Monitor *mon, const QDict *qdict)
     qapi_free_HotpluggableCPUList(saved);
 }
 
-extern struct core_struct core;
+static void hmp_ox_set_debug(QemuOxCtrl *qemu, void *opaque)
+{
+        core.debug = *(uint8_t *) opaque;
+}
+
+static void hmp_ox_print_debug(QemuOxCtrl *qemu, void *opaque)
+{
+        monitor_printf((Monitor *) opaque, "OX (%s): debugging is %s\n",
+                       DEVICE(qemu)->id ? DEVICE(qemu)->id : "ox-ctrl",
+                       core.debug ? "on" : "off");
+}
+
+/* Applies to all ox-ctrl devices */
 void hmp_ox_debug(Monitor *mon, const QDict *qdict)
 {
         const char *name = qdict_get_str(qdict, "on_off");
+        uint8_t debug;
+
         if (!strcmp(name, "on") || !strcmp(name, "off")) {
-                core.debug = strcmp(name, "on") ? 0 : 1;
+                debug = strcmp(name, "on") ? 0 : 1;
+                ox_foreach(hmp_ox_set_debug, &debug);
                 monitor_printf(mon, "OX: debugging %s\n",
-                               core.debug ? "enabled" : "disabled");
+                               debug ? "enabled" : "disabled");
         }
         else {
                 monitor_printf(mon, "OX: Only accepts \"on\" or \"off\". Found: %s\n",
@@ -2466,5 +2484,115 @@ void hmp_ox_debug(Monitor *mon, const QDict *qdict)
 
 void hmp_info_ox_debug(Monitor *mon, const QDict *qdict)
 {
-        monitor_printf(mon, "OX: debugging is %s\n", core.debug ? "on" : "off");
+        ox_foreach(hmp_ox_print_debug, mon);
+}
+
+void hmp_ox_lat(Monitor *mon, const QDict *qdict)
+{
+        const char *action = qdict_get_str(qdict, "action");
+        const char *file = qdict_get_try_str(qdict, "file");
+
+        if (!strcmp(action, "on") || !strcmp(action, "off")) {
+                ox_lat_enabled = strcmp(action, "on") ? 0 : 1;
+                monitor_printf(mon, "OX: latency tracing %s\n",
+                               ox_lat_enabled ? "enabled" : "disabled");
+        } else if (!strcmp(action, "reset")) {
+                ox_lat_reset();
+                monitor_printf(mon, "OX: latency histograms cleared\n");
+        } else if (!strcmp(action, "json")) {
+                if (!file) {
+                        monitor_printf(mon, "OX: json requires a file name\n");
+                } else if (ox_lat_dump_json(file)) {
+                        monitor_printf(mon, "OX: could not write %s\n", file);
+                } else {
+                        monitor_printf(mon, "OX: latency written to %s\n", file);
+                }
+        } else {
+                monitor_printf(mon, "OX: Only accepts \"on\", \"off\", "
+                               "\"reset\" or \"json\". Found: %s\n", action);
+        }
+}
+
+void hmp_info_ox(Monitor *mon, const QDict *qdict)
+{
+        Error *err = NULL;
+        OxInfo *info;
+        OxMqInfoList *mq;
+        OxMqQueueInfoList *q;
+        OxChannelInfoList *ch;
+        int64_t lookups;
+        const char *id = qdict_get_try_str(qdict, "id");
+
+        info = qmp_query_ox(!!id, id, &err);
+        if (err) {
+                hmp_handle_error(mon, &err);
+                return;
+        }
+
+        monitor_printf(mon, "OX (%s): %s mode\n",
+                       info->has_id ? info->id : "ox-ctrl",
+                       info->lnvm ? "open-channel" : "AppNVM");
+
+        for (mq = info->mq; mq; mq = mq->next) {
+                monitor_printf(mon, "ox-mq: %s, size: %" PRId64 ", ext: %"
+                               PRId64 ", TO: %" PRId64 ", TO_BACK: %" PRId64
+                               "\n", mq->value->name, mq->value->queue_size,
+                               mq->value->ext_list, mq->value->timeout,
+                               mq->value->timeout_back);
+                for (q = mq->value->queues; q; q = q->next) {
+                        monitor_printf(mon, "    Q%02" PRId64 ": SF: %" PRId64
+                                       ", SU: %" PRId64 ", SW: %" PRId64
+                                       ", CF: %" PRId64 ", CU: %" PRId64 "\n",
+                                       q->value->id, q->value->sq_free,
+                                       q->value->sq_used, q->value->sq_wait,
+                                       q->value->cq_free, q->value->cq_used);
+                }
+        }
+
+        for (ch = info->channels; ch; ch = ch->next) {
+                lookups = ch->value->map_cache_hits +
+                          ch->value->map_cache_misses;
+                monitor_printf(mon, "channel %" PRId64 ":%s%s blocks free: %"
+                               PRId64 ", used: %" PRId64 ", open: %" PRId64
+                               ", map cache: %" PRId64 "/%" PRId64
+                               " pages, hit rate: %.2f%%, evictions: %"
+                               PRId64 "\n", ch->value->id,
+                               ch->value->active ? "" : " (inactive)",
+                               ch->value->need_gc ? " (need gc)" : "",
+                               ch->value->free_blocks, ch->value->used_blocks,
+                               ch->value->open_blocks,
+                               ch->value->map_cache_used,
+                               ch->value->map_cache_used +
+                               ch->value->map_cache_free,
+                               lookups ? 100.0 * ch->value->map_cache_hits /
+                               lookups : 0.0, ch->value->map_cache_evictions);
+        }
+
+        if (info->has_gc) {
+                monitor_printf(mon, "gc: recycled blocks: %" PRId64
+                               ", moved sectors: %" PRId64 ", map pages: %"
+                               PRId64 ", padding: %" PRId64 ", failed: %"
+                               PRId64 ", unknown: %" PRId64 "\n",
+                               info->gc->recycled_blocks,
+                               info->gc->moved_sectors, info->gc->map_pages,
+                               info->gc->padding_sectors,
+                               info->gc->failed_sectors,
+                               info->gc->unknown_sectors);
+        }
+
+        if (info->has_volt_memory) {
+                monitor_printf(mon, "volt: memory usage: %" PRId64 " MB\n",
+                               info->volt_memory / 1048576);
+        }
+
+        qapi_free_OxInfo(info);
+}
+
+void hmp_info_ox_lat(Monitor *mon, const QDict *qdict)
+{
+        if (qdict_get_try_bool(qdict, "json", false)) {
+                ox_lat_print_json((FILE *)mon, monitor_fprintf);
+        } else {
+                ox_lat_print((FILE *)mon, monitor_fprintf);
+        }
 }
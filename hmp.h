@@ -137,5 +137,8 @@ void hmp_hotpluggable_cpus(Monitor *mon, const QDict *qdict);
 
 void hmp_ox_debug(Monitor *mon, const QDict *qdict);
 void hmp_info_ox_debug(Monitor *mon, const QDict *qdict);
+void hmp_ox_lat(Monitor *mon, const QDict *qdict);
+void hmp_info_ox_lat(Monitor *mon, const QDict *qdict);
+void hmp_info_ox(Monitor *mon, const QDict *qdict);
 
 #endif
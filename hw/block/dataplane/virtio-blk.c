@@ -26,6 +26,25 @@
 #include "hw/virtio/virtio-bus.h"
 #include "qom/object_interfaces.h"
 
+/* Virtqueues can be served by other iothreads than the one of the
+ * BlockBackend. Only the vring work is spread: their requests are popped,
+ * pushed and notified in the virtqueue context, but they are parsed and
+ * submitted to the block layer by the BlockBackend iothread, which is the
+ * only thread allowed to enter it. Each batch popped by another iothread
+ * costs a BH hop there and back, so this helps when the vring processing
+ * and guest notification, not the block layer, bound the I/O rate.
+ */
+typedef struct VirtIOBlockDataPlaneVq {
+    VirtIOBlockDataPlane *s;
+    VirtQueue *vq;
+    IOThread *iothread;
+    AioContext *ctx;
+    QEMUBH *bh;                     /* pushes completed requests */
+    QemuMutex lock;
+    VirtIOBlockReq *done;
+    VirtIOBlockReq **done_tail;
+} VirtIOBlockDataPlaneVq;
+
 struct VirtIOBlockDataPlane {
     bool starting;
     bool stopping;
@@ -40,17 +59,114 @@ struct VirtIOBlockDataPlane {
      * (because you don't own the file descriptor or handle; you just
      * use it).
      */
-    IOThread *iothread;
+    IOThread *iothread;             /* BlockBackend iothread */
     AioContext *ctx;
+
+    VirtIOBlockDataPlaneVq *vqs;
+    QEMUBH *submit_bh;              /* requests from the other iothreads */
+    QemuMutex submit_lock;
+    VirtIOBlockReq *submit;
+    VirtIOBlockReq **submit_tail;
 };
 
-/* Raise an interrupt to signal guest, if necessary */
-void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
+/* Context: BlockBackend AioContext */
+void virtio_blk_data_plane_complete(VirtIOBlockDataPlane *s,
+                                    VirtIOBlockReq *req)
 {
-    set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
+    unsigned i = virtio_get_queue_index(req->vq);
+
+    if (s->vqs[i].ctx != s->ctx) {
+        /* Pushed in the virtqueue context once the request is released */
+        req->push_deferred = true;
+        return;
+    }
+
+    virtqueue_push(req->vq, &req->elem, req->in_len);
+
+    /* Raise an interrupt to signal guest, if necessary */
+    set_bit(i, s->batch_notify_vqs);
     qemu_bh_schedule(s->bh);
 }
 
+/* Context: BlockBackend AioContext */
+void virtio_blk_data_plane_release(VirtIOBlockDataPlane *s,
+                                   VirtIOBlockReq *req)
+{
+    VirtIOBlockDataPlaneVq *dq = &s->vqs[virtio_get_queue_index(req->vq)];
+
+    req->next = NULL;
+    qemu_mutex_lock(&dq->lock);
+    *dq->done_tail = req;
+    dq->done_tail = &req->next;
+    qemu_mutex_unlock(&dq->lock);
+
+    qemu_bh_schedule(dq->bh);
+}
+
+/* Context: virtqueue AioContext */
+static void virtio_blk_data_plane_done_bh(void *opaque)
+{
+    VirtIOBlockDataPlaneVq *dq = opaque;
+    VirtIOBlockReq *req;
+
+    qemu_mutex_lock(&dq->lock);
+    req = dq->done;
+    dq->done = NULL;
+    dq->done_tail = &dq->done;
+    qemu_mutex_unlock(&dq->lock);
+
+    if (!req) {
+        return;
+    }
+
+    while (req) {
+        VirtIOBlockReq *next = req->next;
+
+        virtqueue_push(dq->vq, &req->elem, req->in_len);
+        g_free(req);
+        req = next;
+    }
+
+    if (virtio_should_notify(dq->s->vdev, dq->vq)) {
+        event_notifier_set(virtio_queue_get_guest_notifier(dq->vq));
+    }
+}
+
+/* Context: BlockBackend AioContext */
+static void virtio_blk_data_plane_submit_bh(void *opaque)
+{
+    VirtIOBlockDataPlane *s = opaque;
+    VirtIOBlock *vblk = VIRTIO_BLK(s->vdev);
+    MultiReqBuffer mrb = {};
+    VirtIOBlockReq *req;
+
+    qemu_mutex_lock(&s->submit_lock);
+    req = s->submit;
+    s->submit = NULL;
+    s->submit_tail = &s->submit;
+    qemu_mutex_unlock(&s->submit_lock);
+
+    if (!req) {
+        return;
+    }
+
+    blk_io_plug(vblk->blk);
+
+    while (req) {
+        VirtIOBlockReq *next = req->next;
+
+        req->next = NULL;
+        virtio_blk_handle_request(req, &mrb);
+        req = next;
+    }
+
+    if (mrb.num_reqs) {
+        virtio_blk_submit_multireq(vblk->blk, &mrb);
+    }
+
+    blk_io_unplug(vblk->blk);
+}
+
 static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
@@ -85,10 +201,12 @@ void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    IOThread **vq_iothread;
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (!conf->iothread) {
+    if (!conf->iothread && !conf->iothreads) {
         return;
     }
 
@@ -108,27 +226,83 @@ void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
         return;
     }
 
+    /* Virtqueue i is served by iothread i modulo the number of iothreads */
+    vq_iothread = g_new0(IOThread *, conf->num_queues);
+    if (conf->iothreads) {
+        char **ids = g_strsplit(conf->iothreads, ":", 0);
+        unsigned nids = g_strv_length(ids);
+
+        for (i = 0; i < conf->num_queues && nids; i++) {
+            Object *obj = object_resolve_path_component(
+                                object_get_objects_root(), ids[i % nids]);
+
+            if (!obj || !object_dynamic_cast(obj, TYPE_IOTHREAD)) {
+                error_setg(errp, "iothread '%s' not found", ids[i % nids]);
+                g_strfreev(ids);
+                g_free(vq_iothread);
+                return;
+            }
+            vq_iothread[i] = IOTHREAD(obj);
+        }
+        g_strfreev(ids);
+
+        if (!nids) {
+            error_setg(errp, "iothreads needs at least one iothread id");
+            g_free(vq_iothread);
+            return;
+        }
+    }
+
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
     s->conf = conf;
 
-    s->iothread = conf->iothread;
+    s->iothread = conf->iothread ? conf->iothread : vq_iothread[0];
     object_ref(OBJECT(s->iothread));
     s->ctx = iothread_get_aio_context(s->iothread);
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
+    s->submit_bh = aio_bh_new(s->ctx, virtio_blk_data_plane_submit_bh, s);
+    qemu_mutex_init(&s->submit_lock);
+    s->submit_tail = &s->submit;
+
+    s->vqs = g_new0(VirtIOBlockDataPlaneVq, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        VirtIOBlockDataPlaneVq *dq = &s->vqs[i];
+
+        dq->s = s;
+        dq->vq = virtio_get_queue(vdev, i);
+        dq->iothread = vq_iothread[i] ? vq_iothread[i] : s->iothread;
+        object_ref(OBJECT(dq->iothread));
+        dq->ctx = iothread_get_aio_context(dq->iothread);
+        dq->bh = aio_bh_new(dq->ctx, virtio_blk_data_plane_done_bh, dq);
+        qemu_mutex_init(&dq->lock);
+        dq->done_tail = &dq->done;
+    }
+    g_free(vq_iothread);
+
     *dataplane = s;
 }
 
 /* Context: QEMU global mutex held */
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
+    unsigned i;
+
     if (!s) {
         return;
     }
 
     virtio_blk_data_plane_stop(s);
+    for (i = 0; i < s->conf->num_queues; i++) {
+        qemu_bh_delete(s->vqs[i].bh);
+        qemu_mutex_destroy(&s->vqs[i].lock);
+        object_unref(OBJECT(s->vqs[i].iothread));
+    }
+    g_free(s->vqs);
+    qemu_bh_delete(s->submit_bh);
+    qemu_mutex_destroy(&s->submit_lock);
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
     object_unref(OBJECT(s->iothread));
@@ -139,11 +313,36 @@ static void virtio_blk_data_plane_handle_output(VirtIODevice *vdev,
                                                 VirtQueue *vq)
 {
     VirtIOBlock *s = (VirtIOBlock *)vdev;
+    VirtIOBlockDataPlane *dp = s->dataplane;
+    VirtIOBlockDataPlaneVq *dq;
+    VirtIOBlockReq *req, *head = NULL, **tail = &head;
 
     assert(s->dataplane);
     assert(s->dataplane_started);
 
-    virtio_blk_handle_vq(s, vq);
+    dq = &dp->vqs[virtio_get_queue_index(vq)];
+    if (dq->ctx == dp->ctx) {
+        virtio_blk_handle_vq(s, vq);
+        return;
+    }
+
+    /* Not submitted here: the block layer is not thread-safe, the batch is
+     * handed to the BlockBackend iothread with one BH for all of it.
+     */
+    while ((req = virtio_blk_get_request(s, vq))) {
+        *tail = req;
+        tail = &req->next;
+    }
+    if (!head) {
+        return;
+    }
+
+    qemu_mutex_lock(&dp->submit_lock);
+    *dp->submit_tail = head;
+    dp->submit_tail = tail;
+    qemu_mutex_unlock(&dp->submit_lock);
+
+    qemu_bh_schedule(dp->submit_bh);
 }
 
 /* Context: QEMU global mutex held */
@@ -196,14 +395,14 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        VirtIOBlockDataPlaneVq *dq = &s->vqs[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(dq->ctx);
+        virtio_queue_aio_set_host_notifier_handler(dq->vq, dq->ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(dq->ctx);
     }
-    aio_context_release(s->ctx);
     return;
 
   fail_guest_notifiers:
@@ -234,20 +433,36 @@ void virtio_blk_data_plane_stop(VirtIOBlockDataPlane *s)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
-    aio_context_acquire(s->ctx);
-
     /* Stop notifications for new requests from guest */
     for (i = 0; i < nvqs; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        VirtIOBlockDataPlaneVq *dq = &s->vqs[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        aio_context_acquire(dq->ctx);
+        virtio_queue_aio_set_host_notifier_handler(dq->vq, dq->ctx, NULL);
+        aio_context_release(dq->ctx);
     }
 
+    aio_context_acquire(s->ctx);
+
+    /* Submit what the other iothreads popped, it is drained below */
+    virtio_blk_data_plane_submit_bh(s);
+
     /* Drain and switch bs back to the QEMU main loop */
     blk_set_aio_context(s->conf->conf.blk, qemu_get_aio_context());
 
     aio_context_release(s->ctx);
 
+    /* Push the completions that were handed to the other iothreads */
+    for (i = 0; i < nvqs; i++) {
+        VirtIOBlockDataPlaneVq *dq = &s->vqs[i];
+
+        if (dq->ctx != s->ctx) {
+            aio_context_acquire(dq->ctx);
+            virtio_blk_data_plane_done_bh(dq);
+            aio_context_release(dq->ctx);
+        }
+    }
+
     for (i = 0; i < nvqs; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
     }
@@ -18,6 +18,13 @@
  * Usage: add options:
  *      -drive file=<file>,if=none,id=<drive_id>
  *      -device nvme,drive=<drive_id>,serial=<serial>,id=<id[optional]>
+ *
+ * Namespaces 2 to 8 are backed by their own drives:
+ *      -device nvme,drive=<drive_id>,drive2=<drive_id2>,...,serial=<serial>
+ *
+ * I/O queues can be served by a dedicated thread:
+ *      -object iothread,id=<iothread_id>
+ *      -device nvme,drive=<drive_id>,serial=<serial>,iothread=<iothread_id>
  */
 
 #include "qemu/osdep.h"
@@ -29,10 +36,15 @@
 #include "qapi/error.h"
 #include "qapi/visitor.h"
 #include "sysemu/block-backend.h"
+#include "qemu/main-loop.h"
+#include "qemu/error-report.h"
+#include "sysemu/kvm.h"
 
 #include "nvme.h"
 
 static void nvme_process_sq(void *opaque);
+static void nvme_sq_notifier(EventNotifier *e);
+static bool nvme_sq_poll(void *opaque);
 
 static int nvme_check_sqid(NvmeCtrl *n, uint16_t sqid)
 {
@@ -58,6 +70,47 @@ static void nvme_inc_sq_head(NvmeSQueue *sq)
     sq->head = (sq->head + 1) % sq->size;
 }
 
+/*
+ * Shadow doorbells: the guest keeps the SQ tails and CQ heads in memory and
+ * only writes a doorbell register when it moves past the EventIdx. The
+ * EventIdx is set where the device would stop and wait for the guest.
+ */
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t tail;
+
+    pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &tail, sizeof(tail));
+    tail = le32_to_cpu(tail);
+    if (tail < sq->size) {
+        sq->tail = tail;
+    }
+}
+
+static void nvme_update_sq_eventidx(NvmeSQueue *sq)
+{
+    uint32_t ei = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&sq->ctrl->parent_obj, sq->ei_addr, &ei, sizeof(ei));
+}
+
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    uint32_t head;
+
+    pci_dma_read(&cq->ctrl->parent_obj, cq->db_addr, &head, sizeof(head));
+    head = le32_to_cpu(head);
+    if (head < cq->size) {
+        cq->head = head;
+    }
+}
+
+static void nvme_update_cq_eventidx(NvmeCQueue *cq)
+{
+    uint32_t ei = cpu_to_le32(cq->head);
+
+    pci_dma_write(&cq->ctrl->parent_obj, cq->ei_addr, &ei, sizeof(ei));
+}
+
 static uint8_t nvme_cq_full(NvmeCQueue *cq)
 {
     return (cq->tail + 1) % cq->size == cq->head;
@@ -79,6 +132,44 @@ static void nvme_isr_notify(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+/* The admin queues stay in the main loop, I/O queues run in n->ctx */
+static AioContext *nvme_queue_ctx(NvmeCtrl *n, uint16_t qid)
+{
+    return qid ? n->ctx : qemu_get_aio_context();
+}
+
+static void nvme_irq_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    nvme_isr_notify(cq->ctrl, cq);
+}
+
+/* MSI-X needs the global mutex, the iothread defers it to the main loop */
+static void nvme_cq_notify(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    if (cq->cqid && n->iothread) {
+        qemu_bh_schedule(cq->irq_bh);
+    } else {
+        nvme_isr_notify(n, cq);
+    }
+}
+
+/* Neighbouring entries are merged, dma_blk_io maps one entry at a time */
+static void nvme_sg_add(QEMUSGList *qsg, dma_addr_t addr, dma_addr_t len)
+{
+    if (qsg->nsg) {
+        ScatterGatherEntry *last = &qsg->sg[qsg->nsg - 1];
+
+        if (last->base + last->len == addr) {
+            last->len += len;
+            qsg->size += len;
+            return;
+        }
+    }
+    qemu_sglist_add(qsg, addr, len);
+}
+
 static uint16_t nvme_map_prp(QEMUSGList *qsg, uint64_t prp1, uint64_t prp2,
     uint32_t len, NvmeCtrl *n)
 {
@@ -99,42 +190,48 @@ static uint16_t nvme_map_prp(QEMUSGList *qsg, uint64_t prp1, uint64_t prp2,
         }
         if (len > n->page_size) {
             uint64_t prp_list[n->max_prp_ents];
-            uint32_t nents, prp_trans;
-            int i = 0;
+            uint64_t list_addr = prp2;
 
-            nents = (len + n->page_size - 1) >> n->page_bits;
-            prp_trans = MIN(n->max_prp_ents, nents) * sizeof(uint64_t);
-            pci_dma_read(&n->parent_obj, prp2, (void *)prp_list, prp_trans);
             while (len != 0) {
-                uint64_t prp_ent = le64_to_cpu(prp_list[i]);
+                /* A list runs to the end of its page and is read with one
+                 * DMA. The last entry of a page chains to the next list */
+                uint32_t list_ents = (n->page_size -
+                    (list_addr & (n->page_size - 1))) >> 3;
+                uint32_t nents = (len + n->page_size - 1) >> n->page_bits;
+                uint32_t i;
+
+                if (list_addr & 0x7) {
+                    goto unmap;
+                }
+
+                nents = MIN(nents, list_ents);
+                pci_dma_read(&n->parent_obj, list_addr, (void *)prp_list,
+                    nents * sizeof(uint64_t));
+                for (i = 0; i < nents; i++) {
+                    uint64_t prp_ent = le64_to_cpu(prp_list[i]);
+
+                    if (i == list_ents - 1 && len > n->page_size) {
+                        if (!i || !prp_ent) {
+                            goto unmap;
+                        }
+                        list_addr = prp_ent;
+                        break;
+                    }
 
-                if (i == n->max_prp_ents - 1 && len > n->page_size) {
                     if (!prp_ent || prp_ent & (n->page_size - 1)) {
                         goto unmap;
                     }
 
-                    i = 0;
-                    nents = (len + n->page_size - 1) >> n->page_bits;
-                    prp_trans = MIN(n->max_prp_ents, nents) * sizeof(uint64_t);
-                    pci_dma_read(&n->parent_obj, prp_ent, (void *)prp_list,
-                        prp_trans);
-                    prp_ent = le64_to_cpu(prp_list[i]);
+                    trans_len = MIN(len, n->page_size);
+                    nvme_sg_add(qsg, prp_ent, trans_len);
+                    len -= trans_len;
                 }
-
-                if (!prp_ent || prp_ent & (n->page_size - 1)) {
-                    goto unmap;
-                }
-
-                trans_len = MIN(len, n->page_size);
-                qemu_sglist_add(qsg, prp_ent, trans_len);
-                len -= trans_len;
-                i++;
             }
         } else {
             if (prp2 & (n->page_size - 1)) {
                 goto unmap;
             }
-            qemu_sglist_add(qsg, prp2, len);
+            nvme_sg_add(qsg, prp2, len);
         }
     }
     return NVME_SUCCESS;
@@ -144,6 +241,174 @@ static uint16_t nvme_map_prp(QEMUSGList *qsg, uint64_t prp1, uint64_t prp2,
     return NVME_INVALID_FIELD | NVME_DNR;
 }
 
+static uint16_t nvme_map_sgl_data(QEMUSGList *qsg, NvmeSglDescriptor *desc,
+    uint32_t len, uint32_t *left, NvmeRequest *req)
+{
+    uint32_t dlen = le32_to_cpu(desc->len);
+
+    switch (NVME_SGL_TYPE(desc->type)) {
+    case NVME_SGL_DESCR_TYPE_KEYED_DATA_BLOCK:
+        /* There are no remote keys over PCIe, the address is host memory */
+        dlen &= 0xffffff;
+        /* fall through */
+    case NVME_SGL_DESCR_TYPE_DATA_BLOCK:
+        if (NVME_SGL_SUBTYPE(desc->type) != NVME_SGL_DESCR_SUBTYPE_ADDRESS) {
+            return NVME_SGL_DESCR_TYPE_INVALID | NVME_DNR;
+        }
+        if (dlen > *left) {
+            return NVME_DATA_SGL_LEN_INVALID | NVME_DNR;
+        }
+        if (dlen) {
+            nvme_sg_add(qsg, le64_to_cpu(desc->addr), dlen);
+        }
+        break;
+    case NVME_SGL_DESCR_TYPE_BIT_BUCKET:
+        /* Only data read from the media can be dropped */
+        if (!req) {
+            return NVME_SGL_DESCR_TYPE_INVALID | NVME_DNR;
+        }
+        if (dlen > *left) {
+            return NVME_DATA_SGL_LEN_INVALID | NVME_DNR;
+        }
+        if (!dlen) {
+            break;
+        }
+        if (req->nbb && req->bb[req->nbb - 1].offset +
+                        req->bb[req->nbb - 1].len == len - *left) {
+            req->bb[req->nbb - 1].len += dlen;
+            break;
+        }
+        req->bb = g_renew(NvmeBitBucket, req->bb, req->nbb + 1);
+        req->bb[req->nbb].offset = len - *left;
+        req->bb[req->nbb].len = dlen;
+        req->nbb++;
+        break;
+    default:
+        return NVME_SGL_DESCR_TYPE_INVALID | NVME_DNR;
+    }
+
+    *left -= dlen;
+    return NVME_SUCCESS;
+}
+
+#define NVME_SGL_SEG_READ   256     /* descriptors fetched per DMA */
+
+/* Data descriptors go straight into qsg, bit buckets into req->bb. Without a
+ * request (host to controller data) bit buckets are refused */
+static uint16_t nvme_map_sgl(NvmeCtrl *n, QEMUSGList *qsg,
+    NvmeSglDescriptor *sgl, uint32_t len, NvmeRequest *req)
+{
+    NvmeSglDescriptor seg[NVME_SGL_SEG_READ];
+    NvmeSglDescriptor desc = *sgl;
+    uint32_t left = len;
+    uint16_t status;
+
+    pci_dma_sglist_init(qsg, &n->parent_obj, 1);
+    if (req) {
+        req->bb = NULL;
+        req->nbb = 0;
+    }
+
+    for (;;) {
+        uint8_t type = NVME_SGL_TYPE(desc.type);
+        uint64_t addr = le64_to_cpu(desc.addr);
+        uint32_t seg_len = le32_to_cpu(desc.len);
+        uint32_t nsgld, nread, i, j;
+        uint32_t start = left;
+        bool chained = false;
+
+        if (type != NVME_SGL_DESCR_TYPE_SEGMENT &&
+            type != NVME_SGL_DESCR_TYPE_LAST_SEGMENT) {
+            /* The command holds the only descriptor */
+            status = nvme_map_sgl_data(qsg, &desc, len, &left, req);
+            if (status) {
+                goto unmap;
+            }
+            break;
+        }
+
+        if (NVME_SGL_SUBTYPE(desc.type) != NVME_SGL_DESCR_SUBTYPE_ADDRESS) {
+            status = NVME_SGL_DESCR_TYPE_INVALID | NVME_DNR;
+            goto unmap;
+        }
+        if (!seg_len || seg_len % sizeof(NvmeSglDescriptor)) {
+            status = NVME_INVALID_SGL_SEG_DESCR | NVME_DNR;
+            goto unmap;
+        }
+
+        nsgld = seg_len / sizeof(NvmeSglDescriptor);
+        for (i = 0; i < nsgld; i += nread) {
+            nread = MIN(nsgld - i, NVME_SGL_SEG_READ);
+            pci_dma_read(&n->parent_obj, addr + i * sizeof(NvmeSglDescriptor),
+                (void *)seg, nread * sizeof(NvmeSglDescriptor));
+
+            for (j = 0; j < nread; j++) {
+                uint8_t dtype = NVME_SGL_TYPE(seg[j].type);
+
+                if (dtype == NVME_SGL_DESCR_TYPE_SEGMENT ||
+                    dtype == NVME_SGL_DESCR_TYPE_LAST_SEGMENT) {
+                    /* Only the last descriptor of a segment may chain */
+                    if (i + j != nsgld - 1 ||
+                        type == NVME_SGL_DESCR_TYPE_LAST_SEGMENT) {
+                        status = NVME_INVALID_SGL_SEG_DESCR | NVME_DNR;
+                        goto unmap;
+                    }
+                    desc = seg[j];
+                    chained = true;
+                    continue;
+                }
+
+                status = nvme_map_sgl_data(qsg, &seg[j], len, &left, req);
+                if (status) {
+                    goto unmap;
+                }
+            }
+        }
+
+        if (type == NVME_SGL_DESCR_TYPE_LAST_SEGMENT) {
+            break;
+        }
+        /* A segment chains to the next one and has to carry data, so a
+         * looping list ends when the length runs out */
+        if (!chained || left == start) {
+            status = NVME_INVALID_SGL_SEG_DESCR | NVME_DNR;
+            goto unmap;
+        }
+    }
+
+    if (left) {
+        status = NVME_DATA_SGL_LEN_INVALID | NVME_DNR;
+        goto unmap;
+    }
+    return NVME_SUCCESS;
+
+ unmap:
+    qemu_sglist_destroy(qsg);
+    if (req) {
+        g_free(req->bb);
+        req->bb = NULL;
+        req->nbb = 0;
+    }
+    return status;
+}
+
+/* I/O commands may use PRPs or SGLs, admin commands always use PRPs */
+static uint16_t nvme_map(NvmeCtrl *n, NvmeCmd *cmd, QEMUSGList *qsg,
+    uint32_t len, NvmeRequest *req)
+{
+    switch (NVME_CMD_FLAGS_PSDT(cmd->fuse)) {
+    case NVME_PSDT_PRP:
+        return nvme_map_prp(qsg, le64_to_cpu(cmd->prp1),
+            le64_to_cpu(cmd->prp2), len, n);
+    case NVME_PSDT_SGL_MPTR_CONTIG:
+    case NVME_PSDT_SGL_MPTR_SGL:
+        return nvme_map_sgl(n, qsg, (NvmeSglDescriptor *)&cmd->prp1, len,
+            req);
+    default:
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+}
+
 static uint16_t nvme_dma_read_prp(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
     uint64_t prp1, uint64_t prp2)
 {
@@ -160,6 +425,24 @@ static uint16_t nvme_dma_read_prp(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
     return NVME_SUCCESS;
 }
 
+static uint16_t nvme_dma_write(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
+    NvmeCmd *cmd)
+{
+    QEMUSGList qsg;
+    uint16_t status;
+
+    status = nvme_map(n, cmd, &qsg, len, NULL);
+    if (status) {
+        return status;
+    }
+    if (dma_buf_write(ptr, len, &qsg)) {
+        qemu_sglist_destroy(&qsg);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+    qemu_sglist_destroy(&qsg);
+    return NVME_SUCCESS;
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
@@ -170,6 +453,15 @@ static void nvme_post_cqes(void *opaque)
         NvmeSQueue *sq;
         hwaddr addr;
 
+        if (nvme_cq_full(cq) && cq->db_addr) {
+            nvme_update_cq_head(cq);
+            if (nvme_cq_full(cq)) {
+                /* Ask for a doorbell write once the guest frees entries */
+                nvme_update_cq_eventidx(cq);
+                smp_mb();
+                nvme_update_cq_head(cq);
+            }
+        }
         if (nvme_cq_full(cq)) {
             break;
         }
@@ -183,9 +475,15 @@ static void nvme_post_cqes(void *opaque)
         nvme_inc_cq_tail(cq);
         pci_dma_write(&n->parent_obj, addr, (void *)&req->cqe,
             sizeof(req->cqe));
+
+        /* The SQ stopped fetching on a free request, resume it */
+        if (QTAILQ_EMPTY(&sq->req_list) &&
+            (sq->db_addr || !nvme_sq_empty(sq))) {
+            event_notifier_set(&sq->notifier);
+        }
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
     }
-    nvme_isr_notify(n, cq);
+    nvme_cq_notify(n, cq);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
@@ -193,7 +491,24 @@ static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
     assert(cq->cqid == req->sq->cqid);
     QTAILQ_REMOVE(&req->sq->out_req_list, req, entry);
     QTAILQ_INSERT_TAIL(&cq->req_list, req, entry);
-    timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    qemu_bh_schedule(cq->bh);
+}
+
+static void nvme_read_bit_buckets(NvmeRequest *req)
+{
+    uint8_t *buf = req->bounce;
+    uint32_t src = 0, dst = 0;
+    uint32_t i;
+
+    for (i = 0; i < req->nbb; i++) {
+        memmove(buf + dst, buf + src, req->bb[i].offset - src);
+        dst += req->bb[i].offset - src;
+        src = req->bb[i].offset + req->bb[i].len;
+    }
+    memmove(buf + dst, buf + src, req->iov.size - src);
+    dst += req->iov.size - src;
+
+    dma_buf_read(buf, dst, &req->qsg);
 }
 
 static void nvme_rw_cb(void *opaque, int ret)
@@ -203,11 +518,22 @@ static void nvme_rw_cb(void *opaque, int ret)
     NvmeCtrl *n = sq->ctrl;
     NvmeCQueue *cq = n->cq[sq->cqid];
 
+    if (req->bounce) {
+        if (!ret) {
+            nvme_read_bit_buckets(req);
+        }
+        qemu_iovec_destroy(&req->iov);
+        qemu_vfree(req->bounce);
+        g_free(req->bb);
+        req->bounce = NULL;
+        req->bb = NULL;
+        req->nbb = 0;
+    }
     if (!ret) {
-        block_acct_done(blk_get_stats(n->conf.blk), &req->acct);
+        block_acct_done(blk_get_stats(req->ns->blk), &req->acct);
         req->status = NVME_SUCCESS;
     } else {
-        block_acct_failed(blk_get_stats(n->conf.blk), &req->acct);
+        block_acct_failed(blk_get_stats(req->ns->blk), &req->acct);
         req->status = NVME_INTERNAL_DEV_ERROR;
     }
     if (req->has_sg) {
@@ -220,9 +546,116 @@ static uint16_t nvme_flush(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     NvmeRequest *req)
 {
     req->has_sg = false;
-    block_acct_start(blk_get_stats(n->conf.blk), &req->acct, 0,
+    block_acct_start(blk_get_stats(ns->blk), &req->acct, 0,
          BLOCK_ACCT_FLUSH);
-    req->aiocb = blk_aio_flush(n->conf.blk, nvme_rw_cb, req);
+    req->aiocb = blk_aio_flush(ns->blk, nvme_rw_cb, req);
+
+    return NVME_NO_COMPLETE;
+}
+
+static uint16_t nvme_write_zeros(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
+    NvmeRequest *req)
+{
+    NvmeRwCmd *rw = (NvmeRwCmd *)cmd;
+    uint32_t nlb  = le16_to_cpu(rw->nlb) + 1;
+    uint64_t slba = le64_to_cpu(rw->slba);
+
+    uint8_t lba_index  = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
+    uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
+
+    if ((slba + nlb) > le64_to_cpu(ns->id_ns.nsze)) {
+        block_acct_invalid(blk_get_stats(ns->blk), BLOCK_ACCT_WRITE);
+        return NVME_LBA_RANGE | NVME_DNR;
+    }
+
+    /* Sparse backends unmap the range instead of writing zeroes */
+    req->has_sg = false;
+    block_acct_start(blk_get_stats(ns->blk), &req->acct, 0, BLOCK_ACCT_WRITE);
+    req->aiocb = blk_aio_pwrite_zeroes(ns->blk, slba << data_shift,
+        nlb << data_shift, BDRV_REQ_MAY_UNMAP, nvme_rw_cb, req);
+
+    return NVME_NO_COMPLETE;
+}
+
+/* Discards are issued one at a time, req->aiocb stays cancellable */
+static void nvme_dsm_cb(void *opaque, int ret)
+{
+    NvmeRequest *req = opaque;
+    NvmeNamespace *ns = req->ns;
+    NvmeCtrl *n = req->sq->ctrl;
+    uint8_t lba_index  = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
+    uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
+    uint32_t max_nlb = BDRV_REQUEST_MAX_SECTORS >>
+        (data_shift - BDRV_SECTOR_BITS);
+    uint32_t nlb;
+
+    if (ret < 0) {
+        req->status = NVME_INTERNAL_DEV_ERROR;
+        goto done;
+    }
+
+    while (!req->dsm_nlb && req->dsm_idx < req->dsm_nr) {
+        NvmeDsmRange *range = &req->dsm_ranges[req->dsm_idx++];
+
+        req->dsm_slba = le64_to_cpu(range->slba);
+        req->dsm_nlb = le32_to_cpu(range->nlb);
+    }
+
+    if (req->dsm_nlb) {
+        nlb = MIN(req->dsm_nlb, max_nlb);
+        req->aiocb = blk_aio_pdiscard(ns->blk, req->dsm_slba << data_shift,
+            nlb << data_shift, nvme_dsm_cb, req);
+        req->dsm_slba += nlb;
+        req->dsm_nlb -= nlb;
+        return;
+    }
+    req->status = NVME_SUCCESS;
+
+done:
+    g_free(req->dsm_ranges);
+    req->dsm_ranges = NULL;
+    nvme_enqueue_req_completion(n->cq[req->sq->cqid], req);
+}
+
+static uint16_t nvme_dsm(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
+    NvmeRequest *req)
+{
+    NvmeDsmCmd *dsm = (NvmeDsmCmd *)cmd;
+    uint32_t attr = le32_to_cpu(dsm->attributes);
+    uint32_t nr = (le32_to_cpu(dsm->nr) & 0xff) + 1;
+    uint64_t nsze = le64_to_cpu(ns->id_ns.nsze);
+    NvmeDsmRange *ranges;
+    uint16_t status;
+    int i;
+
+    /* Access hints are accepted and ignored */
+    if (!(attr & NVME_DSMGMT_AD)) {
+        return NVME_SUCCESS;
+    }
+
+    ranges = g_new(NvmeDsmRange, nr);
+    status = nvme_dma_write(n, (uint8_t *)ranges, nr * sizeof(*ranges), cmd);
+    if (status) {
+        g_free(ranges);
+        return status;
+    }
+
+    for (i = 0; i < nr; i++) {
+        uint64_t slba = le64_to_cpu(ranges[i].slba);
+        uint32_t nlb = le32_to_cpu(ranges[i].nlb);
+
+        if (slba + nlb > nsze || slba + nlb < slba) {
+            g_free(ranges);
+            return NVME_LBA_RANGE | NVME_DNR;
+        }
+    }
+
+    req->has_sg = false;
+    req->dsm_ranges = ranges;
+    req->dsm_nr = nr;
+    req->dsm_idx = 0;
+    req->dsm_nlb = 0;
+    nvme_dsm_cb(req, 0);
 
     return NVME_NO_COMPLETE;
 }
@@ -233,8 +666,7 @@ static uint16_t nvme_rw(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     NvmeRwCmd *rw = (NvmeRwCmd *)cmd;
     uint32_t nlb  = le32_to_cpu(rw->nlb) + 1;
     uint64_t slba = le64_to_cpu(rw->slba);
-    uint64_t prp1 = le64_to_cpu(rw->prp1);
-    uint64_t prp2 = le64_to_cpu(rw->prp2);
+    uint16_t status;
 
     uint8_t lba_index  = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
     uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
@@ -244,22 +676,34 @@ static uint16_t nvme_rw(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     enum BlockAcctType acct = is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ;
 
     if ((slba + nlb) > ns->id_ns.nsze) {
-        block_acct_invalid(blk_get_stats(n->conf.blk), acct);
+        block_acct_invalid(blk_get_stats(ns->blk), acct);
         return NVME_LBA_RANGE | NVME_DNR;
     }
 
-    if (nvme_map_prp(&req->qsg, prp1, prp2, data_size, n)) {
-        block_acct_invalid(blk_get_stats(n->conf.blk), acct);
-        return NVME_INVALID_FIELD | NVME_DNR;
+    status = nvme_map(n, cmd, &req->qsg, data_size, is_write ? NULL : req);
+    if (status) {
+        block_acct_invalid(blk_get_stats(ns->blk), acct);
+        return status;
+    }
+
+    req->has_sg = true;
+    if (!is_write && req->nbb) {
+        /* Bit buckets: read the whole range, drop them when it completes */
+        req->bounce = blk_blockalign(ns->blk, data_size);
+        qemu_iovec_init(&req->iov, 1);
+        qemu_iovec_add(&req->iov, req->bounce, data_size);
+        block_acct_start(blk_get_stats(ns->blk), &req->acct, data_size, acct);
+        req->aiocb = blk_aio_preadv(ns->blk, data_offset, &req->iov, 0,
+            nvme_rw_cb, req);
+        return NVME_NO_COMPLETE;
     }
 
     assert((nlb << data_shift) == req->qsg.size);
 
-    req->has_sg = true;
-    dma_acct_start(n->conf.blk, &req->acct, &req->qsg, acct);
+    dma_acct_start(ns->blk, &req->acct, &req->qsg, acct);
     req->aiocb = is_write ?
-        dma_blk_write(n->conf.blk, &req->qsg, data_offset, nvme_rw_cb, req) :
-        dma_blk_read(n->conf.blk, &req->qsg, data_offset, nvme_rw_cb, req);
+        dma_blk_write(ns->blk, &req->qsg, data_offset, nvme_rw_cb, req) :
+        dma_blk_read(ns->blk, &req->qsg, data_offset, nvme_rw_cb, req);
 
     return NVME_NO_COMPLETE;
 }
@@ -274,12 +718,17 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     }
 
     ns = &n->namespaces[nsid - 1];
+    req->ns = ns;
     switch (cmd->opcode) {
     case NVME_CMD_FLUSH:
         return nvme_flush(n, ns, cmd, req);
     case NVME_CMD_WRITE:
     case NVME_CMD_READ:
         return nvme_rw(n, ns, cmd, req);
+    case NVME_CMD_WRITE_ZEROS:
+        return nvme_write_zeros(n, ns, cmd, req);
+    case NVME_CMD_DSM:
+        return nvme_dsm(n, ns, cmd, req);
     default:
         return NVME_INVALID_OPCODE | NVME_DNR;
     }
@@ -288,8 +737,13 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
-    timer_del(sq->timer);
-    timer_free(sq->timer);
+    if (sq->ioeventfd) {
+        memory_region_del_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                                  false, 0, &sq->notifier);
+    }
+    aio_set_event_notifier(nvme_queue_ctx(n, sq->sqid), &sq->notifier, true,
+                           NULL, NULL);
+    event_notifier_cleanup(&sq->notifier);
     g_free(sq->io_req);
     if (sq->sqid) {
         g_free(sq);
@@ -331,19 +785,40 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeCmd *cmd)
     return NVME_SUCCESS;
 }
 
-static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
+/*
+ * With shadow doorbells the tail is read from guest memory, so the tail
+ * doorbell can be an ioeventfd and skip the exit to the device model.
+ */
+static void nvme_init_sq_dbbuf(NvmeCtrl *n, NvmeSQueue *sq)
+{
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+
+    if (n->ioeventfd && kvm_eventfds_enabled() && !sq->ioeventfd) {
+        memory_region_add_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                                  false, 0, &sq->notifier);
+        sq->ioeventfd = true;
+    }
+    event_notifier_set(&sq->notifier);
+}
+
+static int nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
     uint16_t sqid, uint16_t cqid, uint16_t size)
 {
     int i;
     NvmeCQueue *cq;
 
+    if (event_notifier_init(&sq->notifier, 0)) {
+        return -1;
+    }
+
     sq->ctrl = n;
     sq->dma_addr = dma_addr;
     sq->sqid = sqid;
     sq->size = size;
     sq->cqid = cqid;
     sq->head = sq->tail = 0;
-    sq->io_req = g_new(NvmeRequest, sq->size);
+    sq->io_req = g_new0(NvmeRequest, sq->size);
 
     QTAILQ_INIT(&sq->req_list);
     QTAILQ_INIT(&sq->out_req_list);
@@ -351,12 +826,19 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    aio_set_event_notifier(nvme_queue_ctx(n, sqid), &sq->notifier, true,
+                           nvme_sq_notifier, nvme_sq_poll);
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
+
+    /* The admin queue doorbells are not shadowed */
+    if (sqid && n->dbbuf_dbs) {
+        nvme_init_sq_dbbuf(n, sq);
+    }
+    return 0;
 }
 
 static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -386,15 +868,18 @@ static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
         return NVME_INVALID_FIELD | NVME_DNR;
     }
     sq = g_malloc0(sizeof(*sq));
-    nvme_init_sq(sq, n, prp1, sqid, cqid, qsize + 1);
+    if (nvme_init_sq(sq, n, prp1, sqid, cqid, qsize + 1)) {
+        g_free(sq);
+        return NVME_INTERNAL_DEV_ERROR;
+    }
     return NVME_SUCCESS;
 }
 
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
-    timer_del(cq->timer);
-    timer_free(cq->timer);
+    qemu_bh_delete(cq->bh);
+    qemu_bh_delete(cq->irq_bh);
     msix_vector_unuse(&n->parent_obj, cq->vector);
     if (cq->cqid) {
         g_free(cq);
@@ -419,6 +904,12 @@ static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeCmd *cmd)
     return NVME_SUCCESS;
 }
 
+static void nvme_init_cq_dbbuf(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+}
+
 static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     uint16_t cqid, uint16_t vector, uint16_t size, uint16_t irq_enabled)
 {
@@ -434,7 +925,12 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     QTAILQ_INIT(&cq->sq_list);
     msix_vector_use(&n->parent_obj, cq->vector);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    cq->bh = aio_bh_new(nvme_queue_ctx(n, cqid), nvme_post_cqes, cq);
+    cq->irq_bh = qemu_bh_new(nvme_irq_bh, cq);
+
+    if (cqid && n->dbbuf_dbs) {
+        nvme_init_cq_dbbuf(n, cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -560,10 +1056,13 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 {
     uint32_t dw10 = le32_to_cpu(cmd->cdw10);
     uint32_t dw11 = le32_to_cpu(cmd->cdw11);
+    int i;
 
     switch (dw10) {
     case NVME_VOLATILE_WRITE_CACHE:
-        blk_set_enable_write_cache(n->conf.blk, dw11 & 1);
+        for (i = 0; i < n->num_namespaces; i++) {
+            blk_set_enable_write_cache(n->namespaces[i].blk, dw11 & 1);
+        }
         break;
     case NVME_NUMBER_OF_QUEUES:
         req->cqe.result =
@@ -575,8 +1074,39 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     return NVME_SUCCESS;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, NvmeCmd *cmd)
+{
+    uint64_t dbs_addr = le64_to_cpu(cmd->prp1);
+    uint64_t eis_addr = le64_to_cpu(cmd->prp2);
+    int i;
+
+    if (!dbs_addr || dbs_addr & (n->page_size - 1) ||
+        !eis_addr || eis_addr & (n->page_size - 1)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+
+    for (i = 1; i < n->num_queues; i++) {
+        if (n->cq[i]) {
+            nvme_init_cq_dbbuf(n, n->cq[i]);
+        }
+    }
+    for (i = 1; i < n->num_queues; i++) {
+        if (n->sq[i]) {
+            nvme_init_sq_dbbuf(n, n->sq[i]);
+        }
+    }
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 {
+    if (NVME_CMD_FLAGS_PSDT(cmd->fuse) != NVME_PSDT_PRP) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
     switch (cmd->opcode) {
     case NVME_ADM_CMD_DELETE_SQ:
         return nvme_del_sq(n, cmd);
@@ -592,6 +1122,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         return nvme_set_feature(n, cmd, req);
     case NVME_ADM_CMD_GET_FEATURES:
         return nvme_get_feature(n, cmd, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, cmd);
     default:
         return NVME_INVALID_OPCODE | NVME_DNR;
     }
@@ -608,6 +1140,10 @@ static void nvme_process_sq(void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
+
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + sq->head * n->sqe_size;
         pci_dma_read(&n->parent_obj, addr, (void *)&cmd, sizeof(cmd));
@@ -625,13 +1161,75 @@ static void nvme_process_sq(void *opaque)
             req->status = status;
             nvme_enqueue_req_completion(cq, req);
         }
+
+        if (sq->db_addr && nvme_sq_empty(sq)) {
+            /* Ask for a doorbell write for the next entry */
+            nvme_update_sq_eventidx(sq);
+            smp_mb();
+            nvme_update_sq_tail(sq);
+        }
     }
 }
 
+static void nvme_sq_run(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+
+    if (sq->sqid) {
+        nvme_process_sq(sq);
+        return;
+    }
+
+    /* Admin commands create and delete the queues served by n->ctx */
+    aio_context_acquire(n->ctx);
+    nvme_process_sq(sq);
+    aio_context_release(n->ctx);
+}
+
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+    nvme_sq_run(sq);
+}
+
+/*
+ * Busy polling of the submission queues. With shadow doorbells the tail is
+ * read from guest memory, otherwise the doorbell write has already moved it.
+ * The admin queue is never shadowed and is polled from the main loop like
+ * its notifier runs there.
+ */
+static bool nvme_sq_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (QTAILQ_EMPTY(&sq->req_list)) {
+        return false;
+    }
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
+    if (nvme_sq_empty(sq)) {
+        return false;
+    }
+
+    nvme_sq_run(sq);
+    return true;
+}
+
 static void nvme_clear_ctrl(NvmeCtrl *n)
 {
     int i;
 
+    aio_context_acquire(n->ctx);
+    for (i = 0; i < n->num_namespaces; i++) {
+        blk_drain(n->namespaces[i].blk);
+    }
+
     for (i = 0; i < n->num_queues; i++) {
         if (n->sq[i] != NULL) {
             nvme_free_sq(n->sq[i], n);
@@ -643,7 +1241,14 @@ static void nvme_clear_ctrl(NvmeCtrl *n)
         }
     }
 
-    blk_flush(n->conf.blk);
+    for (i = 0; i < n->num_namespaces; i++) {
+        blk_flush(n->namespaces[i].blk);
+        if (n->iothread) {
+            blk_set_aio_context(n->namespaces[i].blk, qemu_get_aio_context());
+        }
+    }
+    n->dbbuf_dbs = n->dbbuf_eis = 0;
+    aio_context_release(n->ctx);
     n->bar.cc = 0;
 }
 
@@ -651,6 +1256,7 @@ static int nvme_start_ctrl(NvmeCtrl *n)
 {
     uint32_t page_bits = NVME_CC_MPS(n->bar.cc) + 12;
     uint32_t page_size = 1 << page_bits;
+    int i;
 
     if (n->cq[0] || n->sq[0] || !n->bar.asq || !n->bar.acq ||
             n->bar.asq & (page_size - 1) || n->bar.acq & (page_size - 1) ||
@@ -671,8 +1277,17 @@ static int nvme_start_ctrl(NvmeCtrl *n)
     n->sqe_size = 1 << NVME_CC_IOSQES(n->bar.cc);
     nvme_init_cq(&n->admin_cq, n, n->bar.acq, 0, 0,
         NVME_AQA_ACQS(n->bar.aqa) + 1, 1);
-    nvme_init_sq(&n->admin_sq, n, n->bar.asq, 0, 0,
-        NVME_AQA_ASQS(n->bar.aqa) + 1);
+    if (nvme_init_sq(&n->admin_sq, n, n->bar.asq, 0, 0,
+        NVME_AQA_ASQS(n->bar.aqa) + 1)) {
+        nvme_free_cq(&n->admin_cq, n);
+        return -1;
+    }
+
+    if (n->iothread) {
+        for (i = 0; i < n->num_namespaces; i++) {
+            blk_set_aio_context(n->namespaces[i].blk, n->ctx);
+        }
+    }
 
     return 0;
 }
@@ -777,9 +1392,9 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         if (start_sqs) {
             NvmeSQueue *sq;
             QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+                event_notifier_set(&sq->notifier);
             }
-            timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+            qemu_bh_schedule(cq->bh);
         }
 
         if (cq->tail != cq->head) {
@@ -800,7 +1415,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         }
 
         sq->tail = new_tail;
-        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        event_notifier_set(&sq->notifier);
     }
 }
 
@@ -811,7 +1426,13 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
     if (addr < sizeof(n->bar)) {
         nvme_write_bar(n, addr, data, size);
     } else if (addr >= 0x1000) {
+        /*
+         * The vCPU writes the doorbells, the I/O queue indexes and the queues
+         * themselves belong to n->ctx (nvme_process_sq, nvme_post_cqes).
+         */
+        aio_context_acquire(n->ctx);
         nvme_process_db(n, addr, data);
+        aio_context_release(n->ctx);
     }
 }
 
@@ -831,16 +1452,30 @@ static int nvme_init(PCIDevice *pci_dev)
     NvmeIdCtrl *id = &n->id_ctrl;
 
     int i;
-    int64_t bs_size;
+    int64_t bs_size[NVME_MAX_NAMESPACES];
     uint8_t *pci_conf;
 
     if (!n->conf.blk) {
         return -1;
     }
+    n->ns_drive[0] = n->conf.blk;
 
-    bs_size = blk_getlength(n->conf.blk);
-    if (bs_size < 0) {
-        return -1;
+    /* Namespace ids are contiguous, drive<n> needs all the drives before */
+    for (i = 1; i < NVME_MAX_NAMESPACES && n->ns_drive[i]; i++) {
+    }
+    n->num_namespaces = i;
+    for (; i < NVME_MAX_NAMESPACES; i++) {
+        if (n->ns_drive[i]) {
+            error_report("nvme: drive%d requires drive%d", i + 1, i);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < n->num_namespaces; i++) {
+        bs_size[i] = blk_getlength(n->ns_drive[i]);
+        if (bs_size[i] < 0) {
+            return -1;
+        }
     }
 
     blkconf_serial(&n->conf, &n->serial);
@@ -848,7 +1483,28 @@ static int nvme_init(PCIDevice *pci_dev)
         return -1;
     }
     blkconf_blocksizes(&n->conf);
-    blkconf_apply_backend_options(&n->conf);
+    for (i = 0; i < n->num_namespaces; i++) {
+        BlockConf conf = n->conf;
+
+        conf.blk = n->ns_drive[i];
+        blkconf_apply_backend_options(&conf);
+    }
+
+    if (n->iothread) {
+        Error *local_err = NULL;
+
+        for (i = 0; i < n->num_namespaces; i++) {
+            if (blk_op_is_blocked(n->ns_drive[i], BLOCK_OP_TYPE_DATAPLANE,
+                                  &local_err)) {
+                error_report_err(local_err);
+                return -1;
+            }
+        }
+        object_ref(OBJECT(n->iothread));
+        n->ctx = iothread_get_aio_context(n->iothread);
+    } else {
+        n->ctx = qemu_get_aio_context();
+    }
 
     pci_conf = pci_dev->config;
     pci_conf[PCI_INTERRUPT_PIN] = 1;
@@ -856,10 +1512,8 @@ static int nvme_init(PCIDevice *pci_dev)
     pci_config_set_class(pci_dev->config, PCI_CLASS_STORAGE_EXPRESS);
     pcie_endpoint_cap_init(&n->parent_obj, 0x80);
 
-    n->num_namespaces = 1;
     n->num_queues = 64;
     n->reg_size = pow2ceil(0x1004 + 2 * (n->num_queues + 1) * 4);
-    n->ns_size = bs_size / (uint64_t)n->num_namespaces;
 
     n->namespaces = g_new0(NvmeNamespace, n->num_namespaces);
     n->sq = g_new0(NvmeSQueue *, n->num_queues);
@@ -881,17 +1535,22 @@ static int nvme_init(PCIDevice *pci_dev)
     id->ieee[0] = 0x00;
     id->ieee[1] = 0x02;
     id->ieee[2] = 0xb3;
-    id->oacs = cpu_to_le16(0);
+    id->oacs = cpu_to_le16(NVME_OACS_DBBUF);
     id->frmw = 7 << 1;
     id->lpa = 1 << 0;
     id->sqes = (0x6 << 4) | 0x6;
     id->cqes = (0x4 << 4) | 0x4;
+    id->oncs = cpu_to_le16(NVME_ONCS_DSM | NVME_ONCS_WRITE_ZEROS);
+    id->sgls = cpu_to_le32(NVME_CTRL_SGLS_SUPPORTED | NVME_CTRL_SGLS_KEYED |
+                           NVME_CTRL_SGLS_BITBUCKET);
     id->nn = cpu_to_le32(n->num_namespaces);
     id->psd[0].mp = cpu_to_le16(0x9c4);
     id->psd[0].enlat = cpu_to_le32(0x10);
     id->psd[0].exlat = cpu_to_le32(0x4);
-    if (blk_enable_write_cache(n->conf.blk)) {
-        id->vwc = 1;
+    for (i = 0; i < n->num_namespaces; i++) {
+        if (blk_enable_write_cache(n->ns_drive[i])) {
+            id->vwc = 1;
+        }
     }
 
     n->bar.cap = 0;
@@ -908,7 +1567,8 @@ static int nvme_init(PCIDevice *pci_dev)
     for (i = 0; i < n->num_namespaces; i++) {
         NvmeNamespace *ns = &n->namespaces[i];
         NvmeIdNs *id_ns = &ns->id_ns;
-        id_ns->nsfeat = 0;
+        ns->blk = n->ns_drive[i];
+        id_ns->nsfeat = 1 << 0;     /* thin provisioning, DSM deallocates */
         id_ns->nlbaf = 0;
         id_ns->flbas = 0;
         id_ns->mc = 0;
@@ -916,7 +1576,7 @@ static int nvme_init(PCIDevice *pci_dev)
         id_ns->dps = 0;
         id_ns->lbaf[0].ds = BDRV_SECTOR_BITS;
         id_ns->ncap  = id_ns->nuse = id_ns->nsze =
-            cpu_to_le64(n->ns_size >>
+            cpu_to_le64(bs_size[i] >>
                 id_ns->lbaf[NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas)].ds);
     }
     return 0;
@@ -931,11 +1591,22 @@ static void nvme_exit(PCIDevice *pci_dev)
     g_free(n->cq);
     g_free(n->sq);
     msix_uninit_exclusive_bar(pci_dev);
+    if (n->iothread) {
+        object_unref(OBJECT(n->iothread));
+    }
 }
 
 static Property nvme_props[] = {
     DEFINE_BLOCK_PROPERTIES(NvmeCtrl, conf),
+    DEFINE_PROP_DRIVE("drive2", NvmeCtrl, ns_drive[1]),
+    DEFINE_PROP_DRIVE("drive3", NvmeCtrl, ns_drive[2]),
+    DEFINE_PROP_DRIVE("drive4", NvmeCtrl, ns_drive[3]),
+    DEFINE_PROP_DRIVE("drive5", NvmeCtrl, ns_drive[4]),
+    DEFINE_PROP_DRIVE("drive6", NvmeCtrl, ns_drive[5]),
+    DEFINE_PROP_DRIVE("drive7", NvmeCtrl, ns_drive[6]),
+    DEFINE_PROP_DRIVE("drive8", NvmeCtrl, ns_drive[7]),
     DEFINE_PROP_STRING("serial", NvmeCtrl, serial),
+    DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, ioeventfd, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -967,6 +1638,10 @@ static void nvme_instance_init(Object *obj)
 {
     NvmeCtrl *s = NVME(obj);
 
+    object_property_add_link(obj, "iothread", TYPE_IOTHREAD,
+                             (Object **)&s->iothread,
+                             qdev_prop_allow_set_link_before_realize,
+                             OBJ_PROP_LINK_UNREF_ON_RELEASE, NULL);
     device_add_bootindex_property(obj, &s->conf.bootindex,
                                   "bootindex", "/namespace@1,0",
                                   DEVICE(obj), &error_abort);
@@ -1,6 +1,9 @@
 #ifndef HW_NVME_H
 #define HW_NVME_H
 #include "qemu/cutils.h"
+#include "qemu/event_notifier.h"
+#include "block/aio.h"
+#include "sysemu/iothread.h"
 
 typedef struct NvmeBar {
     uint64_t    cap;
@@ -155,6 +158,38 @@ typedef struct NvmeCmd {
     uint32_t    cdw15;
 } NvmeCmd;
 
+#define NVME_CMD_FLAGS_PSDT(flags)  (((flags) >> 6) & 0x3)
+
+enum NvmePsdt {
+    NVME_PSDT_PRP               = 0x0,
+    NVME_PSDT_SGL_MPTR_CONTIG   = 0x1,
+    NVME_PSDT_SGL_MPTR_SGL      = 0x2,
+};
+
+/* Replaces prp1 and prp2 when PSDT selects SGLs. The keyed data block has a
+ * 24 bit length followed by the key */
+typedef struct NvmeSglDescriptor {
+    uint64_t    addr;
+    uint32_t    len;
+    uint8_t     rsvd[3];
+    uint8_t     type;
+} NvmeSglDescriptor;
+
+#define NVME_SGL_TYPE(type)     (((type) >> 4) & 0xf)
+#define NVME_SGL_SUBTYPE(type)  ((type) & 0xf)
+
+enum NvmeSglDescriptorType {
+    NVME_SGL_DESCR_TYPE_DATA_BLOCK          = 0x0,
+    NVME_SGL_DESCR_TYPE_BIT_BUCKET          = 0x1,
+    NVME_SGL_DESCR_TYPE_SEGMENT             = 0x2,
+    NVME_SGL_DESCR_TYPE_LAST_SEGMENT        = 0x3,
+    NVME_SGL_DESCR_TYPE_KEYED_DATA_BLOCK    = 0x4,
+};
+
+enum NvmeSglDescriptorSubtype {
+    NVME_SGL_DESCR_SUBTYPE_ADDRESS  = 0x0,
+};
+
 enum NvmeAdminCommands {
     NVME_ADM_CMD_DELETE_SQ      = 0x00,
     NVME_ADM_CMD_CREATE_SQ      = 0x01,
@@ -168,6 +203,7 @@ enum NvmeAdminCommands {
     NVME_ADM_CMD_ASYNC_EV_REQ   = 0x0c,
     NVME_ADM_CMD_ACTIVATE_FW    = 0x10,
     NVME_ADM_CMD_DOWNLOAD_FW    = 0x11,
+    NVME_ADM_CMD_DBBUF_CONFIG   = 0x7c,
     NVME_ADM_CMD_FORMAT_NVM     = 0x80,
     NVME_ADM_CMD_SECURITY_SEND  = 0x81,
     NVME_ADM_CMD_SECURITY_RECV  = 0x82,
@@ -179,6 +215,7 @@ enum NvmeIoCommands {
     NVME_CMD_READ               = 0x02,
     NVME_CMD_WRITE_UNCOR        = 0x04,
     NVME_CMD_COMPARE            = 0x05,
+    NVME_CMD_WRITE_ZEROS        = 0x08,
     NVME_CMD_DSM                = 0x09,
 };
 
@@ -359,6 +396,11 @@ enum NvmeStatusCodes {
     NVME_CMD_ABORT_MISSING_FUSE = 0x000a,
     NVME_INVALID_NSID           = 0x000b,
     NVME_CMD_SEQ_ERROR          = 0x000c,
+    NVME_INVALID_SGL_SEG_DESCR  = 0x000d,
+    NVME_INVALID_NUM_SGL_DESCRS = 0x000e,
+    NVME_DATA_SGL_LEN_INVALID   = 0x000f,
+    NVME_MD_SGL_LEN_INVALID     = 0x0010,
+    NVME_SGL_DESCR_TYPE_INVALID = 0x0011,
     NVME_LBA_RANGE              = 0x0080,
     NVME_CAP_EXCEEDED           = 0x0081,
     NVME_NS_NOT_READY           = 0x0082,
@@ -494,7 +536,12 @@ typedef struct NvmeIdCtrl {
     uint8_t     vwc;
     uint16_t    awun;
     uint16_t    awupf;
-    uint8_t     rsvd703[174];
+    uint8_t     nvscc;
+    uint8_t     rsvd531;
+    uint16_t    acwu;
+    uint16_t    rsvd535;
+    uint32_t    sgls;
+    uint8_t     rsvd703[164];
     uint8_t     rsvd2047[1344];
     NvmePSD     psd[32];
     uint8_t     vs[1024];
@@ -504,6 +551,13 @@ enum NvmeIdCtrlOacs {
     NVME_OACS_SECURITY  = 1 << 0,
     NVME_OACS_FORMAT    = 1 << 1,
     NVME_OACS_FW        = 1 << 2,
+    NVME_OACS_DBBUF     = 1 << 8,
+};
+
+enum NvmeIdCtrlSgls {
+    NVME_CTRL_SGLS_SUPPORTED    = 1 << 0,
+    NVME_CTRL_SGLS_KEYED        = 1 << 2,
+    NVME_CTRL_SGLS_BITBUCKET    = 1 << 16,
 };
 
 enum NvmeIdCtrlOncs {
@@ -616,6 +670,7 @@ static inline void _nvme_check_size(void)
     QEMU_BUILD_BUG_ON(sizeof(NvmeCqe) != 16);
     QEMU_BUILD_BUG_ON(sizeof(NvmeDsmRange) != 16);
     QEMU_BUILD_BUG_ON(sizeof(NvmeCmd) != 64);
+    QEMU_BUILD_BUG_ON(sizeof(NvmeSglDescriptor) != 16);
     QEMU_BUILD_BUG_ON(sizeof(NvmeDeleteQ) != 64);
     QEMU_BUILD_BUG_ON(sizeof(NvmeCreateCq) != 64);
     QEMU_BUILD_BUG_ON(sizeof(NvmeCreateSq) != 64);
@@ -635,14 +690,29 @@ typedef struct NvmeAsyncEvent {
     NvmeAerResult result;
 } NvmeAsyncEvent;
 
+typedef struct NvmeBitBucket {
+    uint32_t    offset;     /* in the command data */
+    uint32_t    len;
+} NvmeBitBucket;
+
 typedef struct NvmeRequest {
     struct NvmeSQueue       *sq;
+    struct NvmeNamespace    *ns;
     BlockAIOCB              *aiocb;
     uint16_t                status;
     bool                    has_sg;
     NvmeCqe                 cqe;
     BlockAcctCookie         acct;
     QEMUSGList              qsg;
+    NvmeDsmRange            *dsm_ranges;    /* deallocated one at a time */
+    uint32_t                dsm_nr;
+    uint32_t                dsm_idx;
+    uint64_t                dsm_slba;       /* left of the current range */
+    uint32_t                dsm_nlb;
+    NvmeBitBucket           *bb;            /* read data to drop, in order */
+    uint32_t                nbb;
+    uint8_t                 *bounce;        /* only for reads with buckets */
+    QEMUIOVector            iov;
     QTAILQ_ENTRY(NvmeRequest)entry;
 } NvmeRequest;
 
@@ -654,7 +724,10 @@ typedef struct NvmeSQueue {
     uint32_t    tail;
     uint32_t    size;
     uint64_t    dma_addr;
-    QEMUTimer   *timer;
+    EventNotifier notifier;     /* doorbell kick, served in the queue ctx */
+    bool        ioeventfd;      /* notifier bound to the tail doorbell */
+    uint64_t    db_addr;        /* shadow doorbell, 0 if not configured */
+    uint64_t    ei_addr;        /* EventIdx */
     NvmeRequest *io_req;
     QTAILQ_HEAD(sq_req_list, NvmeRequest) req_list;
     QTAILQ_HEAD(out_req_list, NvmeRequest) out_req_list;
@@ -671,15 +744,21 @@ typedef struct NvmeCQueue {
     uint32_t    vector;
     uint32_t    size;
     uint64_t    dma_addr;
-    QEMUTimer   *timer;
+    QEMUBH      *bh;            /* posts completions in the queue ctx */
+    QEMUBH      *irq_bh;        /* raises the interrupt in the main loop */
+    uint64_t    db_addr;        /* shadow doorbell, 0 if not configured */
+    uint64_t    ei_addr;        /* EventIdx */
     QTAILQ_HEAD(sq_list, NvmeSQueue) sq_list;
     QTAILQ_HEAD(cq_req_list, NvmeRequest) req_list;
 } NvmeCQueue;
 
 typedef struct NvmeNamespace {
     NvmeIdNs        id_ns;
+    BlockBackend    *blk;
 } NvmeNamespace;
 
+#define NVME_MAX_NAMESPACES 8
+
 #define TYPE_NVME "nvme"
 #define NVME(obj) \
         OBJECT_CHECK(NvmeCtrl, (obj), TYPE_NVME)
@@ -699,7 +778,9 @@ typedef struct NvmeCtrl {
     uint32_t    num_namespaces;
     uint32_t    num_queues;
     uint32_t    max_q_ents;
-    uint64_t    ns_size;
+    uint64_t    dbbuf_dbs;      /* Doorbell Buffer Config, 0 if not set */
+    uint64_t    dbbuf_eis;
+    bool        ioeventfd;
 
     char            *serial;
     NvmeNamespace   *namespaces;
@@ -708,6 +789,12 @@ typedef struct NvmeCtrl {
     NvmeSQueue      admin_sq;
     NvmeCQueue      admin_cq;
     NvmeIdCtrl      id_ctrl;
+
+    /* Namespace n is backed by ns_drive[n - 1], the first one is conf.blk */
+    BlockBackend    *ns_drive[NVME_MAX_NAMESPACES];
+
+    IOThread        *iothread;
+    AioContext      *ctx;       /* I/O queues, iothread or main loop */
 } NvmeCtrl;
 
 #endif /* HW_NVME_H */
@@ -3,8 +3,8 @@
 #include <string.h>
 
 #include "hw/block/ox-ctrl/include/ssd.h"
+#include "hw/block/ox-ctrl/include/ox-bench.h"
 
-extern struct core_struct core;
 const char *argp_program_version = OX_LABEL;
 const char *argp_program_bug_address = "Ivan L. Picoli <ivpi@itu.dk>";
 
@@ -12,7 +12,8 @@ enum cmdtypes {
     CMDARG_START = 1,
     CMDARG_TEST,
     CMDARG_DEBUG,
-    CMDARG_ADMIN
+    CMDARG_ADMIN,
+    CMDARG_BENCH
 };
 
 static char doc_global[] = "\n*** OX Controller " OX_VER " - " LABEL " ***\n"
@@ -22,6 +23,7 @@ static char doc_global[] = "\n*** OX Controller " OX_VER " - " LABEL " ***\n"
         "  debug            Start controller and print Admin/IO commands\n"
         "  test             Start controller, run tests and close\n"
         "  admin            Execute specific tasks within the controller\n"
+        "  bench            Start controller and run an I/O benchmark\n"
         " \n Initial release developed by Ivan L. Picoli <ivpi@itu.dk>\n\n";
 
 static char doc_test[] =
@@ -45,6 +47,15 @@ static char doc_admin[] =
         "\n  Run a specific admin task:"
         "\n    ox-ctrl admin -t <task_name>";
 
+static char doc_bench[] =
+        "\nUse this command to run an I/O benchmark, it will start the "
+        "controller, run the workload and report the results as JSON.\n"
+        "\n Examples:"
+        "\n  Random 4 KB reads on the NVMe layer, 4 threads with QD 16:"
+        "\n    ox-ctrl bench -l nvme -q 16 -j 4 -d 10\n"
+        "\n  70/30 read/write zipfian mix on the FTL layer:"
+        "\n    ox-ctrl bench -l ftl -r 70 -p zipf -z 0.9 -n 100000 -o out.json";
+
 static struct argp_option opt_test[] = {
     {"list", 'l', "list", OPTION_ARG_OPTIONAL,"Show available tests."},
     {"all", 'a', "run_all", OPTION_ARG_OPTIONAL, "Use to run all tests."},
@@ -59,6 +70,20 @@ static struct argp_option opt_admin[] = {
     {0}
 };
 
+static struct argp_option opt_bench[] = {
+    {"layer", 'l', "layer", 0, "mmgr, ftl or nvme. <char>"},
+    {"qd", 'q', "qd", 0, "Queue depth per thread (ftl, nvme). <int>"},
+    {"bs", 'b', "bs", 0, "Block size in bytes (ftl, nvme). <int>"},
+    {"read", 'r', "read_pct", 0, "Percentage of reads, default 100. <int>"},
+    {"pattern", 'p', "pattern", 0, "rand, seq or zipf. <char>"},
+    {"theta", 'z', "theta", 0, "Zipfian skew, between 0 and 1. <float>"},
+    {"threads", 'j', "threads", 0, "Number of threads. <int>"},
+    {"ops", 'n', "ops", 0, "Total I/Os, all threads. <int>"},
+    {"time", 'd', "seconds", 0, "Run time limit. <int>"},
+    {"output", 'o', "file", 0, "JSON output file, default stdout. <char>"},
+    {0}
+};
+
 static error_t parse_opt_test(int key, char *arg, struct argp_state *state)
 {
     struct nvm_init_arg *args = state->input;
@@ -145,29 +170,163 @@ static error_t parse_opt_admin(int key, char *arg, struct argp_state *state)
     return 0;
 }
 
-static void cmd_prepare(struct argp_state *state, struct nvm_init_arg *args,
-                                        const char *cmd, struct argp *argp_cmd)
+static int parse_bench_num(char *arg, uint64_t min, uint64_t max,
+                                                                uint64_t *val)
+{
+    char *end;
+
+    if (!arg || !strlen(arg))
+        return -1;
+
+    *val = strtoull(arg, &end, 10);
+    if (*end != '\0' || *val < min || *val > max)
+        return -1;
+
+    return 0;
+}
+
+/* The benchmark also runs inside QEMU, it is parsed with ARGP_NO_EXIT and
+ * errors are returned instead of exiting */
+static error_t bench_invalid(struct argp_state *state, int key, char *arg)
+{
+    argp_error(state, "invalid value for -%c: '%s'", key, arg ? arg : "");
+    return EINVAL;
+}
+
+static error_t parse_opt_bench(int key, char *arg, struct argp_state *state)
+{
+    struct nvm_init_arg *args = state->input;
+    uint64_t val;
+    char *end;
+
+    switch (key) {
+        case 'l':
+            if (!arg)
+                return bench_invalid(state, key, arg);
+            if (strcmp(arg, "mmgr") == 0)
+                args->bench_layer = OX_BENCH_MMGR;
+            else if (strcmp(arg, "ftl") == 0)
+                args->bench_layer = OX_BENCH_FTL;
+            else if (strcmp(arg, "nvme") == 0)
+                args->bench_layer = OX_BENCH_NVME;
+            else
+                return bench_invalid(state, key, arg);
+            break;
+        case 'q':
+            if (parse_bench_num(arg, 1, OX_BENCH_MAX_QD, &val))
+                return bench_invalid(state, key, arg);
+            args->bench_qd = val;
+            break;
+        case 'b':
+            if (parse_bench_num(arg, NVME_KERNEL_PG_SIZE, OX_BENCH_MAX_BS,
+                                    &val) || val % NVME_KERNEL_PG_SIZE)
+                return bench_invalid(state, key, arg);
+            args->bench_bs = val;
+            break;
+        case 'r':
+            if (parse_bench_num(arg, 0, 100, &val))
+                return bench_invalid(state, key, arg);
+            args->bench_read_pct = val;
+            break;
+        case 'p':
+            if (!arg)
+                return bench_invalid(state, key, arg);
+            if (strcmp(arg, "rand") == 0)
+                args->bench_pattern = OX_BENCH_RAND;
+            else if (strcmp(arg, "seq") == 0)
+                args->bench_pattern = OX_BENCH_SEQ;
+            else if (strcmp(arg, "zipf") == 0)
+                args->bench_pattern = OX_BENCH_ZIPF;
+            else
+                return bench_invalid(state, key, arg);
+            break;
+        case 'z':
+            if (!arg)
+                return bench_invalid(state, key, arg);
+            args->bench_theta = strtod(arg, &end);
+            if (*end != '\0' || args->bench_theta <= 0.0 ||
+                                                    args->bench_theta >= 1.0)
+                return bench_invalid(state, key, arg);
+            break;
+        case 'j':
+            if (parse_bench_num(arg, 1, OX_BENCH_MAX_THREADS, &val))
+                return bench_invalid(state, key, arg);
+            args->bench_threads = val;
+            break;
+        case 'n':
+            if (parse_bench_num(arg, 1, UINT64_MAX, &val))
+                return bench_invalid(state, key, arg);
+            args->bench_ops = val;
+            break;
+        case 'd':
+            if (parse_bench_num(arg, 1, UINT32_MAX, &val))
+                return bench_invalid(state, key, arg);
+            args->bench_time = val;
+            break;
+        case 'o':
+            if (!arg || strlen(arg) == 0 || strlen(arg) >= CMDARG_PATH_LEN)
+                return bench_invalid(state, key, arg);
+            strcpy(args->bench_out, arg);
+            break;
+        case ARGP_KEY_INIT:
+            args->bench_qd = 1;
+            args->bench_threads = 1;
+            args->bench_bs = NVME_KERNEL_PG_SIZE;
+            args->bench_read_pct = 100;
+            args->bench_theta = OX_BENCH_DEF_THETA;
+            break;
+        case ARGP_KEY_END:
+            if (args->bench_qd * args->bench_threads > OX_BENCH_MAX_INFLIGHT ||
+                    (uint64_t) args->bench_qd * args->bench_threads *
+                    args->bench_bs > OX_BENCH_MAX_MEM) {
+                argp_error(state, "qd * threads * bs exceeds the limits");
+                return EINVAL;
+            }
+            if (!args->bench_ops && !args->bench_time)
+                args->bench_time = OX_BENCH_DEF_TIME;
+            break;
+        case ARGP_KEY_ARG:
+        case ARGP_KEY_NO_ARGS:
+        case ARGP_KEY_ERROR:
+        case ARGP_KEY_SUCCESS:
+        case ARGP_KEY_FINI:
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static error_t cmd_prepare(struct argp_state *state, struct nvm_init_arg *args,
+                        const char *cmd, struct argp *argp_cmd, unsigned flags)
 {
     /* Remove the first arg from the parser */
     int argc = state->argc - state->next + 1;
     char** argv = &state->argv[state->next - 1];
     char* argv0 = argv[0];
+    error_t ret;
 
     argv[0] = malloc(strlen(state->name) + strlen(cmd) + 2);
-    if(!argv[0])
+    if(!argv[0]) {
         argp_failure(state, 1, ENOMEM, 0);
+        return ENOMEM;
+    }
 
     sprintf(argv[0], "%s %s", state->name, cmd);
 
-    argp_parse(argp_cmd, argc, argv, ARGP_IN_ORDER, &argc, args);
+    ret = argp_parse(argp_cmd, argc, argv, ARGP_IN_ORDER | flags, &argc, args);
 
     free(argv[0]);
     argv[0] = argv0;
     state->next += argc - 1;
+
+    return ret;
 }
 
 static struct argp argp_test = {opt_test, parse_opt_test, 0, doc_test};
 static struct argp argp_admin = {opt_admin, parse_opt_admin, 0, doc_admin};
+static struct argp argp_bench = {opt_bench, parse_opt_bench, 0, doc_bench};
 
 static error_t parse_opt (int key, char *arg, struct argp_state *state)
 {
@@ -182,10 +341,14 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
                 args->cmdtype = CMDARG_DEBUG;
             else if (strcmp(arg, "test") == 0){
                 args->cmdtype = CMDARG_TEST;
-                cmd_prepare(state, args, "test", &argp_test);
+                return cmd_prepare(state, args, "test", &argp_test, 0);
             } else if (strcmp(arg, "admin") == 0){
                 args->cmdtype = CMDARG_ADMIN;
-                cmd_prepare(state, args, "admin", &argp_admin);
+                return cmd_prepare(state, args, "admin", &argp_admin, 0);
+            } else if (strcmp(arg, "bench") == 0){
+                args->cmdtype = CMDARG_BENCH;
+                return cmd_prepare(state, args, "bench", &argp_bench,
+                                                                ARGP_NO_EXIT);
             }
             break;
         default:
@@ -204,7 +367,9 @@ int cmdarg_init (int argc, char **argv)
     core.args_global = malloc (sizeof (struct nvm_init_arg));
     memset (core.args_global, 0, sizeof(struct nvm_init_arg));
 
-    argp_parse(&argp_global, argc, argv, ARGP_IN_ORDER, NULL, core.args_global);
+    if (argp_parse(&argp_global, argc, argv, ARGP_IN_ORDER, NULL,
+                                                            core.args_global))
+        return -1;
 
     switch (core.args_global->cmdtype)
     {
@@ -219,6 +384,8 @@ int cmdarg_init (int argc, char **argv)
         case CMDARG_ADMIN:
             ret = nvm_admin_unit(core.args_global);
             return (!ret) ? OX_ADMIN_MODE : -1;
+        case CMDARG_BENCH:
+            return OX_BENCH_MODE;
         default:
             printf("Invalid command, please use --help to see more info.\n");
     }
@@ -51,20 +51,85 @@
 #include "hw/block/ox-ctrl/include/ssd.h"
 #include "hw/block/ox-ctrl/include/ox-mq.h"
 #include "hw/block/ox-ctrl/include/uatomic.h"
+#include "hw/block/ox-ctrl/include/ox-bench.h"
 #include "hw/pci/pci.h"
 
-LIST_HEAD(mmgr_list, nvm_mmgr) mmgr_head = LIST_HEAD_INITIALIZER(mmgr_head);
-LIST_HEAD(ftl_list, nvm_ftl) ftl_head = LIST_HEAD_INITIALIZER(ftl_head);
-
-struct core_struct core;
+__thread struct ox_instance *ox_inst;
 struct tests_init_st tests_is __attribute__((weak));
 
+struct ox_thread_arg {
+    struct ox_instance  *inst;
+    void                *(*fn)(void *);
+    void                *arg;
+};
+
+struct ox_instance *ox_inst_new (void)
+{
+    return g_new0 (struct ox_instance, 1);
+}
+
+void ox_inst_free (struct ox_instance *inst)
+{
+    int i;
+
+    for (i = 0; i < OX_ST_COUNT; i++)
+        g_free (inst->st[i]);
+    g_free (inst);
+}
+
+void *ox_state_alloc (uint8_t id, size_t sz)
+{
+    void *st, *cur;
+
+    st = g_malloc0 (sz);
+
+    /* Two threads may get here for the same module, one state is kept */
+    cur = __sync_val_compare_and_swap (&ox_inst->st[id], NULL, st);
+    if (cur) {
+        g_free (st);
+        return cur;
+    }
+
+    return st;
+}
+
+static void *ox_thread_start (void *arg)
+{
+    struct ox_thread_arg th = *(struct ox_thread_arg *) arg;
+
+    free (arg);
+    ox_inst = th.inst;
+
+    return th.fn (th.arg);
+}
+
+/* pthread_create for OX threads, the thread serves the caller's instance */
+int ox_thread_create (pthread_t *tid, void *(*fn)(void *), void *arg)
+{
+    struct ox_thread_arg *th;
+    int ret;
+
+    th = malloc (sizeof (struct ox_thread_arg));
+    if (!th)
+        return ENOMEM;
+
+    th->inst = ox_inst;
+    th->fn = fn;
+    th->arg = arg;
+
+    ret = pthread_create (tid, NULL, ox_thread_start, th);
+    if (ret)
+        free (th);
+
+    return ret;
+}
+
 int nvm_register_pcie_handler (struct nvm_pcie *pcie)
 {
     if (strlen(pcie->name) > MAX_NAME_SIZE)
         return EMAX_NAME_SIZE;
 
-    if(pthread_create (&pcie->io_thread, NULL, pcie->ops->nvme_consumer, pcie))
+    if (ox_thread_create (&pcie->io_thread, pcie->ops->nvme_consumer, pcie))
         return EPCIE_REGISTER;
 
     core.nvm_pcie = pcie;
@@ -158,7 +223,7 @@ int nvm_register_mmgr (struct nvm_mmgr *mmgr)
     if (mmgr->ops->get_ch_info(mmgr->ch_info, g->n_of_ch))
         return EMMGR_REGISTER;
 
-    LIST_INSERT_HEAD(&mmgr_head, mmgr, entry);
+    LIST_INSERT_HEAD(&core.mmgr_head, mmgr, entry);
     core.mmgr_count++;
     core.nvm_ch_count += g->n_of_ch;
 
@@ -172,7 +237,7 @@ int nvm_register_mmgr (struct nvm_mmgr *mmgr)
 static struct nvm_ftl *nvm_get_ftl_instance(uint16_t ftl_id)
 {
     struct nvm_ftl *ftl;
-    LIST_FOREACH(ftl, &ftl_head, entry){
+    LIST_FOREACH(ftl, &core.ftl_head, entry){
         if(ftl->ftl_id == ftl_id)
             return ftl;
     }
@@ -180,29 +245,72 @@ static struct nvm_ftl *nvm_get_ftl_instance(uint16_t ftl_id)
     return NULL;
 }
 
-static uint16_t nvm_ftl_q_schedule (struct nvm_ftl *ftl,
-                                      struct nvm_io_cmd *cmd, uint8_t multi_ch)
+/* AppNVM FTL keeps writes and reads in separate halves of the queues */
+static uint16_t nvm_ftl_q_group (struct nvm_ftl *ftl, struct nvm_io_cmd *cmd,
+                                                              uint16_t *first)
 {
-    uint16_t qid;
+    uint16_t n;
+
+    if (ftl->ftl_id != FTL_ID_APPNVM || ftl->nq < 2) {
+        *first = 0;
+        return ftl->nq;
+    }
 
-    /* Separate writes and reads in different queues for AppNVM FTL */
-    if (ftl->ftl_id == FTL_ID_APPNVM) {
-        qid = (cmd->cmdtype == MMGR_WRITE_PG) ? 0 : 1;
+    n = ftl->nq / 2;
+    *first = (cmd->cmdtype == MMGR_WRITE_PG) ? 0 : n;
 
-        ftl->next_queue[qid] = (ftl->next_queue[qid] + 1 == ftl->nq / 2) ?
-                                                  0 : ftl->next_queue[qid] + 1;
+    return n;
+}
 
-        return ftl->next_queue[qid] + (qid * (ftl->nq / 2));
+static uint16_t nvm_ftl_q_least_loaded (struct nvm_ftl *ftl, uint16_t first,
+                                                                    uint16_t n)
+{
+    uint16_t qid, best = first;
+    int load, min = INT_MAX;
+
+    for (qid = first; qid < first + n; qid++) {
+        load = ox_mq_load (ftl->mq, qid);
+        if (load >= 0 && load < min) {
+            min = load;
+            best = qid;
+            if (!load)
+                break;
+        }
     }
 
-    if (!multi_ch)
-        return cmd->channel[0]->ch_id % ftl->nq;
-    else {
-        qid = ftl->next_queue[0];
-        ftl->next_queue[0] = (ftl->next_queue[0] + 1 == ftl->nq) ?
-                                                    0 : ftl->next_queue[0] + 1;
-        return qid;
+    return best;
+}
+
+/*
+ * Each channel has a home queue in its group, a burst to a busy channel is
+ * kept behind its own queue thread. A command is steered to the least loaded
+ * queue of the group if its home queue is backlogged, unless its channel
+ * already has NVM_FTL_CH_INFLIGHT commands queued. Idle queue threads steal
+ * from backlogged queues of the same group (OX_MQ_WORK_STEAL).
+ */
+static uint16_t nvm_ftl_q_schedule (struct nvm_ftl *ftl,
+                                      struct nvm_io_cmd *cmd, uint8_t multi_ch)
+{
+    struct nvm_channel *ch = cmd->channel[0];
+    uint16_t first, n, qid;
+
+    n = nvm_ftl_q_group (ftl, cmd, &first);
+
+    if (multi_ch) {
+        cmd->ftl_ch = NULL;
+        return nvm_ftl_q_least_loaded (ftl, first, n);
     }
+
+    qid = first + ch->ch_id % n;
+
+    if (u_atomic_read (&ch->ftl_inflight) < NVM_FTL_CH_INFLIGHT &&
+                    ox_mq_load (ftl->mq, qid) >= NVM_FTL_Q_BACKLOG)
+        qid = nvm_ftl_q_least_loaded (ftl, first, n);
+
+    cmd->ftl_ch = ch;
+    u_atomic_inc (&ch->ftl_inflight);
+
+    return qid;
 }
 
 static void nvm_complete_to_host (struct nvm_io_cmd *cmd)
@@ -213,12 +321,17 @@ static void nvm_complete_to_host (struct nvm_io_cmd *cmd)
                 NVME_SUCCESS : (cmd->status.nvme_status) ?
                       cmd->status.nvme_status : NVME_CMD_ABORT_REQ;
 
+    cmd->ts_complete = ox_lat_ts ();
+
     if (core.debug)
         printf(" [NVMe cmd 0x%x. cid: %d completed. Status: %x]\n",
                                    req->cmd.opcode, req->cmd.cid, req->status);
 
-    ((core.run_flag & RUN_TESTS) && core.tests_init->complete_io) ?
-        core.tests_init->complete_io(req) : nvme_rw_cb(req);
+    if (core.run_flag & RUN_BENCH)
+        ox_bench_complete_io (req);
+    else
+        ((core.run_flag & RUN_TESTS) && core.tests_init->complete_io) ?
+            core.tests_init->complete_io(req) : nvme_rw_cb(req);
 }
 
 void nvm_complete_ftl (struct nvm_io_cmd *cmd)
@@ -244,6 +357,9 @@ static void nvm_ftl_process_sq (struct ox_mq_entry *req)
 
     cmd->mq_req = (void *) req;
 
+    ox_lat_add (OX_LAT_FTL_QUEUE, ox_lat_op (cmd->cmdtype), req->qid,
+                                                              cmd->ts_submit);
+
     retry = NVM_QUEUE_RETRY;
     do {
         ret = ftl->ops->submit_io(cmd);
@@ -269,6 +385,9 @@ static void nvm_ftl_process_cq (void *opaque)
 {
     struct nvm_io_cmd *cmd = (struct nvm_io_cmd *) opaque;
 
+    if (cmd->ftl_ch)
+        u_atomic_dec (&cmd->ftl_ch->ftl_inflight);
+
     nvm_complete_to_host (cmd);
 }
 
@@ -299,17 +418,16 @@ int nvm_register_ftl (struct nvm_ftl *ftl)
     mq_config.cq_fn = nvm_ftl_process_cq;
     mq_config.to_fn = nvm_ftl_process_to;
     mq_config.to_usec = NVM_FTL_QUEUE_TO;
-    mq_config.flags = OX_MQ_TO_COMPLETE;
+    mq_config.flags = OX_MQ_TO_COMPLETE | OX_MQ_WORK_STEAL;
+    mq_config.steal_group = (ftl->ftl_id == FTL_ID_APPNVM && ftl->nq > 1) ?
+                                                               ftl->nq / 2 : 0;
     ftl->mq = ox_mq_init(&mq_config);
     if (!ftl->mq)
         return -1;
 
-    ftl->next_queue[0] = 0;
-    ftl->next_queue[1] = 0;
-
     core.ftl_q_count += ftl->nq;
 
-    LIST_INSERT_HEAD(&ftl_head, ftl, entry);
+    LIST_INSERT_HEAD(&core.ftl_head, ftl, entry);
     core.ftl_count++;
 
     log_info("  [nvm: FTL (%s)(%d) registered.]\n", ftl->name, ftl->ftl_id);
@@ -319,12 +437,16 @@ int nvm_register_ftl (struct nvm_ftl *ftl)
         log_info("    [%s cap: Set Bad Block Table]\n", ftl->name);
     if (ftl->cap & 1 << FTL_CAP_GET_L2PTBL)
         log_info("    [%s cap: Get Logical to Physical Table]\n", ftl->name);
-    if (ftl->cap & 1 << FTL_CAP_GET_L2PTBL)
+    if (ftl->cap & 1 << FTL_CAP_SET_L2PTBL)
         log_info("    [%s cap: Set Logical to Physical Table]\n", ftl->name);
     if (ftl->cap & 1 << FTL_CAP_INIT_FN)
         log_info("    [%s cap: Application Function Init]\n", ftl->name);
     if (ftl->cap & 1 << FTL_CAP_EXIT_FN)
         log_info("    [%s cap: Application Function Exit]\n", ftl->name);
+    if (ftl->cap & 1 << FTL_CAP_DEALLOC)
+        log_info("    [%s cap: Deallocate Logical Blocks]\n", ftl->name);
+    if (ftl->cap & 1 << FTL_CAP_GET_CHUNK)
+        log_info("    [%s cap: Chunk State Report]\n", ftl->name);
 
     if (ftl->bbtbl_format == FTL_BBTBL_BYTE)
         log_info("    [%s Bad block table type: Byte array. 1 byte per blk.]\n",
@@ -346,6 +468,12 @@ void nvm_callback (struct nvm_mmgr_io_cmd *cmd)
 
     gettimeofday(&cmd->tend,NULL);
 
+    /* Media managers that do not trace their own queue account the whole
+     * submission as media time */
+    if (!cmd->ts_media)
+        ox_lat_add (OX_LAT_MEDIA, ox_lat_op (cmd->cmdtype), cmd->ppa.g.ch,
+                                                               cmd->ts_queue);
+
     if (core.debug)
         nvm_debug_print_mmgr_io (cmd);
 
@@ -369,6 +497,7 @@ int nvm_submit_ftl (struct nvm_io_cmd *cmd)
 {
     struct nvm_ftl *ftl;
     int ret, retry, qid, i;
+    uint64_t ch_id;
     uint8_t ch_ppa[core.nvm_ch_count];
 
     uint8_t multi_ch = 0;
@@ -434,9 +563,11 @@ int nvm_submit_ftl (struct nvm_io_cmd *cmd)
             return NVME_LBA_RANGE;
         }
 
-        cmd->channel[0] = core.nvm_ch[cmd->slba /
-                                       (core.nvm_ns_size / core.nvm_ch_count)];
-        multi_ch++;
+        /* FTL queues are scheduled by the channel partition of the LBA */
+        ch_id = (cmd->slba * cmd->sec_sz) /
+                                       (core.nvm_ns_size / core.nvm_ch_count);
+        cmd->channel[0] = core.nvm_ch[(ch_id < core.nvm_ch_count) ?
+                                              ch_id : core.nvm_ch_count - 1];
 
         ftl = nvm_get_ftl_instance(core.std_ftl);
 
@@ -446,6 +577,12 @@ int nvm_submit_ftl (struct nvm_io_cmd *cmd)
     retry = NVM_QUEUE_RETRY;
 
     qid = nvm_ftl_q_schedule (ftl, cmd, multi_ch);
+
+    cmd->ts_submit = ox_lat_add (OX_LAT_SQ_FETCH, ox_lat_op (cmd->cmdtype),
+                                                 req->sq->sqid, cmd->ts_fetch);
+    if (!cmd->ts_submit)
+        cmd->ts_submit = ox_lat_ts ();
+
     do {
         ret = ox_mq_submit_req(ftl->mq, qid, cmd);
 
@@ -464,6 +601,9 @@ int nvm_submit_ftl (struct nvm_io_cmd *cmd)
         }
     } while (ret && retry);
 
+    if (!retry && cmd->ftl_ch)
+        u_atomic_dec (&cmd->ftl_ch->ftl_inflight);
+
     return (retry) ? NVME_NO_COMPLETE : NVME_CMD_ABORT_REQ;
 
 CH_ERR:
@@ -484,6 +624,14 @@ int nvm_dma (void *ptr, uint64_t prp, ssize_t size, uint8_t direction)
     if (!size || !prp)
         return 0;
 
+    if (prp & NVM_PRP_LOCAL) {
+        prp &= ~NVM_PRP_LOCAL;
+        if (direction == NVM_DMA_TO_HOST)
+            direction = NVM_DMA_SYNC_READ;
+        else if (direction == NVM_DMA_FROM_HOST)
+            direction = NVM_DMA_SYNC_WRITE;
+    }
+
     switch (direction) {
         case NVM_DMA_TO_HOST:
             return nvme_write_to_host(ptr, prp, size);
@@ -504,6 +652,8 @@ int nvm_dma (void *ptr, uint64_t prp, ssize_t size, uint8_t direction)
 int nvm_submit_mmgr (struct nvm_mmgr_io_cmd *cmd)
 {
     gettimeofday(&cmd->tstart,NULL);
+    cmd->ts_queue = ox_lat_ts ();
+    cmd->ts_media = 0;
     cmd->cmdtype = cmd->nvm_io->cmdtype;
 
     switch (cmd->nvm_io->cmdtype) {
@@ -640,6 +790,8 @@ int nvm_submit_sync_io (struct nvm_channel *ch, struct nvm_mmgr_io_cmd *cmd,
     cmd->status = NVM_IO_PROCESS;
 
     gettimeofday(&cmd->tstart,NULL);
+    cmd->ts_queue = ox_lat_ts ();
+    cmd->ts_media = 0;
 
     switch (cmd->cmdtype) {
         case MMGR_READ_PG:
@@ -732,7 +884,7 @@ int nvm_submit_multi_plane_sync_io (struct nvm_channel *ch,
         pl_arg[pl_i].ch = ch;
         pl_arg[pl_i].cmdtype = cmdtype;
         pl_arg[pl_i].cmd = &cmd[pl_i];
-        pthread_create(&tid[pl_i],NULL,nvm_sub_pl_sio_th,(void *)&pl_arg[pl_i]);
+        ox_thread_create (&tid[pl_i], nvm_sub_pl_sio_th, (void *)&pl_arg[pl_i]);
 
         if (pl_delay > 0)
             usleep(pl_delay);
@@ -748,7 +900,7 @@ int nvm_submit_multi_plane_sync_io (struct nvm_channel *ch,
 
 static void nvm_unregister_mmgr (struct nvm_mmgr *mmgr)
 {
-    if (LIST_EMPTY(&mmgr_head))
+    if (LIST_EMPTY(&core.mmgr_head))
         return;
 
     mmgr->ops->exit(mmgr);
@@ -761,7 +913,7 @@ static void nvm_unregister_mmgr (struct nvm_mmgr *mmgr)
 
 static void nvm_unregister_ftl (struct nvm_ftl *ftl)
 {
-    if (LIST_EMPTY(&ftl_head))
+    if (LIST_EMPTY(&core.ftl_head))
         return;
 
     ox_mq_destroy(ftl->mq);
@@ -772,6 +924,24 @@ static void nvm_unregister_ftl (struct nvm_ftl *ftl)
     log_info(" [nvm: FTL (%s)(%d) unregistered.]\n", ftl->name, ftl->ftl_id);
 }
 
+/* Fills 'g' with the widest value of each field among all media managers */
+void nvm_get_max_geometry (struct nvm_mmgr_geometry *g)
+{
+    struct nvm_mmgr *mmgr;
+    struct nvm_mmgr_geometry *mg;
+
+    memset (g, 0, sizeof (struct nvm_mmgr_geometry));
+    LIST_FOREACH(mmgr, &core.mmgr_head, entry){
+        mg = mmgr->geometry;
+        g->n_of_ch     = MAX(g->n_of_ch, mg->n_of_ch);
+        g->lun_per_ch  = MAX(g->lun_per_ch, mg->lun_per_ch);
+        g->blk_per_lun = MAX(g->blk_per_lun, mg->blk_per_lun);
+        g->pg_per_blk  = MAX(g->pg_per_blk, mg->pg_per_blk);
+        g->sec_per_pg  = MAX(g->sec_per_pg, mg->sec_per_pg);
+        g->n_of_planes = MAX(g->n_of_planes, mg->n_of_planes);
+    }
+}
+
 static int nvm_ch_config (void)
 {
     int i, c = 0, ret;
@@ -784,12 +954,13 @@ static int nvm_ch_config (void)
 
     struct nvm_channel *ch;
     struct nvm_mmgr *mmgr;
-    LIST_FOREACH(mmgr, &mmgr_head, entry){
+    LIST_FOREACH(mmgr, &core.mmgr_head, entry){
         for (i = 0; i < mmgr->geometry->n_of_ch; i++){
             ch = core.nvm_ch[c] = &mmgr->ch_info[i];
             ch->ch_id       = c;
             ch->geometry    = mmgr->geometry;
             ch->mmgr        = mmgr;
+            ch->ftl_inflight.counter = U_ATOMIC_INIT_RUNTIME(0);
 
             /* For now we set all channels to be managed by the standard FTL */
             /* For now all channels are set to the same namespace */
@@ -882,12 +1053,72 @@ static int nvm_ftl_cap_exit_fn (struct nvm_ftl *ftl,
     return 0;
 }
 
+static int nvm_ftl_cap_dealloc (struct nvm_ftl *ftl,
+                                            struct nvm_ftl_cap_dealloc_st *arg)
+{
+    if (!ftl->ops->dealloc || !arg->nlb)
+        return -1;
+
+    return ftl->ops->dealloc (arg->slba, arg->nlb);
+}
+
+static int nvm_ftl_cap_get_stats (struct nvm_ftl *ftl,
+                                              struct nvm_ftl_cap_stats_st *arg)
+{
+    if (!ftl->ops->get_stats || !arg->ch)
+        return -1;
+
+    return ftl->ops->get_stats (arg);
+}
+
+static int nvm_ftl_cap_get_chunk (struct nvm_channel *ch,
+                                              struct nvm_ftl_cap_chunk_st *arg)
+{
+    if (!ch->ftl->ops->get_chunk || !arg->chk || !arg->nchk)
+        return -1;
+
+    return ch->ftl->ops->get_chunk (&arg->ppa, arg->nchk, arg->chk);
+}
+
+static int nvm_ftl_cap_l2ptbl (struct nvm_ftl *ftl, uint8_t cap,
+                                             struct nvm_ftl_cap_l2ptbl_st *arg)
+{
+    if (!arg->tbl || !arg->nlb)
+        return -1;
+
+    if (cap == FTL_CAP_GET_L2PTBL)
+        return (ftl->ops->get_l2ptbl) ?
+                    ftl->ops->get_l2ptbl (arg->slba, arg->nlb, arg->tbl) : -1;
+
+    return (ftl->ops->set_l2ptbl) ?
+                    ftl->ops->set_l2ptbl (arg->slba, arg->nlb, arg->tbl) : -1;
+}
+
+/* Returns 1 if the FTL serving the global namespace supports 'cap' */
+int nvm_ftl_cap_support (uint8_t cap)
+{
+    struct nvm_ftl *ftl;
+
+    if (core.lnvm)
+        return 0;
+
+    ftl = nvm_get_ftl_instance(core.std_ftl);
+    if (!ftl)
+        return 0;
+
+    return (ftl->cap & 1 << cap) ? 1 : 0;
+}
+
 int nvm_ftl_cap_exec (uint8_t cap, void *arg)
 {
     struct nvm_channel *ch;
     struct nvm_ftl_cap_set_bbtbl_st *set_bbtbl;
     struct nvm_ftl_cap_get_bbtbl_st *get_bbtbl;
     struct nvm_ftl_cap_gl_fn        *gl_fn;
+    struct nvm_ftl_cap_dealloc_st   *dealloc;
+    struct nvm_ftl_cap_stats_st     *stats;
+    struct nvm_ftl_cap_l2ptbl_st    *l2ptbl;
+    struct nvm_ftl_cap_chunk_st     *chunk;
     struct nvm_ftl                  *ftl;
 
     if (!arg)
@@ -922,6 +1153,34 @@ int nvm_ftl_cap_exec (uint8_t cap, void *arg)
 
         case FTL_CAP_GET_L2PTBL:
         case FTL_CAP_SET_L2PTBL:
+
+            /* The mapping table belongs to the global namespace FTL */
+            l2ptbl = (struct nvm_ftl_cap_l2ptbl_st *) arg;
+            if (core.lnvm || !(core.run_flag & RUN_FTL))
+                goto OUT;
+            ftl = nvm_get_ftl_instance(core.std_ftl);
+            if (!ftl)
+                goto OUT;
+            if (ftl->cap & 1 << cap) {
+                if (nvm_ftl_cap_l2ptbl(ftl, cap, l2ptbl))
+                    goto OUT;
+                return 0;
+            }
+            break;
+
+        case FTL_CAP_GET_CHUNK:
+
+            chunk = (struct nvm_ftl_cap_chunk_st *) arg;
+            if (chunk->ppa.g.ch >= core.nvm_ch_count)
+                goto OUT;
+            ch = core.nvm_ch[chunk->ppa.g.ch];
+            if (ch->ftl->cap & 1 << FTL_CAP_GET_CHUNK) {
+                if (nvm_ftl_cap_get_chunk(ch, chunk))
+                    goto OUT;
+                return 0;
+            }
+            break;
+
         case FTL_CAP_INIT_FN:
 
             gl_fn = (struct nvm_ftl_cap_gl_fn *) arg;
@@ -948,6 +1207,38 @@ int nvm_ftl_cap_exec (uint8_t cap, void *arg)
             }
             break;
 
+        case FTL_CAP_DEALLOC:
+
+            /* Deallocation is issued to the global namespace FTL */
+            dealloc = (struct nvm_ftl_cap_dealloc_st *) arg;
+            if (core.lnvm)
+                goto OUT;
+            ftl = nvm_get_ftl_instance(core.std_ftl);
+            if (!ftl)
+                goto OUT;
+            if (ftl->cap & 1 << FTL_CAP_DEALLOC) {
+                if (nvm_ftl_cap_dealloc(ftl, dealloc))
+                    goto OUT;
+                return 0;
+            }
+            break;
+
+        case FTL_CAP_GET_STATS:
+
+            /* Statistics are collected from the global namespace FTL */
+            stats = (struct nvm_ftl_cap_stats_st *) arg;
+            if (core.lnvm || !(core.run_flag & RUN_FTL))
+                goto OUT;
+            ftl = nvm_get_ftl_instance(core.std_ftl);
+            if (!ftl)
+                goto OUT;
+            if (ftl->cap & 1 << FTL_CAP_GET_STATS) {
+                if (nvm_ftl_cap_get_stats(ftl, stats))
+                    goto OUT;
+                return 0;
+            }
+            break;
+
         default:
             goto OUT;
     }
@@ -1058,7 +1349,7 @@ static void nvm_clear_all (uint8_t stop_all)
     /* Clean all ftls */
     if (core.run_flag & RUN_FTL) {
         while (core.ftl_count) {
-            ftl = LIST_FIRST(&ftl_head);
+            ftl = LIST_FIRST(&core.ftl_head);
             nvm_unregister_ftl(ftl);
         };
         core.run_flag ^= RUN_FTL;
@@ -1067,7 +1358,7 @@ static void nvm_clear_all (uint8_t stop_all)
     /* Clean all media managers */
     if (core.run_flag & RUN_MMGR) {
         while (core.mmgr_count) {
-            mmgr = LIST_FIRST(&mmgr_head);
+            mmgr = LIST_FIRST(&core.mmgr_head);
             nvm_unregister_mmgr(mmgr);
         };
         core.run_flag ^= RUN_MMGR;
@@ -1205,11 +1496,11 @@ int nvm_init_ctrl (int argc, char **argv, QemuOxCtrl *qemu)
 
     exec = cmdarg_init(argc, argv);
     if (exec < 0)
-        goto OUT;
+        return -EINVAL;
 
     openlog("NVME",LOG_CONS | LOG_PID | LOG_NDELAY, LOG_LOCAL0);
-    LIST_INIT(&mmgr_head);
-    LIST_INIT(&ftl_head);
+    LIST_INIT(&core.mmgr_head);
+    LIST_INIT(&core.ftl_head);
 
     printf("OX Controller %s - %s\n Starting...\n", OX_VER, LABEL);
     log_info("[nvm: OX Controller is starting...]\n");
@@ -1229,6 +1520,14 @@ int nvm_init_ctrl (int argc, char **argv, QemuOxCtrl *qemu)
         case OX_ADMIN_MODE:
             modet_fn = core.tests_init->admin;
             break;
+        case OX_BENCH_MODE:
+            /* The controller keeps running after the benchmark */
+            core.run_flag ^= RUN_TESTS;
+            core.run_flag |= RUN_BENCH;
+            if (ox_bench_run (core.args_global))
+                printf(" Benchmark failed. Check log file.\n");
+            core.run_flag ^= RUN_BENCH;
+            return 0;
         case OX_RUN_MODE:
             core.run_flag ^= RUN_TESTS;
            // while(1) { usleep(1); } break;
@@ -1238,7 +1537,7 @@ int nvm_init_ctrl (int argc, char **argv, QemuOxCtrl *qemu)
     }
 
     if (core.tests_init->init) {
-        pthread_create(&mode_t, NULL, modet_fn, NULL);
+        ox_thread_create (&mode_t, modet_fn, NULL);
         pthread_join(mode_t, NULL);
     }
 
@@ -1251,4 +1550,17 @@ CLEAN:
 OUT:
     nvm_clear_all(NVM_FULL_UPDOWN);
     return 0;
+}
+
+/* Stops a controller started by nvm_init_ctrl, if it is still running */
+void nvm_exit_ctrl (void)
+{
+    if (core.run_flag & ~RUN_TESTS)
+        nvm_clear_all(NVM_FULL_UPDOWN);
+    core.run_flag = 0;
+
+    free (core.args_global);
+    core.args_global = NULL;
+    core.qemu = NULL;
+    closelog();
 }
\ No newline at end of file
@@ -30,10 +30,12 @@
 #include <string.h>
 #include "hw/block/ox-ctrl/include/ssd.h"
 
-LIST_HEAD(app_ch, app_channel) app_ch_head = LIST_HEAD_INITIALIZER(app_ch_head);
+struct app_channels_state {
+    LIST_HEAD(app_ch, app_channel) app_ch_head;
+};
 
-extern struct core_struct core;
-extern pthread_spinlock_t *md_ch_spin;
+#define appch_st (*(struct app_channels_state *) ox_state \
+                      (OX_ST_APP_CHANNELS, sizeof (struct app_channels_state)))
 
 static int app_reserve_blks (struct app_channel *lch)
 {
@@ -150,7 +152,9 @@ static int app_init_blk_md (struct app_channel *lch)
 
     memset (md->tbl, 0, md->entry_sz * tblks);
     md->magic = 0;
+    md->version = APP_BLK_MD_VERSION;
     md->entries = tblks;
+    md->ckpt_seq = 0;
 
     ret = appnvm()->md->load_fn (lch);
     if (ret) goto ERR;
@@ -163,6 +167,9 @@ static int app_init_blk_md (struct app_channel *lch)
         if (ret) goto ERR;
     }
 
+    /* Write sequence keeps growing across checkpoints of all channels */
+    app_seq_raise (md->ckpt_seq);
+
     log_info("    [appnvm: Block metadata started. Ch %d]\n", ch->ch_id);
 
     return 0;
@@ -192,11 +199,19 @@ static int app_init_map (struct app_channel *lch)
     struct nvm_channel *ch = lch->ch;
     struct nvm_mmgr_geometry *g = ch->geometry;
 
-    /* sector granularity mapping table */
-    ch_map_sz = g->sec_per_ch * sizeof(struct app_map_entry);
+    if (app_map_fmt_init ()) {
+        log_err("[appnvm ERR: Ch %d -> Geometry does not fit the mapping "
+                                                 "entry format.]\n", ch->ch_id);
+        return -1;
+    }
+
+    /* sector granularity mapping table, LBAs are implied by the position */
+    ch_map_sz = g->sec_per_ch * app_map_ent_sz ();
 
     /* each map_md entry maps to a mapping table physical page */
     ch_map_md_ent = ch_map_sz / g->pl_pg_size;
+    if (ch_map_sz % g->pl_pg_size)
+        ch_map_md_ent++;
 
     lch->map_md = malloc (sizeof(struct app_map_md));
     if (!lch->map_md)
@@ -210,6 +225,7 @@ static int app_init_map (struct app_channel *lch)
 
     memset (md->tbl, 0, md->entry_sz * ch_map_md_ent);
     md->magic = 0;
+    md->version = APP_MAP_MD_VERSION;
     md->entries = ch_map_md_ent;
 
     ret = appnvm()->ch_map->load_fn (lch);
@@ -272,12 +288,12 @@ static int channels_init (struct nvm_channel *ch, uint16_t id)
     struct app_channel *lch;
     uint32_t blk_sz;
 
-    md_ch_spin = realloc
-                 ((void *) md_ch_spin, sizeof (pthread_spinlock_t) * (id + 1));
-    if (!md_ch_spin)
+    app_st.md_ch_spin = realloc ((void *) app_st.md_ch_spin,
+                                     sizeof (pthread_spinlock_t) * (id + 1));
+    if (!app_st.md_ch_spin)
         return -1;
 
-    if (pthread_spin_init (&md_ch_spin[id], 0))
+    if (pthread_spin_init (&app_st.md_ch_spin[id], 0))
         return -1;
 
     lch = malloc (sizeof(struct app_channel));
@@ -285,8 +301,9 @@ static int channels_init (struct nvm_channel *ch, uint16_t id)
         goto CH_SPIN;
 
     lch->ch = ch;
+    lch->ch_prov = NULL;
 
-    LIST_INSERT_HEAD(&app_ch_head, lch, entry);
+    LIST_INSERT_HEAD(&appch_st.app_ch_head, lch, entry);
     lch->app_ch_id = id;
 
     lch->flags.busy.counter = U_ATOMIC_INIT_RUNTIME(0);
@@ -308,11 +325,10 @@ static int channels_init (struct nvm_channel *ch, uint16_t id)
     if (app_init_blk_md (lch))
         goto FREE_BBT;
 
-    if (appnvm()->ch_prov->init_fn (lch))
-        goto FREE_BLK_MD;
+    /* Channel provisioning is started by the global init after recovery */
 
     if (app_init_map (lch))
-        goto EXIT_CH_PROV;
+        goto FREE_BLK_MD;
 
     /* Remove reserved blocks from namespace */
     blk_sz = lch->ch->geometry->pg_per_blk * lch->ch->geometry->pg_size;
@@ -323,8 +339,6 @@ static int channels_init (struct nvm_channel *ch, uint16_t id)
                                                           lch->bbtbl->bb_count);
     return 0;
 
-EXIT_CH_PROV:
-    appnvm()->ch_prov->exit_fn (lch);
 FREE_BLK_MD:
     app_exit_blk_md (lch);
 FREE_BBT:
@@ -339,7 +353,7 @@ FREE_LCH:
     LIST_REMOVE (lch, entry);
     free(lch);
 CH_SPIN:
-    pthread_spin_destroy (&md_ch_spin[id]);
+    pthread_spin_destroy (&app_st.md_ch_spin[id]);
     return -1;
 }
 
@@ -376,14 +390,15 @@ static void channels_exit (struct app_channel *lch)
                                           "Channel %d]", lch->ch->ch_id);
 
     app_exit_map (lch);
-    appnvm()->ch_prov->exit_fn (lch);
+    if (lch->ch_prov)
+        appnvm()->ch_prov->exit_fn (lch);
     app_exit_blk_md (lch);
     app_exit_bbt (lch);
 
     pthread_spin_destroy (&lch->flags.busy_spin);
     pthread_spin_destroy (&lch->flags.active_spin);
     pthread_spin_destroy (&lch->flags.need_gc_spin);
-    pthread_spin_destroy (&md_ch_spin[lch->app_ch_id]);
+    pthread_spin_destroy (&app_st.md_ch_spin[lch->app_ch_id]);
 
     LIST_REMOVE (lch, entry);
     free(lch);
@@ -392,7 +407,7 @@ static void channels_exit (struct app_channel *lch)
 static struct app_channel *channels_get(uint16_t ch_id)
 {
     struct app_channel *lch;
-    LIST_FOREACH(lch, &app_ch_head, entry){
+    LIST_FOREACH(lch, &appch_st.app_ch_head, entry){
         if(lch->ch->ch_id == ch_id)
             return lch;
     }
@@ -405,7 +420,7 @@ static int channels_get_list (struct app_channel **list, uint16_t nch)
     int n = 0, i = nch - 1;
     struct app_channel *lch;
 
-    LIST_FOREACH(lch, &app_ch_head, entry){
+    LIST_FOREACH(lch, &appch_st.app_ch_head, entry){
         if (i < 0)
             break;
         list[i] = lch;
@@ -422,5 +437,5 @@ void channels_register (void) {
     appnvm()->channels.get_fn = channels_get;
     appnvm()->channels.get_list_fn = channels_get_list;
 
-    LIST_INIT(&app_ch_head);
+    LIST_INIT(&appch_st.app_ch_head);
 }
\ No newline at end of file
@@ -32,18 +32,176 @@
 #include "appnvm.h"
 #include "hw/block/ox-ctrl/include/uatomic.h"
 
-extern struct core_struct core;
-struct app_global __appnvm;
-static uint8_t gl_fn; /* Positive if global function has been called */
-uint16_t app_nch;
+struct app_core_state {
+    uint8_t gl_fn; /* Positive if global function has been called */
 
-pthread_mutex_t     gc_ns_mutex;
-pthread_spinlock_t *md_ch_spin;
+    /* Global write sequence, stored in the OOB area of every written page */
+    uint32_t                app_seq;
+    uint8_t                 app_seq_valid; /* Set by the first app_seq_raise */
+    pthread_spinlock_t      app_seq_spin;
+
+    /* Mapping table entry format, set by the first channel initialization */
+    struct app_map_fmt      map_fmt;
+
+    struct nvm_ftl          app_ftl;
+};
+
+#define appc_st (*(struct app_core_state *) ox_state (OX_ST_APP_CORE, \
+                                              sizeof (struct app_core_state)))
 
 static int app_submit_io (struct nvm_io_cmd *);
 
 struct app_global *appnvm (void) {
-    return &__appnvm;
+    return &app_st.gl;
+}
+
+/**
+ * Reserves 'n' consecutive write sequence numbers.
+ * @return the first sequence number of the reserved range
+ */
+uint32_t app_seq_next (uint32_t n)
+{
+    uint32_t seq;
+
+    pthread_spin_lock (&appc_st.app_seq_spin);
+    seq = appc_st.app_seq;
+    appc_st.app_seq += n;
+    pthread_spin_unlock (&appc_st.app_seq_spin);
+
+    return seq;
+}
+
+uint32_t app_seq_get (void)
+{
+    uint32_t seq;
+
+    pthread_spin_lock (&appc_st.app_seq_spin);
+    seq = appc_st.app_seq;
+    pthread_spin_unlock (&appc_st.app_seq_spin);
+
+    return seq;
+}
+
+/**
+ * Moves the write sequence forward to 'seq' if 'seq' is newer. The first call
+ * after startup takes 'seq' as is, the counter might have wrapped.
+ */
+void app_seq_raise (uint32_t seq)
+{
+    pthread_spin_lock (&appc_st.app_seq_spin);
+    if (!appc_st.app_seq_valid || app_seq_cmp (seq, appc_st.app_seq) > 0)
+        appc_st.app_seq = seq;
+    appc_st.app_seq_valid = 1;
+    pthread_spin_unlock (&appc_st.app_seq_spin);
+}
+
+static inline uint8_t app_map_bits (uint32_t n)
+{
+    return (n > 1) ? 32 - __builtin_clz (n - 1) : 0;
+}
+
+/**
+ * Sets the mapping table entry format from the widest geometry among all
+ * media managers, so all channels share it whatever their init order. Only
+ * the first call computes it, app_exit resets it.
+ * @return 0 on success, -1 if the packed PPA does not fit in 64 bits
+ */
+int app_map_fmt_init (void)
+{
+    struct nvm_mmgr_geometry g;
+    uint32_t bits;
+    struct app_map_fmt *fmt = &appc_st.map_fmt;
+
+    if (fmt->ent_sz)
+        return 0;
+
+    nvm_get_max_geometry (&g);
+
+    fmt->sec_bits = app_map_bits (g.sec_per_pg);
+    fmt->pl_bits  = app_map_bits (g.n_of_planes);
+    fmt->ch_bits  = app_map_bits (g.n_of_ch);
+    fmt->lun_bits = app_map_bits (g.lun_per_ch);
+    fmt->pg_bits  = app_map_bits (g.pg_per_blk);
+    fmt->blk_bits = app_map_bits (g.blk_per_lun);
+
+    bits = fmt->sec_bits + fmt->pl_bits + fmt->ch_bits +
+               fmt->lun_bits + fmt->pg_bits + fmt->blk_bits;
+    if (bits > 64) {
+        memset (fmt, 0, sizeof (struct app_map_fmt));
+        return -1;
+    }
+
+    fmt->ent_sz = (bits <= 32) ? sizeof (uint32_t) : sizeof (uint64_t);
+
+    return 0;
+}
+
+size_t app_map_ent_sz (void)
+{
+    return appc_st.map_fmt.ent_sz;
+}
+
+static uint64_t app_map_pack (uint64_t ppa)
+{
+    struct nvm_ppa_addr addr;
+    uint64_t packed;
+    uint8_t shift;
+    struct app_map_fmt *fmt = &appc_st.map_fmt;
+
+    addr.ppa = ppa;
+
+    packed = addr.g.sec;
+    shift = fmt->sec_bits;
+    packed |= (uint64_t) addr.g.pl << shift;
+    shift += fmt->pl_bits;
+    packed |= (uint64_t) addr.g.ch << shift;
+    shift += fmt->ch_bits;
+    packed |= (uint64_t) addr.g.lun << shift;
+    shift += fmt->lun_bits;
+    packed |= (uint64_t) addr.g.pg << shift;
+    shift += fmt->pg_bits;
+    packed |= (uint64_t) addr.g.blk << shift;
+
+    return packed;
+}
+
+static uint64_t app_map_unpack (uint64_t packed)
+{
+    struct nvm_ppa_addr addr;
+    struct app_map_fmt *fmt = &appc_st.map_fmt;
+
+    addr.ppa = 0x0;
+
+    addr.g.sec = packed & ((1ULL << fmt->sec_bits) - 1);
+    packed >>= fmt->sec_bits;
+    addr.g.pl = packed & ((1ULL << fmt->pl_bits) - 1);
+    packed >>= fmt->pl_bits;
+    addr.g.ch = packed & ((1ULL << fmt->ch_bits) - 1);
+    packed >>= fmt->ch_bits;
+    addr.g.lun = packed & ((1ULL << fmt->lun_bits) - 1);
+    packed >>= fmt->lun_bits;
+    addr.g.pg = packed & ((1ULL << fmt->pg_bits) - 1);
+    packed >>= fmt->pg_bits;
+    addr.g.blk = packed;
+
+    return addr.ppa;
+}
+
+/* Returns the PPA of entry 'ent' in a mapping table page, 0 if unmapped */
+uint64_t app_map_ent_get (uint8_t *pg_buf, uint32_t ent)
+{
+    if (appc_st.map_fmt.ent_sz == sizeof (uint32_t))
+        return app_map_unpack (((uint32_t *) pg_buf)[ent]);
+
+    return app_map_unpack (((uint64_t *) pg_buf)[ent]);
+}
+
+void app_map_ent_set (uint8_t *pg_buf, uint32_t ent, uint64_t ppa)
+{
+    if (appc_st.map_fmt.ent_sz == sizeof (uint32_t))
+        ((uint32_t *) pg_buf)[ent] = (uint32_t) app_map_pack (ppa);
+    else
+        ((uint64_t *) pg_buf)[ent] = app_map_pack (ppa);
 }
 
 void app_pg_io_prepare (struct app_channel *lch, struct app_io_data *data)
@@ -337,15 +495,167 @@ static int app_submit_io (struct nvm_io_cmd *cmd)
     return appnvm()->lba_io->submit_fn (cmd);
 }
 
+static int app_dealloc (uint64_t slba, uint32_t nlb)
+{
+    int ret;
+
+    if (!appc_st.gl_fn)
+        return -1;
+
+    /* Unmapped sectors are invalidated, GC does not move them anymore */
+    pthread_mutex_lock (&app_st.gc_ns_mutex);
+    ret = appnvm()->gl_map->unmap_fn (slba, nlb);
+    pthread_mutex_unlock (&app_st.gc_ns_mutex);
+
+    if (ret)
+        log_err ("[appnvm: Deallocate failed. slba %lu, nlb %d]", slba, nlb);
+
+    return ret;
+}
+
+/* Unmapped LBAs are returned as zero */
+static int app_get_l2ptbl (uint64_t slba, uint32_t nlb, uint64_t *tbl)
+{
+    uint32_t i;
+
+    if (!appc_st.gl_fn)
+        return -1;
+
+    for (i = 0; i < nlb; i++) {
+        tbl[i] = appnvm()->gl_map->read_fn (slba + i);
+        if (tbl[i] == AND64) {
+            log_err ("[appnvm: Get L2P table failed. lba %lu]", slba + i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* A restored PPA must point to a sector that still holds valid data: the
+ * block is in use, the page has been written and the sector has not been
+ * invalidated. Otherwise GC could erase the block under the new mapping. */
+static int app_l2p_ppa_valid (struct nvm_ppa_addr *ppa)
+{
+    struct app_channel *lch;
+    struct nvm_mmgr_geometry *g;
+    struct app_blk_md_entry *blk;
+    uint8_t inv;
+
+    if (ppa->g.ch >= app_st.app_nch)
+        return 0;
+
+    lch = appnvm()->channels.get_fn (ppa->g.ch);
+    if (!lch)
+        return 0;
+
+    g = lch->ch->geometry;
+
+    if (ppa->g.lun >= g->lun_per_ch || ppa->g.blk >= g->blk_per_lun ||
+            ppa->g.pg >= g->pg_per_blk || ppa->g.pl >= g->n_of_planes ||
+            ppa->g.sec >= g->sec_per_pg || ppa->g.rsv)
+        return 0;
+
+    blk = appnvm()->md->get_fn (lch, ppa->g.lun);
+    if (!blk)
+        return 0;
+    blk = &blk[ppa->g.blk];
+
+    if (!(blk->flags & APP_BLK_MD_USED) || !(blk->flags & APP_BLK_MD_AVLB) ||
+                                               ppa->g.pg >= blk->current_pg)
+        return 0;
+
+    pthread_spin_lock (&app_st.md_ch_spin[ppa->g.ch]);
+    inv = blk->pg_state[ppa->g.pg * g->n_of_planes + ppa->g.pl] &
+                                                          (1 << ppa->g.sec);
+    pthread_spin_unlock (&app_st.md_ch_spin[ppa->g.ch]);
+
+    return !inv;
+}
+
+/* Restores a table previously exported by app_get_l2ptbl of this FTL. Zero
+ * entries unmap the LBA, other entries must be the current mapping of their
+ * LBA. A sector that is not invalidated is always mapped to the LBA in its
+ * OOB, or is being written for it, so any other PPA would end up mapped to
+ * two LBAs and be lost for one of them when GC moves or invalidates it. */
+static int app_set_l2ptbl (uint64_t slba, uint32_t nlb, uint64_t *tbl)
+{
+    struct nvm_ppa_addr ppa;
+    uint32_t i;
+    int ret = 0;
+
+    if (!appc_st.gl_fn)
+        return -1;
+
+    /* GC must not move sectors while the mapping is checked and replaced */
+    pthread_mutex_lock (&app_st.gc_ns_mutex);
+
+    for (i = 0; i < nlb; i++) {
+        ppa.ppa = tbl[i];
+        if (!ppa.ppa)
+            continue;
+        if (!app_l2p_ppa_valid (&ppa) ||
+                            appnvm()->gl_map->read_fn (slba + i) != ppa.ppa) {
+            log_err ("[appnvm: Set L2P table. Invalid PPA 0x%016" PRIx64 ", "
+                                        "lba %" PRIu64 "]", ppa.ppa, slba + i);
+            pthread_mutex_unlock (&app_st.gc_ns_mutex);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < nlb; i++) {
+        if (tbl[i])
+            continue;
+
+        ret = appnvm()->gl_map->unmap_fn (slba + i, 1);
+        if (ret) {
+            log_err ("[appnvm: Set L2P table failed. lba %" PRIu64 "]",
+                                                                     slba + i);
+            break;
+        }
+    }
+    pthread_mutex_unlock (&app_st.gc_ns_mutex);
+
+    return ret;
+}
+
+static int app_get_stats (struct nvm_ftl_cap_stats_st *st)
+{
+    struct app_channel *lch[app_st.app_nch];
+    uint16_t ch_i, nch;
+
+    if (!appc_st.gl_fn)
+        return -1;
+
+    nch = appnvm()->channels.get_list_fn (lch, app_st.app_nch);
+    if (nch > st->n_ch)
+        nch = st->n_ch;
+
+    for (ch_i = 0; ch_i < nch; ch_i++) {
+        memset (&st->ch[ch_i], 0x0, sizeof (struct nvm_ftl_ch_stats));
+        st->ch[ch_i].ch_id = lch[ch_i]->ch->ch_id;
+        st->ch[ch_i].active = appnvm_ch_active (lch[ch_i]);
+        st->ch[ch_i].need_gc = appnvm_ch_need_gc (lch[ch_i]);
+
+        appnvm()->ch_prov->stats_fn (lch[ch_i], &st->ch[ch_i]);
+        appnvm()->gl_map->stats_fn (lch[ch_i], &st->ch[ch_i]);
+    }
+    st->n_ch = nch;
+
+    appnvm()->gc->stats_fn (&st->gc);
+
+    return 0;
+}
+
 static int app_init_channel (struct nvm_channel *ch)
 {
     int ret;
 
-    ret = appnvm()->channels.init_fn (ch, app_nch);
+    ret = appnvm()->channels.init_fn (ch, app_st.app_nch);
     if (ret)
         return ret;
 
-    app_nch++;
+    app_st.app_nch++;
 
     return 0;
 }
@@ -397,8 +707,8 @@ static int app_ftl_set_bbtbl (struct nvm_ppa_addr *ppa, uint8_t value)
 
 static void app_exit (void)
 {
-    struct app_channel *lch[app_nch];
-    int nch = app_nch, nth, retry, i;
+    struct app_channel *lch[app_st.app_nch];
+    int nch = app_st.app_nch, nth, retry, i;
 
     appnvm()->channels.get_list_fn (lch, nch);
 
@@ -415,18 +725,50 @@ static void app_exit (void)
         } while (nth && retry < 200); /* Waiting max of 1 second */
 
         appnvm()->channels.exit_fn (lch[i]);
-        app_nch--;
+        app_st.app_nch--;
+    }
+
+    memset (&appc_st.map_fmt, 0, sizeof (struct app_map_fmt));
+}
+
+static void app_exit_ch_prov (struct app_channel **lch, uint16_t nch)
+{
+    while (nch) {
+        nch--;
+        appnvm()->ch_prov->exit_fn (lch[nch]);
+        lch[nch]->ch_prov = NULL;
     }
 }
 
 static int app_global_init (void)
 {
-    if (!app_nch)
+    struct app_channel *lch[app_st.app_nch];
+    uint16_t ch_i;
+
+    if (!app_st.app_nch)
         return 0;
 
+    appnvm()->channels.get_list_fn (lch, app_st.app_nch);
+
+    /* Recovery runs before channel provisioning, otherwise blocks written
+     * after the last checkpoint could be erased when the lines are built */
+    if (appnvm()->recovery->init_fn ()) {
+        log_err ("[appnvm: Recovery NOT started.\n");
+        return -1;
+    }
+
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        if (appnvm()->ch_prov->init_fn (lch[ch_i])) {
+            log_err ("[appnvm: Channel Provisioning NOT started. Ch %d\n",
+                                                        lch[ch_i]->ch->ch_id);
+            app_exit_ch_prov (lch, ch_i);
+            goto EXIT_REC;
+        }
+    }
+
     if (appnvm()->gl_prov->init_fn ()) {
         log_err ("[appnvm: Global Provisioning NOT started.\n");
-        return -1;
+        goto EXIT_CH_PROV;
     }
 
     if (appnvm()->gl_map->init_fn ()) {
@@ -434,12 +776,18 @@ static int app_global_init (void)
         goto EXIT_GL_PROV;
     }
 
+    if (appnvm()->recovery->replay_fn ()) {
+        log_err ("[appnvm: Recovery replay failed.\n");
+        goto EXIT_GL_MAP;
+    }
+    appnvm()->recovery->exit_fn ();
+
     if (appnvm()->lba_io->init_fn ()) {
         log_err ("[appnvm: LBA I/O NOT started.\n");
         goto EXIT_GL_MAP;
     }
 
-    if (pthread_mutex_init (&gc_ns_mutex, NULL))
+    if (pthread_mutex_init (&app_st.gc_ns_mutex, NULL))
         goto EXIT_LBA_IO;
 
     if (appnvm()->gc->init_fn ()) {
@@ -453,33 +801,37 @@ static int app_global_init (void)
     return 0;
 
 NS_MUTEX:
-    pthread_mutex_destroy (&gc_ns_mutex);
+    pthread_mutex_destroy (&app_st.gc_ns_mutex);
 EXIT_LBA_IO:
     appnvm()->lba_io->exit_fn ();
 EXIT_GL_MAP:
     appnvm()->gl_map->exit_fn ();
 EXIT_GL_PROV:
     appnvm()->gl_prov->exit_fn ();
+EXIT_CH_PROV:
+    app_exit_ch_prov (lch, app_st.app_nch);
+EXIT_REC:
+    appnvm()->recovery->exit_fn ();
     return -1;
 }
 
 static void app_global_exit (void)
 {
     appnvm()->gc->exit_fn ();
-    pthread_mutex_destroy (&gc_ns_mutex);
+    pthread_mutex_destroy (&app_st.gc_ns_mutex);
     appnvm()->lba_io->exit_fn ();
     appnvm()->gl_map->exit_fn ();
     appnvm()->gl_prov->exit_fn ();
 
-    if (md_ch_spin)
-        free ((void *)md_ch_spin);
+    if (app_st.md_ch_spin)
+        free ((void *)app_st.md_ch_spin);
 }
 
 static int app_init_fn (uint16_t fn_id, void *arg)
 {
     switch (fn_id) {
         case APP_FN_GLOBAL:
-            gl_fn = 1;
+            appc_st.gl_fn = 1;
             return app_global_init();
             break;
         default:
@@ -492,7 +844,11 @@ static void app_exit_fn (uint16_t fn_id)
 {
     switch (fn_id) {
         case APP_FN_GLOBAL:
-            return (gl_fn) ? app_global_exit() : 0;
+            /* Statistics and deallocation are refused after the exit */
+            if (appc_st.gl_fn) {
+                appc_st.gl_fn = 0;
+                app_global_exit();
+            }
             break;
         default:
             log_info ("[appnvm (exit_fn): Function not found. id %d\n", fn_id);
@@ -544,6 +900,9 @@ int appnvm_mod_set (uint8_t *modset)
                 case APPMOD_GC:
                     appnvm()->gc = (struct app_gc *) mod;
                     break;
+                case APPMOD_RECOVERY:
+                    appnvm()->recovery = (struct app_recovery *) mod;
+                    break;
             }
 
             log_info ("  [appnvm: Module set. "
@@ -591,6 +950,8 @@ static void ftl_appnvm_mod_probe (void)
     lba_io_register ();
     /* Garbage collection modules */
     gc_register ();
+    /* Crash recovery modules */
+    recovery_register ();
 }
 
 struct nvm_ftl_ops app_ops = {
@@ -601,10 +962,14 @@ struct nvm_ftl_ops app_ops = {
     .get_bbtbl   = app_ftl_get_bbtbl,
     .set_bbtbl   = app_ftl_set_bbtbl,
     .init_fn     = app_init_fn,
-    .exit_fn     = app_exit_fn
+    .exit_fn     = app_exit_fn,
+    .dealloc     = app_dealloc,
+    .get_stats   = app_get_stats,
+    .get_l2ptbl  = app_get_l2ptbl,
+    .set_l2ptbl  = app_set_l2ptbl
 };
 
-struct nvm_ftl app_ftl = {
+static const struct nvm_ftl app_ftl_default = {
     .ftl_id         = FTL_ID_APPNVM,
     .name           = "APPNVM",
     .nq             = 8,
@@ -624,12 +989,20 @@ int ftl_appnvm_init (void)
         APPFTL_GL_MAP,
         APPFTL_PPA_IO,
         APPFTL_LBA_IO,
-        APPFTL_GC
+        APPFTL_GC,
+        APPFTL_RECOVERY
     };
 
-    gl_fn = 0;
-    app_nch = 0;
-    md_ch_spin = NULL;
+    appc_st.gl_fn = 0;
+    app_st.app_nch = 0;
+    app_st.md_ch_spin = NULL;
+    app_st.map_new = 0;
+    appc_st.app_seq = 0;
+    appc_st.app_seq_valid = 0;
+    memcpy (&appc_st.app_ftl, &app_ftl_default, sizeof (struct nvm_ftl));
+
+    if (pthread_spin_init (&appc_st.app_seq_spin, 0))
+        return -1;
 
     memset (appnvm()->mod_list, 0x0, sizeof (void *) *
                                            APPNVM_FN_SLOTS * APPNVM_MOD_COUNT);
@@ -638,11 +1011,15 @@ int ftl_appnvm_init (void)
     if (appnvm_mod_set (modset_appftl))
         return -1;
 
-    app_ftl.cap |= 1 << FTL_CAP_GET_BBTBL;
-    app_ftl.cap |= 1 << FTL_CAP_SET_BBTBL;
-    app_ftl.cap |= 1 << FTL_CAP_INIT_FN;
-    app_ftl.cap |= 1 << FTL_CAP_EXIT_FN;
-    app_ftl.bbtbl_format = FTL_BBTBL_BYTE;
-
-    return nvm_register_ftl(&app_ftl);
+    appc_st.app_ftl.cap |= 1 << FTL_CAP_GET_BBTBL;
+    appc_st.app_ftl.cap |= 1 << FTL_CAP_SET_BBTBL;
+    appc_st.app_ftl.cap |= 1 << FTL_CAP_INIT_FN;
+    appc_st.app_ftl.cap |= 1 << FTL_CAP_EXIT_FN;
+    appc_st.app_ftl.cap |= 1 << FTL_CAP_DEALLOC;
+    appc_st.app_ftl.cap |= 1 << FTL_CAP_GET_STATS;
+    appc_st.app_ftl.cap |= 1 << FTL_CAP_GET_L2PTBL;
+    appc_st.app_ftl.cap |= 1 << FTL_CAP_SET_L2PTBL;
+    appc_st.app_ftl.bbtbl_format = FTL_BBTBL_BYTE;
+
+    return nvm_register_ftl(&appc_st.app_ftl);
 }
\ No newline at end of file
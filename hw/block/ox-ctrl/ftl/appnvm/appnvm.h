@@ -39,6 +39,18 @@
 
 #define APP_MAGIC          0x3c
 
+/* Block metadata format. Version 2 adds the checkpoint sequence and the
+ * write sequence in the page OOB area, version 3 the wider PPA fields of
+ * the configurable geometry. Version 1 tables carry no version */
+#define APP_BLK_MD_VERSION 3
+
+/* Mapping metadata format, entries hold raw PPAs. Version 1 has the wider
+ * PPA fields, older tables carry no version */
+#define APP_MAP_MD_VERSION 1
+
+/* Sector state of a block, one byte per plane page: pages * planes */
+#define APP_PG_STATE_SZ    1024
+
 #define APP_TRANS_TO_NVM    0
 #define APP_TRANS_FROM_NVM  1
 
@@ -105,7 +117,7 @@ enum app_pg_type {
 
 /* ------- APPNVM MODULE IDS ------- */
 
-#define APPNVM_MOD_COUNT        9
+#define APPNVM_MOD_COUNT        10
 #define APPNVM_FN_SLOTS         32
 
 enum appnvm_mod_types {
@@ -117,7 +129,8 @@ enum appnvm_mod_types {
     APPMOD_GL_MAP   = 0x5,
     APPMOD_PPA_IO   = 0x6,
     APPMOD_LBA_IO   = 0x7,
-    APPMOD_GC       = 0x8
+    APPMOD_GC       = 0x8,
+    APPMOD_RECOVERY = 0x9
 };
 
 /* Bad block table modules */
@@ -147,6 +160,9 @@ enum appnvm_mod_types {
 /* Garbage Collection modules */
 #define APPFTL_GC       0x1
 
+/* Crash recovery modules */
+#define APPFTL_RECOVERY 0x1
+
 enum app_gl_functions {
     APP_FN_GLOBAL   = 0
 };
@@ -173,7 +189,8 @@ struct app_bbtbl {
 struct app_pg_oob {
     uint64_t    lba;
     uint8_t     pg_type;
-    uint8_t     rsv[7];
+    uint8_t     rsv[3];
+    uint32_t    seq;      /* Write sequence, used by crash recovery */
 } __attribute__((packed));
 
 struct app_io_data {
@@ -196,13 +213,15 @@ struct app_blk_md_entry {
     uint32_t                erase_count;
     uint16_t                current_pg;
     uint16_t                invalid_sec;
-    uint8_t                 pg_state[1024]; /* max of 8192 sectors per block */
+    uint8_t                 pg_state[APP_PG_STATE_SZ]; /* 8 sectors/byte */
 } __attribute__((packed));   /* 1042 bytes per entry */
 
 struct app_blk_md {
     uint8_t  magic;
+    uint8_t  version;
     uint32_t entries;
     size_t   entry_sz;
+    uint32_t ckpt_seq; /* Write sequence when the table was flushed */
     /* This struct is stored on NVM up to this point, *tbl is not stored */
     uint8_t  *tbl;
 };
@@ -223,13 +242,30 @@ struct app_ch_flags {
     pthread_spinlock_t  busy_spin;
 };
 
+/* Mapping metadata entry, one per mapping table page. 'lba' is the page
+ * index and 'ppa' the page PPA (or the cache entry, if the page is cached) */
 struct app_map_entry {
     uint64_t lba;
     uint64_t ppa;
 } __attribute__((packed)); /* 16 bytes entry */
 
+/* Mapping table pages store only PPAs, the LBA is implied by the entry
+ * position. PPA fields are packed using the bits required by the geometry,
+ * entries are 4 bytes if the packed PPA fits in 32 bits, 8 bytes otherwise.
+ * A zero entry is an unmapped LBA. */
+struct app_map_fmt {
+    uint8_t  ent_sz;
+    uint8_t  sec_bits;
+    uint8_t  pl_bits;
+    uint8_t  ch_bits;
+    uint8_t  lun_bits;
+    uint8_t  pg_bits;
+    uint8_t  blk_bits;
+};
+
 struct app_map_md {
     uint8_t  magic;
+    uint8_t  version;
     uint32_t entries;
     size_t   entry_sz;
     uint8_t  *tbl;
@@ -277,6 +313,8 @@ typedef struct app_blk_md_entry *(app_ch_prov_get_blk) (struct app_channel *,
                                                                      uint16_t);
 typedef int  (app_ch_prov_get_ppas)(struct app_channel *, struct nvm_ppa_addr *,
                                                                      uint16_t);
+typedef void (app_ch_prov_stats)(struct app_channel *,
+                                                    struct nvm_ftl_ch_stats *);
 
 typedef int                   (app_gl_prov_init) (void);
 typedef void                  (app_gl_prov_exit) (void);
@@ -294,6 +332,9 @@ typedef int         (app_gl_map_upsert) (uint64_t lba, uint64_t ppa);
 typedef uint64_t    (app_gl_map_read) (uint64_t lba);
 typedef int         (app_gl_map_upsert_md) (uint64_t index, uint64_t new_ppa,
                                                               uint64_t old_ppa);
+typedef int         (app_gl_map_unmap) (uint64_t slba, uint32_t nlb);
+typedef void        (app_gl_map_stats) (struct app_channel *,
+                                                    struct nvm_ftl_ch_stats *);
 
 typedef int  (app_ppa_io_submit) (struct nvm_io_cmd *);
 typedef void (app_ppa_io_callback) (struct nvm_mmgr_io_cmd *);
@@ -309,6 +350,11 @@ typedef struct app_blk_md_entry **(app_gc_target) (struct app_channel *,
                                                                     uint32_t *);
 typedef int (app_gc_recycle_blk)(struct app_channel *,struct app_blk_md_entry *,
                                                 uint16_t tid, uint32_t *failed);
+typedef void (app_gc_stats) (struct nvm_ftl_gc_stats *);
+
+typedef int  (app_recovery_init) (void);
+typedef void (app_recovery_exit) (void);
+typedef int  (app_recovery_replay) (void);
 
 struct app_channels {
     app_ch_init         *init_fn;
@@ -342,6 +388,7 @@ struct app_ch_prov {
     app_ch_prov_put_blk     *put_blk_fn;
     app_ch_prov_get_blk     *get_blk_fn;
     app_ch_prov_get_ppas    *get_ppas_fn;
+    app_ch_prov_stats       *stats_fn;
 };
 
 struct app_gl_prov {
@@ -367,6 +414,8 @@ struct app_gl_map {
     app_gl_map_upsert_md *upsert_md_fn;
     app_gl_map_upsert    *upsert_fn;
     app_gl_map_read      *read_fn;
+    app_gl_map_unmap     *unmap_fn;
+    app_gl_map_stats     *stats_fn;
 };
 
 struct app_ppa_io {
@@ -389,6 +438,14 @@ struct app_gc {
     app_gc_exit         *exit_fn;
     app_gc_target       *target_fn;
     app_gc_recycle_blk  *recycle_fn;
+    app_gc_stats        *stats_fn;
+};
+
+struct app_recovery {
+    uint8_t              mod_id;
+    app_recovery_init   *init_fn;
+    app_recovery_exit   *exit_fn;
+    app_recovery_replay *replay_fn;
 };
 
 struct app_global {
@@ -404,8 +461,21 @@ struct app_global {
     struct app_ppa_io       *ppa_io;
     struct app_lba_io       *lba_io;
     struct app_gc           *gc;
+    struct app_recovery     *recovery;
+};
+
+/* AppNVM state shared by the modules of one OX instance */
+struct app_global_state {
+    struct app_global       gl;
+    uint16_t                app_nch;
+    pthread_mutex_t         gc_ns_mutex;
+    pthread_spinlock_t      *md_ch_spin;
+    uint8_t                 map_new;   /* Set when a channel map is created */
 };
 
+#define app_st (*(struct app_global_state *) ox_state (OX_ST_APP_GLOBAL, \
+                                            sizeof (struct app_global_state)))
+
 /* ------- INLINE FUNCTIONS ------- */
 
 static inline int appnvm_ch_active (struct app_channel *lch)
@@ -478,6 +548,14 @@ static inline void appnvm_ch_dec_thread (struct app_channel *lch)
     pthread_spin_unlock (&lch->flags.busy_spin);
 }
 
+/* Compares write sequences across a wrap of the 32-bit counter, live
+ * sequences must lie within 2^31 of each other.
+ * @return negative if a is older than b, 0 if equal, positive if newer */
+static inline int32_t app_seq_cmp (uint32_t a, uint32_t b)
+{
+    return (int32_t) (a - b);
+}
+
 /* ------- GENERAL USE FUNCTIONS ------- */
 
 struct  app_io_data *app_alloc_pg_io (struct app_channel *lch);
@@ -493,6 +571,13 @@ int     app_nvm_seq_transfer (struct app_io_data *io, struct nvm_ppa_addr *ppa,
         uint8_t *user_buf, uint16_t pgs, uint16_t ent_per_pg, uint32_t ent_left,
         size_t entry_sz, uint8_t direction, uint8_t reserved);
 int     app_get_ch_list (struct app_channel **list);
+uint32_t app_seq_next (uint32_t n);
+uint32_t app_seq_get (void);
+void    app_seq_raise (uint32_t seq);
+int     app_map_fmt_init (void);
+size_t  app_map_ent_sz (void);
+uint64_t app_map_ent_get (uint8_t *pg_buf, uint32_t ent);
+void    app_map_ent_set (uint8_t *pg_buf, uint32_t ent, uint64_t ppa);
 
 /* ------- APPNVM CORE FUNCTIONS ------- */
 
@@ -512,5 +597,6 @@ void gl_map_register (void);
 void ppa_io_register (void);
 void lba_io_register (void);
 void gc_register (void);
+void recovery_register (void);
 
 #endif /* APP_H */
\ No newline at end of file
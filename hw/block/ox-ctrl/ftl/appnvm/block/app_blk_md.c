@@ -27,8 +27,6 @@
 #include "hw/block/ox-ctrl/include/ssd.h"
 #include "../appnvm.h"
 
-extern pthread_spinlock_t *md_ch_spin;
-
 static int blk_md_create (struct app_channel *lch)
 {
     int i;
@@ -51,6 +49,7 @@ static int blk_md_load (struct app_channel *lch)
 {
     int pg;
     struct app_blk_md *md = lch->blk_md;
+    struct app_blk_md md_oob;
     struct nvm_ppa_addr ppa;
 
     struct app_io_data *io = app_alloc_pg_io(lch);
@@ -93,6 +92,24 @@ static int blk_md_load (struct app_channel *lch)
                             md->entries, sizeof(struct app_blk_md_entry),
                             APP_TRANS_FROM_NVM, APP_IO_RESERVED))
                 goto ERR;
+
+        /* get the checkpoint sequence from the first page OOB area */
+        if (app_io_rsv_blk (lch, MMGR_READ_PG, (void **) io->pl_vec,
+                                                            lch->meta_blk, pg))
+            goto ERR;
+
+        memcpy (&md_oob, &io->buf[io->pg_sz], sizeof(struct app_blk_md));
+
+        /* Older tables have no write sequence in the OOB area of the data
+         * pages, the crash recovery cannot order them */
+        if (md_oob.version != APP_BLK_MD_VERSION) {
+            log_err("[appnvm ERR: Ch %d -> Block metadata format version %d "
+                    "not supported (expected %d). Format the device.]\n",
+                    io->ch->ch_id, md_oob.version, APP_BLK_MD_VERSION);
+            goto ERR;
+        }
+
+        md->ckpt_seq = md_oob.ckpt_seq;
     }
 
     md->magic = 0;
@@ -140,6 +157,7 @@ static int blk_md_flush (struct app_channel *lch)
     }
 
     md->magic = APP_MAGIC;
+    md->ckpt_seq = app_seq_get ();
     memset (io->buf, 0, io->buf_sz);
 
     /* set info to OOB area */
@@ -187,7 +205,7 @@ static void blk_md_invalidate (struct app_channel *lch,
     lun = appnvm()->md->get_fn (lch, ppa->g.lun);
     pg_map = &lun[ppa->g.blk].pg_state[ppa->g.pg * g->n_of_planes];
 
-    pthread_spin_lock (&md_ch_spin[ppa->g.ch]);
+    pthread_spin_lock (&app_st.md_ch_spin[ppa->g.ch]);
 
     /* If full is > 0, invalidate all sectors in the page */
     if (full) {
@@ -199,7 +217,7 @@ static void blk_md_invalidate (struct app_channel *lch,
         lun[ppa->g.blk].invalid_sec++;
     }
 
-    pthread_spin_unlock (&md_ch_spin[ppa->g.ch]);
+    pthread_spin_unlock (&app_st.md_ch_spin[ppa->g.ch]);
 }
 
 static struct app_global_md appftl_md = {
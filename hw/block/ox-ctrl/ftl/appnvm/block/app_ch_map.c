@@ -29,22 +29,20 @@
 #include <string.h>
 #include "hw/block/ox-ctrl/include/ssd.h"
 
-extern uint16_t app_nch;
-uint8_t         map_new;
-
 static int ch_map_create (struct app_channel *lch)
 {
     int i;
     struct app_map_entry *ent;
     struct app_map_md *md = lch->map_md;
+    uint16_t nch = app_st.app_nch;
 
     for (i = 0; i < md->entries; i++) {
         ent = ((struct app_map_entry *) md->tbl) + i;
         memset (ent, 0x0, sizeof (struct app_map_entry));
-        ent->lba = (i * app_nch) + lch->app_ch_id;
+        ent->lba = (i * nch) + lch->app_ch_id;
     }
 
-    map_new = 1;
+    app_st.map_new = 1;
 
     return 0;
 }
@@ -53,6 +51,7 @@ static int ch_map_load (struct app_channel *lch)
 {
     int pg;
     struct app_map_md *md = lch->map_md;
+    struct app_map_md stored;
     struct nvm_ppa_addr ppa;
 
     struct app_io_data *io = app_alloc_pg_io(lch);
@@ -94,6 +93,24 @@ static int ch_map_load (struct app_channel *lch)
                             md->entries, sizeof(struct app_map_entry),
                             APP_TRANS_FROM_NVM, APP_IO_RESERVED))
                 goto ERR;
+
+        /* Older tables hold PPAs with the former field widths */
+        memcpy (&stored, &io->buf[io->pg_sz], sizeof(struct app_map_md));
+        if (stored.version != APP_MAP_MD_VERSION) {
+            log_err("[appnvm ERR: Ch %d -> Mapping metadata format version %d "
+                    "not supported (expected %d). Format the device.]\n",
+                    io->ch->ch_id, stored.version, APP_MAP_MD_VERSION);
+            goto ERR;
+        }
+
+        /* A table flushed with another mapping entry format has a different
+         * number of entries, its mapping pages cannot be decoded */
+        if (stored.entries != md->entries) {
+            log_err("[appnvm ERR: Ch %d -> Mapping table format mismatch. "
+                    "Entries: %d, expected: %d. The disk must be recreated.]\n",
+                    io->ch->ch_id, stored.entries, md->entries);
+            goto ERR;
+        }
     }
 
     md->magic = 0;
@@ -177,6 +194,6 @@ static struct app_ch_map appftl_ch_map = {
 };
 
 void ch_map_register (void) {
-    map_new = 0;
+    app_st.map_new = 0;
     appnvm_mod_register (APPMOD_CH_MAP, APPFTL_CH_MAP, &appftl_ch_map);
 }
\ No newline at end of file
@@ -390,7 +390,7 @@ NEXT:
         if (vblk->blk_md->flags & APP_BLK_MD_LINE)
             vblk->blk_md->flags ^= APP_BLK_MD_LINE;
 
-        memset (vblk->blk_md->pg_state, 0x0, 1024);
+        memset (vblk->blk_md->pg_state, 0x0, APP_PG_STATE_SZ);
 
         appnvm()->ch_prov->check_gc_fn (lch);
 
@@ -697,6 +697,25 @@ static struct app_blk_md_entry *ch_prov_get_blk (struct app_channel *lch,
     return blk->blk_md;
 }
 
+static void ch_prov_stats (struct app_channel *lch,
+                                                 struct nvm_ftl_ch_stats *st)
+{
+    uint16_t lun_i;
+    struct ch_prov *prov = (struct ch_prov *) lch->ch_prov;
+
+    st->free_blks = st->used_blks = st->open_blks = 0;
+    if (!prov)
+        return;
+
+    pthread_mutex_lock(&prov->ch_mutex);
+    for (lun_i = 0; lun_i < lch->ch->geometry->lun_per_ch; lun_i++) {
+        st->free_blks += prov->luns[lun_i].nfree_blks;
+        st->used_blks += prov->luns[lun_i].nused_blks;
+        st->open_blks += prov->luns[lun_i].nopen_blks;
+    }
+    pthread_mutex_unlock(&prov->ch_mutex);
+}
+
 static struct app_ch_prov appftl_ch_prov = {
     .mod_id       = APPFTL_CH_PROV,
     .init_fn      = ch_prov_init,
@@ -704,7 +723,8 @@ static struct app_ch_prov appftl_ch_prov = {
     .check_gc_fn  = ch_prov_check_gc,
     .put_blk_fn   = ch_prov_blk_put,
     .get_blk_fn   = ch_prov_get_blk,
-    .get_ppas_fn  = ch_prov_get_ppas
+    .get_ppas_fn  = ch_prov_get_ppas,
+    .stats_fn     = ch_prov_stats
 };
 
 void ch_prov_register (void)
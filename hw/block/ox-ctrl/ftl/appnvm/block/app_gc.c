@@ -35,18 +35,22 @@
 #define APP_GC_DELAY_US      10000
 #define APP_GC_DELAY_CH_BUSY 1000
 
-extern uint16_t              app_nch;
-static struct app_channel  **ch;
-static pthread_t             check_th;
-static uint8_t               stop;
-static struct app_io_data ***gc_buf;
-static uint16_t              buf_pg_sz, buf_oob_sz, buf_npg;
-
-static uint32_t gc_recycled_blks;
-static uint64_t gc_moved_sec, gc_pad_sec, gc_err_sec, gc_wro_sec, gc_map_pgs;
+struct app_gc_state {
+    struct app_channel  **ch;
+    pthread_t             check_th;
+    uint8_t               stop;
+    struct app_io_data ***gc_buf;
+    uint16_t              buf_pg_sz, buf_oob_sz, buf_npg;
+
+    uint32_t gc_recycled_blks;
+    uint64_t gc_moved_sec, gc_pad_sec, gc_err_sec, gc_wro_sec, gc_map_pgs;
+
+    pthread_mutex_t *gc_cond_mutex;
+    pthread_cond_t  *gc_cond;
+};
 
-pthread_mutex_t *gc_cond_mutex;
-pthread_cond_t  *gc_cond;
+#define gc_st (*(struct app_gc_state *) ox_state (OX_ST_APP_GC, \
+                                                sizeof (struct app_gc_state)))
 
 struct gc_th_arg {
     uint16_t            tid;
@@ -57,7 +61,7 @@ struct gc_th_arg {
 static int gc_bucket_sort (struct app_blk_md_entry **list,
                     uint32_t list_sz, uint32_t n_buckets, uint32_t min_invalid)
 {
-    uint32_t stop, bi, j, k, ip, bucketc[++n_buckets];
+    uint32_t done, bi, j, k, ip, bucketc[++n_buckets];
     struct app_blk_md_entry **bucket[n_buckets];
     int ret = -1;
 
@@ -77,18 +81,18 @@ static int gc_bucket_sort (struct app_blk_md_entry **list,
     }
 
     k = 0;
-    stop = 0;
+    done = 0;
     for (bi = n_buckets - 1; bi > 0; bi--) {
         for (j = 0; j < bucketc[bi]; j++) {
             if (((float) bi / (float) n_buckets < APPNVM_GC_TARGET_RATE &&
                             (k >= APPNVM_GC_MAX_BLKS)) || (bi < min_invalid)) {
-                stop++;
+                done++;
                 break;
             }
             list[k] = bucket[bi][j];
             k++;
         }
-        if (stop) break;
+        if (done) break;
     }
     ret = k;
 
@@ -175,6 +179,15 @@ static int gc_check_valid_pg (struct app_channel *lch,
     return map;
 }
 
+/* Moved data is a new version for recovery, it gets a new write sequence */
+static void gc_set_pg_seq (struct app_channel *lch, struct app_io_data *io)
+{
+    uint32_t sec_i, seq = app_seq_next (1);
+
+    for (sec_i = 0; sec_i < lch->ch->geometry->sec_per_pl_pg; sec_i++)
+        ((struct app_pg_oob *) io->oob_vec[sec_i])->seq = seq;
+}
+
 static int gc_proc_mapping_pg (struct app_channel *lch, struct app_io_data *io,
                            struct nvm_ppa_addr *old_ppa, struct app_pg_oob *oob)
 {
@@ -183,6 +196,8 @@ static int gc_proc_mapping_pg (struct app_channel *lch, struct app_io_data *io,
     if (appnvm()->ch_prov->get_ppas_fn (lch, ppa_list, 1))
         return -1;
 
+    gc_set_pg_seq (lch, io);
+
     if (app_pg_io (lch, MMGR_WRITE_PG, (void **) io->pl_vec, ppa_list))
         goto ERR;
 
@@ -215,7 +230,7 @@ static int gc_read_blk (struct app_channel *lch,
             ppa.ppa = blk_md->ppa.ppa;
             ppa.g.pg = pg_i;
 
-            io = (struct app_io_data *) gc_buf[tid][pg_i];
+            io = (struct app_io_data *) gc_st.gc_buf[tid][pg_i];
 
             if (app_pg_io (lch, MMGR_READ_PG, (void **) io->pl_vec, &ppa))
                 return -1;
@@ -223,11 +238,11 @@ static int gc_read_blk (struct app_channel *lch,
             oob = (struct app_pg_oob *) io->oob_vec[0];
             if (oob->pg_type == APP_PG_MAP) {
                 if (gc_proc_mapping_pg (lch, io, &ppa, oob)) {
-                    gc_err_sec += lch->ch->geometry->sec_per_pl_pg;
+                    gc_st.gc_err_sec += lch->ch->geometry->sec_per_pl_pg;
                     return -1;
                 }
                 nsec += lch->ch->geometry->sec_per_pl_pg;
-                gc_map_pgs++;
+                gc_st.gc_map_pgs++;
             }
         }
     }
@@ -247,6 +262,8 @@ static uint8_t gc_process_pg (struct app_channel *lch, struct app_io_data *io,
     if (appnvm()->ch_prov->get_ppas_fn (lch, ppa_list, 1))
         return ret;
 
+    gc_set_pg_seq (lch, io);
+
     if (app_pg_io (lch, MMGR_WRITE_PG, (void **) io->pl_vec, ppa_list)) {
 
         /* TODO: If write fails, tell provisioning to recycle
@@ -291,7 +308,7 @@ static int gc_move_sector (struct app_channel *lch, struct app_io_data *w_io,
     struct app_pg_oob *sec_oob;
     struct nvm_mmgr_geometry *geo = lch->ch->geometry;
 
-    io = (struct app_io_data *) gc_buf[tid][pg_i];
+    io = (struct app_io_data *) gc_st.gc_buf[tid][pg_i];
     sec_oob = (struct app_pg_oob *) io->oob_vec[sec_i];
 
     switch (sec_oob->pg_type) {
@@ -299,7 +316,7 @@ static int gc_move_sector (struct app_channel *lch, struct app_io_data *w_io,
             break;
         case APP_PG_PADDING:
             appnvm()->md->invalidate_fn (lch, old_ppa, APP_INVALID_SECTOR);
-            gc_pad_sec++;
+            gc_st.gc_pad_sec++;
             return -1;
         case APP_PG_MAP:
         case APP_PG_RESERVED:
@@ -323,7 +340,7 @@ static int gc_move_sector (struct app_channel *lch, struct app_io_data *w_io,
     return 0;
 
 ERR:
-    gc_wro_sec++;
+    gc_st.gc_wro_sec++;
     log_info ("[gc: Suspicious data type (%d). LBA %lu, PPA "
             "(%d/%d/%d/%d/%d/%d)\n", sec_oob->pg_type, sec_oob->lba,
             old_ppa->g.ch, old_ppa->g.lun, old_ppa->g.blk,
@@ -418,7 +435,7 @@ static int gc_recycle_blks (struct app_channel *lch,
             log_err ("[appnvm (gc): Read block / move mapping failed.]");
             continue;
         }
-        gc_moved_sec += blk_sec;
+        gc_st.gc_moved_sec += blk_sec;
         count_sec += blk_sec;
 
         blk_sec = appnvm()->gc->recycle_fn (lch, list[blk_i], tid, &failed_sec);
@@ -437,12 +454,12 @@ static int gc_recycle_blks (struct app_channel *lch,
                 goto COUNT;
             }
             recycled++;
-            gc_recycled_blks++;
+            gc_st.gc_recycled_blks++;
         }
 
 COUNT:
-        gc_moved_sec += blk_sec;
-        gc_err_sec   += failed_sec;
+        gc_st.gc_moved_sec += blk_sec;
+        gc_st.gc_err_sec   += failed_sec;
         count_sec    += blk_sec;
     }
 
@@ -456,9 +473,10 @@ static void gc_print_stats (struct app_channel *lch, uint32_t recycled,
     printf (" GC (%d): (%d/%d) %.2f MB, T: (%d/%lu) %.2f MB, "
             "(M%lu/P%lu/F%lu/W%lu) \n", lch->app_ch_id, recycled, blk_sec,
             (4.0 * (double) blk_sec) / (double) 1024,
-            gc_recycled_blks, gc_moved_sec,
-            (4.0 * (double) gc_moved_sec) / (double) 1024,
-            gc_map_pgs, gc_pad_sec, gc_err_sec, gc_wro_sec);
+            gc_st.gc_recycled_blks, gc_st.gc_moved_sec,
+            (4.0 * (double) gc_st.gc_moved_sec) / (double) 1024,
+            gc_st.gc_map_pgs, gc_st.gc_pad_sec, gc_st.gc_err_sec,
+            gc_st.gc_wro_sec);
 }
 
 static void *gc_run_ch (void *arg)
@@ -470,13 +488,14 @@ static void *gc_run_ch (void *arg)
     struct app_channel       *lch = th_arg->lch;
     struct app_blk_md_entry **list;
 
-    while (!stop) {
+    while (!gc_st.stop) {
 
-        pthread_mutex_lock(&gc_cond_mutex[th_arg->tid]);
-        pthread_cond_signal(&gc_cond[th_arg->tid]);
-        pthread_cond_wait(&gc_cond[th_arg->tid], &gc_cond_mutex[th_arg->tid]);
-        pthread_mutex_unlock(&gc_cond_mutex[th_arg->tid]);
-        if (stop)
+        pthread_mutex_lock(&gc_st.gc_cond_mutex[th_arg->tid]);
+        pthread_cond_signal(&gc_st.gc_cond[th_arg->tid]);
+        pthread_cond_wait(&gc_st.gc_cond[th_arg->tid],
+                                          &gc_st.gc_cond_mutex[th_arg->tid]);
+        pthread_mutex_unlock(&gc_st.gc_cond_mutex[th_arg->tid]);
+        if (gc_st.stop)
             break;
 
         appnvm_ch_active_unset (lch);
@@ -516,45 +535,46 @@ static void *gc_run_ch (void *arg)
 
 static void *gc_check_fn (void *arg)
 {
-    uint8_t wait[app_nch];
+    uint8_t wait[app_st.app_nch];
     uint16_t cch = 0, sleep = 0, n_run = 0, ch_i, th_i;
-    pthread_t run_th[app_nch];
+    pthread_t run_th[app_st.app_nch];
     struct gc_th_arg *th_arg;
 
-    memset (wait, 0x0, sizeof (uint8_t) * app_nch);
+    memset (wait, 0x0, sizeof (uint8_t) * app_st.app_nch);
 
-    th_arg = malloc (sizeof (struct gc_th_arg) * app_nch);
+    th_arg = malloc (sizeof (struct gc_th_arg) * app_st.app_nch);
     if (!th_arg)
         return NULL;
 
-    for (th_i = 0; th_i < app_nch; th_i++) {
+    for (th_i = 0; th_i < app_st.app_nch; th_i++) {
         th_arg[th_i].tid = th_i;
-        th_arg[th_i].lch = ch[th_i];
+        th_arg[th_i].lch = gc_st.ch[th_i];
 
-        if (pthread_create (&run_th[th_i], NULL, gc_run_ch,
+        if (ox_thread_create (&run_th[th_i], gc_run_ch,
                                                        (void *) &th_arg[th_i]))
             goto STOP;
     }
 
-    while (!stop) {
-        if (appnvm_ch_need_gc (ch[cch])) {
+    while (!gc_st.stop) {
+        if (appnvm_ch_need_gc (gc_st.ch[cch])) {
 
             th_arg[cch].bufid = n_run;
             n_run++;
             sleep++;
             wait[cch]++;
 
-            pthread_mutex_lock (&gc_cond_mutex[cch]);
-            pthread_cond_signal(&gc_cond[cch]);
-            pthread_mutex_unlock (&gc_cond_mutex[cch]);
+            pthread_mutex_lock (&gc_st.gc_cond_mutex[cch]);
+            pthread_cond_signal(&gc_st.gc_cond[cch]);
+            pthread_mutex_unlock (&gc_st.gc_cond_mutex[cch]);
 
-            if (n_run == APP_GC_PARALLEL_CH || (cch == app_nch - 1)) {
-                for (ch_i = 0; ch_i < app_nch; ch_i++) {
+            if (n_run == APP_GC_PARALLEL_CH || (cch == app_st.app_nch - 1)) {
+                for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
                     if (wait[ch_i]) {
-                        pthread_mutex_lock (&gc_cond_mutex[cch]);
-                        pthread_cond_signal(&gc_cond[cch]);
-                        pthread_cond_wait(&gc_cond[cch], &gc_cond_mutex[cch]);
-                        pthread_mutex_unlock (&gc_cond_mutex[cch]);
+                        pthread_mutex_lock (&gc_st.gc_cond_mutex[cch]);
+                        pthread_cond_signal(&gc_st.gc_cond[cch]);
+                        pthread_cond_wait(&gc_st.gc_cond[cch],
+                                                  &gc_st.gc_cond_mutex[cch]);
+                        pthread_mutex_unlock (&gc_st.gc_cond_mutex[cch]);
                         wait[cch] = 0x0;
                         n_run--;
                     }
@@ -565,7 +585,7 @@ static void *gc_check_fn (void *arg)
             }
         }
 
-        cch = (cch == app_nch - 1) ? 0 : cch + 1;
+        cch = (cch == app_st.app_nch - 1) ? 0 : cch + 1;
         if (!cch) {
             if (!sleep)
                 usleep (APP_GC_DELAY_US);
@@ -576,9 +596,9 @@ static void *gc_check_fn (void *arg)
 STOP:
     while (th_i) {
         th_i--;
-        pthread_mutex_lock (&gc_cond_mutex[th_i]);
-        pthread_cond_signal(&gc_cond[th_i]);
-        pthread_mutex_unlock (&gc_cond_mutex[th_i]);
+        pthread_mutex_lock (&gc_st.gc_cond_mutex[th_i]);
+        pthread_cond_signal(&gc_st.gc_cond[th_i]);
+        pthread_mutex_unlock (&gc_st.gc_cond_mutex[th_i]);
         pthread_join (run_th[th_i], NULL);
     }
 
@@ -590,18 +610,18 @@ static int gc_alloc_buf (void)
 {
     uint32_t th_i, pg_i;
 
-    gc_buf = malloc (sizeof (void *) * APP_GC_PARALLEL_CH);
-    if (!gc_buf)
+    gc_st.gc_buf = malloc (sizeof (void *) * APP_GC_PARALLEL_CH);
+    if (!gc_st.gc_buf)
         return -1;
 
     for (th_i = 0; th_i < APP_GC_PARALLEL_CH; th_i++) {
-        gc_buf[th_i] = malloc (sizeof (uint8_t *) * buf_npg);
-        if (!gc_buf[th_i])
+        gc_st.gc_buf[th_i] = malloc (sizeof (uint8_t *) * gc_st.buf_npg);
+        if (!gc_st.gc_buf[th_i])
             goto FREE_BUF;
 
-        for (pg_i = 0; pg_i < buf_npg; pg_i++) {
-            gc_buf[th_i][pg_i] = app_alloc_pg_io (ch[0]);
-            if (!gc_buf[th_i][pg_i])
+        for (pg_i = 0; pg_i < gc_st.buf_npg; pg_i++) {
+            gc_st.gc_buf[th_i][pg_i] = app_alloc_pg_io (gc_st.ch[0]);
+            if (!gc_st.gc_buf[th_i][pg_i])
                 goto FREE_BUF_PG;
         }
     }
@@ -611,17 +631,17 @@ static int gc_alloc_buf (void)
 FREE_BUF_PG:
     while (pg_i) {
         pg_i--;
-        app_free_pg_io (gc_buf[th_i][pg_i]);
+        app_free_pg_io (gc_st.gc_buf[th_i][pg_i]);
     }
-    free (gc_buf[th_i]);
+    free (gc_st.gc_buf[th_i]);
 FREE_BUF:
     while (th_i) {
         th_i--;
-        for (pg_i = 0; pg_i < buf_npg; pg_i++)
-            app_free_pg_io (gc_buf[th_i][pg_i]);
-        free (gc_buf[th_i]);
+        for (pg_i = 0; pg_i < gc_st.buf_npg; pg_i++)
+            app_free_pg_io (gc_st.gc_buf[th_i][pg_i]);
+        free (gc_st.gc_buf[th_i]);
     }
-    free (gc_buf);
+    free (gc_st.gc_buf);
     return -1;
 }
 
@@ -631,11 +651,11 @@ static void gc_free_buf (void)
 
     while (th_i) {
         th_i--;
-        for (pg_i = 0; pg_i < buf_npg; pg_i++)
-            app_free_pg_io (gc_buf[th_i][pg_i]);
-        free (gc_buf[th_i]);
+        for (pg_i = 0; pg_i < gc_st.buf_npg; pg_i++)
+            app_free_pg_io (gc_st.gc_buf[th_i][pg_i]);
+        free (gc_st.gc_buf[th_i]);
     }
-    free (gc_buf);
+    free (gc_st.gc_buf);
 }
 
 static int gc_init (void)
@@ -643,35 +663,36 @@ static int gc_init (void)
     uint16_t nch, ch_i;
     struct nvm_mmgr_geometry *geo;
 
-    ch = malloc (sizeof (struct app_channel *) * app_nch);
-    if (!ch)
+    gc_st.ch = malloc (sizeof (struct app_channel *) * app_st.app_nch);
+    if (!gc_st.ch)
         return -1;
 
-    nch = appnvm()->channels.get_list_fn (ch, app_nch);
-    if (nch != app_nch)
+    nch = appnvm()->channels.get_list_fn (gc_st.ch, app_st.app_nch);
+    if (nch != app_st.app_nch)
         goto FREE_CH;
 
-    gc_recycled_blks = 0;
-    gc_moved_sec = gc_pad_sec = gc_err_sec = gc_wro_sec = gc_map_pgs = 0;
+    gc_st.gc_recycled_blks = 0;
+    gc_st.gc_moved_sec = gc_st.gc_pad_sec = gc_st.gc_err_sec = 0;
+    gc_st.gc_wro_sec = gc_st.gc_map_pgs = 0;
 
-    geo = ch[0]->ch->geometry;
-    buf_pg_sz = geo->pg_size;
-    buf_oob_sz = geo->pg_oob_sz;
-    buf_npg = geo->pg_per_blk;
+    geo = gc_st.ch[0]->ch->geometry;
+    gc_st.buf_pg_sz = geo->pg_size;
+    gc_st.buf_oob_sz = geo->pg_oob_sz;
+    gc_st.buf_npg = geo->pg_per_blk;
 
-    gc_cond = malloc (sizeof (pthread_cond_t) * app_nch);
-    if (!gc_cond)
+    gc_st.gc_cond = malloc (sizeof (pthread_cond_t) * app_st.app_nch);
+    if (!gc_st.gc_cond)
         goto FREE_CH;
 
-    gc_cond_mutex = malloc (sizeof (pthread_mutex_t) * app_nch);
-    if (!gc_cond_mutex)
+    gc_st.gc_cond_mutex = malloc (sizeof (pthread_mutex_t) * app_st.app_nch);
+    if (!gc_st.gc_cond_mutex)
         goto FREE_COND;
 
-    for (ch_i = 0; ch_i < app_nch; ch_i++) {
-        if (pthread_cond_init (&gc_cond[ch_i], NULL))
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        if (pthread_cond_init (&gc_st.gc_cond[ch_i], NULL))
             goto COND_MUTEX;
-        if (pthread_mutex_init (&gc_cond_mutex[ch_i], NULL)) {
-            pthread_cond_destroy (&gc_cond[ch_i]);
+        if (pthread_mutex_init (&gc_st.gc_cond_mutex[ch_i], NULL)) {
+            pthread_cond_destroy (&gc_st.gc_cond[ch_i]);
             goto COND_MUTEX;
         }
     }
@@ -679,8 +700,8 @@ static int gc_init (void)
     if (gc_alloc_buf ())
         goto COND_MUTEX;
 
-    stop = 0;
-    if (pthread_create (&check_th, NULL, gc_check_fn, NULL))
+    gc_st.stop = 0;
+    if (ox_thread_create (&gc_st.check_th, gc_check_fn, NULL))
         goto FREE_BUF;
 
     return 0;
@@ -690,14 +711,14 @@ FREE_BUF:
 COND_MUTEX:
     while (ch_i) {
         ch_i--;
-        pthread_cond_destroy (&gc_cond[ch_i]);
-        pthread_mutex_destroy (&gc_cond_mutex[ch_i]);
+        pthread_cond_destroy (&gc_st.gc_cond[ch_i]);
+        pthread_mutex_destroy (&gc_st.gc_cond_mutex[ch_i]);
     }
-    free (gc_cond_mutex);
+    free (gc_st.gc_cond_mutex);
 FREE_COND:
-    free (gc_cond);
+    free (gc_st.gc_cond);
 FREE_CH:
-    free (ch);
+    free (gc_st.ch);
     return -1;
 }
 
@@ -705,18 +726,28 @@ static void gc_exit (void)
 {
     uint16_t ch_i;
 
-    stop++;
-    pthread_join (check_th, NULL);
+    gc_st.stop++;
+    pthread_join (gc_st.check_th, NULL);
     gc_free_buf ();
 
-    for (ch_i = 0; ch_i < app_nch; ch_i++) {
-        pthread_cond_destroy (&gc_cond[ch_i]);
-        pthread_mutex_destroy (&gc_cond_mutex[ch_i]);
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        pthread_cond_destroy (&gc_st.gc_cond[ch_i]);
+        pthread_mutex_destroy (&gc_st.gc_cond_mutex[ch_i]);
     }
 
-    free (gc_cond_mutex);
-    free (gc_cond);
-    free (ch);
+    free (gc_st.gc_cond_mutex);
+    free (gc_st.gc_cond);
+    free (gc_st.ch);
+}
+
+static void gc_stats (struct nvm_ftl_gc_stats *st)
+{
+    st->recycled_blks = gc_st.gc_recycled_blks;
+    st->moved_sec     = gc_st.gc_moved_sec;
+    st->pad_sec       = gc_st.gc_pad_sec;
+    st->err_sec       = gc_st.gc_err_sec;
+    st->wro_sec       = gc_st.gc_wro_sec;
+    st->map_pgs       = gc_st.gc_map_pgs;
 }
 
 static struct app_gc appftl_gc = {
@@ -724,7 +755,8 @@ static struct app_gc appftl_gc = {
     .init_fn    = gc_init,
     .exit_fn    = gc_exit,
     .target_fn  = gc_get_target_blks,
-    .recycle_fn = gc_process_blk
+    .recycle_fn = gc_process_blk,
+    .stats_fn   = gc_stats
 };
 
 void gc_register (void)
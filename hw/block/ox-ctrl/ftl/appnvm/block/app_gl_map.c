@@ -35,9 +35,6 @@
 
 #define MAP_ADDR_FLAG   ((1 & AND64) << 63)
 
-extern pthread_spinlock_t *md_ch_spin;
-extern uint8_t             map_new;
-
 struct map_cache_entry {
     uint8_t                     dirty;
     uint8_t                    *buf;
@@ -58,6 +55,9 @@ struct map_cache {
     uint32_t                                nfree;
     uint32_t                                nused;
     uint16_t                                id;
+    uint64_t                                hits;
+    uint64_t                                misses;
+    uint64_t                                evictions;
 };
 
 struct map_pg_addr {
@@ -70,12 +70,18 @@ struct map_pg_addr {
     };
 };
 
-static struct map_cache    *map_ch_cache;
-extern uint16_t             app_nch;
-static struct app_channel **ch;
+struct app_gl_map_state {
+    struct map_cache    *map_ch_cache;
+    struct app_channel **ch;
+
+    /* The mapping strategy ensures the entry size matches with the NVM pg
+     * size. Entries hold packed PPAs only, see app_map_ent_get/set */
+    uint64_t             map_ent_per_pg;
+    size_t               map_ent_sz;
+};
 
-/* The mapping strategy ensures the entry size matches with the NVM pg size */
-static uint64_t             map_ent_per_pg;
+#define glm_st (*(struct app_gl_map_state *) ox_state (OX_ST_APP_GL_MAP, \
+                                            sizeof (struct app_gl_map_state)))
 
 /**
  * - The mapping table is spread using the global provisioning functions.
@@ -98,6 +104,7 @@ static int map_nvm_write (struct map_cache_entry *ent, uint64_t lba)
     struct nvm_ppa_addr *addr;
     struct app_io_data *io;
     int sec, ret = -1;
+    uint32_t seq;
 
     prov_ppa = appnvm()->gl_prov->new_fn (1);
     if (!prov_ppa) {
@@ -105,23 +112,25 @@ static int map_nvm_write (struct map_cache_entry *ent, uint64_t lba)
         return -1;
     }
 
-    if (prov_ppa->nppas != ch[0]->ch->geometry->sec_per_pl_pg)
+    if (prov_ppa->nppas != glm_st.ch[0]->ch->geometry->sec_per_pl_pg)
         log_err ("[appnvm (gl_map): NVM write. wrong PPAs. nppas %d]",
                                                               prov_ppa->nppas);
 
     addr = &prov_ppa->ppa[0];
-    lch = ch[addr->g.ch];
+    lch = glm_st.ch[addr->g.ch];
     io = app_alloc_pg_io(lch);
     if (io == NULL)
         goto FREE_PPA;
 
+    seq = app_seq_next (1);
     for (sec = 0; sec < io->ch->geometry->sec_per_pl_pg; sec++) {
         ((struct app_pg_oob *) io->oob_vec[sec])->lba = lba;
         ((struct app_pg_oob *) io->oob_vec[sec])->pg_type = APP_PG_MAP;
+        ((struct app_pg_oob *) io->oob_vec[sec])->seq = seq;
     }
 
-    ret = app_nvm_seq_transfer (io, addr, ent->buf, 1, map_ent_per_pg,
-                            map_ent_per_pg, sizeof(struct app_map_entry),
+    ret = app_nvm_seq_transfer (io, addr, ent->buf, 1, glm_st.map_ent_per_pg,
+                            glm_st.map_ent_per_pg, glm_st.map_ent_sz,
                             APP_TRANS_TO_NVM, APP_IO_NORMAL);
     if (ret)
         /* TODO: If write fails, the block should be closed and subsequent
@@ -146,14 +155,14 @@ static int map_nvm_read (struct map_cache_entry *ent)
     addr.ppa = ent->md_entry->ppa;
 
     /* TODO: Support multiple media managers for mapping the channel ID */
-    lch = ch[addr.g.ch];
+    lch = glm_st.ch[addr.g.ch];
 
     io = app_alloc_pg_io(lch);
     if (io == NULL)
         return -1;
 
-    ret = app_nvm_seq_transfer (io, &addr, ent->buf, 1, map_ent_per_pg,
-                            map_ent_per_pg, sizeof(struct app_map_entry),
+    ret = app_nvm_seq_transfer (io, &addr, ent->buf, 1, glm_st.map_ent_per_pg,
+                            glm_st.map_ent_per_pg, glm_st.map_ent_sz,
                             APP_TRANS_FROM_NVM, APP_IO_NORMAL);
     if (ret)
         log_err("[appnvm (gl_map): NVM read failed. PPA 0x%016lx]", addr.ppa);
@@ -198,7 +207,7 @@ static int map_evict_pg_cache (struct map_cache *cache)
 
         /* Invalidate old page PPAs */
         if (old_ppa.ppa)
-            appnvm()->md->invalidate_fn (ch[old_ppa.g.ch], &old_ppa,
+            appnvm()->md->invalidate_fn (glm_st.ch[old_ppa.g.ch], &old_ppa,
                                                              APP_INVALID_PAGE);
     }
 
@@ -208,6 +217,8 @@ static int map_evict_pg_cache (struct map_cache *cache)
 
     pthread_mutex_unlock (cache_ent->mutex);
 
+    __sync_fetch_and_add (&cache->evictions, 1);
+
     pthread_spin_lock (&cache->mb_spin);
     LIST_INSERT_HEAD (&cache->mbf_head, cache_ent, f_entry);
     cache->nfree++;
@@ -217,11 +228,9 @@ static int map_evict_pg_cache (struct map_cache *cache)
 }
 
 static int map_load_pg_cache (struct map_cache *cache,
-           struct app_map_entry *md_entry, uint64_t first_lba, uint32_t pg_off)
+                               struct app_map_entry *md_entry, uint32_t pg_off)
 {
     struct map_cache_entry *cache_ent;
-    struct app_map_entry *map_ent;
-    uint64_t ent_id;
 
     if (LIST_EMPTY(&cache->mbf_head))
         if (map_evict_pg_cache (cache))
@@ -240,11 +249,7 @@ static int map_load_pg_cache (struct map_cache *cache,
 
     /* If metadata entry PPA is zero, mapping page does not exist yet */
     if (!md_entry->ppa) {
-        for (ent_id = 0; ent_id < map_ent_per_pg; ent_id++) {
-            map_ent = &((struct app_map_entry *) cache_ent->buf)[ent_id];
-            map_ent->lba = first_lba + ent_id;
-            map_ent->ppa = 0x0;
-        }
+        memset (cache_ent->buf, 0x0, glm_st.map_ent_per_pg * glm_st.map_ent_sz);
         cache_ent->dirty = 1;
     } else {
         if (map_nvm_read (cache_ent)) {
@@ -262,8 +267,7 @@ static int map_load_pg_cache (struct map_cache *cache,
         /* Cache entry PPA is set after the read completes */
     }
 
-    cache_ent->mutex = &ch[cache->id]->map_md->entry_mutex[pg_off];
-    map_ent = &((struct app_map_entry *) cache_ent->buf)[0];
+    cache_ent->mutex = &glm_st.ch[cache->id]->map_md->entry_mutex[pg_off];
 
     md_entry->ppa = (uint64_t) cache_ent;
     md_entry->ppa |= MAP_ADDR_FLAG;
@@ -292,6 +296,9 @@ static int map_init_ch_cache (struct map_cache *cache)
     TAILQ_INIT(&cache->mbu_head);
     cache->nfree = 0;
     cache->nused = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
 
     for (pg_i = 0; pg_i < MAP_BUF_CH_PGS; pg_i++) {
         cache->pg_buf[pg_i].dirty = 0;
@@ -355,35 +362,36 @@ static int map_init (void)
 {
     uint32_t nch, ch_i, pg_sz;
 
-    ch = malloc (sizeof (struct app_channel *) * app_nch);
-    if (!ch)
+    glm_st.ch = malloc (sizeof (struct app_channel *) * app_st.app_nch);
+    if (!glm_st.ch)
         return -1;
 
-    nch = appnvm()->channels.get_list_fn (ch, app_nch);
-    if (nch != app_nch)
+    nch = appnvm()->channels.get_list_fn (glm_st.ch, app_st.app_nch);
+    if (nch != app_st.app_nch)
         goto FREE_CH;
 
-    map_ch_cache = malloc (sizeof (struct map_cache) * app_nch);
-    if (!map_ch_cache)
+    glm_st.map_ch_cache = malloc (sizeof (struct map_cache) * app_st.app_nch);
+    if (!glm_st.map_ch_cache)
         goto FREE_CH;
 
-    pg_sz = ch[0]->ch->geometry->pl_pg_size;
-    for (ch_i = 0; ch_i < app_nch; ch_i++) {
-        pg_sz = MIN(ch[ch_i]->ch->geometry->pl_pg_size, pg_sz);
+    pg_sz = glm_st.ch[0]->ch->geometry->pl_pg_size;
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        pg_sz = MIN(glm_st.ch[ch_i]->ch->geometry->pl_pg_size, pg_sz);
 
-        if (map_init_ch_cache (&map_ch_cache[ch_i]))
+        if (map_init_ch_cache (&glm_st.map_ch_cache[ch_i]))
             goto EXIT_BUF_CH;
 
-        map_ch_cache[ch_i].id = ch_i;
+        glm_st.map_ch_cache[ch_i].id = ch_i;
     }
 
-    map_ent_per_pg = pg_sz / sizeof (struct app_map_entry);
+    glm_st.map_ent_sz = app_map_ent_sz ();
+    glm_st.map_ent_per_pg = pg_sz / glm_st.map_ent_sz;
 
     /* Recalculate mapping metadata indexes if the table is new */
-    if (map_new) {
-        for (ch_i = 0; ch_i < app_nch; ch_i++)
-            appnvm()->ch_map->create_fn (ch[ch_i]);
-        map_new = 0;
+    if (app_st.map_new) {
+        for (ch_i = 0; ch_i < app_st.app_nch; ch_i++)
+            appnvm()->ch_map->create_fn (glm_st.ch[ch_i]);
+        app_st.map_new = 0;
     }
 
     log_info("    [appnvm: Global Mapping started.]\n");
@@ -393,73 +401,75 @@ static int map_init (void)
 EXIT_BUF_CH:
     while (ch_i) {
         ch_i--;
-        map_exit_ch_cache (&map_ch_cache[ch_i]);
+        map_exit_ch_cache (&glm_st.map_ch_cache[ch_i]);
     }
-    free (map_ch_cache);
+    free (glm_st.map_ch_cache);
 FREE_CH:
-    free (ch);
+    free (glm_st.ch);
     return -1;
 }
 
 static void map_exit (void)
 {
-    uint32_t ch_i = app_nch;
+    uint32_t ch_i = app_st.app_nch;
 
     while (ch_i) {
         ch_i--;
-        map_exit_ch_cache (&map_ch_cache[ch_i]);
+        map_exit_ch_cache (&glm_st.map_ch_cache[ch_i]);
     }
 
-    free (map_ch_cache);
-    free (ch);
+    free (glm_st.map_ch_cache);
+    free (glm_st.ch);
 }
 
 static struct map_cache_entry *map_get_cache_entry (uint64_t lba)
 {
     uint32_t ch_map, pg_off;
-    uint64_t first_pg_lba;
     struct app_map_entry *md_ent;
     struct map_cache_entry *cache_ent = NULL;
     struct map_pg_addr *addr;
+    struct map_cache *cache;
+    pthread_mutex_t *ent_mutex;
 
     /* Mapping metadata pages are spread among channels using round-robin */
-    ch_map = (lba / map_ent_per_pg) % app_nch;
-    pg_off = (lba / map_ent_per_pg) / app_nch;
+    ch_map = (lba / glm_st.map_ent_per_pg) % app_st.app_nch;
+    pg_off = (lba / glm_st.map_ent_per_pg) / app_st.app_nch;
 
-    md_ent = appnvm()->ch_map->get_fn (ch[ch_map], pg_off);
+    md_ent = appnvm()->ch_map->get_fn (glm_st.ch[ch_map], pg_off);
     if (!md_ent) {
         log_err ("[appnvm (gl_map): Map MD page out of bounds. Ch %d\n",ch_map);
         return NULL;
     }
 
     addr = (struct map_pg_addr *) &md_ent->ppa;
+    cache = &glm_st.map_ch_cache[ch_map];
+    ent_mutex = &glm_st.ch[ch_map]->map_md->entry_mutex[pg_off];
 
     /* If the PPA flag is zero, the mapping page is not cached yet */
     /* There is a mutex per metadata page */
-    pthread_mutex_lock (&ch[ch_map]->map_md->entry_mutex[pg_off]);
+    pthread_mutex_lock (ent_mutex);
     if (!addr->g.flag) {
 
-        first_pg_lba = (lba / map_ent_per_pg) * map_ent_per_pg;
-
-        if (map_load_pg_cache (&map_ch_cache[ch_map], md_ent, first_pg_lba,
-                                                                     pg_off)) {
-            pthread_mutex_unlock (&ch[ch_map]->map_md->entry_mutex[pg_off]);
+        if (map_load_pg_cache (cache, md_ent, pg_off)) {
+            pthread_mutex_unlock (ent_mutex);
             log_err ("[appnvm(gl_map): Mapping page not loaded ch %d\n",ch_map);
             return NULL;
         }
+        __sync_fetch_and_add (&cache->misses, 1);
 
     } else {
 
         /* Keep cache entry as hot, in the tail of the queue */
         cache_ent = (struct map_cache_entry *) ((uint64_t) addr->g.addr);
 
-        pthread_spin_lock (&map_ch_cache[ch_map].mb_spin);
-        TAILQ_REMOVE(&map_ch_cache[ch_map].mbu_head, cache_ent, u_entry);
-        TAILQ_INSERT_TAIL(&map_ch_cache[ch_map].mbu_head, cache_ent, u_entry);
-        pthread_spin_unlock (&map_ch_cache[ch_map].mb_spin);
+        pthread_spin_lock (&cache->mb_spin);
+        TAILQ_REMOVE(&cache->mbu_head, cache_ent, u_entry);
+        TAILQ_INSERT_TAIL(&cache->mbu_head, cache_ent, u_entry);
+        pthread_spin_unlock (&cache->mb_spin);
 
+        __sync_fetch_and_add (&cache->hits, 1);
     }
-    pthread_mutex_unlock (&ch[ch_map]->map_md->entry_mutex[pg_off]);
+    pthread_mutex_unlock (ent_mutex);
 
     /* At this point, the PPA only points to the cache */
     if (cache_ent == NULL)
@@ -477,10 +487,10 @@ static int map_upsert_md (uint64_t index, uint64_t new_ppa, uint64_t old_ppa)
     struct nvm_ppa_addr ppa;
     int ret = 0;
 
-    ch_map = index % app_nch;
-    pg_off = index / app_nch;
+    ch_map = index % app_st.app_nch;
+    pg_off = index / app_st.app_nch;
 
-    md_ent = appnvm()->ch_map->get_fn (ch[ch_map], pg_off);
+    md_ent = appnvm()->ch_map->get_fn (glm_st.ch[ch_map], pg_off);
     if (!md_ent) {
         log_err ("[appnvm (gl_map): MD page out of bounds. Index %lu\n", index);
         return -1;
@@ -498,7 +508,7 @@ static int map_upsert_md (uint64_t index, uint64_t new_ppa, uint64_t old_ppa)
     addr = (struct map_pg_addr *) &md_ent->ppa;
 
     /* If the PPA flag is zero, the mapping page is not cached */
-    pthread_mutex_lock (&ch[ch_map]->map_md->entry_mutex[pg_off]);
+    pthread_mutex_lock (&glm_st.ch[ch_map]->map_md->entry_mutex[pg_off]);
     if (!addr->g.flag) {
 
         if (addr->addr != old_ppa)
@@ -515,11 +525,12 @@ static int map_upsert_md (uint64_t index, uint64_t new_ppa, uint64_t old_ppa)
             cache_ent->ppa.ppa = new_ppa;
 
     }
-    pthread_mutex_unlock (&ch[ch_map]->map_md->entry_mutex[pg_off]);
+    pthread_mutex_unlock (&glm_st.ch[ch_map]->map_md->entry_mutex[pg_off]);
 
     ppa.ppa = old_ppa;
     if (old_ppa)
-        appnvm()->md->invalidate_fn (ch[ppa.g.ch], &ppa, APP_INVALID_PAGE);
+        appnvm()->md->invalidate_fn (glm_st.ch[ppa.g.ch], &ppa,
+                                                             APP_INVALID_PAGE);
 
     return ret;
 }
@@ -527,13 +538,12 @@ static int map_upsert_md (uint64_t index, uint64_t new_ppa, uint64_t old_ppa)
 static int map_upsert (uint64_t lba, uint64_t ppa)
 {
     uint32_t ch_map, ent_off;
-    struct app_map_entry *map_ent;
     struct map_cache_entry *cache_ent;
-    struct nvm_ppa_addr old_ppa, addr;
+    struct nvm_ppa_addr old_ppa;
 
-    ch_map = (lba / map_ent_per_pg) % app_nch;
-    ent_off = lba % map_ent_per_pg;
-    if (ent_off >= map_ent_per_pg) {
+    ch_map = (lba / glm_st.map_ent_per_pg) % app_st.app_nch;
+    ent_off = lba % glm_st.map_ent_per_pg;
+    if (ent_off >= glm_st.map_ent_per_pg) {
         log_err ("[appnvm(gl_map): Entry offset out of bounds. Ch %d\n",ch_map);
         return -1;
     }
@@ -542,27 +552,16 @@ static int map_upsert (uint64_t lba, uint64_t ppa)
     if (!cache_ent)
         return -1;
 
-    map_ent = &((struct app_map_entry *) cache_ent->buf)[ent_off];
-
-    if (map_ent->lba != lba) {
-        addr.ppa = map_ent->ppa;
-        log_err ("[appnvm(gl_map): WRITE LBA does not match entry. lba: %lu, "
-            "map lba: %lu, map ppa: (%d/%d/%d/%d/%d/%d), Ch %d, ent_off %d\n",
-            lba, map_ent->lba, addr.g.ch, addr.g.lun, addr.g.blk, addr.g.pl,
-            addr.g.pg, addr.g.sec, ch_map, ent_off);
-        return -1;
-    }
-
     /* If LBA is not new, mark old PPA page as invalid for GC */
-    old_ppa.ppa = map_ent->ppa;
-    if (map_ent->ppa)
-        appnvm()->md->invalidate_fn (ch[old_ppa.g.ch], &old_ppa,
+    old_ppa.ppa = app_map_ent_get (cache_ent->buf, ent_off);
+    if (old_ppa.ppa)
+        appnvm()->md->invalidate_fn (glm_st.ch[old_ppa.g.ch], &old_ppa,
                                                            APP_INVALID_SECTOR);
 
-    pthread_spin_lock (&md_ch_spin[old_ppa.g.ch]);
-    map_ent->ppa = ppa;
+    pthread_spin_lock (&app_st.md_ch_spin[old_ppa.g.ch]);
+    app_map_ent_set (cache_ent->buf, ent_off, ppa);
     cache_ent->dirty = 1;
-    pthread_spin_unlock (&md_ch_spin[old_ppa.g.ch]);
+    pthread_spin_unlock (&app_st.md_ch_spin[old_ppa.g.ch]);
 
     return 0;
 }
@@ -570,12 +569,10 @@ static int map_upsert (uint64_t lba, uint64_t ppa)
 static uint64_t map_read (uint64_t lba)
 {
     struct map_cache_entry *cache_ent;
-    struct app_map_entry *map_ent;
-    struct nvm_ppa_addr ppa;
     uint32_t ent_off;
 
-    ent_off = lba % map_ent_per_pg;
-    if (ent_off >= map_ent_per_pg) {
+    ent_off = lba % glm_st.map_ent_per_pg;
+    if (ent_off >= glm_st.map_ent_per_pg) {
         log_err ("[appnvm(gl_map): Entry offset out of bounds. lba %lu\n", lba);
         return AND64;
     }
@@ -584,18 +581,99 @@ static uint64_t map_read (uint64_t lba)
     if (!cache_ent)
         return AND64;
 
-    map_ent = &((struct app_map_entry *) cache_ent->buf)[ent_off];
+    return app_map_ent_get (cache_ent->buf, ent_off);
+}
 
-    if (map_ent->lba != lba) {
-        ppa.ppa = map_ent->ppa;
-        log_err ("[appnvm(gl_map): READ LBA does not match entry. lba: %lu, "
-            "map lba: %lu, map ppa: (%d/%d/%d/%d/%d/%d), ent_off %d\n",
-                lba, map_ent->lba, ppa.g.ch, ppa.g.lun, ppa.g.blk, ppa.g.pl,
-                ppa.g.pg, ppa.g.sec, ent_off);
-        return -1;
+/* Entries are cleared in batches of one mapping page, the page is kept in
+ * the cache by holding its metadata mutex. Mapping pages never written are
+ * skipped without being loaded, all their LBAs are already unmapped. */
+static int map_unmap (uint64_t slba, uint32_t nlb)
+{
+    uint32_t ch_map, pg_off, ent_off, n_ent, ent_i;
+    uint64_t lba = slba, elba = slba + nlb;
+    struct app_map_entry *md_ent;
+    struct map_cache_entry *cache_ent;
+    struct map_pg_addr *addr;
+    struct nvm_ppa_addr old_ppa;
+    pthread_mutex_t *pg_mutex;
+
+    while (lba < elba) {
+        ent_off = lba % glm_st.map_ent_per_pg;
+        n_ent = MIN(glm_st.map_ent_per_pg - ent_off, elba - lba);
+
+        ch_map = (lba / glm_st.map_ent_per_pg) % app_st.app_nch;
+        pg_off = (lba / glm_st.map_ent_per_pg) / app_st.app_nch;
+
+        md_ent = appnvm()->ch_map->get_fn (glm_st.ch[ch_map], pg_off);
+        if (!md_ent) {
+            log_err ("[appnvm (gl_map): Unmap MD page out of bounds. "
+                                                          "Ch %d\n", ch_map);
+            return -1;
+        }
+
+        addr = (struct map_pg_addr *) &md_ent->ppa;
+        pg_mutex = &glm_st.ch[ch_map]->map_md->entry_mutex[pg_off];
+
+        pthread_mutex_lock (pg_mutex);
+        if (!addr->addr) {
+            pthread_mutex_unlock (pg_mutex);
+            lba += n_ent;
+            continue;
+        }
+        pthread_mutex_unlock (pg_mutex);
+
+        cache_ent = map_get_cache_entry (lba);
+        if (!cache_ent)
+            return -1;
+
+        /* The page might be evicted before the mutex is taken, retry */
+        pthread_mutex_lock (pg_mutex);
+        if (!addr->g.flag ||
+                (struct map_cache_entry *) ((uint64_t) addr->g.addr) !=
+                                                                   cache_ent) {
+            pthread_mutex_unlock (pg_mutex);
+            continue;
+        }
+
+        for (ent_i = 0; ent_i < n_ent; ent_i++) {
+            old_ppa.ppa = app_map_ent_get (cache_ent->buf, ent_off + ent_i);
+            if (!old_ppa.ppa)
+                continue;
+
+            /* Mark old PPA as invalid, GC does not move it anymore */
+            appnvm()->md->invalidate_fn (glm_st.ch[old_ppa.g.ch], &old_ppa,
+                                                           APP_INVALID_SECTOR);
+            app_map_ent_set (cache_ent->buf, ent_off + ent_i, 0x0);
+            cache_ent->dirty = 1;
+        }
+        pthread_mutex_unlock (pg_mutex);
+
+        lba += n_ent;
     }
 
-    return map_ent->ppa;
+    return 0;
+}
+
+static void map_stats (struct app_channel *lch, struct nvm_ftl_ch_stats *st)
+{
+    uint32_t ch_i;
+    struct map_cache *cache;
+
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        if (glm_st.ch[ch_i] != lch)
+            continue;
+
+        cache = &glm_st.map_ch_cache[ch_i];
+        pthread_spin_lock (&cache->mb_spin);
+        st->map_cache_used = cache->nused;
+        st->map_cache_free = cache->nfree;
+        pthread_spin_unlock (&cache->mb_spin);
+
+        st->map_cache_hits      = cache->hits;
+        st->map_cache_misses    = cache->misses;
+        st->map_cache_evictions = cache->evictions;
+        return;
+    }
 }
 
 static struct app_gl_map appftl_gl_map = {
@@ -604,7 +682,9 @@ static struct app_gl_map appftl_gl_map = {
     .exit_fn        = map_exit,
     .upsert_md_fn   = map_upsert_md,
     .upsert_fn      = map_upsert,
-    .read_fn        = map_read
+    .read_fn        = map_read,
+    .unmap_fn       = map_unmap,
+    .stats_fn       = map_stats
 };
 
 void gl_map_register (void) {
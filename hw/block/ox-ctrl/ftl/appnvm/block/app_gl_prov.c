@@ -30,25 +30,29 @@
 #include <string.h>
 #include "hw/block/ox-ctrl/include/ssd.h"
 
-extern uint16_t app_nch;
-static struct app_channel **ch;
-static pthread_spinlock_t cur_ch_spin;
-static u_atomic_t cur_ch_id;
+struct app_gl_prov_state {
+    struct app_channel **ch;
+    pthread_spinlock_t cur_ch_spin;
+    u_atomic_t cur_ch_id;
+};
+
+#define glp_st (*(struct app_gl_prov_state *) ox_state (OX_ST_APP_GL_PROV, \
+                                           sizeof (struct app_gl_prov_state)))
 
 static int gl_prov_init (void)
 {
     int nch;
 
-    ch = malloc (sizeof (struct app_channel *) * app_nch);
-    if (!ch)
+    glp_st.ch = malloc (sizeof (struct app_channel *) * app_st.app_nch);
+    if (!glp_st.ch)
         return -1;
 
-    cur_ch_id.counter = U_ATOMIC_INIT_RUNTIME(0);
-    if (pthread_spin_init (&cur_ch_spin, 0))
+    glp_st.cur_ch_id.counter = U_ATOMIC_INIT_RUNTIME(0);
+    if (pthread_spin_init (&glp_st.cur_ch_spin, 0))
         goto FREE;
 
-    nch = appnvm()->channels.get_list_fn (ch, app_nch);
-    if (nch != app_nch)
+    nch = appnvm()->channels.get_list_fn (glp_st.ch, app_st.app_nch);
+    if (nch != app_st.app_nch)
         goto SPIN_LOCK;
 
     log_info("    [appnvm: Global Provisioning started.]\n");
@@ -56,20 +60,22 @@ static int gl_prov_init (void)
     return 0;
 
 SPIN_LOCK:
-    pthread_spin_destroy (&cur_ch_spin);
+    pthread_spin_destroy (&glp_st.cur_ch_spin);
 FREE:
-    free (ch);
+    free (glp_st.ch);
     return -1;
 }
 
 static void gl_prov_exit (void)
 {
-    pthread_spin_destroy (&cur_ch_spin);
-    free (ch);
+    pthread_spin_destroy (&glp_st.cur_ch_spin);
+    free (glp_st.ch);
 }
 
 static struct app_prov_ppas *gl_prov_get_ppa_list (uint32_t pgs)
 {
+    uint16_t                  app_nch = app_st.app_nch;
+    struct app_channel      **ch = glp_st.ch;
     uint32_t ch_id, act_ch_id, nact_ch, cc, new_cc, nppas, tppas, pg_left, i;
     struct app_prov_ppas      tmp_ppa[app_nch];
     struct app_channel       *dec_ch[app_nch];
@@ -121,13 +127,13 @@ static struct app_prov_ppas *gl_prov_get_ppa_list (uint32_t pgs)
 
 REDIST:
     /* Collect the current ch and set the new current ch for the next thread */
-    pthread_spin_lock (&cur_ch_spin);
-    cc = u_atomic_read (&cur_ch_id);
+    pthread_spin_lock (&glp_st.cur_ch_spin);
+    cc = u_atomic_read (&glp_st.cur_ch_id);
     new_cc = (pgs % app_nch) + cc;
     if (new_cc > app_nch - 1)
         new_cc -= app_nch;
-    u_atomic_set (&cur_ch_id, new_cc);
-    pthread_spin_unlock (&cur_ch_spin);
+    u_atomic_set (&glp_st.cur_ch_id, new_cc);
+    pthread_spin_unlock (&glp_st.cur_ch_spin);
 
     /* Distribute the pages among the active channels */
     pg_left = pgs;
@@ -256,7 +262,7 @@ static void gl_prov_free_ppa_list (struct app_prov_ppas *ppas)
             appnvm_ch_dec_thread(ppas->ch[i]);
         if (APPNVM_DEBUG_GL_PROV)
             printf (" [appnvm (gl_prov): FREE Ch %d - %d users]\n", i,
-                                                    appnvm_ch_nthreads(ch[i]));
+                                              appnvm_ch_nthreads(glp_st.ch[i]));
     }
 
     free (ppas->ch);
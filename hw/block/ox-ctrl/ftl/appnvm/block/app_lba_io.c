@@ -75,25 +75,30 @@ struct lba_io_sec_ent {
  * next command, if time is finished, a smaller PPA I/O command is issued */
 #define LBA_IO_EMPTY_US 400
 
-STAILQ_HEAD(flba_q, lba_io_sec) flbahead = STAILQ_HEAD_INITIALIZER(flbahead);
-TAILQ_HEAD(ulba_q, lba_io_sec) ulbahead = TAILQ_HEAD_INITIALIZER(ulbahead);
-static pthread_spinlock_t sec_spin;
+struct app_lba_io_state {
+    STAILQ_HEAD(flba_q, lba_io_sec) flbahead;
+    TAILQ_HEAD(ulba_q, lba_io_sec)  ulbahead;
+    pthread_spinlock_t              sec_spin;
 
-STAILQ_HEAD(fcmd_q, lba_io_cmd) fcmdhead = STAILQ_HEAD_INITIALIZER(fcmdhead);
-TAILQ_HEAD(ucmd_q, lba_io_cmd) ucmdhead = TAILQ_HEAD_INITIALIZER(ucmdhead);
-static pthread_spinlock_t cmd_spin;
+    STAILQ_HEAD(fcmd_q, lba_io_cmd) fcmdhead;
+    TAILQ_HEAD(ucmd_q, lba_io_cmd)  ucmdhead;
+    pthread_spinlock_t              cmd_spin;
 
-extern pthread_mutex_t gc_ns_mutex;
+    struct ox_mq        *lba_io_mq;
 
-static struct ox_mq        *lba_io_mq;
+    uint16_t             sec_pl_pg;
+    struct app_channel **ch;
 
-static uint16_t             sec_pl_pg;
-extern uint16_t             app_nch;
-static struct app_channel **ch;
+    /* index 0: write line, index 1: read line */
+    struct lba_io_sec   *rw_line[2][64];
+    uint8_t              rw_off[2];
+};
+
+#define lio_st (*(struct app_lba_io_state *) ox_state (OX_ST_APP_LBA_IO, \
+                                            sizeof (struct app_lba_io_state)))
 
-/* index 0: write line, index 1: read line */
-static struct lba_io_sec   *rw_line[2][64];
-static uint8_t              rw_off[2];
+/* Returned to the host for unmapped LBAs */
+static uint8_t              zero_sec[NVME_KERNEL_PG_SIZE];
 
 static void lba_io_reset_cmd (struct lba_io_cmd *lcmd)
 {
@@ -152,7 +157,7 @@ COMPLETE_LBA:
             }
 
         }
-        ox_mq_complete_req (lba_io_mq, lba[i]->mentry);
+        ox_mq_complete_req (lio_st.lba_io_mq, lba[i]->mentry);
     }
 
 COMPLETE_CMD:
@@ -170,10 +175,10 @@ COMPLETE_CMD:
     }
     pthread_mutex_unlock (&lcmd->mutex);
 
-    pthread_spin_lock (&cmd_spin);
-    TAILQ_REMOVE(&ucmdhead, lcmd, uentry);
-    STAILQ_INSERT_TAIL(&fcmdhead, lcmd, fentry);
-    pthread_spin_unlock (&cmd_spin);
+    pthread_spin_lock (&lio_st.cmd_spin);
+    TAILQ_REMOVE(&lio_st.ucmdhead, lcmd, uentry);
+    STAILQ_INSERT_TAIL(&lio_st.fcmdhead, lcmd, fentry);
+    pthread_spin_unlock (&lio_st.cmd_spin);
 }
 
 static int lba_io_submit (struct nvm_io_cmd *cmd)
@@ -182,27 +187,27 @@ static int lba_io_submit (struct nvm_io_cmd *cmd)
     struct lba_io_sec *lba[256];
     qtype = (cmd->cmdtype == MMGR_WRITE_PG) ? LBA_IO_WRITE_Q : LBA_IO_READ_Q;
 
-    for (ch_i = 0; ch_i < app_nch; ch_i++)
-        if (appnvm_ch_active (ch[ch_i]))
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++)
+        if (appnvm_ch_active (lio_st.ch[ch_i]))
             ret++;
     if (!ret)
         goto REQUEUE;
 
     for (sec_i = 0; sec_i < cmd->n_sec; sec_i++) {
-        pthread_spin_lock (&sec_spin);
-        if (STAILQ_EMPTY(&flbahead)) {
-            pthread_spin_unlock (&sec_spin);
+        pthread_spin_lock (&lio_st.sec_spin);
+        if (STAILQ_EMPTY(&lio_st.flbahead)) {
+            pthread_spin_unlock (&lio_st.sec_spin);
             goto REQUEUE;
         }
 
-        lba[sec_i] = STAILQ_FIRST(&flbahead);
+        lba[sec_i] = STAILQ_FIRST(&lio_st.flbahead);
         if (!lba[sec_i]) {
-            pthread_spin_unlock (&sec_spin);
+            pthread_spin_unlock (&lio_st.sec_spin);
             goto REQUEUE;
         }
-        STAILQ_REMOVE_HEAD (&flbahead, fentry);
-        TAILQ_INSERT_TAIL(&ulbahead, lba[sec_i], uentry);
-        pthread_spin_unlock (&sec_spin);
+        STAILQ_REMOVE_HEAD (&lio_st.flbahead, fentry);
+        TAILQ_INSERT_TAIL(&lio_st.ulbahead, lba[sec_i], uentry);
+        pthread_spin_unlock (&lio_st.sec_spin);
 
         lba[sec_i]->lba_id = sec_i;
         lba[sec_i]->nvme = cmd;
@@ -213,7 +218,7 @@ static int lba_io_submit (struct nvm_io_cmd *cmd)
     }
 
     for (sec_i = 0; sec_i < cmd->n_sec; sec_i++) {
-        if (ox_mq_submit_req(lba_io_mq, qtype, lba[sec_i]))
+        if (ox_mq_submit_req(lio_st.lba_io_mq, qtype, lba[sec_i]))
             /* MQ_TO and callback take care of aborting submitted lbas */
             goto REQUEUE_UNPROCESSED;
     }
@@ -232,10 +237,10 @@ REQUEUE_UNPROCESSED:
         lba[sec_i]->nvme = 0x0;
         lba[sec_i]->lba = 0x0;
         lba[sec_i]->prp = 0x0;
-        pthread_spin_lock (&sec_spin);
-        TAILQ_REMOVE(&ulbahead, lba[sec_i], uentry);
-        STAILQ_INSERT_TAIL(&flbahead, lba[sec_i], fentry);
-        pthread_spin_unlock (&sec_spin);
+        pthread_spin_lock (&lio_st.sec_spin);
+        TAILQ_REMOVE(&lio_st.ulbahead, lba[sec_i], uentry);
+        STAILQ_INSERT_TAIL(&lio_st.flbahead, lba[sec_i], fentry);
+        pthread_spin_unlock (&lio_st.sec_spin);
         sec_i++;
     }
     return ret;
@@ -246,10 +251,10 @@ REQUEUE:
         lba[sec_i]->nvme = 0x0;
         lba[sec_i]->lba = 0x0;
         lba[sec_i]->prp = 0x0;
-        pthread_spin_lock (&sec_spin);
-        TAILQ_REMOVE(&ulbahead, lba[sec_i], uentry);
-        STAILQ_INSERT_TAIL(&flbahead, lba[sec_i], fentry);
-        pthread_spin_unlock (&sec_spin);
+        pthread_spin_lock (&lio_st.sec_spin);
+        TAILQ_REMOVE(&lio_st.ulbahead, lba[sec_i], uentry);
+        STAILQ_INSERT_TAIL(&lio_st.flbahead, lba[sec_i], fentry);
+        pthread_spin_unlock (&lio_st.sec_spin);
     }
     cmd->status.status = NVM_IO_FAIL;
     cmd->status.nvme_status = NVME_INTERNAL_DEV_ERROR;
@@ -336,21 +341,21 @@ static void lba_io_prepare_cmd (struct lba_io_cmd *lcmd, uint8_t type)
 static int lba_io_write (struct lba_io_cmd *lcmd)
 {
     struct lba_io_sec_ent *nvme_lba;
-    uint32_t sec_i, pgs, sec_oob;
+    uint32_t sec_i, pgs, sec_oob, seq;
     struct nvm_io_cmd *cmd;
     struct app_prov_ppas *ppas;
-    uint32_t nlb = rw_off[LBA_IO_WRITE_Q];
+    uint32_t nlb = lio_st.rw_off[LBA_IO_WRITE_Q];
     struct app_pg_oob *oob;
 
-    pgs = nlb / sec_pl_pg;
-    if (nlb % sec_pl_pg > 0)
+    pgs = nlb / lio_st.sec_pl_pg;
+    if (nlb % lio_st.sec_pl_pg > 0)
         pgs++;
 
     cmd = &lcmd->cmd;
-    cmd->n_sec = sec_pl_pg * pgs;
+    cmd->n_sec = lio_st.sec_pl_pg * pgs;
 
     /* The OOB area is used to store the page LBA, for GC reverse mapping */
-    sec_oob = ch[0]->ch->geometry->sec_oob_sz;
+    sec_oob = lio_st.ch[0]->ch->geometry->sec_oob_sz;
     cmd->md_sz = cmd->n_sec * sec_oob;
     lcmd->oob_lba = malloc (cmd->md_sz);
     if (!lcmd->oob_lba)
@@ -364,18 +369,23 @@ static int lba_io_write (struct lba_io_cmd *lcmd)
 
     lcmd->prov = ppas;
 
+    /* Each sector gets its own write sequence, the same LBA may appear more
+     * than once in the line and recovery must know the newest copy */
+    seq = app_seq_next (cmd->n_sec);
+
     for (sec_i = 0; sec_i < nlb; sec_i++) {
-        rw_line[LBA_IO_WRITE_Q][sec_i]->ppa.ppa = ppas->ppa[sec_i].ppa;
+        lio_st.rw_line[LBA_IO_WRITE_Q][sec_i]->ppa.ppa = ppas->ppa[sec_i].ppa;
 
         cmd->ppalist[sec_i].ppa = ppas->ppa[sec_i].ppa;
-        cmd->prp[sec_i]         = rw_line[LBA_IO_WRITE_Q][sec_i]->prp;
-        cmd->channel[sec_i]     = ch[ppas->ppa[sec_i].g.ch]->ch;
+        cmd->prp[sec_i]         = lio_st.rw_line[LBA_IO_WRITE_Q][sec_i]->prp;
+        cmd->channel[sec_i]     = lio_st.ch[ppas->ppa[sec_i].g.ch]->ch;
 
-        lcmd->vec[sec_i]        = rw_line[LBA_IO_WRITE_Q][sec_i];
+        lcmd->vec[sec_i]        = lio_st.rw_line[LBA_IO_WRITE_Q][sec_i];
 
         oob = (struct app_pg_oob *) (lcmd->oob_lba + (sec_oob * sec_i));
         oob->lba = lcmd->vec[sec_i]->lba;
         oob->pg_type = APP_PG_NAMESPACE;
+        oob->seq = seq + sec_i;
 
         /* Keep the LBA/PPAs in the nvme command, in this way, if the command
         fails, no lba is upserted in the mapping table */
@@ -390,11 +400,12 @@ static int lba_io_write (struct lba_io_cmd *lcmd)
     /* Padding the physical write if needed (same data for now) */
     while (sec_i < cmd->n_sec) {
         cmd->ppalist[sec_i].ppa = ppas->ppa[sec_i].ppa;
-        cmd->prp[sec_i] = rw_line[LBA_IO_WRITE_Q][0]->prp;
-        cmd->channel[sec_i] = ch[ppas->ppa[sec_i].g.ch]->ch;
+        cmd->prp[sec_i] = lio_st.rw_line[LBA_IO_WRITE_Q][0]->prp;
+        cmd->channel[sec_i] = lio_st.ch[ppas->ppa[sec_i].g.ch]->ch;
         oob = (struct app_pg_oob *) (lcmd->oob_lba + (sec_oob * sec_i));
         oob->lba = AND64;
         oob->pg_type = APP_PG_PADDING;
+        oob->seq = seq + sec_i;
         sec_i++;
     }
 
@@ -426,56 +437,113 @@ FREE:
     return -1;
 }
 
+/* Unmapped LBAs (deallocated or never written) are completed without
+ * touching the NVM, zeroes are returned to the host */
+static void lba_io_read_unmapped (struct lba_io_sec *lba)
+{
+    struct nvm_io_cmd *nvme_cmd = lba->nvme;
+
+    if (nvme_cmd && nvme_cmd->status.status != NVM_IO_FAIL) {
+        if (nvm_dma ((void *) zero_sec, lba->prp, NVME_KERNEL_PG_SIZE,
+                                                            NVM_DMA_TO_HOST)) {
+            nvme_cmd->status.status = NVM_IO_FAIL;
+            nvme_cmd->status.nvme_status = NVME_DATA_TRAS_ERROR;
+        } else {
+            nvme_cmd->status.status = NVM_IO_SUCCESS;
+            nvme_cmd->status.nvme_status = NVME_SUCCESS;
+        }
+    }
+
+    ox_mq_complete_req (lio_st.lba_io_mq, lba->mentry);
+}
+
 static int lba_io_read (struct lba_io_cmd *lcmd)
 {
     int ret;
-    uint32_t sec_i, sec_oob, pgs;
+    uint32_t sec_i, sec_oob, pgs, nsec, nunmap;
     struct nvm_io_cmd *cmd;
-    uint32_t nlb = rw_off[LBA_IO_READ_Q];
+    uint32_t nlb = lio_st.rw_off[LBA_IO_READ_Q];
     struct nvm_ppa_addr sec_ppa;
+    struct lba_io_sec *lba, *unmap[LBA_IO_PPA_SIZE];
+    uint64_t ts;
 
-    pgs = nlb / sec_pl_pg;
-    if (nlb % sec_pl_pg > 0)
+    pgs = nlb / lio_st.sec_pl_pg;
+    if (nlb % lio_st.sec_pl_pg > 0)
         pgs++;
 
     cmd = &lcmd->cmd;
     cmd->n_sec = nlb;
 
     /* The OOB area is used to store the page LBA, for GC reverse mapping */
-    sec_oob = ch[0]->ch->geometry->sec_oob_sz;
-    cmd->md_sz = sec_pl_pg * pgs * sec_oob;
+    sec_oob = lio_st.ch[0]->ch->geometry->sec_oob_sz;
+    cmd->md_sz = lio_st.sec_pl_pg * pgs * sec_oob;
     lcmd->oob_lba = malloc (cmd->md_sz);
     if (!lcmd->oob_lba)
         return 1;
 
+    /* All LBAs are looked up before any completion, the line is retried
+     * entirely if the mapping table fails */
+    ts = ox_lat_ts ();
     for (sec_i = 0; sec_i < nlb; sec_i++) {
 
         sec_ppa.ppa = appnvm()->gl_map->read_fn
-                                          (rw_line[LBA_IO_READ_Q][sec_i]->lba);
+                                   (lio_st.rw_line[LBA_IO_READ_Q][sec_i]->lba);
         if (sec_ppa.ppa == AND64) {
             free (lcmd->oob_lba);
             return 1;
         }
+        ts = ox_lat_add (OX_LAT_MAP, OX_LAT_OP_READ, sec_ppa.g.ch, ts);
 
-        rw_line[LBA_IO_READ_Q][sec_i]->ppa.ppa = sec_ppa.ppa;
-        cmd->ppalist[sec_i].ppa = sec_ppa.ppa;
-        cmd->prp[sec_i] = rw_line[LBA_IO_READ_Q][sec_i]->prp;
+        lio_st.rw_line[LBA_IO_READ_Q][sec_i]->ppa.ppa = sec_ppa.ppa;
+    }
 
-        cmd->channel[sec_i] = ch[sec_ppa.g.ch]->ch;
+    nsec = nunmap = 0;
+    for (sec_i = 0; sec_i < nlb; sec_i++) {
+        lba = lio_st.rw_line[LBA_IO_READ_Q][sec_i];
+        if (!lba->ppa.ppa) {
+            unmap[nunmap] = lba;
+            nunmap++;
+            continue;
+        }
 
-        lcmd->vec[sec_i] = rw_line[LBA_IO_READ_Q][sec_i];
+        cmd->ppalist[nsec].ppa = lba->ppa.ppa;
+        cmd->prp[nsec] = lba->prp;
+        cmd->channel[nsec] = lio_st.ch[lba->ppa.g.ch]->ch;
+        lcmd->vec[nsec] = lba;
+        nsec++;
     }
 
-    lba_io_prepare_cmd (lcmd, LBA_IO_READ_Q);
+    if (nsec) {
+        cmd->n_sec = nsec;
+        lba_io_prepare_cmd (lcmd, LBA_IO_READ_Q);
 
-    ret = appnvm()->ppa_io->submit_fn (cmd);
+        ret = appnvm()->ppa_io->submit_fn (cmd);
 
-    pthread_mutex_lock (&lcmd->mutex);
-    if (ret && lcmd->oob_lba)
+        pthread_mutex_lock (&lcmd->mutex);
+        if (ret && lcmd->oob_lba)
+            free (lcmd->oob_lba);
+        pthread_mutex_unlock (&lcmd->mutex);
+
+        if (ret)
+            return ret;
+    } else {
+
+        /* No LBA is mapped, the PPA command is not needed */
         free (lcmd->oob_lba);
-    pthread_mutex_unlock (&lcmd->mutex);
+        lcmd->oob_lba = NULL;
 
-    return ret;
+        pthread_spin_lock (&lio_st.cmd_spin);
+        TAILQ_REMOVE(&lio_st.ucmdhead, lcmd, uentry);
+        STAILQ_INSERT_TAIL(&lio_st.fcmdhead, lcmd, fentry);
+        pthread_spin_unlock (&lio_st.cmd_spin);
+    }
+
+    /* Unmapped LBAs are completed only after the line is submitted, a failed
+     * submission retries the entire line */
+    for (sec_i = 0; sec_i < nunmap; sec_i++)
+        lba_io_read_unmapped (unmap[sec_i]);
+
+    return 0;
 }
 
 static int lba_io_rw (uint8_t type)
@@ -483,18 +551,18 @@ static int lba_io_rw (uint8_t type)
     int ret;
     struct lba_io_cmd *lcmd;
 
-    if (STAILQ_EMPTY(&fcmdhead))
+    if (STAILQ_EMPTY(&lio_st.fcmdhead))
         return -1;
 
-    pthread_spin_lock (&cmd_spin);
-    lcmd = STAILQ_FIRST(&fcmdhead);
+    pthread_spin_lock (&lio_st.cmd_spin);
+    lcmd = STAILQ_FIRST(&lio_st.fcmdhead);
     if (!lcmd) {
-        pthread_spin_unlock (&cmd_spin);
+        pthread_spin_unlock (&lio_st.cmd_spin);
         return -1;
     }
-    STAILQ_REMOVE_HEAD (&fcmdhead, fentry);
-    TAILQ_INSERT_TAIL(&ucmdhead, lcmd, uentry);
-    pthread_spin_unlock (&cmd_spin);
+    STAILQ_REMOVE_HEAD (&lio_st.fcmdhead, fentry);
+    TAILQ_INSERT_TAIL(&lio_st.ucmdhead, lcmd, uentry);
+    pthread_spin_unlock (&lio_st.cmd_spin);
 
     lba_io_reset_cmd (lcmd);
 
@@ -506,10 +574,10 @@ static int lba_io_rw (uint8_t type)
     return 0;
 
 REQUEUE:
-    pthread_spin_lock (&cmd_spin);
-    TAILQ_REMOVE(&ucmdhead, lcmd, uentry);
-    STAILQ_INSERT_TAIL(&fcmdhead, lcmd, fentry);
-    pthread_spin_unlock (&cmd_spin);
+    pthread_spin_lock (&lio_st.cmd_spin);
+    TAILQ_REMOVE(&lio_st.ucmdhead, lcmd, uentry);
+    STAILQ_INSERT_TAIL(&lio_st.fcmdhead, lcmd, fentry);
+    pthread_spin_unlock (&lio_st.cmd_spin);
 
     return ret;
 }
@@ -519,11 +587,11 @@ static void lba_io_complete_failed_lbas (uint8_t type)
     uint16_t i;
     struct lba_io_sec *lba;
 
-    for (i = 0; i < rw_off[type]; i++) {
-        lba = rw_line[type][i];
+    for (i = 0; i < lio_st.rw_off[type]; i++) {
+        lba = lio_st.rw_line[type][i];
         lba->nvme->status.status = NVM_IO_FAIL;
         lba->nvme->status.nvme_status = NVME_DATA_TRAS_ERROR;
-        ox_mq_complete_req (lba_io_mq, lba->mentry);
+        ox_mq_complete_req (lio_st.lba_io_mq, lba->mentry);
     }
 }
 
@@ -534,21 +602,21 @@ static void lba_io_sec_sq (struct ox_mq_entry *req)
     lba->mentry = req;
 
     /* 1 write thread and 1 read thread, so, no lock is needed */
-    rw_line[lba->type][rw_off[lba->type]] = lba;
-    rw_off[lba->type]++;
+    lio_st.rw_line[lba->type][lio_st.rw_off[lba->type]] = lba;
+    lio_st.rw_off[lba->type]++;
 
-    ret = ox_mq_used_count (lba_io_mq, lba->type);
+    ret = ox_mq_used_count (lio_st.lba_io_mq, lba->type);
 
     if (ret < 0) {
         lba_io_complete_failed_lbas (lba->type);
         goto RESET_LINE;
     } else if (ret == 0) {
         usleep (LBA_IO_EMPTY_US);
-        ret = ox_mq_used_count (lba_io_mq, lba->type);
+        ret = ox_mq_used_count (lio_st.lba_io_mq, lba->type);
     }
 
 RETRY:
-    if ((rw_off[lba->type] == LBA_IO_PPA_SIZE) || !ret) {
+    if ((lio_st.rw_off[lba->type] == LBA_IO_PPA_SIZE) || !ret) {
         if (lba_io_rw (lba->type)) {
             usleep (LBA_IO_RETRY_DELAY);
             if (retry == LBA_IO_RETRY) {
@@ -565,8 +633,8 @@ RETRY:
     return;
 
 RESET_LINE:
-    rw_off[lba->type] = 0;
-    memset (rw_line[lba->type], 0x0, sizeof (struct lba_io_sec *)
+    lio_st.rw_off[lba->type] = 0;
+    memset (lio_st.rw_line[lba->type], 0x0, sizeof (struct lba_io_sec *)
                                                             * LBA_IO_PPA_SIZE);
 }
 
@@ -574,8 +642,10 @@ static void lba_io_upsert_map (struct nvm_io_cmd *cmd)
 {
     uint32_t sec;
     struct lba_io_sec_ent *ent;
-    uint64_t old_ppa;
+    struct nvm_ppa_addr new_ppa;
+    uint64_t old_ppa, ts;
 
+    ts = ox_lat_ts ();
     for (sec = 0; sec < cmd->n_sec; sec++) {
         ent = (struct lba_io_sec_ent *) cmd->mmgr_io[sec / 4].rsvd;
         ent = ent + (sec % 4);
@@ -584,13 +654,15 @@ static void lba_io_upsert_map (struct nvm_io_cmd *cmd)
         if (old_ppa == AND64)
             goto ROLLBACK;
 
-        pthread_mutex_lock (&gc_ns_mutex);
+        pthread_mutex_lock (&app_st.gc_ns_mutex);
         if (appnvm()->gl_map->upsert_fn (ent->lba, ent->ppa)) {
-            pthread_mutex_unlock (&gc_ns_mutex);
+            pthread_mutex_unlock (&app_st.gc_ns_mutex);
             goto ROLLBACK;
         }
-        pthread_mutex_unlock (&gc_ns_mutex);
+        pthread_mutex_unlock (&app_st.gc_ns_mutex);
 
+        new_ppa.ppa = ent->ppa;
+        ts = ox_lat_add (OX_LAT_MAP, OX_LAT_OP_WRITE, new_ppa.g.ch, ts);
         ent->ppa = old_ppa;
     }
 
@@ -666,13 +738,13 @@ ERR_TIMEOUT:
     lba->prov = NULL;
     lba->lba = lba->ppa.ppa = lba->prp = 0x0;
 
-    pthread_spin_lock (&sec_spin);
-    TAILQ_REMOVE(&ulbahead, lba, uentry);
-    STAILQ_INSERT_TAIL(&flbahead, lba, fentry);
-    pthread_spin_unlock (&sec_spin);
+    pthread_spin_lock (&lio_st.sec_spin);
+    TAILQ_REMOVE(&lio_st.ulbahead, lba, uentry);
+    STAILQ_INSERT_TAIL(&lio_st.flbahead, lba, fentry);
+    pthread_spin_unlock (&lio_st.sec_spin);
 }
 
-struct ox_mq_config lba_io_mq_config = {
+static const struct ox_mq_config lba_io_mq_config = {
     /* Queue 0: write, queue 1: read */
     .name       = "LBA_IO",
     .n_queues   = 2,
@@ -689,15 +761,15 @@ static void lba_io_free_cmd (void)
     struct lba_io_cmd *cmd;
     struct lba_io_sec *sec;
 
-    while (!STAILQ_EMPTY(&fcmdhead)) {
-        cmd = STAILQ_FIRST(&fcmdhead);
-        STAILQ_REMOVE_HEAD (&fcmdhead, fentry);
+    while (!STAILQ_EMPTY(&lio_st.fcmdhead)) {
+        cmd = STAILQ_FIRST(&lio_st.fcmdhead);
+        STAILQ_REMOVE_HEAD (&lio_st.fcmdhead, fentry);
         pthread_mutex_destroy (&cmd->mutex);
         free (cmd);
     }
-    while (!STAILQ_EMPTY(&flbahead)) {
-        sec = STAILQ_FIRST(&flbahead);
-        STAILQ_REMOVE_HEAD (&flbahead, fentry);
+    while (!STAILQ_EMPTY(&lio_st.flbahead)) {
+        sec = STAILQ_FIRST(&lio_st.flbahead);
+        STAILQ_REMOVE_HEAD (&lio_st.flbahead, fentry);
         free (sec);
     }
 }
@@ -707,31 +779,33 @@ static int lba_io_init (void)
     uint32_t cmd_i, lba_i, ch_i, ret;
     struct lba_io_cmd *cmd;
     struct lba_io_sec *sec;
+    struct ox_mq_config mq_config;
 
-    ch = malloc (sizeof(struct app_channel *) * app_nch);
-    if (!ch)
+    lio_st.ch = malloc (sizeof(struct app_channel *) * app_st.app_nch);
+    if (!lio_st.ch)
         return -1;
 
-    ret = appnvm()->channels.get_list_fn (ch, app_nch);
-    if (ret != app_nch)
+    ret = appnvm()->channels.get_list_fn (lio_st.ch, app_st.app_nch);
+    if (ret != app_st.app_nch)
         goto FREE_CH;
 
-    sec_pl_pg = ch[0]->ch->geometry->sec_per_pl_pg;
-    for (ch_i = 0; ch_i < app_nch; ch_i++)
-        sec_pl_pg = MIN(ch[ch_i]->ch->geometry->sec_per_pl_pg, sec_pl_pg);
+    lio_st.sec_pl_pg = lio_st.ch[0]->ch->geometry->sec_per_pl_pg;
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++)
+        lio_st.sec_pl_pg = MIN(lio_st.ch[ch_i]->ch->geometry->sec_per_pl_pg,
+                                                            lio_st.sec_pl_pg);
 
-    STAILQ_INIT(&fcmdhead);
-    TAILQ_INIT(&ucmdhead);
-    STAILQ_INIT(&flbahead);
-    TAILQ_INIT(&ulbahead);
+    STAILQ_INIT(&lio_st.fcmdhead);
+    TAILQ_INIT(&lio_st.ucmdhead);
+    STAILQ_INIT(&lio_st.flbahead);
+    TAILQ_INIT(&lio_st.ulbahead);
 
-    rw_off[0] = 0;
-    rw_off[1] = 0;
+    lio_st.rw_off[0] = 0;
+    lio_st.rw_off[1] = 0;
 
-    if (pthread_spin_init(&cmd_spin, 0))
+    if (pthread_spin_init(&lio_st.cmd_spin, 0))
         goto FREE_CH;
 
-    if (pthread_spin_init(&sec_spin, 0))
+    if (pthread_spin_init(&lio_st.sec_spin, 0))
         goto CMD_SPIN;
 
     for (cmd_i = 0; cmd_i < LBA_IO_PPA_ENTRIES; cmd_i++) {
@@ -744,19 +818,20 @@ static int lba_io_init (void)
             goto FREE_CMD;
         }
 
-        STAILQ_INSERT_TAIL(&fcmdhead, cmd, fentry);
+        STAILQ_INSERT_TAIL(&lio_st.fcmdhead, cmd, fentry);
 
         for (lba_i = 0; lba_i < 64; lba_i++) {
             sec = calloc (sizeof (struct lba_io_sec), 1);
             if (!sec)
                 goto FREE_CMD;
 
-            STAILQ_INSERT_TAIL(&flbahead, sec, fentry);
+            STAILQ_INSERT_TAIL(&lio_st.flbahead, sec, fentry);
         }
     }
 
-    lba_io_mq = ox_mq_init(&lba_io_mq_config);
-    if (!lba_io_mq)
+    memcpy (&mq_config, &lba_io_mq_config, sizeof (struct ox_mq_config));
+    lio_st.lba_io_mq = ox_mq_init(&mq_config);
+    if (!lio_st.lba_io_mq)
         goto FREE_CMD;
 
     log_info("    [appnvm: LBA I/O started.]\n");
@@ -765,11 +840,11 @@ static int lba_io_init (void)
 
 FREE_CMD:
     lba_io_free_cmd ();
-    pthread_spin_destroy (&sec_spin);
+    pthread_spin_destroy (&lio_st.sec_spin);
 CMD_SPIN:
-    pthread_spin_destroy (&cmd_spin);
+    pthread_spin_destroy (&lio_st.cmd_spin);
 FREE_CH:
-    free (ch);
+    free (lio_st.ch);
     return -1;
 }
 
@@ -778,28 +853,28 @@ static void lba_io_exit (void)
     struct lba_io_cmd *cmd;
     struct lba_io_sec *sec;
 
-    ox_mq_destroy(lba_io_mq);
+    ox_mq_destroy(lio_st.lba_io_mq);
 
-    while (!TAILQ_EMPTY(&ucmdhead)) {
-        cmd = TAILQ_FIRST(&ucmdhead);
-        TAILQ_REMOVE(&ucmdhead, cmd, uentry);
+    while (!TAILQ_EMPTY(&lio_st.ucmdhead)) {
+        cmd = TAILQ_FIRST(&lio_st.ucmdhead);
+        TAILQ_REMOVE(&lio_st.ucmdhead, cmd, uentry);
 
-        STAILQ_INSERT_TAIL(&fcmdhead, cmd, fentry);
+        STAILQ_INSERT_TAIL(&lio_st.fcmdhead, cmd, fentry);
     }
 
-    while (!TAILQ_EMPTY(&ulbahead)) {
-        sec = TAILQ_FIRST(&ulbahead);
-        TAILQ_REMOVE(&ulbahead, sec, uentry);
+    while (!TAILQ_EMPTY(&lio_st.ulbahead)) {
+        sec = TAILQ_FIRST(&lio_st.ulbahead);
+        TAILQ_REMOVE(&lio_st.ulbahead, sec, uentry);
 
-        ox_mq_complete_req(lba_io_mq, sec->mentry);
+        ox_mq_complete_req(lio_st.lba_io_mq, sec->mentry);
 
-        STAILQ_INSERT_TAIL(&flbahead, sec, fentry);
+        STAILQ_INSERT_TAIL(&lio_st.flbahead, sec, fentry);
     }
 
     lba_io_free_cmd ();
-    pthread_spin_destroy (&sec_spin);
-    pthread_spin_destroy (&cmd_spin);
-    free (ch);
+    pthread_spin_destroy (&lio_st.sec_spin);
+    pthread_spin_destroy (&lio_st.cmd_spin);
+    free (lio_st.ch);
 }
 
 static struct app_lba_io appftl_lba_io = {
@@ -0,0 +1,645 @@
+/* OX: Open-Channel NVM Express SSD Controller
+ *  - AppNVM Flash Translation Layer (Crash Recovery)
+ *
+ * Copyright 2018 IT University of Copenhagen.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Partially supported by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "../appnvm.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/time.h>
+#include "hw/block/ox-ctrl/include/ssd.h"
+
+#define REC_ENT_ALLOC   4096
+
+/**
+ * - Block metadata and mapping metadata are only persisted at clean
+ *    shutdown (checkpoint). Each checkpoint stores the current write sequence.
+ * - Every written page carries its LBA, type and write sequence in the OOB.
+ * - At startup, all channels are scanned in parallel (1 thread per channel).
+ *    Only pages written after the checkpoint are collected: pages beyond
+ *    the checkpoint current page of open blocks, and blocks that were
+ *    (re)opened after the checkpoint (first page sequence >= checkpoint).
+ *    Sequences are compared with app_seq_cmp, the counter might wrap.
+ * - Mapping pages are replayed first (newest per index), then namespace
+ *    sectors newer than their mapping page are replayed in sequence order.
+ * - Mapping pages evicted from the cache during the replay are written back
+ *    by the global mapping. The replayed pages they supersede are tracked and
+ *    invalidated after the replay.
+ * - Invalid sectors of scanned pages are rebuilt after the replay.
+ */
+
+struct rec_entry {
+    uint64_t lba;
+    uint64_t ppa;
+    uint32_t seq;
+    uint8_t  pg_type;
+    uint8_t  applied; /* Mapping page set in the mapping metadata */
+    uint8_t  evicted; /* Mapping page superseded by a cache write-back */
+};
+
+struct rec_ch {
+    struct app_channel  *lch;
+    struct rec_entry    *ent;
+    uint32_t             nent;
+    uint32_t             ent_sz;
+    uint16_t            *pg_from; /* First page written after checkpoint */
+    uint32_t             ckpt_seq;
+    uint32_t             max_seq;
+    uint32_t             nblks;
+    uint32_t             npgs;
+    uint8_t              scan;
+    int                  ret;
+    pthread_t            tid;
+};
+
+struct app_recovery_state {
+    struct app_channel **ch;
+    struct rec_ch       *rec_ch;
+
+    /* The block metadata module is replaced by a copy of it during the
+     * replay, the registered module is shared by all instances */
+    struct app_global_md *rec_md_orig;
+    struct app_global_md  rec_md;
+
+    /* All scanned mapping pages sorted by PPA, used to track cache
+     * evictions */
+    struct rec_entry   **rec_map_ppa;
+    uint32_t             rec_nmap_ppa;
+    uint8_t              rec_track_evict;
+};
+
+#define rec_st (*(struct app_recovery_state *) ox_state (OX_ST_APP_RECOVERY, \
+                                          sizeof (struct app_recovery_state)))
+
+static int rec_add_entry (struct rec_ch *rch, uint64_t lba, uint64_t ppa,
+                                                uint32_t seq, uint8_t pg_type)
+{
+    struct rec_entry *ent;
+
+    if (rch->nent == rch->ent_sz) {
+        ent = realloc (rch->ent, sizeof (struct rec_entry) *
+                                                (rch->ent_sz + REC_ENT_ALLOC));
+        if (!ent)
+            return -1;
+        rch->ent = ent;
+        rch->ent_sz += REC_ENT_ALLOC;
+    }
+
+    ent = &rch->ent[rch->nent];
+    ent->lba = lba;
+    ent->ppa = ppa;
+    ent->seq = seq;
+    ent->pg_type = pg_type;
+    ent->applied = 0;
+    ent->evicted = 0;
+    rch->nent++;
+
+    return 0;
+}
+
+static int rec_pg_written (struct app_pg_oob *oob, uint32_t ckpt_seq)
+{
+    switch (oob->pg_type) {
+        case APP_PG_NAMESPACE:
+        case APP_PG_MAP:
+        case APP_PG_PADDING:
+            return app_seq_cmp (oob->seq, ckpt_seq) >= 0;
+        default:
+            return 0;
+    }
+}
+
+static int rec_scan_blk (struct rec_ch *rch, struct app_io_data *io,
+                                  struct app_blk_md_entry *md, uint32_t blk_off)
+{
+    uint32_t pg, sec_i, reopen = 0;
+    struct app_pg_oob *oob;
+    struct nvm_ppa_addr ppa;
+    struct nvm_mmgr_geometry *g = rch->lch->ch->geometry;
+
+    ppa.ppa = md->ppa.ppa;
+    ppa.g.pg = 0;
+
+    if (app_pg_io (rch->lch, MMGR_READ_PG, (void **) io->pl_vec, &ppa))
+        return -1;
+
+    /* Block erased and written after the checkpoint */
+    if (rec_pg_written ((struct app_pg_oob *) io->oob_vec[0], rch->ckpt_seq))
+        reopen = 1;
+    else if ((md->flags & APP_BLK_MD_USED) && (md->flags & APP_BLK_MD_OPEN))
+        pg = md->current_pg;
+    else
+        return 0;
+
+    if (reopen)
+        pg = 0;
+
+    if (pg >= g->pg_per_blk)
+        return 0;
+
+    rch->pg_from[blk_off] = pg;
+
+    for (; pg < g->pg_per_blk; pg++) {
+        ppa.g.pg = pg;
+
+        /* First page is already in the buffer */
+        if (pg || !reopen)
+            if (app_pg_io (rch->lch, MMGR_READ_PG, (void **) io->pl_vec, &ppa))
+                return -1;
+
+        oob = (struct app_pg_oob *) io->oob_vec[0];
+        if (!rec_pg_written (oob, rch->ckpt_seq))
+            break;
+
+        rch->npgs++;
+
+        /* Mapping pages are tracked as a whole page */
+        if (oob->pg_type == APP_PG_MAP) {
+            ppa.g.pl = 0;
+            ppa.g.sec = 0;
+            if (rec_add_entry (rch, oob->lba, ppa.ppa, oob->seq, APP_PG_MAP))
+                return -1;
+            if (app_seq_cmp (oob->seq, rch->max_seq) > 0)
+                rch->max_seq = oob->seq;
+            continue;
+        }
+
+        for (sec_i = 0; sec_i < g->sec_per_pl_pg; sec_i++) {
+            oob = (struct app_pg_oob *) io->oob_vec[sec_i];
+            ppa.g.pl  = sec_i / g->sec_per_pg;
+            ppa.g.sec = sec_i % g->sec_per_pg;
+
+            if (rec_add_entry (rch, oob->lba, ppa.ppa, oob->seq,
+                                 (oob->pg_type == APP_PG_NAMESPACE) ?
+                                 APP_PG_NAMESPACE : APP_PG_PADDING))
+                return -1;
+
+            if (app_seq_cmp (oob->seq, rch->max_seq) > 0)
+                rch->max_seq = oob->seq;
+        }
+    }
+
+    /* Rebuild the block metadata, invalid sectors are set after the replay */
+    if (reopen) {
+        md->erase_count++;
+        md->invalid_sec = 0;
+        memset (md->pg_state, 0x0, APP_PG_STATE_SZ);
+        md->flags |= (APP_BLK_MD_USED | APP_BLK_MD_OPEN);
+        if (md->flags & APP_BLK_MD_LINE)
+            md->flags ^= APP_BLK_MD_LINE;
+    }
+
+    md->current_pg = pg;
+
+    if (md->current_pg == g->pg_per_blk) {
+        if (md->flags & APP_BLK_MD_OPEN)
+            md->flags ^= APP_BLK_MD_OPEN;
+        if (md->flags & APP_BLK_MD_LINE)
+            md->flags ^= APP_BLK_MD_LINE;
+    }
+
+    rch->nblks++;
+
+    return 0;
+}
+
+static void *rec_scan_ch (void *arg)
+{
+    uint32_t lun, blk, pl, bad;
+    uint8_t *bbt;
+    struct app_blk_md_entry *lun_md;
+    struct rec_ch *rch = (struct rec_ch *) arg;
+    struct nvm_mmgr_geometry *g = rch->lch->ch->geometry;
+    struct app_io_data *io;
+
+    rch->ret = -1;
+
+    io = app_alloc_pg_io (rch->lch);
+    if (!io)
+        return NULL;
+
+    for (lun = 0; lun < g->lun_per_ch; lun++) {
+        bbt = appnvm()->bbt->get_fn (rch->lch, lun);
+        lun_md = appnvm()->md->get_fn (rch->lch, lun);
+        if (!bbt || !lun_md)
+            goto FREE;
+
+        for (blk = 0; blk < g->blk_per_lun; blk++) {
+
+            /* Skip bad and reserved blocks */
+            bad = 0;
+            for (pl = 0; pl < g->n_of_planes; pl++)
+                bad += bbt[g->n_of_planes * blk + pl];
+            if (bad)
+                continue;
+
+            if (rec_scan_blk (rch, io, &lun_md[blk], lun * g->blk_per_lun +
+                                                                         blk)) {
+                log_err ("[appnvm (recovery): Scan failed. Ch %d, blk "
+                                  "(%d/%d)]\n", rch->lch->ch->ch_id, lun, blk);
+                goto FREE;
+            }
+        }
+    }
+
+    rch->ret = 0;
+
+FREE:
+    app_free_pg_io (io);
+    return NULL;
+}
+
+static int rec_cmp_seq (const void *a, const void *b)
+{
+    const struct rec_entry *ea = *(const struct rec_entry **) a;
+    const struct rec_entry *eb = *(const struct rec_entry **) b;
+    int32_t diff = app_seq_cmp (ea->seq, eb->seq);
+
+    return (diff > 0) - (diff < 0);
+}
+
+static int rec_cmp_map (const void *a, const void *b)
+{
+    const struct rec_entry *ea = *(const struct rec_entry **) a;
+    const struct rec_entry *eb = *(const struct rec_entry **) b;
+
+    if (ea->lba != eb->lba)
+        return (ea->lba > eb->lba) - (ea->lba < eb->lba);
+
+    return rec_cmp_seq (a, b);
+}
+
+static int rec_cmp_ppa (const void *a, const void *b)
+{
+    const struct rec_entry *ea = *(const struct rec_entry **) a;
+    const struct rec_entry *eb = *(const struct rec_entry **) b;
+
+    return (ea->ppa > eb->ppa) - (ea->ppa < eb->ppa);
+}
+
+static struct rec_entry *rec_find_ppa (uint64_t ppa)
+{
+    uint32_t lo = 0, hi = rec_st.rec_nmap_ppa, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (rec_st.rec_map_ppa[mid]->ppa < ppa)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (lo < rec_st.rec_nmap_ppa && rec_st.rec_map_ppa[lo]->ppa == ppa) ?
+                                               rec_st.rec_map_ppa[lo] : NULL;
+}
+
+/* Invalidations of scanned pages are discarded during the replay, the old
+ * PPA might point to a block that has been erased after the checkpoint.
+ * While namespace sectors are replayed, a page invalidation comes from a
+ * mapping cache eviction. If the evicted page is a scanned mapping page it
+ * is invalidated after the replay, otherwise it has been written during the
+ * replay or before the checkpoint and is invalidated now. */
+static void rec_invalidate (struct app_channel *lch, struct nvm_ppa_addr *ppa,
+                                                                  uint8_t full)
+{
+    struct rec_ch *rch = &rec_st.rec_ch[ppa->g.ch];
+    struct rec_entry *ent;
+    uint32_t blk_off = ppa->g.lun * lch->ch->geometry->blk_per_lun +
+                                                                   ppa->g.blk;
+
+    if (ppa->g.pg >= rch->pg_from[blk_off]) {
+        if (!rec_st.rec_track_evict || full != APP_INVALID_PAGE)
+            return;
+
+        ent = rec_find_ppa (ppa->ppa);
+        if (ent) {
+            ent->evicted = 1;
+            return;
+        }
+    }
+
+    rec_st.rec_md_orig->invalidate_fn (lch, ppa, full);
+}
+
+static struct rec_entry *rec_find_map (struct rec_entry **map, uint32_t nmap,
+                                                                uint64_t index)
+{
+    uint32_t lo = 0, hi = nmap, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (map[mid]->lba < index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (lo < nmap && map[lo]->lba == index) ? map[lo] : NULL;
+}
+
+static void rec_exit (void)
+{
+    uint32_t ch_i;
+
+    if (!rec_st.rec_ch)
+        return;
+
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        free (rec_st.rec_ch[ch_i].ent);
+        free (rec_st.rec_ch[ch_i].pg_from);
+    }
+
+    free (rec_st.rec_ch);
+    free (rec_st.ch);
+    rec_st.rec_ch = NULL;
+    rec_st.ch = NULL;
+}
+
+static int rec_init (void)
+{
+    uint32_t ch_i, blk_i, nblks, tent = 0, tblks = 0, tpgs = 0, found = 0;
+    struct nvm_mmgr_geometry *g;
+    struct timeval start, end;
+    uint64_t usec;
+
+    rec_st.rec_ch = NULL;
+
+    rec_st.ch = malloc (sizeof (struct app_channel *) * app_st.app_nch);
+    if (!rec_st.ch)
+        return -1;
+
+    if (appnvm()->channels.get_list_fn (rec_st.ch, app_st.app_nch) !=
+                                                               app_st.app_nch)
+        goto FREE_CH;
+
+    rec_st.rec_ch = calloc (app_st.app_nch, sizeof (struct rec_ch));
+    if (!rec_st.rec_ch)
+        goto FREE_CH;
+
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        g = rec_st.ch[ch_i]->ch->geometry;
+        nblks = g->lun_per_ch * g->blk_per_lun;
+
+        rec_st.rec_ch[ch_i].lch = rec_st.ch[ch_i];
+        rec_st.rec_ch[ch_i].ckpt_seq = rec_st.ch[ch_i]->blk_md->ckpt_seq;
+        rec_st.rec_ch[ch_i].max_seq = rec_st.rec_ch[ch_i].ckpt_seq;
+        rec_st.rec_ch[ch_i].pg_from = malloc (sizeof (uint16_t) * nblks);
+        if (!rec_st.rec_ch[ch_i].pg_from)
+            goto FREE_REC;
+
+        for (blk_i = 0; blk_i < nblks; blk_i++)
+            rec_st.rec_ch[ch_i].pg_from[blk_i] = g->pg_per_blk;
+    }
+
+    gettimeofday (&start, NULL);
+
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+
+        /* Magic is only set if the table has been created in this boot */
+        if (rec_st.ch[ch_i]->blk_md->magic == APP_MAGIC) {
+            rec_st.rec_ch[ch_i].ret = 0;
+            continue;
+        }
+
+        if (ox_thread_create (&rec_st.rec_ch[ch_i].tid, rec_scan_ch,
+                                                      &rec_st.rec_ch[ch_i])) {
+            rec_st.rec_ch[ch_i].ret = -1;
+            continue;
+        }
+        rec_st.rec_ch[ch_i].scan = 1;
+        found++;
+    }
+
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        if (rec_st.rec_ch[ch_i].scan)
+            pthread_join (rec_st.rec_ch[ch_i].tid, NULL);
+    }
+
+    gettimeofday (&end, NULL);
+    usec = (end.tv_sec * (uint64_t) 1000000 + end.tv_usec) -
+                               (start.tv_sec * (uint64_t) 1000000 + start.tv_usec);
+
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        if (rec_st.rec_ch[ch_i].ret) {
+            log_err ("[appnvm (recovery): Channel %d NOT scanned.]\n",
+                                                  rec_st.ch[ch_i]->ch->ch_id);
+            goto FREE_REC;
+        }
+        tent += rec_st.rec_ch[ch_i].nent;
+        tblks += rec_st.rec_ch[ch_i].nblks;
+        tpgs += rec_st.rec_ch[ch_i].npgs;
+
+        /* New writes must be newer than any recovered page */
+        if (rec_st.rec_ch[ch_i].nent)
+            app_seq_raise (rec_st.rec_ch[ch_i].max_seq + 1);
+    }
+
+    log_info ("    [appnvm: Recovery scan: %d channels, %d blocks, %d pages, "
+                  "%d sectors in %" PRIu64 " us]\n", found, tblks, tpgs, tent,
+                  usec);
+
+    return 0;
+
+FREE_REC:
+    rec_exit ();
+    return -1;
+FREE_CH:
+    free (rec_st.ch);
+    rec_st.ch = NULL;
+    return -1;
+}
+
+static int rec_replay (void)
+{
+    uint32_t ch_i, ent_i, nmap = 0, nns = 0, map_i, upd = 0, inv = 0, err = 0;
+    uint64_t map_ent_per_pg, pg_sz;
+    struct rec_entry **map, **ns, *ent, *map_ent;
+    struct app_map_entry *md_ent;
+    struct nvm_ppa_addr ppa;
+    struct timeval start, end;
+    uint64_t usec;
+
+    if (!rec_st.rec_ch)
+        return -1;
+
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        for (ent_i = 0; ent_i < rec_st.rec_ch[ch_i].nent; ent_i++) {
+            if (rec_st.rec_ch[ch_i].ent[ent_i].pg_type == APP_PG_MAP)
+                nmap++;
+            else if (rec_st.rec_ch[ch_i].ent[ent_i].pg_type == APP_PG_NAMESPACE)
+                nns++;
+        }
+    }
+
+    if (!nmap && !nns)
+        return 0;
+
+    gettimeofday (&start, NULL);
+
+    map = malloc (sizeof (struct rec_entry *) * (nmap + 1));
+    if (!map)
+        return -1;
+
+    ns = malloc (sizeof (struct rec_entry *) * (nns + 1));
+    if (!ns)
+        goto FREE_MAP;
+
+    rec_st.rec_map_ppa = malloc (sizeof (struct rec_entry *) * (nmap + 1));
+    if (!rec_st.rec_map_ppa)
+        goto FREE_NS;
+
+    nmap = nns = rec_st.rec_nmap_ppa = 0;
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        for (ent_i = 0; ent_i < rec_st.rec_ch[ch_i].nent; ent_i++) {
+            ent = &rec_st.rec_ch[ch_i].ent[ent_i];
+            if (ent->pg_type == APP_PG_MAP) {
+                map[nmap++] = ent;
+                rec_st.rec_map_ppa[rec_st.rec_nmap_ppa++] = ent;
+            } else if (ent->pg_type == APP_PG_NAMESPACE)
+                ns[nns++] = ent;
+        }
+    }
+
+    /* Keep only the newest mapping page per index */
+    qsort (map, nmap, sizeof (struct rec_entry *), rec_cmp_map);
+    for (ent_i = 0, map_i = 0; ent_i < nmap; ent_i++) {
+        if (ent_i + 1 < nmap && map[ent_i + 1]->lba == map[ent_i]->lba)
+            continue;
+        map[map_i++] = map[ent_i];
+    }
+    nmap = map_i;
+
+    qsort (rec_st.rec_map_ppa, rec_st.rec_nmap_ppa, sizeof (struct rec_entry *),
+                                                                  rec_cmp_ppa);
+
+    qsort (ns, nns, sizeof (struct rec_entry *), rec_cmp_seq);
+
+    /* Must match the global mapping entries per page */
+    pg_sz = rec_st.ch[0]->ch->geometry->pl_pg_size;
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++)
+        pg_sz = MIN(rec_st.ch[ch_i]->ch->geometry->pl_pg_size, pg_sz);
+    map_ent_per_pg = pg_sz / app_map_ent_sz ();
+
+    rec_st.rec_md_orig = appnvm()->md;
+    memcpy (&rec_st.rec_md, appnvm()->md, sizeof (struct app_global_md));
+    rec_st.rec_md.invalidate_fn = rec_invalidate;
+    appnvm()->md = &rec_st.rec_md;
+
+    /* Nothing is cached yet, metadata entries point to the checkpoint pages */
+    for (map_i = 0; map_i < nmap; map_i++) {
+        md_ent = appnvm()->ch_map->get_fn
+                            (rec_st.ch[map[map_i]->lba % app_st.app_nch],
+                                            map[map_i]->lba / app_st.app_nch);
+        if (!md_ent || appnvm()->gl_map->upsert_md_fn (map[map_i]->lba,
+                                               map[map_i]->ppa, md_ent->ppa)) {
+            err++;
+            continue;
+        }
+        map[map_i]->applied = 1;
+    }
+
+    /* Dirty mapping pages evicted from here on are written back to NVM */
+    rec_st.rec_track_evict = 1;
+    for (ent_i = 0; ent_i < nns; ent_i++) {
+        map_ent = rec_find_map (map, nmap, ns[ent_i]->lba / map_ent_per_pg);
+
+        /* Sector is already present in a newer mapping page */
+        if (map_ent && map_ent->applied &&
+                                app_seq_cmp (map_ent->seq, ns[ent_i]->seq) > 0)
+            continue;
+
+        if (appnvm()->gl_map->upsert_fn (ns[ent_i]->lba, ns[ent_i]->ppa))
+            err++;
+        else
+            upd++;
+    }
+
+    rec_st.rec_track_evict = 0;
+    appnvm()->md = rec_st.rec_md_orig;
+
+    /* Rebuild invalid sectors of scanned pages */
+    for (ch_i = 0; ch_i < app_st.app_nch; ch_i++) {
+        for (ent_i = 0; ent_i < rec_st.rec_ch[ch_i].nent; ent_i++) {
+            ent = &rec_st.rec_ch[ch_i].ent[ent_i];
+            ppa.ppa = ent->ppa;
+
+            switch (ent->pg_type) {
+                case APP_PG_NAMESPACE:
+                    if (appnvm()->gl_map->read_fn (ent->lba) == ent->ppa)
+                        continue;
+                    break;
+                case APP_PG_MAP:
+                    if (ent->applied && !ent->evicted)
+                        continue;
+                    appnvm()->md->invalidate_fn (rec_st.rec_ch[ch_i].lch, &ppa,
+                                                             APP_INVALID_PAGE);
+                    inv++;
+                    continue;
+                case APP_PG_PADDING:
+                default:
+                    break;
+            }
+
+            appnvm()->md->invalidate_fn (rec_st.rec_ch[ch_i].lch, &ppa,
+                                                           APP_INVALID_SECTOR);
+            inv++;
+        }
+    }
+
+    gettimeofday (&end, NULL);
+    usec = (end.tv_sec * (uint64_t) 1000000 + end.tv_usec) -
+                               (start.tv_sec * (uint64_t) 1000000 + start.tv_usec);
+
+    log_info ("    [appnvm: Recovery replay: %d map pages, %d sectors, "
+          "%d invalid, %d errors in %" PRIu64 " us]\n", nmap, upd, inv, err,
+          usec);
+    if (err)
+        log_err ("[appnvm (recovery): %d mapping updates NOT replayed.]\n",
+                                                                         err);
+
+    free (rec_st.rec_map_ppa);
+    rec_st.rec_map_ppa = NULL;
+    rec_st.rec_nmap_ppa = 0;
+    free (ns);
+    free (map);
+    return 0;
+
+FREE_NS:
+    free (ns);
+FREE_MAP:
+    free (map);
+    return -1;
+}
+
+static struct app_recovery appftl_recovery = {
+    .mod_id     = APPFTL_RECOVERY,
+    .init_fn    = rec_init,
+    .exit_fn    = rec_exit,
+    .replay_fn  = rec_replay
+};
+
+void recovery_register (void) {
+    appnvm_mod_register (APPMOD_RECOVERY, APPFTL_RECOVERY, &appftl_recovery);
+}
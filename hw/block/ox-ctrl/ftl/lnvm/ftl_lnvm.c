@@ -19,15 +19,21 @@
 #include <sys/queue.h>
 #include "ftl_lnvm.h"
 
-LIST_HEAD(lnvm_ch, lnvm_channel) ch_head = LIST_HEAD_INITIALIZER(ch_head);
+struct lnvm_state {
+    LIST_HEAD(lnvm_ch, lnvm_channel)    ch_head;
+    pthread_mutex_t                     endio_mutex;
+    struct nvm_ftl                      lnvm;
+};
+
+#define lnvm_st (*(struct lnvm_state *) ox_state (OX_ST_LNVM, \
+                                                sizeof (struct lnvm_state)))
 
-static pthread_mutex_t endio_mutex;
 static int lnvm_submit_io (struct nvm_io_cmd *);
 
 static struct lnvm_channel *lnvm_get_ch_instance(uint16_t ch_id)
 {
     struct lnvm_channel *lch;
-    LIST_FOREACH(lch, &ch_head, entry){
+    LIST_FOREACH(lch, &lnvm_st.ch_head, entry){
         if(lch->ch->ch_mmgr_id == ch_id)
             return lch;
     }
@@ -37,11 +43,11 @@ static struct lnvm_channel *lnvm_get_ch_instance(uint16_t ch_id)
 
 static void lnvm_set_pgmap(uint8_t *pgmap, uint8_t index, uint8_t flag)
 {
-    pthread_mutex_lock(&endio_mutex);
+    pthread_mutex_lock(&lnvm_st.endio_mutex);
     pgmap[index / 8] = (flag)
             ? pgmap[index / 8] | (1 << (index % 8))
             : pgmap[index / 8] ^ (1 << (index % 8));
-    pthread_mutex_unlock(&endio_mutex);
+    pthread_mutex_unlock(&lnvm_st.endio_mutex);
 }
 
 static int lnvm_check_pgmap_complete (uint8_t *pgmap, uint8_t ni) {
@@ -75,7 +81,7 @@ static int lnvm_check_end_io (struct nvm_io_cmd *cmd)
 {
     if (cmd->status.pgs_p == cmd->status.total_pgs) {
 
-        pthread_mutex_lock(&endio_mutex);
+        pthread_mutex_lock(&lnvm_st.endio_mutex);
         /* if true, some pages failed */
         if ( lnvm_check_pgmap_complete(cmd->status.pg_map,
                                       ((cmd->status.total_pgs - 1) / 8) + 1)) {
@@ -100,31 +106,75 @@ static int lnvm_check_end_io (struct nvm_io_cmd *cmd)
     goto RETURN;
 
 SUBMIT:
-    pthread_mutex_unlock(&endio_mutex);
+    pthread_mutex_unlock(&lnvm_st.endio_mutex);
     lnvm_submit_io(cmd);
     goto RETURN;
 
 COMPLETE:
-    pthread_mutex_unlock(&endio_mutex);
+    pthread_mutex_unlock(&lnvm_st.endio_mutex);
     nvm_complete_ftl(cmd);
 
 RETURN:
     return 0;
 }
 
+/* Updates the chunk state after a successful write or erase. The write
+ * pointer is the highest sector written, writes are not enforced to be
+ * sequential because the host may pipeline them. */
+static void lnvm_chunk_update (struct nvm_mmgr_io_cmd *cmd)
+{
+    struct lnvm_channel *lch = lnvm_get_ch_instance(cmd->ppa.g.ch);
+    struct nvm_mmgr_geometry *g;
+    struct nvm_ftl_chunk *chk;
+    uint32_t wp, clba;
+
+    if (!lch || !lch->chktbl)
+        return;
+
+    g = lch->ch->geometry;
+    if (cmd->ppa.g.lun >= g->lun_per_ch || cmd->ppa.g.blk >= g->blk_per_lun)
+        return;
+
+    chk = &lch->chktbl->tbl[cmd->ppa.g.lun * g->blk_per_lun + cmd->ppa.g.blk];
+    clba = g->pg_per_blk * g->n_of_planes * g->sec_per_pg;
+
+    pthread_mutex_lock(&lch->chktbl->mutex);
+    switch (cmd->cmdtype) {
+        case MMGR_WRITE_PG:
+            wp = (cmd->ppa.g.pg * g->n_of_planes + cmd->ppa.g.pl + 1) *
+                                                                g->sec_per_pg;
+            if (wp > chk->wp)
+                chk->wp = wp;
+            chk->state = (chk->wp >= clba) ? FTL_CHUNK_CLOSED : FTL_CHUNK_OPEN;
+            break;
+        case MMGR_ERASE_BLK:
+            if (cmd->ppa.g.pl == 0)
+                chk->erase_count++;
+            chk->state = FTL_CHUNK_FREE;
+            chk->wp = 0;
+            break;
+        default:
+            pthread_mutex_unlock(&lch->chktbl->mutex);
+            return;
+    }
+    lch->chktbl->dirty = 1;
+    pthread_mutex_unlock(&lch->chktbl->mutex);
+}
+
 static void lnvm_callback_io (struct nvm_mmgr_io_cmd *cmd)
 {
     if (cmd->status == NVM_IO_SUCCESS) {
+        lnvm_chunk_update(cmd);
         lnvm_set_pgmap(cmd->nvm_io->status.pg_map, cmd->pg_index,FTL_PGMAP_OFF);
-        pthread_mutex_lock(&endio_mutex);
+        pthread_mutex_lock(&lnvm_st.endio_mutex);
         cmd->nvm_io->status.pgs_s++;
     } else {
-        pthread_mutex_lock(&endio_mutex);
+        pthread_mutex_lock(&lnvm_st.endio_mutex);
         cmd->nvm_io->status.pg_errors++;
     }
 
     cmd->nvm_io->status.pgs_p++;
-    pthread_mutex_unlock(&endio_mutex);
+    pthread_mutex_unlock(&lnvm_st.endio_mutex);
 
     lnvm_check_end_io(cmd->nvm_io);
 }
@@ -248,10 +298,10 @@ static int lnvm_submit_io (struct nvm_io_cmd *cmd)
                     ret = -1;
             }
             if (ret) {
-                pthread_mutex_lock(&endio_mutex);
+                pthread_mutex_lock(&lnvm_st.endio_mutex);
                 cmd->status.pg_errors++;
                 cmd->status.pgs_p++;
-                pthread_mutex_unlock(&endio_mutex);
+                pthread_mutex_unlock(&lnvm_st.endio_mutex);
                 lnvm_check_end_io(cmd);
             }
         }
@@ -260,6 +310,45 @@ static int lnvm_submit_io (struct nvm_io_cmd *cmd)
     return 0;
 }
 
+static int lnvm_init_chktbl (struct lnvm_channel *lch)
+{
+    int i;
+    struct lnvm_chktbl *chk;
+    struct nvm_mmgr_geometry *g = lch->ch->geometry;
+
+    chk = malloc (sizeof(struct lnvm_chktbl));
+    if (!chk)
+        return EMEM;
+
+    chk->nchk = g->blk_per_lun * g->lun_per_ch;
+    chk->tbl = calloc (chk->nchk, sizeof(struct nvm_ftl_chunk));
+    if (!chk->tbl) {
+        free (chk);
+        return EMEM;
+    }
+
+    for (i = 0; i < chk->nchk; i++)
+        chk->tbl[i].state = FTL_CHUNK_FREE;
+
+    chk->magic = 0;
+    chk->dirty = 0;
+    pthread_mutex_init (&chk->mutex, NULL);
+    lch->chktbl = chk;
+
+    return 0;
+}
+
+static void lnvm_free_chktbl (struct lnvm_channel *lch)
+{
+    if (!lch->chktbl)
+        return;
+
+    pthread_mutex_destroy (&lch->chktbl->mutex);
+    free (lch->chktbl->tbl);
+    free (lch->chktbl);
+    lch->chktbl = NULL;
+}
+
 static int lnvm_init_channel (struct nvm_channel *ch)
 {
     uint32_t tblks;
@@ -311,25 +400,39 @@ static int lnvm_init_channel (struct nvm_channel *ch)
     bbt->magic = 0;
     bbt->bb_sz = tblks;
 
-    ret = lnvm_get_bbt_nvm(lch, bbt);
+    ret = lnvm_init_chktbl(lch);
     if (ret) goto ERR;
 
+    /* Only Open-Channel 2.0 reports chunk state, it must survive restarts */
+    if (core.ocssd2 && !lnvm_chktbl_fits(lch)) {
+        log_err("[lnvm ERR: Ch %d -> Chunk table (%u chunks) does not fit "
+                   "after the bad block table in a %u bytes page.]\n",
+                   ch->ch_id, lch->chktbl->nchk, ch->geometry->pg_size);
+        ret = -1;
+        goto ERR_CHK;
+    }
+
+    ret = lnvm_get_bbt_nvm(lch, bbt);
+    if (ret) goto ERR_CHK;
+
     /* create and flush bad block table if it does not exist */
     /* this procedure will erase the entire device (only in test mode) */
     if (bbt->magic == FTL_LNVM_MAGIC) {
         printf(" [lnvm: Channel %d. Creating bad block table...]", ch->ch_id);
         fflush(stdout);
         ret = lnvm_bbt_create (lch, bbt, LNVM_BBT_EMERGENCY);
-        if (ret) goto ERR;
+        if (ret) goto ERR_CHK;
         ret = lnvm_flush_bbt (lch, bbt);
-        if (ret) goto ERR;
+        if (ret) goto ERR_CHK;
     }
 
-    LIST_INSERT_HEAD(&ch_head, lch, entry);
+    LIST_INSERT_HEAD(&lnvm_st.ch_head, lch, entry);
     log_info("    [lnvm: channel %d started with %d bad blocks.]\n",ch->ch_id,
                                                                 bbt->bb_count);
     return 0;
 
+ERR_CHK:
+    lnvm_free_chktbl(lch);
 ERR:
     free(bbt->tbl);
 FREE_BBTBL:
@@ -386,20 +489,58 @@ static int lnvm_ftl_set_bbtbl (struct nvm_ppa_addr *ppa, uint8_t value)
     return 0;
 }
 
+/* Chunks with any plane marked in the bad block table are reported offline */
+static int lnvm_ftl_get_chunk (struct nvm_ppa_addr *ppa, uint32_t nchk,
+                                                     struct nvm_ftl_chunk *chk)
+{
+    int i, pl, n_pl, l_addr;
+    struct lnvm_channel *lch = lnvm_get_ch_instance(ppa->g.ch);
+    struct nvm_mmgr_geometry *g;
+
+    if (!lch || !lch->chktbl)
+        return -1;
+
+    g = lch->ch->geometry;
+    n_pl = g->n_of_planes;
+    if (ppa->g.lun >= g->lun_per_ch || nchk != g->blk_per_lun)
+        return -1;
+
+    pthread_mutex_lock(&lch->chktbl->mutex);
+    memcpy(chk, &lch->chktbl->tbl[ppa->g.lun * g->blk_per_lun],
+                                        nchk * sizeof(struct nvm_ftl_chunk));
+    pthread_mutex_unlock(&lch->chktbl->mutex);
+
+    l_addr = ppa->g.lun * g->blk_per_lun * n_pl;
+    for (i = 0; i < nchk; i++) {
+        for (pl = 0; pl < n_pl; pl++) {
+            if (lch->bbtbl->tbl[l_addr + i * n_pl + pl] != NVM_BBT_FREE) {
+                chk[i].state = FTL_CHUNK_OFFLINE;
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
 static void lnvm_exit (void)
 {
     struct lnvm_channel *lch;
 
-    LIST_FOREACH(lch, &ch_head, entry){
+    LIST_FOREACH(lch, &lnvm_st.ch_head, entry){
+        if (lch->chktbl->dirty && lnvm_flush_bbt (lch, lch->bbtbl))
+            log_err("[lnvm ERR: Ch %d -> Chunk table not flushed.]\n",
+                                                            lch->ch->ch_id);
+        lnvm_free_chktbl(lch);
         free(lch->bbtbl->tbl);
         free(lch->bbtbl);
     }
-    while (!LIST_EMPTY(&ch_head)) {
-        lch = LIST_FIRST(&ch_head);
+    while (!LIST_EMPTY(&lnvm_st.ch_head)) {
+        lch = LIST_FIRST(&lnvm_st.ch_head);
         LIST_REMOVE (lch, entry);
         free(lch);
     }
-    pthread_mutex_destroy (&endio_mutex);
+    pthread_mutex_destroy (&lnvm_st.endio_mutex);
 }
 
 struct nvm_ftl_ops lnvm_ops = {
@@ -409,9 +550,10 @@ struct nvm_ftl_ops lnvm_ops = {
     .exit        = lnvm_exit,
     .get_bbtbl   = lnvm_ftl_get_bbtbl,
     .set_bbtbl   = lnvm_ftl_set_bbtbl,
+    .get_chunk   = lnvm_ftl_get_chunk,
 };
 
-struct nvm_ftl lnvm = {
+static const struct nvm_ftl lnvm_default = {
     .ftl_id         = FTL_ID_LNVM,
     .name           = "FTL_LNVM",
     .nq             = 8,
@@ -421,10 +563,12 @@ struct nvm_ftl lnvm = {
 
 int ftl_lnvm_init (void)
 {
-    LIST_INIT(&ch_head);
-    pthread_mutex_init (&endio_mutex, NULL);
-    lnvm.cap |= 1 << FTL_CAP_GET_BBTBL;
-    lnvm.cap |= 1 << FTL_CAP_SET_BBTBL;
-    lnvm.bbtbl_format = FTL_BBTBL_BYTE;
-    return nvm_register_ftl(&lnvm);
+    memcpy (&lnvm_st.lnvm, &lnvm_default, sizeof (struct nvm_ftl));
+    LIST_INIT(&lnvm_st.ch_head);
+    pthread_mutex_init (&lnvm_st.endio_mutex, NULL);
+    lnvm_st.lnvm.cap |= 1 << FTL_CAP_GET_BBTBL;
+    lnvm_st.lnvm.cap |= 1 << FTL_CAP_SET_BBTBL;
+    lnvm_st.lnvm.cap |= 1 << FTL_CAP_GET_CHUNK;
+    lnvm_st.lnvm.bbtbl_format = FTL_BBTBL_BYTE;
+    return nvm_register_ftl(&lnvm_st.lnvm);
 }
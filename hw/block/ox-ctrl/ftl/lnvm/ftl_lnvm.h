@@ -13,12 +13,14 @@
 #define FTL_LNVM_H
 
 #include <sys/queue.h>
+#include <stddef.h>
 #include "hw/block/ox-ctrl/include/ssd.h"
 
 #define FTL_LNVM_IO_RETRY       0
 #define FTL_LNVM_RSV_BLK        1
 #define FTL_LNVM_RSV_BLK_COUNT  1
 #define FTL_LNVM_MAGIC          0x3c
+#define FTL_LNVM_CHK_MAGIC      0x3d
 
 enum {
     FTL_PGMAP_OFF   = 0,
@@ -51,14 +53,30 @@ struct lnvm_bbtbl {
     uint8_t  *tbl;
 };
 
+/* Chunk table, one entry per block (all planes), indexed by
+ * (lun * blk_per_lun + blk). It is stored after the bad block table, in the
+ * same page of the reserved block. */
+struct lnvm_chktbl {
+    uint8_t  magic;
+    uint32_t nchk;
+    /* This struct is stored on NVM up to this point, the fields below not */
+    uint8_t  dirty;
+    struct nvm_ftl_chunk *tbl;
+    pthread_mutex_t      mutex;
+};
+
+#define LNVM_CHKTBL_HDR_SZ  (offsetof(struct lnvm_chktbl, dirty))
+
 struct lnvm_channel {
     struct nvm_channel       *ch;
     struct lnvm_bbtbl        *bbtbl;
+    struct lnvm_chktbl       *chktbl;
     LIST_ENTRY(lnvm_channel) entry;
 };
 
 int lnvm_get_bbt_nvm (struct lnvm_channel *, struct lnvm_bbtbl *);
 int lnvm_bbt_create (struct lnvm_channel *, struct lnvm_bbtbl *, uint8_t);
 int lnvm_flush_bbt (struct lnvm_channel *, struct lnvm_bbtbl *);
+int lnvm_chktbl_fits (struct lnvm_channel *);
 
 #endif /* FTL_LNVM_H */
\ No newline at end of file
@@ -15,8 +15,6 @@
 #include <string.h>
 #include "ftl_lnvm.h"
 
-extern struct core_struct core;
-
 /* Erases the entire channel, failed erase marks the block as bad
  * bbt -> bad block table pointer to be filled up
  * bbt_sz -> pointer to integer, function will set it up
@@ -179,6 +177,64 @@ static uint16_t lnvm_count_bb (struct lnvm_channel *lch)
     return bb;
 }
 
+/* The chunk table is placed after the bad block table (8-byte aligned) in the
+ * data area of plane 0. Returns its offset, or 0 if it does not fit. Channel
+ * init refuses such geometries in Open-Channel 2.0 mode, the only user of the
+ * table. */
+static uint32_t lnvm_chktbl_off (struct lnvm_channel *lch, uint32_t pg_sz)
+{
+    uint32_t off = (lch->bbtbl->bb_sz + 7) & ~7;
+
+    if (!lch->chktbl || off + LNVM_CHKTBL_HDR_SZ + lch->chktbl->nchk *
+                                   sizeof(struct nvm_ftl_chunk) > pg_sz)
+        return 0;
+
+    return off;
+}
+
+int lnvm_chktbl_fits (struct lnvm_channel *lch)
+{
+    return lnvm_chktbl_off (lch, lch->ch->geometry->pg_size) != 0;
+}
+
+static void lnvm_set_chktbl (struct lnvm_channel *lch, uint8_t *buf,
+                                                                uint32_t pg_sz)
+{
+    struct lnvm_chktbl *chk = lch->chktbl;
+    uint32_t off = lnvm_chktbl_off (lch, pg_sz);
+
+    if (!off)
+        return;
+
+    pthread_mutex_lock (&chk->mutex);
+    chk->magic = FTL_LNVM_CHK_MAGIC;
+    memcpy (buf + off, chk, LNVM_CHKTBL_HDR_SZ);
+    memcpy (buf + off + LNVM_CHKTBL_HDR_SZ, chk->tbl,
+                                   chk->nchk * sizeof(struct nvm_ftl_chunk));
+    chk->dirty = 0;
+    pthread_mutex_unlock (&chk->mutex);
+}
+
+/* Tables flushed before the chunk table existed are ignored, all chunks are
+ * kept as free in this case */
+static void lnvm_get_chktbl (struct lnvm_channel *lch, uint8_t *buf,
+                                                                uint32_t pg_sz)
+{
+    struct lnvm_chktbl nvm_chk, *chk = lch->chktbl;
+    uint32_t off = lnvm_chktbl_off (lch, pg_sz);
+
+    if (!off)
+        return;
+
+    memcpy (&nvm_chk, buf + off, LNVM_CHKTBL_HDR_SZ);
+    if (nvm_chk.magic != FTL_LNVM_CHK_MAGIC || nvm_chk.nchk != chk->nchk)
+        return;
+
+    memcpy (chk->tbl, buf + off + LNVM_CHKTBL_HDR_SZ,
+                                   chk->nchk * sizeof(struct nvm_ftl_chunk));
+    chk->magic = FTL_LNVM_CHK_MAGIC;
+}
+
 int lnvm_flush_bbt (struct lnvm_channel *lch, struct lnvm_bbtbl *bbt)
 {
     int ret, pg, i;
@@ -237,6 +293,9 @@ int lnvm_flush_bbt (struct lnvm_channel *lch, struct lnvm_bbtbl *bbt)
     /* set bad block table */
     memcpy (buf, bbt->tbl, bbt->bb_sz);
 
+    /* set chunk table */
+    lnvm_set_chktbl (lch, buf, pg_sz);
+
     ret = lnvm_io_rsv_blk (ch, MMGR_WRITE_PG, buf_vec, pg);
 
 OUT:
@@ -339,6 +398,9 @@ int lnvm_get_bbt_nvm (struct lnvm_channel *lch, struct lnvm_bbtbl *bbt)
         /* copy bad block table to channel */
         memcpy(bbt->tbl, buf, bbt->bb_sz);
 
+        /* copy chunk table to channel */
+        lnvm_get_chktbl (lch, buf, pg_sz);
+
         pg++;
     } while (pg < ch->geometry->pg_per_blk);
 
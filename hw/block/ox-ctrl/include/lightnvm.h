@@ -4,30 +4,27 @@
 #include <stdint.h>
 #include <stdio.h>
 
+/* PPA field widths, limits for the media geometry (see ox-ctrl properties).
+ * Channels, LUNs, blocks, pages and planes are taken from the media manager,
+ * sectors per page are fixed. */
 #define LNVM_SEC_BITS       2
-#define LNVM_PG_BITS        6
-#define LNVM_PL_BITS        1
-#define LNVM_BLK_BITS       6
-#define LNVM_LUN_BITS       2
-#define LNVM_CH_BITS        3
-#define LNVM_RSV_BITS       44
+#define LNVM_PG_BITS        10
+#define LNVM_PL_BITS        2
+#define LNVM_BLK_BITS       12
+#define LNVM_LUN_BITS       4
+#define LNVM_CH_BITS        7
+#define LNVM_RSV_BITS       27
 
 #define LNVM_SECSZ          0x1000
 #define LNVM_SEC_OOBSZ      0x10
 #define LNVM_SEC_PG         (1 << LNVM_SEC_BITS)
-#define LNVM_PG_BLK         (1 << LNVM_PG_BITS)
-#define LNVM_CH             (1 << LNVM_CH_BITS)
-#define LNVM_LUN_CH         (1 << LNVM_LUN_BITS)
-#define LNVM_BLK_LUN        (1 << LNVM_BLK_BITS)
-#define LNVM_PLANES         (1 << LNVM_PL_BITS)
 #define LNVM_PG_SIZE        (LNVM_SECSZ * LNVM_SEC_PG)
-#define LNVM_PL_PG_SIZE     (LNVM_SECSZ * LNVM_SEC_PG * LNVM_PLANES)
-#define LNVM_SEC_PL_PG      (LNVM_SEC_PG * LNVM_PLANES)
 
 #define LNVM_MAX_SEC_RQ     64
 #define LNVM_MTYPE          0
 #define LNVM_FMTYPE         0
 #define LNVM_VER_ID         1
+#define LNVM_VER_ID_20      2
 #define LNVM_DOM            0x0
 #define LNVM_CAP            0x3
 #define LNVM_READ_L2P       0x1
@@ -43,25 +40,41 @@
 #define LNVM_TBET           2400
 #define LNVM_TBEM           2400
 
+/* Open-Channel 2.0 */
+#define LNVM_CHK_TP_W_SEQ   0x1  /* chunk type: sequential write required */
+#define LNVM_CHK_DESC_SZ    32
+
 #define LNVM_MAX_GRPS_PR_IDENT (20)
 #define LNVM_FEAT_EXT_START 64
 #define LNVM_FEAT_EXT_END 127
 #define LNVM_PBA_UNMAPPED UINT64_MAX
 #define LNVM_LBA_UNMAPPED UINT64_MAX
+#define LNVM_L2P_CHUNK_PGS 16 /* L2P table host pages per DMA transfer */
+
+/* Vector copy buffer: destination PPAs, data and OOB. The OOB area has room
+ * for a full page at the end, the media manager transfers OOB per page. */
+#define LNVM_COPY_BUF_SZ(nlb)   ((nlb) * (sizeof(uint64_t) + LNVM_SECSZ + \
+                                   LNVM_SEC_OOBSZ) + LNVM_SEC_OOBSZ * LNVM_SEC_PG)
 
 enum LnvmAdminCommands {
     LNVM_ADM_CMD_IDENTITY           = 0xe2,
     LNVM_ADM_CMD_GET_L2P_TBL        = 0xea,
+    LNVM_ADM_CMD_SET_L2P_TBL        = 0xeb, /* OX specific */
     LNVM_ADM_CMD_GET_BB_TBL         = 0xf2,
     LNVM_ADM_CMD_SET_BB_TBL         = 0xf1,
 };
 
+enum LnvmLogPages {
+    LNVM_LOG_CHUNK_INFO             = 0xca, /* Open-Channel 2.0 */
+};
+
 enum LnvmDmCommands {
     LNVM_CMD_HYBRID_WRITE      = 0x81,
     LNVM_CMD_HYBRID_READ       = 0x02,
     LNVM_CMD_PHYS_WRITE        = 0x91,
     LNVM_CMD_PHYS_READ         = 0x92,
     LNVM_CMD_ERASE_SYNC        = 0x90,
+    LNVM_CMD_VECT_COPY         = 0x93,
 };
 
 typedef struct LnvmIdAddrFormat {
@@ -118,6 +131,59 @@ typedef struct LnvmIdCtrl {
     LnvmIdGroup   groups[4];
 } LnvmIdCtrl;
 
+/* Open-Channel 2.0: LBA = grp | pu | chk | lbk, from the most significant */
+typedef struct LnvmIdAddrFormat20 {
+    uint8_t  grp_len;
+    uint8_t  pu_len;
+    uint8_t  chk_len;
+    uint8_t  lbk_len;
+    uint8_t  res[4];
+} LnvmIdAddrFormat20;
+
+typedef struct LnvmIdCtrl20 {
+    uint8_t       mjr;
+    uint8_t       mnr;
+    uint8_t       rsvd1[6];
+    struct LnvmIdAddrFormat20 lbaf;
+    uint32_t      mccap;
+    uint8_t       rsvd2[12];
+    uint8_t       wit;
+    uint8_t       rsvd3[31];
+    /* Geometry */
+    uint16_t      num_grp;
+    uint16_t      num_pu;
+    uint32_t      num_chk;
+    uint32_t      clba;
+    uint8_t       rsvd4[52];
+    /* Write data requirements */
+    uint32_t      ws_min;
+    uint32_t      ws_opt;
+    uint32_t      mw_cunits;
+    uint32_t      maxoc;
+    uint32_t      maxocpu;
+    uint8_t       rsvd5[44];
+    /* Performance related metrics */
+    uint32_t      trdt;
+    uint32_t      trdm;
+    uint32_t      twrt;
+    uint32_t      twrm;
+    uint32_t      tcrst;
+    uint32_t      tcrsm;
+    uint8_t       rsvd6[40];
+    uint8_t       rsvd7[2816];
+    uint8_t       vs[1024];
+} LnvmIdCtrl20;
+
+typedef struct LnvmChunkDesc {
+    uint8_t     state;
+    uint8_t     type;
+    uint8_t     wli;
+    uint8_t     rsvd[5];
+    uint64_t    slba;
+    uint64_t    cnlb;
+    uint64_t    wp;
+} LnvmChunkDesc;
+
 typedef struct LnvmParams {
     /* configurable device characteristics */
     uint16_t    pgs_per_blk;
@@ -152,6 +218,9 @@ typedef struct LnvmGetL2PTbl {
     uint16_t rsvd2[6];
 } LnvmGetL2PTbl;
 
+/* Same layout as LnvmGetL2PTbl, the table is read from the host */
+typedef LnvmGetL2PTbl LnvmSetL2PTbl;
+
 typedef struct LnvmGetBBTbl {
     uint8_t opcode;
     uint8_t flags;
@@ -212,6 +281,7 @@ typedef struct LnvmRwCmd {
 typedef struct LnvmCtrl {
     LnvmParams     params;
     LnvmIdCtrl     id_ctrl;
+    LnvmIdCtrl20   id_ctrl20;
     uint8_t        bb_gen_freq;
     uint32_t       err_write;
     uint32_t       err_write_cnt;
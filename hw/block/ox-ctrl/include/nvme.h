@@ -35,6 +35,10 @@
 #define NVME_MQ_NAME        "/nvme_mq"
 #define SHADOW_REG_SZ       64
 #define NVME_MAX_PRIORITY   4
+#define NVME_ARB_MAX_SQS    (SHADOW_REG_SZ * 2)
+#define NVME_ARB_INFLIGHT   1024 /* I/O commands fetched and not completed */
+#define NVME_ARB_DELAY_NS   500
+#define NVME_ARB_STALL_NS   100000
 
 #define NVME_KERNEL_PG_SIZE 4096
 
@@ -556,6 +560,33 @@ typedef struct NvmeRwCmd {
     uint16_t    appmask;
 } __attribute__((packed)) NvmeRwCmd;
 
+typedef struct NvmeDsmCmd {
+    uint8_t     opcode;
+    uint8_t     fuse : 2;
+    uint8_t     rsvd : 4;
+    uint8_t     psdt : 2;
+    uint16_t    cid;
+    uint32_t    nsid;
+    uint64_t    rsvd2[2];
+    uint64_t    prp1;
+    uint64_t    prp2;
+    uint32_t    nr;
+    uint32_t    attributes;
+    uint32_t    rsvd12[4];
+} __attribute__((packed)) NvmeDsmCmd;
+
+enum {
+    NVME_DSMGMT_IDR = 1 << 0,
+    NVME_DSMGMT_IDW = 1 << 1,
+    NVME_DSMGMT_AD  = 1 << 2,
+};
+
+typedef struct NvmeDsmRange {
+    uint32_t    cattr;
+    uint32_t    nlb;
+    uint64_t    slba;
+} NvmeDsmRange;
+
 typedef struct vs_reg {
     uint8_t rsvd;
     uint8_t mnr;
@@ -704,6 +735,11 @@ typedef struct NvmeQSched {
     unsigned int prio_lvl_next_q[NVME_MAX_PRIORITY];
     uint32_t     round_robin_status_regs[4];
     int	     WRR;
+    uint32_t     credits[NVME_MAX_PRIORITY]; /* weighted classes, per round */
+    uint32_t     inflight;
+    uint32_t     max_inflight;
+    uint8_t      stalled;   /* waiting for completions, see nvme_post_cqe */
+    QEMUTimer    *timer;
 } NvmeQSched;
 
 typedef struct NvmeErrorLog {
@@ -769,7 +805,6 @@ typedef struct NvmeSQ {
     TAILQ_ENTRY(NvmeSQ) entry;
     struct NvmeCtrl     *ctrl;
     uint8_t             phys_contig;
-    uint8_t             arb_burst;
     uint16_t            sqid;
     uint16_t            cqid;
     uint32_t            head;
@@ -779,7 +814,6 @@ typedef struct NvmeSQ {
     uint64_t            completed;
     uint64_t            *prp_list;
     struct NvmeRequest  *io_req;
-    QEMUTimer           *timer;
     TAILQ_HEAD (sq_reqhead, NvmeRequest) req_list;
     TAILQ_HEAD (sq_outreqhead, NvmeRequest) out_req_list;
     /* Mapped memory location where the tail pointer is stored by the guest */
@@ -886,6 +920,9 @@ typedef struct NvmeRequest {
     uint64_t                 meta_size;
     uint64_t                 mptr;
     void                     *meta_buf;
+    uint8_t                  *cmp_buf; /* NVM data + host data for compare */
+    uint8_t                  *copy_buf; /* vector copy, see lnvm_copy */
+    void                     *ndp_job; /* near-data processing, see ox-ndp.c */
     struct nvm_io_cmd        nvm_io;
     uint8_t                  lba_index;
     QEMUBH                   *bh;
@@ -1057,6 +1094,7 @@ typedef struct NvmeCtrl {
     int         mq_rxid;
 
     char            *serial;
+    struct ox_instance *inst;   /* owner, entered by the QEMU timers */
     NvmeErrorLog    *elpes;
     NvmeRequest     **aer_reqs;
     NvmeNamespace   *namespaces;
@@ -1091,10 +1129,12 @@ int nvme_check_cqid (NvmeCtrl *, uint16_t);
 int nvme_check_sqid (NvmeCtrl *, uint16_t);
 void nvme_free_sq (NvmeSQ *, NvmeCtrl *);
 void nvme_free_cq (NvmeCQ *, NvmeCtrl *);
+void nvme_arb_put_inflight (NvmeCtrl *);
 void nvme_addr_read (NvmeCtrl *, uint64_t, void *, int);
 void nvme_addr_write (NvmeCtrl *, uint64_t, void *, int);
 void nvme_enqueue_event (NvmeCtrl *, uint8_t, uint8_t, uint8_t);
 void nvme_rw_cb (void *);
+void nvme_compare_cb (NvmeRequest *);
 
 /* NVMe Admin cmd */
 uint16_t nvme_identify (NvmeCtrl *, NvmeCmd *);
@@ -1116,6 +1156,7 @@ uint16_t nvme_flush(NvmeCtrl *, NvmeNamespace *, NvmeCmd *, NvmeRequest *);
 uint16_t nvme_compare(NvmeCtrl *, NvmeNamespace *, NvmeCmd *, NvmeRequest *);
 uint16_t nvme_write_zeros(NvmeCtrl *,NvmeNamespace *,NvmeCmd *,NvmeRequest *);
 uint16_t nvme_rw (NvmeCtrl *, NvmeNamespace *, NvmeCmd *, NvmeRequest *);
+uint16_t nvme_rw_submit (NvmeNamespace *, NvmeRwCmd *, NvmeRequest *, uint8_t);
 
 /* LNVM functions */
 int lnvm_init(NvmeCtrl *);
@@ -1127,11 +1168,25 @@ void lnvm_init_id_ctrl(LnvmIdCtrl *);
 /* LNVM Admin cmd */
 uint16_t lnvm_identity(NvmeCtrl *, NvmeCmd *);
 uint16_t lnvm_get_l2p_tbl(NvmeCtrl *, NvmeCmd *, NvmeRequest *);
+uint16_t lnvm_set_l2p_tbl(NvmeCtrl *, NvmeCmd *, NvmeRequest *);
 uint16_t lnvm_get_bb_tbl(NvmeCtrl *, NvmeCmd *, NvmeRequest *);
 uint16_t lnvm_set_bb_tbl(NvmeCtrl *, NvmeCmd *, NvmeRequest *);
+uint16_t lnvm_get_chunk_info(NvmeCtrl *, NvmeCmd *);
 
 /* LNVM IO cmd */
 uint16_t lnvm_erase_sync(NvmeCtrl *, NvmeNamespace *, NvmeCmd *, NvmeRequest *);
 uint16_t lnvm_rw(NvmeCtrl *, NvmeNamespace *, NvmeCmd *, NvmeRequest *);
+uint16_t lnvm_copy(NvmeCtrl *, NvmeNamespace *, NvmeCmd *, NvmeRequest *);
+int lnvm_copy_cb(NvmeRequest *);
+
+/* NDP functions */
+uint16_t ndp_info (NvmeCtrl *, NvmeCmd *);
+uint16_t ndp_install (NvmeCtrl *, NvmeCmd *, NvmeRequest *);
+uint16_t ndp_delete (NvmeCtrl *, NvmeCmd *);
+uint16_t ndp_kernel_req (NvmeCtrl *, NvmeCmd *);
+uint16_t ndp_run_job (NvmeCtrl *, NvmeNamespace *, NvmeCmd *, NvmeRequest *);
+int ndp_job_cb (NvmeRequest *);
+void ndp_init (void);
+void ndp_exit (void);
 
 #endif /* NVME_H */
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef OX_BENCH_H
+#define OX_BENCH_H
+
+#include <stdint.h>
+
+/* I/O benchmark. Workloads are generated inside OX and submitted straight to
+ * one layer of the controller, no guest is needed:
+ *
+ *  mmgr -> nvm_submit_sync_io, one flash page per I/O, reads only
+ *  ftl  -> nvm_submit_ftl, global LBAs (AppNVM mode)
+ *  nvme -> nvme_rw_submit on namespace 1 (AppNVM mode)
+ *
+ * Data is kept in controller memory (NVM_PRP_LOCAL). Writes overwrite the
+ * namespace data. Results are reported as JSON:
+ *
+ *  ox-ctrl bench -l ftl -q 32 -b 4096 -r 70 -p zipf -j 4 -d 10 -o out.json
+ *
+ * In QEMU, the options are given by the 'bench' property of ox-ctrl. The
+ * benchmark runs before the guest starts and the controller stays up.
+ */
+
+enum ox_bench_layer {
+    OX_BENCH_AUTO = 0,  /* nvme in AppNVM mode, mmgr in open-channel mode */
+    OX_BENCH_MMGR,
+    OX_BENCH_FTL,
+    OX_BENCH_NVME
+};
+
+enum ox_bench_pattern {
+    OX_BENCH_RAND = 0,
+    OX_BENCH_SEQ,       /* each thread runs over its own part of the span */
+    OX_BENCH_ZIPF       /* lower addresses are the most popular */
+};
+
+#define OX_BENCH_MAX_QD         256
+#define OX_BENCH_MAX_THREADS    64
+#define OX_BENCH_MAX_INFLIGHT   1024    /* qd * threads */
+#define OX_BENCH_MAX_BS         (256 * 4096)
+#define OX_BENCH_MAX_MEM        (256 * 1024 * 1024) /* qd * threads * bs */
+#define OX_BENCH_DEF_TIME       10      /* seconds, if no op count is given */
+#define OX_BENCH_DEF_THETA      0.99
+
+struct nvm_init_arg;
+struct NvmeRequest;
+
+int  ox_bench_run (struct nvm_init_arg *args);
+void ox_bench_complete_io (struct NvmeRequest *req);
+
+#endif /* OX_BENCH_H */
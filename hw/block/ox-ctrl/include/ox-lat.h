@@ -0,0 +1,95 @@
+/* OX: OpenChannel NVM Express SSD Controller
+ *
+ * Copyright (C) 2016, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * This code is licensed under the GNU GPL v2 or later.
+ *
+ * Per-stage latency histograms. Each command is timestamped when it crosses
+ * a pipeline stage and the elapsed time is added to a log-linear histogram
+ * indexed by stage, operation and queue. Histograms are updated with atomic
+ * operations only, no lock is taken in the I/O path.
+ *
+ * The queue index depends on the stage:
+ *      - SQ fetch, CQ post and total: NVMe submission queue
+ *      - FTL queue: FTL queue selected by the core
+ *      - Map, MMGR queue, media and DMA: NVM channel
+ */
+
+#ifndef OX_LAT_H
+#define OX_LAT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "qemu/osdep.h"
+#include "qemu/fprintf-fn.h"
+
+enum ox_lat_stage {
+    OX_LAT_SQ_FETCH = 0,    /* SQ entry fetched -> submitted to the FTL */
+    OX_LAT_FTL_QUEUE,       /* waiting in the FTL queue */
+    OX_LAT_MAP,             /* logical to physical lookup or update */
+    OX_LAT_MMGR_QUEUE,      /* waiting in the media manager queue */
+    OX_LAT_MEDIA,           /* media operation */
+    OX_LAT_DMA,             /* host <-> controller data transfer */
+    OX_LAT_CQ_POST,         /* FTL completion -> CQ entry posted */
+    OX_LAT_TOTAL,           /* SQ entry fetched -> CQ entry posted */
+    OX_LAT_STAGE_COUNT
+};
+
+enum ox_lat_op {
+    OX_LAT_OP_READ = 0,
+    OX_LAT_OP_WRITE,
+    OX_LAT_OP_OTHER,
+    OX_LAT_OP_COUNT
+};
+
+/* Queues above the limit share the histogram of (qid % OX_LAT_QUEUES) */
+#define OX_LAT_QUEUES       16
+
+/* Log-linear buckets: values below OX_LAT_SUB nanoseconds have one bucket
+ * each, above it every power of two is split in OX_LAT_SUB linear buckets.
+ * Latencies above 2^OX_LAT_MAX_BITS ns (~68 seconds) share the last one. */
+#define OX_LAT_SUB_BITS     3
+#define OX_LAT_SUB          (1 << OX_LAT_SUB_BITS)
+#define OX_LAT_MAX_BITS     36
+#define OX_LAT_BUCKETS      ((OX_LAT_MAX_BITS - OX_LAT_SUB_BITS + 1) \
+                                                                * OX_LAT_SUB)
+
+struct ox_lat_hist {
+    uint64_t    count;
+    uint64_t    sum;
+    uint64_t    max;
+    uint64_t    bucket[OX_LAT_BUCKETS];
+};
+
+/* Histograms are process wide, shared by all ox-ctrl devices */
+extern uint8_t ox_lat_enabled;
+
+/* Returns a monotonic timestamp in nanoseconds, or 0 if tracing is off.
+ * A zero timestamp is never accounted by ox_lat_add. */
+static inline uint64_t ox_lat_ts (void)
+{
+    struct timespec ts;
+
+    if (!ox_lat_enabled)
+        return 0;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t ox_lat_add (uint8_t stage, uint8_t op, uint16_t qid, uint64_t start);
+void     ox_lat_hist_add (struct ox_lat_hist *h, uint64_t lat);
+void     ox_lat_hist_merge (struct ox_lat_hist *dst, struct ox_lat_hist *src);
+uint64_t ox_lat_hist_percentile (struct ox_lat_hist *h, double pct);
+uint8_t  ox_lat_op (uint8_t cmdtype);
+void     ox_lat_reset (void);
+void     ox_lat_print (FILE *f, fprintf_function print);
+void     ox_lat_print_json (FILE *f, fprintf_function print);
+int      ox_lat_dump_json (const char *path);
+
+#endif /* OX_LAT_H */
@@ -47,6 +47,9 @@ typedef void (ox_mq_cq_fn)(void *);
 /* void ** is an array of timeout opaque entries, int is the array size */
 typedef void (ox_mq_to_fn)(void **, int);
 
+struct ox_mq;
+typedef void (ox_mq_walk_fn)(struct ox_mq *, void *);
+
 struct ox_mq_queue {
     pthread_mutex_t                        sq_free_mutex;
     pthread_mutex_t                        cq_free_mutex;
@@ -70,9 +73,13 @@ struct ox_mq_queue {
     pthread_t                              cq_tid;
     uint8_t                                running; /* if 0, kill threads */
     struct ox_mq_stats                     stats;
+    struct ox_mq_queue                     *steal_q; /* first of the group */
+    uint32_t                               steal_n;  /* 0, no work stealing */
 };
 
 #define OX_MQ_TO_COMPLETE   (1 << 0) /* Complete request after timeout */
+#define OX_MQ_WORK_STEAL    (1 << 1) /* Idle threads take requests from busy
+                                        queues of the same steal group */
 
 struct ox_mq_config {
     char                name[40];
@@ -83,12 +90,14 @@ struct ox_mq_config {
     ox_mq_to_fn         *to_fn;  /* timeout call */
     uint64_t            to_usec; /* timeout in microseconds */
     uint8_t             flags;
+    uint32_t            steal_group; /* queues per steal group, 0 for all */
 };
 
 struct ox_mq {
     LIST_ENTRY(ox_mq)                 entry;
     struct ox_mq_queue                *queues;
     struct ox_mq_config               *config;
+    struct ox_instance                *inst;        /* owner */
     pthread_t                         to_tid;       /* timeout thread */
     LIST_HEAD(oxmq_ext, ox_mq_entry)  ext_list;     /* new allocated entries */
     struct ox_mq_stats                stats;
@@ -102,7 +111,9 @@ int           ox_mq_complete_req (struct ox_mq *, struct ox_mq_entry *);
 void          ox_mq_show_mq (struct ox_mq *);
 void          ox_mq_show_all (void);
 struct ox_mq *ox_mq_get (const char *);
+void          ox_mq_walk (ox_mq_walk_fn *, void *);
 int           ox_mq_used_count (struct ox_mq *, uint16_t qid);
+int           ox_mq_load (struct ox_mq *, uint16_t qid);
 int           ox_mq_get_status (struct ox_mq *, struct ox_mq_stats *,
                                                                   uint16_t qid);
 
@@ -1,6 +1,24 @@
 #ifndef OX_NDP_H
 #define OX_NDP_H
 
+#include <stdint.h>
+
+/* Near-data processing. The host installs kernels built from a fixed set of
+ * built-ins and runs jobs over LBA ranges. Jobs read the data through the
+ * FTL into controller memory and only the result is transferred to the host.
+ *
+ * Admin commands:
+ *  NDP_ADM_CMD_INFO      -> PRP1: struct ndp_info
+ *  NDP_ADM_CMD_INST_DAEM -> PRP1: struct ndp_kernel_param, CQE DW0: kernel id
+ *  NDP_ADM_CMD_DEL_DAEM  -> CDW10: kernel id
+ *
+ * I/O commands:
+ *  NDP_EXEC_RUN_JOB      -> CDW10-11: slba, CDW12: nlb (0's based),
+ *                           CDW13: kernel id, PRP1: struct ndp_job_result,
+ *                           CQE DW0: matches (lower 32 bits)
+ *  NDP_EXEC_DAEM_REQ     -> CDW10: kernel id, PRP1: struct ndp_kernel_stats
+ */
+
 enum NdpAdminCommands {
     NDP_ADM_CMD_INFO       = 0xe6,
     NDP_ADM_CMD_INST_DAEM  = 0xd1,
@@ -12,5 +30,72 @@ enum NdpExecCommands {
     NDP_EXEC_DAEM_REQ      = 0xa3
 };
 
-#endif /* OX_NDP_H */
+enum NdpBuiltins {
+    NDP_KERN_SCAN          = 0x1, /* records matching a predicate on a field */
+    NDP_KERN_COUNT         = 0x2, /* records containing any non-zero byte */
+    NDP_KERN_CHECKSUM      = 0x3, /* CRC32C over the range */
+    NDP_KERN_GREP          = 0x4  /* positions matching a byte pattern */
+};
+
+enum NdpScanOp {
+    NDP_OP_EQ              = 0x0,
+    NDP_OP_NE              = 0x1,
+    NDP_OP_LT              = 0x2,
+    NDP_OP_LE              = 0x3,
+    NDP_OP_GT              = 0x4,
+    NDP_OP_GE              = 0x5
+};
 
+#define NDP_VERSION         1
+#define NDP_MAX_KERNELS     16
+#define NDP_PAT_MAX         256
+#define NDP_SEG_SECS        256  /* sectors read per FTL request */
+
+/* Records are fixed size, a power of two up to the sector size. Fields are
+ * unsigned little endian integers of 1, 2, 4 or 8 bytes. */
+struct ndp_kernel_param {
+    uint8_t     builtin;
+    uint8_t     op;
+    uint8_t     field_sz;
+    uint8_t     rsvd;
+    uint16_t    pat_len;
+    uint16_t    rsvd2;
+    uint32_t    rec_sz;
+    uint32_t    field_off;
+    uint64_t    value;
+    uint8_t     pattern[NDP_PAT_MAX];
+} __attribute__((packed));
+
+struct ndp_info {
+    uint16_t    version;
+    uint16_t    max_kernels;
+    uint16_t    n_kernels;
+    uint16_t    seg_secs;
+    uint32_t    builtins;    /* bit n set: built-in n supported */
+    uint32_t    kernels;     /* bit n set: kernel id n installed */
+    uint8_t     builtin_of[NDP_MAX_KERNELS];
+} __attribute__((packed));
+
+struct ndp_job_result {
+    uint32_t    kernel_id;
+    uint32_t    crc32c;
+    uint64_t    slba;
+    uint64_t    nlb;
+    uint64_t    bytes;
+    uint64_t    records;
+    uint64_t    matches;
+    uint64_t    sum;         /* scan: sum of the matching field values */
+    uint64_t    time_ns;
+} __attribute__((packed));
+
+struct ndp_kernel_stats {
+    uint32_t    kernel_id;
+    uint32_t    rsvd;
+    uint64_t    jobs;
+    uint64_t    failed;
+    uint64_t    bytes;
+    uint64_t    matches;
+    uint64_t    time_ns;
+} __attribute__((packed));
+
+#endif /* OX_NDP_H */
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include "hw/block/ox-ctrl/include/uatomic.h"
 #include "hw/block/ox-ctrl/include/ox-mq.h"
+#include "hw/block/ox-ctrl/include/ox-lat.h"
 #include "hw/block/ox-ctrl/include/lightnvm.h"
 #include "qemu/osdep.h"
 #include "hw/block/block.h"
@@ -56,6 +57,8 @@
 #define NVM_QUEUE_RETRY_SLEEP   1000
 #define NVM_FTL_QUEUE_SIZE      512
 #define NVM_FTL_QUEUE_TO        4000000
+#define NVM_FTL_CH_INFLIGHT     64  /* cmds per channel before no steering */
+#define NVM_FTL_Q_BACKLOG       4   /* home queue load to steer a command */
 
 #define NVM_SYNCIO_TO          10
 #define NVM_SYNCIO_FLAG_BUF    0x1
@@ -65,6 +68,10 @@
 #define NVM_FULL_UPDOWN        0x1
 #define NVM_RESTART            0x0
 
+/* PRPs with this bit set point to controller memory instead of host memory.
+ * Used by commands whose data is consumed inside the controller (compare) */
+#define NVM_PRP_LOCAL          (1ULL << 63)
+
 /* All media managers must accept page r/w of NVM_PG_SIZE + OOB_SIZE*/
 #define NVM_PG_SIZE            0x4000
 #define NVM_OOB_BITS           6
@@ -148,6 +155,8 @@ struct nvm_mmgr_io_cmd {
     pthread_mutex_t         *sync_mutex;
     struct timeval          tstart;
     struct timeval          tend;
+    uint64_t                ts_queue; /* latency tracing, ns */
+    uint64_t                ts_media;
 
     /* MMGR specific */
     uint8_t                 rsvd[170];
@@ -161,6 +170,7 @@ struct nvm_io_cmd {
     struct nvm_mmgr_io_cmd      mmgr_io[64];
     void                        *req;
     void                        *mq_req;
+    struct nvm_channel          *ftl_ch; /* channel charged by q scheduler */
     uint64_t                    prp[256]; /* maximum 1 MB for block I/O */
     uint64_t                    md_prp[256];
     uint32_t                    sec_sz;
@@ -169,6 +179,11 @@ struct nvm_io_cmd {
     uint64_t                    slba;
     uint8_t                     cmdtype;
     pthread_mutex_t             mutex;
+
+    /* latency tracing timestamps (ns), 0 if tracing is off */
+    uint64_t                    ts_fetch;
+    uint64_t                    ts_submit;
+    uint64_t                    ts_complete;
 };
 
 #include "hw/block/ox-ctrl/include/nvme.h"
@@ -222,7 +237,8 @@ enum RUN_FLAGS {
     RUN_PCIE       = 1 << 4,
     RUN_NVME       = 1 << 5,
     RUN_TESTS      = 1 << 6,
-    RUN_APPNVM     = 1 << 7
+    RUN_APPNVM     = 1 << 7,
+    RUN_BENCH      = 1 << 8
 };
 
 struct nvm_mmgr;
@@ -328,6 +344,71 @@ struct nvm_ftl_cap_gl_fn {
     void                *arg;
 };
 
+struct nvm_ftl_cap_dealloc_st {
+    uint64_t            slba;
+    uint32_t            nlb;
+};
+
+/* Chunk (block across all planes) states, values follow Open-Channel 2.0 */
+enum {
+    FTL_CHUNK_FREE      = 0x1,
+    FTL_CHUNK_CLOSED    = 0x2,
+    FTL_CHUNK_OPEN      = 0x4,
+    FTL_CHUNK_OFFLINE   = 0x8
+};
+
+struct nvm_ftl_chunk {
+    uint8_t             state;
+    uint8_t             rsvd;
+    uint16_t            wp;          /* sectors written in the chunk */
+    uint32_t            erase_count;
+} __attribute__((packed));
+
+/* Returns 'nchk' chunks of the LUN addressed by 'ppa' (channel and LUN) */
+struct nvm_ftl_cap_chunk_st {
+    struct nvm_ppa_addr     ppa;
+    uint32_t                nchk;
+    struct nvm_ftl_chunk    *chk;
+};
+
+/* 'tbl' holds 'nlb' PPAs starting at 'slba', zero is an unmapped LBA */
+struct nvm_ftl_cap_l2ptbl_st {
+    uint64_t            slba;
+    uint32_t            nlb;
+    uint64_t            *tbl;
+};
+
+struct nvm_ftl_ch_stats {
+    uint16_t            ch_id;
+    uint8_t             active;
+    uint8_t             need_gc;
+    uint32_t            free_blks;
+    uint32_t            used_blks;
+    uint32_t            open_blks;
+    uint32_t            map_cache_used;  /* cached mapping pages */
+    uint32_t            map_cache_free;
+    uint64_t            map_cache_hits;
+    uint64_t            map_cache_misses;
+    uint64_t            map_cache_evictions;
+};
+
+struct nvm_ftl_gc_stats {
+    uint64_t            recycled_blks;
+    uint64_t            moved_sec;
+    uint64_t            pad_sec;   /* padding sectors dropped */
+    uint64_t            err_sec;   /* sectors failed to move */
+    uint64_t            wro_sec;   /* sectors with unexpected type */
+    uint64_t            map_pgs;   /* mapping pages moved */
+};
+
+/* The caller provides room for 'n_ch' channels, the FTL sets 'n_ch' to the
+ * number of channels filled */
+struct nvm_ftl_cap_stats_st {
+    uint16_t                 n_ch;
+    struct nvm_ftl_ch_stats *ch;
+    struct nvm_ftl_gc_stats  gc;
+};
+
 /* --- FTL CAPABILITIES BIT OFFSET --- */
 
 enum {
@@ -340,7 +421,13 @@ enum {
     /* Application function support */
     FTL_CAP_INIT_FN             = 0x04,
     FTL_CAP_EXIT_FN             = 0x05,
-    FTL_CAP_CALL_FN             = 0X06
+    FTL_CAP_CALL_FN             = 0X06,
+    /* Deallocate (trim) logical blocks support */
+    FTL_CAP_DEALLOC             = 0x07,
+    /* Runtime statistics (channels, GC, mapping cache) */
+    FTL_CAP_GET_STATS           = 0x08,
+    /* Chunk state and write pointer (Open-Channel 2.0) */
+    FTL_CAP_GET_CHUNK           = 0x09
 };
 
 /* --- FTL BAD BLOCK TABLE FORMATS --- */
@@ -362,6 +449,12 @@ typedef int       (nvm_ftl_set_bbtbl)(struct nvm_ppa_addr *, uint8_t);
 typedef int       (nvm_ftl_init_fn)(uint16_t, void *arg);
 typedef void      (nvm_ftl_exit_fn)(uint16_t);
 typedef int       (nvm_ftl_call_fn)(uint16_t, void *arg);
+typedef int       (nvm_ftl_dealloc)(uint64_t, uint32_t);
+typedef int       (nvm_ftl_get_stats)(struct nvm_ftl_cap_stats_st *);
+typedef int       (nvm_ftl_get_l2ptbl)(uint64_t, uint32_t, uint64_t *);
+typedef int       (nvm_ftl_set_l2ptbl)(uint64_t, uint32_t, uint64_t *);
+typedef int       (nvm_ftl_get_chunk)(struct nvm_ppa_addr *, uint32_t,
+                                                      struct nvm_ftl_chunk *);
 
 struct nvm_ftl_ops {
     nvm_ftl_submit_io      *submit_io; /* FTL queue request consumer */
@@ -373,6 +466,11 @@ struct nvm_ftl_ops {
     nvm_ftl_init_fn        *init_fn;
     nvm_ftl_exit_fn        *exit_fn;
     nvm_ftl_call_fn        *call_fn;
+    nvm_ftl_dealloc        *dealloc;
+    nvm_ftl_get_stats      *get_stats;
+    nvm_ftl_get_l2ptbl     *get_l2ptbl;
+    nvm_ftl_set_l2ptbl     *set_l2ptbl;
+    nvm_ftl_get_chunk      *get_chunk;
 };
 
 struct nvm_ftl {
@@ -383,7 +481,6 @@ struct nvm_ftl {
     uint16_t                bbtbl_format;
     uint8_t                 nq; /* Number of queues/threads, up to 64 per FTL */
     struct ox_mq            *mq;
-    uint16_t                next_queue[2];
     LIST_ENTRY(nvm_ftl)     entry;
 };
 
@@ -401,6 +498,7 @@ struct nvm_channel {
     struct nvm_mmgr_geometry    *geometry;
     struct nvm_ppa_addr         *mmgr_rsv_list; /* list of mmgr reserved blks */
     struct nvm_ppa_addr         *ftl_rsv_list;
+    u_atomic_t                  ftl_inflight; /* cmds in the FTL queues */
     LIST_ENTRY(nvm_channel)     entry;
     union {
         struct {
@@ -422,6 +520,9 @@ struct nvm_channel {
 #define OX_RUN_MODE         0x0
 #define OX_TEST_MODE        0x1
 #define OX_ADMIN_MODE       0x2
+#define OX_BENCH_MODE       0x3
+
+#define CMDARG_PATH_LEN     256
 
 struct nvm_init_arg
 {
@@ -434,6 +535,17 @@ struct nvm_init_arg
     char        test_subtest[CMDARG_LEN];
     /* CMD ADMIN */
     char        admin_task[CMDARG_LEN];
+    /* CMD BENCH, see ox-bench.h */
+    uint8_t     bench_layer;
+    uint8_t     bench_pattern;
+    uint8_t     bench_read_pct;
+    uint16_t    bench_qd;
+    uint16_t    bench_threads;
+    uint32_t    bench_bs;
+    uint32_t    bench_time;
+    uint64_t    bench_ops;
+    double      bench_theta;
+    char        bench_out[CMDARG_PATH_LEN];
 };
 
 /* tests initialization functions */
@@ -457,9 +569,13 @@ struct nvm_sync_io_arg {
     uint8_t                 status;
 };
 
+struct ox_instance;
+
 typedef struct QemuOxCtrl {
     PCIDevice       parent_obj;
     PCIDevice       *pci_dev;
+    struct ox_instance *inst;   /* controller state of this device */
+    QLIST_ENTRY(QemuOxCtrl) next;
     MemoryRegion    iomem;
     MemoryRegion    ctrl_mem;
     BlockConf       conf;
@@ -468,7 +584,16 @@ typedef struct QemuOxCtrl {
     uint8_t         debug;
     uint8_t         lnvm;
     uint8_t         volt;
+    uint8_t         lat;
+    uint8_t         ocssd2;
+    uint8_t         namespaces;
+    uint8_t         channels;   /* VOLT geometry */
+    uint8_t         luns;
+    uint16_t        blocks;
+    uint16_t        pages;
+    uint8_t         planes;
     char            *serial;
+    char            *bench;     /* ox-ctrl bench options, see ox-bench.h */
 } QemuOxCtrl;
 
 struct core_struct {
@@ -477,11 +602,13 @@ struct core_struct {
     uint16_t                ftl_q_count;
     uint16_t                nvm_ch_count;
     uint64_t                nvm_ns_size;
+    uint8_t                 nvm_ns_count; /* namespaces, channel partitioned */
     jmp_buf                 jump;
-    uint8_t                 run_flag;
+    uint16_t                run_flag;
     uint8_t                 debug;
     uint16_t                std_ftl;
     uint8_t                 lnvm;
+    uint8_t                 ocssd2; /* Open-Channel 2.0 interface */
     uint8_t                 volt;
     struct nvm_pcie         *nvm_pcie;
     struct nvm_channel      **nvm_ch;
@@ -489,13 +616,74 @@ struct core_struct {
     struct tests_init_st    *tests_init;
     struct nvm_init_arg     *args_global;
     QemuOxCtrl              *qemu;
+    LIST_HEAD(mmgr_list, nvm_mmgr) mmgr_head;
+    LIST_HEAD(ftl_list, nvm_ftl)   ftl_head;
 };
 
+/* Module state kept in the instance, see ox_state */
+enum ox_state_id {
+    OX_ST_APP_GLOBAL = 0,
+    OX_ST_APP_CORE,
+    OX_ST_APP_CHANNELS,
+    OX_ST_APP_GC,
+    OX_ST_APP_GL_MAP,
+    OX_ST_APP_GL_PROV,
+    OX_ST_APP_LBA_IO,
+    OX_ST_APP_RECOVERY,
+    OX_ST_LNVM,
+    OX_ST_VOLT,
+    OX_ST_NDP,
+    OX_ST_PCIE,
+    OX_ST_COUNT
+};
+
+/* Each ox-ctrl device runs its own controller. The instance holds the core,
+ * FTL and media manager state of one device, ox_inst is the instance served
+ * by the calling thread. Threads started with ox_thread_create inherit it
+ * from their creator, QEMU callbacks (MMIO, timers, monitor) select it with
+ * ox_inst_enter. */
+struct ox_instance {
+    struct core_struct      core_st;
+    void                    *st[OX_ST_COUNT];
+};
+
+extern __thread struct ox_instance *ox_inst;
+
+#define core (ox_inst->core_st)
+
+struct ox_instance *ox_inst_new (void);
+void  ox_inst_free (struct ox_instance *);
+void *ox_state_alloc (uint8_t, size_t);
+int   ox_thread_create (pthread_t *, void *(*)(void *), void *);
+
+static inline struct ox_instance *ox_inst_enter (struct ox_instance *inst)
+{
+    struct ox_instance *prev = ox_inst;
+
+    ox_inst = inst;
+    return prev;
+}
+
+static inline void ox_inst_leave (struct ox_instance *prev)
+{
+    ox_inst = prev;
+}
+
+/* Module state is zeroed when first used and freed with the instance,
+ * fields that need more are set up by the module init function */
+static inline void *ox_state (uint8_t id, size_t sz)
+{
+    void *st = ox_inst->st[id];
+
+    return (st) ? st : ox_state_alloc (id, sz);
+}
+
 /* core functions */
 int  nvm_restart (void);
 int  nvm_register_mmgr(struct nvm_mmgr *);
 int  nvm_register_pcie_handler(struct nvm_pcie *);
 int  nvm_register_ftl (struct nvm_ftl *);
+void nvm_get_max_geometry (struct nvm_mmgr_geometry *);
 int  nvm_submit_ftl (struct nvm_io_cmd *);
 int  nvm_submit_mmgr (struct nvm_mmgr_io_cmd *);
 void nvm_complete_ftl (struct nvm_io_cmd *);
@@ -504,7 +692,9 @@ int  nvm_dma (void *, uint64_t, ssize_t, uint8_t);
 int  nvm_memcheck (void *);
 int  nvm_contains_ppa (struct nvm_ppa_addr *, uint32_t, struct nvm_ppa_addr);
 int  nvm_ftl_cap_exec (uint8_t, void *);
+int  nvm_ftl_cap_support (uint8_t);
 int  nvm_init_ctrl (int, char **, QemuOxCtrl *);
+void nvm_exit_ctrl (void);
 int  nvm_test_unit (struct nvm_init_arg *);
 int  nvm_admin_unit (struct nvm_init_arg *);
 int  nvm_submit_sync_io (struct nvm_channel *, struct nvm_mmgr_io_cmd *,
@@ -512,9 +702,13 @@ int  nvm_submit_sync_io (struct nvm_channel *, struct nvm_mmgr_io_cmd *,
 int  nvm_submit_multi_plane_sync_io (struct nvm_channel *,
                           struct nvm_mmgr_io_cmd *, void *, uint8_t, uint64_t);
 
+/* qemu device functions */
+void ox_foreach (void (*)(QemuOxCtrl *, void *), void *);
+
 /* media managers init function */
 int mmgr_dfcnand_init(void);
 int mmgr_volt_init(void);
+uint64_t mmgr_volt_mem_usage(void);
 
 /* FTLs init function */
 int ftl_lnvm_init(void);
@@ -523,7 +717,7 @@ int ftl_appnvm_init(void);
 /* nvme functions */
 int  nvme_init(struct NvmeCtrl *);
 void nvme_process_reg (struct NvmeCtrl *, uint64_t, uint64_t);
-void nvme_q_scheduler (struct NvmeCtrl *, uint32_t *);
+void nvme_q_scheduler (void *);
 void nvme_process_db (struct NvmeCtrl *, uint64_t, uint64_t);
 /* nvme functions used by tests */
 uint16_t nvme_admin_cmd (struct NvmeCtrl *, struct NvmeCmd *,
@@ -11,8 +11,6 @@
 #include "hw/block/ox-ctrl/include/lightnvm.h"
 #include "hw/block/ox-ctrl/include/uatomic.h"
 
-extern struct core_struct core;
-
 uint8_t lnvm_dev(NvmeCtrl *n)
 {
     return (n->lightnvm_ctrl.id_ctrl.ver_id != 0);
@@ -36,21 +34,25 @@ static void lnvm_debug_print_io (struct nvm_ppa_addr *list, uint64_t *prp,
     fflush (stdout);
 }
 
+/* Geometry is exposed as set by the media manager, channels are expected to
+ * share the same geometry */
 void lnvm_set_default(LnvmCtrl *ctrl)
 {
+    struct nvm_mmgr_geometry *g = core.nvm_ch[0]->geometry;
+
     ctrl->id_ctrl.ver_id = LNVM_VER_ID;
     ctrl->id_ctrl.dom = LNVM_DOM;
     ctrl->id_ctrl.cap = LNVM_CAP;
     ctrl->params.sec_size = LNVM_SECSZ;
     ctrl->params.secs_per_pg = LNVM_SEC_PG;
-    ctrl->params.pgs_per_blk = LNVM_PG_BLK;
+    ctrl->params.pgs_per_blk = g->pg_per_blk;
     ctrl->params.max_sec_per_rq = LNVM_MAX_SEC_RQ;
     ctrl->params.mtype = LNVM_MTYPE;
     ctrl->params.fmtype = LNVM_FMTYPE;
-    ctrl->params.num_ch = LNVM_CH;
-    ctrl->params.num_lun = LNVM_LUN_CH;
-    ctrl->params.num_blk = LNVM_BLK_LUN;
-    ctrl->params.num_pln = LNVM_PLANES;
+    ctrl->params.num_ch = core.nvm_ch_count;
+    ctrl->params.num_lun = g->lun_per_ch;
+    ctrl->params.num_blk = g->blk_per_lun;
+    ctrl->params.num_pln = g->n_of_planes;
     ctrl->bb_gen_freq = LNVM_BB_GEN_FREQ;
     ctrl->err_write = LNVM_ERR_WRITE;
 }
@@ -63,39 +65,171 @@ static void lnvm_tbl_initialize(uint64_t *tbl, uint32_t len)
         tbl[i] = LNVM_LBA_UNMAPPED;
 }
 
-uint16_t lnvm_get_l2p_tbl(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
+/*
+ * Builds the list of host pages covering 'len' bytes from PRP1 and PRP2 (a
+ * single page or a PRP list). A PRP list runs to the end of its page, the
+ * last entry of a full list page points to the next list page. The list is
+ * allocated here, freed by the caller.
+ */
+static uint16_t lnvm_map_prp(NvmeCtrl *n, uint64_t prp1, uint64_t prp2,
+                                  uint64_t len, uint64_t **prp, uint32_t *npg)
 {
-    LnvmGetL2PTbl *gtbl = (LnvmGetL2PTbl*)cmd;
-    uint32_t nlb = gtbl->nlb;
-    uint64_t prp1 = gtbl->prp1;
-    uint32_t nsid = gtbl->nsid;
-    uint64_t tbl_sz;
-    uint64_t *tbl;
-    int ret;
+    uint64_t off = prp1 & (n->page_size - 1);
+    uint64_t list = prp2;
+    uint32_t pg, nents, list_ents;
+    uint16_t ret = NVME_INVALID_FIELD | NVME_DNR;
+    uint8_t chain;
+
+    *npg = (off + len + n->page_size - 1) / n->page_size;
+    *prp = malloc(sizeof(uint64_t) * *npg);
+    if (!*prp)
+        return NVME_INTERNAL_DEV_ERROR;
 
-    if (nsid == 0 || nsid > n->num_namespaces) {
-        return NVME_INVALID_NSID | NVME_DNR;
+    (*prp)[0] = prp1;
+    if (*npg == 2)
+        (*prp)[1] = prp2;
+
+    for (pg = 1; *npg > 2 && pg < *npg; pg += nents) {
+        if (!list || list & (sizeof(uint64_t) - 1))
+            goto err;
+
+        list_ents = (n->page_size - (list & (n->page_size - 1))) /
+                                                             sizeof(uint64_t);
+        nents = *npg - pg;
+        chain = nents > list_ents;
+        if (chain) {
+            nents = list_ents - 1;
+            if (!nents)
+                goto err;
+        }
+
+        /* The chain pointer lands in a slot filled by the next list page */
+        if (nvme_read_from_host((void *)(&(*prp)[pg]), list,
+                                    (nents + chain) * sizeof(uint64_t))) {
+            ret = NVME_DATA_TRAS_ERROR;
+            goto err;
+        }
+
+        if (chain)
+            list = (*prp)[pg + nents];
     }
 
-    tbl_sz = nlb * sizeof(uint64_t);
-    tbl = calloc (1, tbl_sz);
+    return NVME_SUCCESS;
+
+err:
+    free(*prp);
+    *prp = NULL;
+    return ret;
+}
+
+/*
+ * Exchanges the L2P table with the FTL chunk by chunk, the table is never
+ * allocated entirely. A chunk is a run of physically contiguous host pages
+ * (up to LNVM_L2P_CHUNK_PGS), copied in a single DMA transfer.
+ */
+static uint16_t lnvm_l2p_tbl_xfer(NvmeCtrl *n, LnvmGetL2PTbl *cmd, uint8_t cap)
+{
+    struct nvm_ftl_cap_l2ptbl_st arg;
+    NvmeNamespace *ns;
+    uint64_t *prp = NULL, *tbl = NULL, lba, elba, base;
+    uint32_t npg, pg, cpg, off, i;
+    uint64_t len;
+    uint16_t ret;
+    uint8_t ftl_tbl = nvm_ftl_cap_support(cap);
+
+    if (cmd->nsid == 0 || cmd->nsid > n->num_namespaces)
+        return NVME_INVALID_NSID | NVME_DNR;
+
+    /* Without a device side mapping (open-channel mode) nothing to restore */
+    if (cap == FTL_CAP_SET_L2PTBL && !ftl_tbl)
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    ns = &n->namespaces[cmd->nsid - 1];
+    if (!cmd->nlb || cmd->slba + cmd->nlb > ns->id_ns.nsze)
+        return NVME_LBA_RANGE | NVME_DNR;
+
+    if (!cmd->prp1 || cmd->prp1 & (sizeof(uint64_t) - 1))
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    off = cmd->prp1 & (n->page_size - 1);
+    len = (uint64_t) cmd->nlb * sizeof(uint64_t);
+
+    ret = lnvm_map_prp(n, cmd->prp1, cmd->prp2, len, &prp, &npg);
+    if (ret)
+        goto out;
+
+    tbl = malloc(n->page_size * LNVM_L2P_CHUNK_PGS);
     if (!tbl) {
-        log_info("[ERROR lnvm: cannot allocate bitmap for l2p table]\n");
+        log_info("[ERROR lnvm: cannot allocate buffer for l2p table]\n");
+        ret = NVME_INTERNAL_DEV_ERROR;
         goto out;
     }
-    lnvm_tbl_initialize(tbl, nlb);
 
-    // TODO: call core (slba is the first page in a flat addr space)
+    lba = cmd->slba + ns->start_block;
+    elba = lba + cmd->nlb;
+    pg = 0;
 
-    if (prp1) {
-        ret = nvme_write_to_host((uint8_t *)tbl, prp1, tbl_sz);
-        free(tbl);
-        return ret;
+    while (lba < elba && pg < npg) {
+        base = prp[pg] - off;
+        len = n->page_size - off;
+        for (cpg = 1; cpg < LNVM_L2P_CHUNK_PGS && pg + cpg < npg; cpg++) {
+            if (prp[pg + cpg] != base + (uint64_t) cpg * n->page_size)
+                break;
+            len += n->page_size;
+        }
+
+        arg.slba = lba;
+        arg.nlb = MIN(len / sizeof(uint64_t), elba - lba);
+        arg.tbl = tbl;
+
+        if (cap == FTL_CAP_GET_L2PTBL) {
+            if (!ftl_tbl) {
+                lnvm_tbl_initialize(tbl, arg.nlb);
+            } else {
+                if (nvm_ftl_cap_exec(cap, (void *) &arg)) {
+                    ret = NVME_INTERNAL_DEV_ERROR;
+                    break;
+                }
+                for (i = 0; i < arg.nlb; i++)
+                    if (!tbl[i])
+                        tbl[i] = LNVM_LBA_UNMAPPED;
+            }
+            if (nvme_write_to_host(tbl, prp[pg], arg.nlb * sizeof(uint64_t)))
+                ret = NVME_DATA_TRAS_ERROR;
+        } else {
+            if (nvme_read_from_host(tbl, prp[pg], arg.nlb * sizeof(uint64_t))) {
+                ret = NVME_DATA_TRAS_ERROR;
+                break;
+            }
+            for (i = 0; i < arg.nlb; i++)
+                if (tbl[i] == LNVM_LBA_UNMAPPED)
+                    tbl[i] = 0;
+            if (nvm_ftl_cap_exec(cap, (void *) &arg))
+                ret = NVME_INTERNAL_DEV_ERROR;
+        }
+
+        if (ret)
+            break;
+
+        lba += arg.nlb;
+        pg += cpg;
+        off = 0;
     }
 
-    free(tbl);
 out:
-    return NVME_INVALID_FIELD;
+    free(tbl);
+    free(prp);
+    return ret;
+}
+
+uint16_t lnvm_get_l2p_tbl(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
+{
+    return lnvm_l2p_tbl_xfer(n, (LnvmGetL2PTbl *) cmd, FTL_CAP_GET_L2PTBL);
+}
+
+uint16_t lnvm_set_l2p_tbl(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
+{
+    return lnvm_l2p_tbl_xfer(n, (LnvmSetL2PTbl *) cmd, FTL_CAP_SET_L2PTBL);
 }
 
 uint16_t lnvm_set_bb_tbl(NvmeCtrl *n, NvmeCmd *nvmecmd, NvmeRequest *req)
@@ -196,18 +330,153 @@ out:
     return NVME_INVALID_FIELD;
 }
 
+static inline uint64_t lnvm_lba20_field(uint64_t lba, uint8_t off,
+                                                                  uint8_t len)
+{
+    return (lba >> off) & ((1ULL << len) - 1);
+}
+
+/*
+ * Converts an Open-Channel 2.0 address (group, parallel unit, chunk, logical
+ * block) into a device PPA. Group is the channel, parallel unit the LUN and
+ * chunk the block across all planes. Logical blocks inside a chunk follow the
+ * page order, planes interleaved: lbk = (pg * planes + pl) * secs_per_pg + sec
+ */
+static int lnvm_lba20_to_ppa(LnvmCtrl *ln, struct nvm_ppa_addr *ppa)
+{
+    LnvmIdCtrl20 *id = &ln->id_ctrl20;
+    LnvmIdAddrFormat20 *lbaf = &id->lbaf;
+    uint64_t lba = ppa->ppa;
+    uint64_t lbk, chk, pu, grp;
+
+    lbk = lnvm_lba20_field(lba, 0, lbaf->lbk_len);
+    chk = lnvm_lba20_field(lba, lbaf->lbk_len, lbaf->chk_len);
+    pu  = lnvm_lba20_field(lba, lbaf->lbk_len + lbaf->chk_len, lbaf->pu_len);
+    grp = lba >> (lbaf->lbk_len + lbaf->chk_len + lbaf->pu_len);
+
+    if (lbk >= id->clba || chk >= id->num_chk || pu >= id->num_pu ||
+                                                          grp >= id->num_grp)
+        return -1;
+
+    ppa->ppa = 0;
+    ppa->g.ch = grp;
+    ppa->g.lun = pu;
+    ppa->g.blk = chk;
+    ppa->g.pg = lbk / ln->params.sec_per_phys_pl;
+    ppa->g.pl = (lbk / ln->params.secs_per_pg) % ln->params.num_pln;
+    ppa->g.sec = lbk % ln->params.secs_per_pg;
+
+    return 0;
+}
+
+static uint64_t lnvm_chunk20_slba(LnvmCtrl *ln, uint32_t grp, uint32_t pu,
+                                                                 uint32_t chk)
+{
+    LnvmIdAddrFormat20 *lbaf = &ln->id_ctrl20.lbaf;
+
+    return ((uint64_t) grp << (lbaf->pu_len + lbaf->chk_len + lbaf->lbk_len)) |
+           ((uint64_t) pu << (lbaf->chk_len + lbaf->lbk_len)) |
+           ((uint64_t) chk << lbaf->lbk_len);
+}
+
+/*
+ * Chunk Information log page (Open-Channel 2.0). Descriptors are ordered by
+ * group, parallel unit and chunk. The chunk state is kept by the FTL.
+ */
+uint16_t lnvm_get_chunk_info(NvmeCtrl *n, NvmeCmd *cmd)
+{
+    LnvmCtrl *ln = &n->lightnvm_ctrl;
+    LnvmIdCtrl20 *id = &ln->id_ctrl20;
+    struct nvm_ftl_cap_chunk_st arg;
+    struct nvm_ftl_chunk *chk = NULL;
+    LnvmChunkDesc *desc = NULL;
+    uint64_t *prp = NULL, off, len, tot, pgoff, sz, xfer;
+    uint32_t npg, pg, idx, first, last, pu_idx, d;
+    uint8_t *buf;
+    uint16_t ret;
+
+    len = ((uint64_t) ((cmd->cdw10 >> 16) | ((cmd->cdw11 & 0xffff) << 16))
+                                                                     + 1) << 2;
+    off = ((uint64_t) cmd->cdw13 << 32) | cmd->cdw12;
+    tot = (uint64_t) id->num_grp * id->num_pu * id->num_chk * LNVM_CHK_DESC_SZ;
+
+    if (off >= tot || off & 0x3 || !cmd->prp1)
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    len = MIN(len, tot - off);
+    first = off / LNVM_CHK_DESC_SZ;
+    last = (off + len - 1) / LNVM_CHK_DESC_SZ;
+
+    ret = NVME_INTERNAL_DEV_ERROR;
+    desc = calloc(last - first + 1, sizeof(LnvmChunkDesc));
+    chk = malloc(sizeof(struct nvm_ftl_chunk) * id->num_chk);
+    if (!desc || !chk)
+        goto out;
+
+    pu_idx = UINT32_MAX;
+    for (idx = first; idx <= last; idx++) {
+        if (idx / id->num_chk != pu_idx) {
+            pu_idx = idx / id->num_chk;
+            arg.ppa.ppa = 0;
+            arg.ppa.g.ch = pu_idx / id->num_pu;
+            arg.ppa.g.lun = pu_idx % id->num_pu;
+            arg.nchk = id->num_chk;
+            arg.chk = chk;
+            if (nvm_ftl_cap_exec(FTL_CAP_GET_CHUNK, (void *) &arg))
+                goto out;
+        }
+
+        d = idx - first;
+        desc[d].state = chk[idx % id->num_chk].state;
+        desc[d].type = LNVM_CHK_TP_W_SEQ;
+        desc[d].wli = MIN(chk[idx % id->num_chk].erase_count, 0xff);
+        desc[d].slba = lnvm_chunk20_slba(ln, pu_idx / id->num_pu,
+                                     pu_idx % id->num_pu, idx % id->num_chk);
+        desc[d].cnlb = id->clba;
+        desc[d].wp = desc[d].slba + chk[idx % id->num_chk].wp;
+    }
+
+    ret = lnvm_map_prp(n, cmd->prp1, cmd->prp2, len, &prp, &npg);
+    if (ret)
+        goto out;
+
+    buf = (uint8_t *) desc + (off % LNVM_CHK_DESC_SZ);
+    pgoff = cmd->prp1 & (n->page_size - 1);
+    for (pg = 0, xfer = 0; pg < npg && xfer < len; pg++) {
+        sz = MIN(n->page_size - pgoff, len - xfer);
+        if (nvme_write_to_host(buf + xfer, prp[pg], sz)) {
+            ret = NVME_DATA_TRAS_ERROR;
+            break;
+        }
+        xfer += sz;
+        pgoff = 0;
+    }
+
+out:
+    free(prp);
+    free(chk);
+    free(desc);
+    return ret;
+}
+
 uint16_t lnvm_erase_sync(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     NvmeRequest *req)
 {
-    uint8_t i;
+    uint8_t i, pl;
     LnvmRwCmd *dm = (LnvmRwCmd *)cmd;
+    LnvmCtrl *ln = &n->lightnvm_ctrl;
+    uint8_t n_pl = ln->params.num_pln;
     uint64_t spba = dm->spba;
     uint32_t nlb = dm->nlb + 1;
     struct nvm_ppa_addr *psl = req->nvm_io.ppalist;
+    struct nvm_ppa_addr chk_ppa;
+
+    /* Open-Channel 2.0 vector reset takes chunks, erased in all planes */
+    uint32_t max_blks = (core.ocssd2) ? 64 / n_pl : n_pl;
 
-    if (nlb > LNVM_PLANES) {
+    if (nlb > max_blks) {
         log_info( "[ERROR lnvm: Wrong erase n of blocks (%d). "
-                "Max: %d supported]\n", nlb, LNVM_PLANES);
+                "Max: %d supported]\n", nlb, max_blks);
         return NVME_INVALID_FIELD | NVME_DNR;
     } else if (nlb > 1) {
         if (spba == LNVM_PBA_UNMAPPED || !spba)
@@ -218,9 +487,23 @@ uint16_t lnvm_erase_sync(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
         psl[0].ppa = spba;
     }
 
+    /* From the last chunk, so the list is expanded in place */
+    if (core.ocssd2) {
+        for (i = nlb; i-- > 0; ) {
+            chk_ppa.ppa = psl[i].ppa;
+            if (lnvm_lba20_to_ppa(ln, &chk_ppa))
+                return NVME_INVALID_FIELD | NVME_DNR;
+            for (pl = 0; pl < n_pl; pl++) {
+                psl[i * n_pl + pl].ppa = chk_ppa.ppa;
+                psl[i * n_pl + pl].g.pl = pl;
+            }
+        }
+        nlb = nlb * n_pl;
+    }
+
     /* In case of single PPA, we make the vector for multiple planes */
-    if (nlb < LNVM_PLANES) {
-        nlb = LNVM_PLANES;
+    if (nlb < n_pl) {
+        nlb = n_pl;
         for (i = 1; i < nlb; i++) {
             psl[i].ppa = psl[0].ppa;
             psl[i].g.pl = i;
@@ -274,68 +557,27 @@ static inline uint64_t nvme_gen_to_dev_addr(LnvmCtrl *ln,struct nvm_ppa_addr *r)
     return ret;
 }
 
-uint16_t lnvm_rw(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd, NvmeRequest *req)
+/*
+ * Groups the PPA vector in page commands and submits it to the FTL. PPAs and
+ * PRPs must be set in req->nvm_io. 'oob' is the metadata size per sector,
+ * metadata is transferred from/to 'meta' if not zero.
+ */
+static uint16_t lnvm_rw_submit(NvmeNamespace *ns, NvmeRequest *req,
+               uint16_t cid, uint32_t nlb, uint32_t sec_sz, uint64_t meta,
+                                                                 uint16_t oob)
 {
     int i, pg, nsec;
-    uint64_t sppa, eppa, moff;
-
-    LnvmCtrl *ln = &n->lightnvm_ctrl;
-    LnvmRwCmd *lrw = (LnvmRwCmd *)cmd;
+    uint64_t moff;
     struct nvm_ppa_addr *psl = req->nvm_io.ppalist;
+    uint64_t meta_size = (meta) ? (uint64_t) oob * nlb : 0;
 
-    uint32_t nlb  = lrw->nlb + 1;
-    uint64_t spba = lrw->spba;
-    uint64_t meta = lrw->metadata;
-
-    uint8_t lba_index = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
-    uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
-    uint16_t oob = ns->id_ns.lbaf[lba_index].ms;
-    uint64_t data_size = nlb << data_shift;
-    uint32_t n_sectors = data_size / LNVM_SECSZ;
-
-    uint64_t meta_size = oob * nlb;
-
-    uint16_t is_write = (lrw->opcode == LNVM_CMD_PHYS_WRITE ||
-                                          lrw->opcode == LNVM_CMD_HYBRID_WRITE);
-
-    if (n_sectors > ln->params.max_sec_per_rq || n_sectors > 64) {
-
-        log_info( "[ERROR lnvm: npages too large (%u). "
-                "Max:%u supported]\n", n_sectors, ln->params.max_sec_per_rq);
-        return NVME_INVALID_FIELD | NVME_DNR;
-
-    } else if (n_sectors > 1) {
-        if (spba == LNVM_PBA_UNMAPPED || !spba)
-            return NVME_INVALID_FIELD | NVME_DNR;
-
-        nvme_read_from_host((void *)psl, spba, n_sectors * sizeof(uint64_t));
-    } else {
-        psl[0].ppa = spba;
-    }
-
-    req->is_write = is_write;
-
-    sppa = eppa = nvme_gen_to_dev_addr(ln, &psl[0]);
-    if (n_sectors > 1)
-        eppa = nvme_gen_to_dev_addr(ln, &psl[n_sectors - 1]);
-
-    req->nvm_io.prp[0] = lrw->prp1;
-
-    if (n_sectors == 2)
-        req->nvm_io.prp[1] = lrw->prp2;
-    else if (n_sectors > 2)
-        nvme_read_from_host((void *)(&req->nvm_io.prp[1]), lrw->prp2,
-                                             (n_sectors-1) * sizeof(uint64_t));
-
-    meta_size = (meta) ? meta_size : 0;
-    req->slba = sppa;
     req->meta_size = meta_size;
     req->status = NVME_SUCCESS;
     req->nlb = nlb;
     req->ns = ns;
 
-    req->nvm_io.cid = lrw->cid;
-    req->nvm_io.sec_sz = (1 << data_shift);
+    req->nvm_io.cid = cid;
+    req->nvm_io.sec_sz = sec_sz;
     req->nvm_io.md_sz = meta_size;
     req->nvm_io.cmdtype = (req->is_write) ? MMGR_WRITE_PG : MMGR_READ_PG;
     req->nvm_io.n_sec = nlb;
@@ -382,11 +624,178 @@ uint16_t lnvm_rw(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd, NvmeRequest *req)
 
     if (core.debug)
         lnvm_debug_print_io (req->nvm_io.ppalist, req->nvm_io.prp,
-                                req->nvm_io.md_prp, nlb, data_size, meta_size);
+                  req->nvm_io.md_prp, nlb, (uint64_t) nlb * sec_sz, meta_size);
 
     return nvm_submit_ftl(&req->nvm_io);
 }
 
+/* Reads a PPA vector from the host, a single PPA is given in the command */
+static uint16_t lnvm_read_ppa_list(LnvmCtrl *ln, struct nvm_ppa_addr *psl,
+                                                uint64_t addr, uint32_t nlb)
+{
+    uint32_t i;
+
+    if (nlb > 1) {
+        if (addr == LNVM_PBA_UNMAPPED || !addr)
+            return NVME_INVALID_FIELD | NVME_DNR;
+
+        nvme_read_from_host((void *)psl, addr, nlb * sizeof(uint64_t));
+    } else {
+        psl[0].ppa = addr;
+    }
+
+    if (core.ocssd2) {
+        for (i = 0; i < nlb; i++) {
+            if (lnvm_lba20_to_ppa(ln, &psl[i])) {
+                log_info( "[ERROR lnvm: Invalid 2.0 address 0x%016lx]\n",
+                                                               psl[i].ppa);
+                return NVME_INVALID_FIELD | NVME_DNR;
+            }
+        }
+    }
+
+    return NVME_SUCCESS;
+}
+
+uint16_t lnvm_rw(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd, NvmeRequest *req)
+{
+    uint16_t ret;
+
+    LnvmCtrl *ln = &n->lightnvm_ctrl;
+    LnvmRwCmd *lrw = (LnvmRwCmd *)cmd;
+    struct nvm_ppa_addr *psl = req->nvm_io.ppalist;
+
+    uint32_t nlb  = lrw->nlb + 1;
+    uint64_t spba = lrw->spba;
+    uint64_t meta = lrw->metadata;
+
+    uint8_t lba_index = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
+    uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
+    uint16_t oob = ns->id_ns.lbaf[lba_index].ms;
+    uint64_t data_size = nlb << data_shift;
+    uint32_t n_sectors = data_size / LNVM_SECSZ;
+
+    uint16_t is_write = (lrw->opcode == LNVM_CMD_PHYS_WRITE ||
+                                          lrw->opcode == LNVM_CMD_HYBRID_WRITE);
+
+    if (n_sectors > ln->params.max_sec_per_rq || n_sectors > 64) {
+
+        log_info( "[ERROR lnvm: npages too large (%u). "
+                "Max:%u supported]\n", n_sectors, ln->params.max_sec_per_rq);
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    }
+
+    ret = lnvm_read_ppa_list(ln, psl, spba, n_sectors);
+    if (ret)
+        return ret;
+
+    req->is_write = is_write;
+    req->slba = nvme_gen_to_dev_addr(ln, &psl[0]);
+
+    req->nvm_io.prp[0] = lrw->prp1;
+
+    if (n_sectors == 2)
+        req->nvm_io.prp[1] = lrw->prp2;
+    else if (n_sectors > 2)
+        nvme_read_from_host((void *)(&req->nvm_io.prp[1]), lrw->prp2,
+                                             (n_sectors-1) * sizeof(uint64_t));
+
+    return lnvm_rw_submit(ns, req, lrw->cid, nlb, (1 << data_shift), meta, oob);
+}
+
+/*
+ * Vector copy: the source sectors are read into controller memory, data and
+ * OOB, and written to the destination sectors by the same request when the
+ * read completes (see lnvm_copy_cb). Only the PPA lists cross PCIe.
+ *
+ * 'copy_buf' layout: destination PPAs, data, OOB.
+ */
+uint16_t lnvm_copy(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
+                                                              NvmeRequest *req)
+{
+    LnvmCtrl *ln = &n->lightnvm_ctrl;
+    LnvmRwCmd *lrw = (LnvmRwCmd *)cmd;
+    struct nvm_ppa_addr *dst;
+    uint32_t i, nlb = lrw->nlb + 1;
+    uint8_t *data, *oob;
+    uint16_t ret;
+
+    req->nvm_io.status.status = NVM_IO_NEW;
+    req->is_write = 0;
+
+    if (nlb > ln->params.max_sec_per_rq || nlb > 64) {
+        log_info( "[ERROR lnvm: copy too large (%u). "
+                      "Max:%u supported]\n", nlb, ln->params.max_sec_per_rq);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    req->copy_buf = g_malloc(LNVM_COPY_BUF_SZ(nlb));
+    dst = (struct nvm_ppa_addr *) req->copy_buf;
+    data = req->copy_buf + nlb * sizeof(uint64_t);
+    oob = data + nlb * LNVM_SECSZ;
+
+    /* The destination list (DW14-15) is kept until the read completes */
+    ret = lnvm_read_ppa_list(ln, req->nvm_io.ppalist, lrw->spba, nlb);
+    if (ret)
+        goto FREE;
+    ret = lnvm_read_ppa_list(ln, dst, lrw->slba, nlb);
+    if (ret)
+        goto FREE;
+
+    for (i = 0; i < nlb; i++)
+        req->nvm_io.prp[i] = ((uint64_t) (data + i * LNVM_SECSZ)) |
+                                                                 NVM_PRP_LOCAL;
+
+    req->slba = nvme_gen_to_dev_addr(ln, &req->nvm_io.ppalist[0]);
+
+    ret = lnvm_rw_submit(ns, req, lrw->cid, nlb, LNVM_SECSZ,
+                             ((uint64_t) oob) | NVM_PRP_LOCAL, LNVM_SEC_OOBSZ);
+
+    /* If the buffer was not released by the callback, the cmd is not queued */
+    if (ret != NVME_NO_COMPLETE && req->copy_buf)
+        goto FREE;
+
+    return ret;
+
+FREE:
+    g_free(req->copy_buf);
+    req->copy_buf = NULL;
+    return ret;
+}
+
+/*
+ * Called when a copy phase completes. Returns 1 if the write phase was
+ * submitted, the completion is then posted when the write completes.
+ */
+int lnvm_copy_cb(NvmeRequest *req)
+{
+    uint32_t nlb = req->nlb;
+    uint8_t *oob = req->copy_buf + nlb * (sizeof(uint64_t) + LNVM_SECSZ);
+    uint16_t ret;
+
+    if (req->status != NVME_SUCCESS || req->is_write)
+        goto FREE;
+
+    /* Data PRPs are kept, sector i is written from the same buffer */
+    memcpy(req->nvm_io.ppalist, req->copy_buf, nlb * sizeof(uint64_t));
+    req->is_write = 1;
+
+    ret = lnvm_rw_submit(req->ns, req, req->nvm_io.cid, nlb, LNVM_SECSZ,
+                             ((uint64_t) oob) | NVM_PRP_LOCAL, LNVM_SEC_OOBSZ);
+
+    /* Queued, or completed with error by the FTL (buffer already released) */
+    if (ret == NVME_NO_COMPLETE || !req->copy_buf)
+        return 1;
+
+    req->status = ret;
+
+FREE:
+    g_free(req->copy_buf);
+    req->copy_buf = NULL;
+    return 0;
+}
+
 static int lightnvm_flush_tbls(NvmeCtrl *n)
 {
     /* TODO */
@@ -418,16 +827,64 @@ void lnvm_init_id_ctrl(LnvmIdCtrl *ln_id)
     ppaf->blk_offset  += ppaf->pg_offset + ppaf->pg_len;
 }
 
+static uint8_t lnvm_addr_bits(uint32_t n)
+{
+    uint8_t bits = 0;
+
+    while ((1ULL << bits) < n)
+        bits++;
+
+    return bits;
+}
+
+/* Open-Channel 2.0 geometry, built from the 1.2 parameters */
+static void lnvm_init_id_ctrl20(LnvmCtrl *ln)
+{
+    LnvmIdCtrl20 *id = &ln->id_ctrl20;
+
+    memset(id, 0, sizeof(LnvmIdCtrl20));
+
+    id->mjr = LNVM_VER_ID_20;
+    id->mnr = 0;
+    id->num_grp = ln->params.num_ch;
+    id->num_pu = ln->params.num_lun;
+    id->num_chk = ln->params.num_blk;
+    id->clba = ln->params.pgs_per_blk * ln->params.sec_per_phys_pl;
+
+    id->lbaf.grp_len = lnvm_addr_bits(id->num_grp);
+    id->lbaf.pu_len = lnvm_addr_bits(id->num_pu);
+    id->lbaf.chk_len = lnvm_addr_bits(id->num_chk);
+    id->lbaf.lbk_len = lnvm_addr_bits(id->clba);
+
+    /* Writes must cover a page in all planes */
+    id->ws_min = ln->params.sec_per_phys_pl;
+    id->ws_opt = ln->params.sec_per_phys_pl;
+    id->mw_cunits = 0;
+    id->maxoc = 0;
+    id->maxocpu = 0;
+
+    id->trdt = LNVM_TRDT;
+    id->trdm = LNVM_TRDM;
+    id->twrt = LNVM_TPRT;
+    id->twrm = LNVM_TPRM;
+    id->tcrst = LNVM_TBET;
+    id->tcrsm = LNVM_TBEM;
+}
+
 uint16_t lnvm_identity(NvmeCtrl *n, NvmeCmd *cmd)
 {
     NvmeIdentify *c = (NvmeIdentify *)cmd;
     uint64_t prp1 = c->prp1;
 
     LnvmIdCtrl *id = &n->lightnvm_ctrl.id_ctrl;
-    if (prp1)
-        return nvme_write_to_host(id, prp1, sizeof (LnvmIdCtrl));
+    if (!prp1)
+        return NVME_SUCCESS;
 
-    return NVME_SUCCESS;
+    if (core.ocssd2)
+        return nvme_write_to_host(&n->lightnvm_ctrl.id_ctrl20, prp1,
+                                                        sizeof (LnvmIdCtrl20));
+
+    return nvme_write_to_host(id, prp1, sizeof (LnvmIdCtrl));
 }
 
 void lightnvm_exit(NvmeCtrl *n)
@@ -502,6 +959,9 @@ int lnvm_init(NvmeCtrl *n)
         ln->params.sec_per_log_pl = ln->params.sec_per_lun * c->num_lun;
         ln->params.total_secs = ln->params.sec_per_log_pl;
 
+        if (core.ocssd2)
+            lnvm_init_id_ctrl20(ln);
+
         log_info("   [lnvm: Namespace %d]\n",i);
         log_info("    [lnvm: Channels: %d]\n",c->num_ch);
         log_info("    [lnvm: LUNs per Channel: %d]\n",c->num_lun);
@@ -92,7 +92,7 @@ static int dfcnand_dma_helper (io_cmd *cmd)
 {
     uint32_t dma_sz;
     int dma_sec, c = 0, ret = 0;
-    uint64_t prp;
+    uint64_t prp, ts;
     uint8_t direction;
     struct nvm_mmgr_io_cmd *nvm_cmd =
                            (struct nvm_mmgr_io_cmd *) cmd->dfc_io.nvm_mmgr_io;
@@ -111,6 +111,7 @@ static int dfcnand_dma_helper (io_cmd *cmd)
     }
 
     dma_sec = nvm_cmd->n_sectors + 1;
+    ts = ox_lat_ts ();
     for (; c < dma_sec; c++) {
         dma_sz = (c == dma_sec - 1) ? nvm_cmd->md_sz : nvm_cmd->sec_sz;
         prp = (c == dma_sec - 1) ? nvm_cmd->md_prp : nvm_cmd->prp[c];
@@ -119,6 +120,8 @@ static int dfcnand_dma_helper (io_cmd *cmd)
                                 nvm_cmd->sec_sz * c), prp, dma_sz, direction);
         if (ret) break;
     }
+    ox_lat_add (OX_LAT_DMA, ox_lat_op (nvm_cmd->cmdtype),
+                                                      nvm_cmd->ppa.g.ch, ts);
 
     return ret;
 }
@@ -3,71 +3,115 @@
 #include <mqueue.h>
 #include <syslog.h>
 #include "volt.h"
-#include "hw/block/ox-ctrl/include/uatomic.h"
 #include "hw/block/ox-ctrl/include/ssd.h"
 #include "hw/block/ox-ctrl/include/ox-mq.h"
+#include "qemu/host-utils.h"
+
+struct volt_state {
+    /* DMA slots per channel, a set bit in prp_map is a slot in use. Slots
+     * are taken and released with atomic operations, the mutex and condition
+     * are only used to sleep when all slots of a channel are busy */
+    uint32_t                    *prp_map;
+    uint32_t                    *prp_waiters;
+    pthread_mutex_t             *prpmap_mutex;
+    pthread_cond_t              *prpmap_cond;
+
+    VoltCtrl                    *volt;
+    struct nvm_mmgr             volt_mmgr;
+    struct nvm_mmgr_geometry    volt_geo;
+    void                        **dma_buf;
+    char                        *volt_disk;
+};
 
-static u_atomic_t       nextprp[VOLT_CHIP_COUNT];
-static pthread_mutex_t  prpmap_mutex[VOLT_CHIP_COUNT];
-static uint32_t         prp_map[VOLT_CHIP_COUNT];
+#define volt_st (*(struct volt_state *) ox_state (OX_ST_VOLT, \
+                                                sizeof (struct volt_state)))
 
-static VoltCtrl             *volt;
-static struct nvm_mmgr      volt_mmgr;
-static void                 **dma_buf;
-extern struct core_struct   core;
+static int volt_start_prp_map(void)
+{
+    int i, n_ch = volt_st.volt_mmgr.geometry->n_of_ch;
 
-static const char *volt_disk = "volt_disk";
+    QEMU_BUILD_BUG_ON(VOLT_DMA_SLOT_CH > 32);
 
-static int volt_start_prp_map(void)
+    volt_st.prp_map = g_new0 (uint32_t, n_ch);
+    volt_st.prp_waiters = g_new0 (uint32_t, n_ch);
+    volt_st.prpmap_mutex = g_new0 (pthread_mutex_t, n_ch);
+    volt_st.prpmap_cond = g_new0 (pthread_cond_t, n_ch);
+
+    for (i = 0; i < n_ch; i++) {
+        pthread_mutex_init (&volt_st.prpmap_mutex[i], NULL);
+        pthread_cond_init (&volt_st.prpmap_cond[i], NULL);
+    }
+
+    return 0;
+}
+
+static void volt_free_prp_map(void)
 {
     int i;
 
-    for (i = 0; i < VOLT_CHIP_COUNT; i++) {
-        nextprp[i].counter = U_ATOMIC_INIT_RUNTIME(0);
-        pthread_mutex_init (&prpmap_mutex[i], NULL);
-        atomic_mb_set(&prp_map[i], 0);
+    for (i = 0; i < volt_st.volt_mmgr.geometry->n_of_ch; i++) {
+        pthread_mutex_destroy(&volt_st.prpmap_mutex[i]);
+        pthread_cond_destroy(&volt_st.prpmap_cond[i]);
     }
 
-    return 0;
+    g_free (volt_st.prp_map);
+    g_free (volt_st.prp_waiters);
+    g_free (volt_st.prpmap_mutex);
+    g_free (volt_st.prpmap_cond);
 }
 
-static void volt_set_prp_map(uint32_t index, uint32_t ch, uint8_t flag)
+static inline uint32_t volt_prp_full (void)
 {
-    pthread_mutex_lock(&prpmap_mutex[ch]);
-    prp_map[ch] = (flag)
-            ? prp_map[ch] | (1 << (index - 1))
-            : prp_map[ch] ^ (1 << (index - 1));
-    pthread_mutex_unlock(&prpmap_mutex[ch]);
+    return (VOLT_DMA_SLOT_CH == 32) ? ~0U : (1U << VOLT_DMA_SLOT_CH) - 1;
 }
 
-static uint32_t volt_get_next_prp(struct volt_dma *dma, uint32_t ch){
-    uint32_t next = 0;
+/* Releases the slot held by 'dma', if any. Safe to call twice for the same
+ * command (request timeout followed by the completion) */
+static void volt_put_prp(struct volt_dma *dma, uint32_t ch)
+{
+    uint32_t index = atomic_xchg(&dma->prp_index, 0);
+
+    if (!index)
+        return;
+
+    atomic_and(&volt_st.prp_map[ch], ~(1U << (index - 1)));
+
+    if (atomic_read(&volt_st.prp_waiters[ch])) {
+        pthread_mutex_lock(&volt_st.prpmap_mutex[ch]);
+        pthread_cond_broadcast(&volt_st.prpmap_cond[ch]);
+        pthread_mutex_unlock(&volt_st.prpmap_mutex[ch]);
+    }
+}
+
+/* Waiters are counted before checking the map, a slot released after the
+ * check finds the waiter and wakes it up under the mutex */
+static void volt_wait_prp(uint32_t ch)
+{
+    pthread_mutex_lock(&volt_st.prpmap_mutex[ch]);
+    atomic_inc(&volt_st.prp_waiters[ch]);
+    while (atomic_read(&volt_st.prp_map[ch]) == volt_prp_full ())
+        pthread_cond_wait(&volt_st.prpmap_cond[ch], &volt_st.prpmap_mutex[ch]);
+    atomic_dec(&volt_st.prp_waiters[ch]);
+    pthread_mutex_unlock(&volt_st.prpmap_mutex[ch]);
+}
+
+static uint32_t volt_get_next_prp(struct volt_dma *dma, uint32_t ch)
+{
+    uint32_t map, slot;
 
     do {
-        pthread_mutex_lock(&prpmap_mutex[ch]);
-
-        next = u_atomic_read(&nextprp[ch]);
-        if (next == VOLT_DMA_SLOT_CH)
-            next = 1;
-        else
-            next++;
-        u_atomic_set(&nextprp[ch], next);
-
-        if (prp_map[ch] & (1 << (next - 1))) {
-            pthread_mutex_unlock(&prpmap_mutex[ch]);
-            usleep(1);
+        map = atomic_read(&volt_st.prp_map[ch]);
+        if (map == volt_prp_full ()) {
+            volt_wait_prp(ch);
             continue;
         }
+        slot = ctz32(~map);
+    } while (atomic_cmpxchg(&volt_st.prp_map[ch], map,
+                                                 map | (1U << slot)) != map);
 
-        /* set prp_map instantly */
-        prp_map[ch] |= 1 << (next - 1);
-
-        pthread_mutex_unlock(&prpmap_mutex[ch]);
+    dma->prp_index = slot + 1;
 
-        dma->prp_index = next;
-
-        return next - 1;
-    } while (1);
+    return slot;
 }
 
 static VoltBlock *volt_get_block(struct nvm_ppa_addr addr){
@@ -75,22 +119,22 @@ static VoltBlock *volt_get_block(struct nvm_ppa_addr addr){
     VoltLun *lun;
     VoltBlock *blk;
 
-    ch = &volt->channels[addr.g.ch];
+    ch = &volt_st.volt->channels[addr.g.ch];
     lun = &ch->lun_offset[addr.g.lun];
-    blk = &lun->blk_offset[addr.g.blk * volt_mmgr.geometry->n_of_planes +
-                                                                    addr.g.pl];
+    blk = &lun->blk_offset[addr.g.blk *
+                        volt_st.volt_mmgr.geometry->n_of_planes + addr.g.pl];
     return blk;
 }
 
 static uint64_t volt_add_mem(uint64_t bytes)
 {
-    volt->status.allocated_memory += bytes;
+    volt_st.volt->status.allocated_memory += bytes;
     return bytes;
 }
 
 static void volt_sub_mem(uint64_t bytes)
 {
-    volt->status.allocated_memory -= bytes;
+    volt_st.volt->status.allocated_memory -= bytes;
 }
 
 static void *volt_alloc (uint64_t sz)
@@ -106,7 +150,7 @@ static void volt_free (void *ptr, uint64_t sz)
 
 static void volt_free_page_data(VoltPage *pg)
 {
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
     volt_free (pg->data, geo->pg_size + (geo->sec_oob_sz * geo->sec_per_pg));
 }
 
@@ -114,7 +158,7 @@ static void volt_free_block_data (VoltBlock *blk)
 {
     int i_pg;
 
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
 
     for (i_pg = 0; i_pg < geo->pg_per_blk; i_pg++)
         volt_free_page_data (&blk->pages[i_pg]);
@@ -125,55 +169,58 @@ static void volt_free_block_data (VoltBlock *blk)
 static void volt_free_blocks (int nblk, int npg_lb, int free_pg_lb)
 {
     int i_blk, i_pg;
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
 
     int total_blk = geo->n_of_planes * geo->blk_per_lun * geo->lun_per_ch *
                                                                    geo->n_of_ch;
     /* Free pages in the completed allocated blocks */
     for (i_blk = 0; i_blk < nblk; i_blk++)
-        volt_free_block_data (&volt->blocks[i_blk]);
+        volt_free_block_data (&volt_st.volt->blocks[i_blk]);
 
     /* Free pages in the last failed block */
     for (i_pg = 0; i_pg < npg_lb; i_pg++)
-        volt_free_page_data (&volt->blocks[nblk].pages[i_pg]);
+        volt_free_page_data (&volt_st.volt->blocks[nblk].pages[i_pg]);
 
     if (free_pg_lb)
-        volt_free (volt->blocks[nblk].pages,sizeof(VoltPage) * geo->pg_per_blk);
+        volt_free (volt_st.volt->blocks[nblk].pages,
+                                        sizeof(VoltPage) * geo->pg_per_blk);
 
-    volt_free (volt->blocks, sizeof(VoltBlock) * total_blk);
+    volt_free (volt_st.volt->blocks, sizeof(VoltBlock) * total_blk);
 }
 
 static void volt_free_luns (int tot_blk)
 {
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
     int total_luns = geo->lun_per_ch * geo->n_of_ch;
 
     volt_free_blocks(tot_blk, 0, 0);
-    volt_free (volt->luns, sizeof (VoltLun) * total_luns);
+    volt_free (volt_st.volt->luns, sizeof (VoltLun) * total_luns);
 }
 
 static void volt_free_channels (int tot_blk)
 {
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
 
     volt_free_luns(tot_blk);
-    volt_free (volt->channels, sizeof (VoltCh) * geo->n_of_ch);
+    volt_free (volt_st.volt->channels, sizeof (VoltCh) * geo->n_of_ch);
 }
 
 static void volt_free_dma_buf (void)
 {
     int slots;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
+    uint32_t n_slots = VOLT_DMA_SLOT_CH * geo->n_of_ch;
 
-    for (slots = 0; slots < VOLT_DMA_SLOT_INDEX; slots++)
-        volt_free (dma_buf[slots], VOLT_PAGE_SIZE + VOLT_SECTOR_SIZE);
+    for (slots = 0; slots < n_slots; slots++)
+        volt_free (volt_st.dma_buf[slots], geo->pg_size + VOLT_SECTOR_SIZE);
 
-    volt_free (dma_buf, sizeof (void *) * VOLT_DMA_SLOT_INDEX);
-    volt_free (volt->edma, VOLT_PAGE_SIZE + VOLT_SECTOR_SIZE);
+    volt_free (volt_st.dma_buf, sizeof (void *) * n_slots);
+    volt_free (volt_st.volt->edma, geo->pg_size + VOLT_SECTOR_SIZE);
 }
 
 static void volt_clean_mem(void)
 {
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
     int tot_blk = geo->n_of_planes * geo->blk_per_lun * geo->lun_per_ch *
                                                                    geo->n_of_ch;
     volt_free_channels(tot_blk);
@@ -182,7 +229,7 @@ static void volt_clean_mem(void)
 
 static int volt_init_page(VoltPage *pg)
 {
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
 
     pg->state = 0;
     pg->data = volt_alloc(geo->pg_size + (geo->sec_oob_sz * geo->sec_per_pg));
@@ -194,19 +241,19 @@ static int volt_init_page(VoltPage *pg)
 
 static int volt_init_blocks(void)
 {
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
 
     int page_count = 0, pg_blk, blk_count = 0, free_pg;
     int i_blk, i_pg;
     int total_blk = geo->n_of_planes * geo->blk_per_lun * geo->lun_per_ch *
                                                                    geo->n_of_ch;
 
-    volt->blocks = volt_alloc(sizeof(VoltBlock) * total_blk);
-    if (!volt->blocks)
+    volt_st.volt->blocks = volt_alloc(sizeof(VoltBlock) * total_blk);
+    if (!volt_st.volt->blocks)
         return -1;
 
     for (i_blk = 0; i_blk < total_blk; i_blk++) {
-        VoltBlock *blk = &volt->blocks[i_blk];
+        VoltBlock *blk = &volt_st.volt->blocks[i_blk];
         blk->id = i_blk;
         blk->life = VOLT_BLK_LIFE;
 
@@ -239,16 +286,16 @@ FREE:
 static int volt_init_luns(void)
 {
     int i_lun;
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
     int total_luns = geo->lun_per_ch * geo->n_of_ch;
 
-    volt->luns = volt_alloc(sizeof (VoltLun) * total_luns);
-    if (!volt->luns)
+    volt_st.volt->luns = volt_alloc(sizeof (VoltLun) * total_luns);
+    if (!volt_st.volt->luns)
         return VOLT_MEM_ERROR;
 
     for (i_lun = 0; i_lun < total_luns; i_lun++)
-        volt->luns[i_lun].blk_offset =
-                    &volt->blocks[i_lun * geo->blk_per_lun * geo->n_of_planes];
+        volt_st.volt->luns[i_lun].blk_offset =
+          &volt_st.volt->blocks[i_lun * geo->blk_per_lun * geo->n_of_planes];
 
     return VOLT_MEM_OK;
 }
@@ -256,14 +303,15 @@ static int volt_init_luns(void)
 static int volt_init_channels(void)
 {
     int i_ch;
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
 
-    volt->channels = volt_alloc(sizeof (VoltCh) * geo->n_of_ch);
-    if (!volt->channels)
+    volt_st.volt->channels = volt_alloc(sizeof (VoltCh) * geo->n_of_ch);
+    if (!volt_st.volt->channels)
         return VOLT_MEM_ERROR;
 
     for (i_ch = 0; i_ch < geo->n_of_ch; i_ch++)
-        volt->channels[i_ch].lun_offset = &volt->luns[i_ch * geo->lun_per_ch];
+        volt_st.volt->channels[i_ch].lun_offset =
+                                    &volt_st.volt->luns[i_ch * geo->lun_per_ch];
 
     return VOLT_MEM_OK;
 }
@@ -271,18 +319,21 @@ static int volt_init_channels(void)
 static int volt_init_dma_buf (void)
 {
     int slots = 0, slots_i;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
+    uint32_t n_slots = VOLT_DMA_SLOT_CH * geo->n_of_ch;
+    uint32_t slot_sz = geo->pg_size + VOLT_SECTOR_SIZE;
 
-    volt->edma = volt_alloc(VOLT_PAGE_SIZE + VOLT_SECTOR_SIZE);
-    if (!volt->edma)
+    volt_st.volt->edma = volt_alloc(slot_sz);
+    if (!volt_st.volt->edma)
         return -1;
 
-    dma_buf = volt_alloc(sizeof (void *) * VOLT_DMA_SLOT_INDEX);
-    if (!dma_buf)
+    volt_st.dma_buf = volt_alloc(sizeof (void *) * n_slots);
+    if (!volt_st.dma_buf)
         goto FREE;
 
-    for (slots_i = 0; slots_i < VOLT_DMA_SLOT_INDEX; slots_i++) {
-        dma_buf[slots_i] = volt_alloc(VOLT_PAGE_SIZE + VOLT_SECTOR_SIZE);
-        if (!dma_buf[slots_i])
+    for (slots_i = 0; slots_i < n_slots; slots_i++) {
+        volt_st.dma_buf[slots_i] = volt_alloc(slot_sz);
+        if (!volt_st.dma_buf[slots_i])
             goto FREE_SLOTS;
         slots++;
     }
@@ -291,35 +342,19 @@ static int volt_init_dma_buf (void)
 
 FREE_SLOTS:
         for (slots_i = 0; slots_i < slots; slots_i++)
-            volt_free (dma_buf[slots_i], VOLT_PAGE_SIZE + VOLT_SECTOR_SIZE);
-        volt_free (dma_buf, sizeof (void *) * VOLT_DMA_SLOT_INDEX);
+            volt_free (volt_st.dma_buf[slots_i], slot_sz);
+        volt_free (volt_st.dma_buf, sizeof (void *) * n_slots);
 FREE:
-    volt_free (volt->edma, VOLT_PAGE_SIZE + VOLT_SECTOR_SIZE);
+    volt_free (volt_st.volt->edma, slot_sz);
     return -1;
 }
 
-/* Reorder the OOB data in case of single sector read */
-static void volt_oob_reorder (uint8_t *oob, uint32_t map)
-{
-    int i;
-    uint8_t oob_off = 0;
-    uint32_t meta_sz = LNVM_SEC_OOBSZ * VOLT_SECTOR_COUNT;
-
-    for (i = 0; i < VOLT_SECTOR_COUNT - 1; i++)
-        if (map & (1 << i))
-            memcpy (oob + oob_off,
-                    oob + oob_off + LNVM_SEC_OOBSZ,
-                    meta_sz - oob_off - LNVM_SEC_OOBSZ);
-        else
-            oob_off += LNVM_SEC_OOBSZ;
-}
-
 static int volt_host_dma_helper (struct nvm_mmgr_io_cmd *nvm_cmd)
 {
-    uint32_t dma_sz, sec_map = 0, dma_sec, c = 0, ret = 0;
+    uint32_t dma_sz, dma_sec, c = 0, ret = 0;
     uint64_t prp;
     uint8_t direction;
-    uint8_t *oob_addr;
+    uint64_t ts;
     struct volt_dma *dma = (struct volt_dma *) nvm_cmd->rsvd;
 
     switch (nvm_cmd->cmdtype) {
@@ -335,22 +370,15 @@ static int volt_host_dma_helper (struct nvm_mmgr_io_cmd *nvm_cmd)
             return -1;
     }
 
-    oob_addr = dma->virt_addr + nvm_cmd->sec_sz * nvm_cmd->n_sectors;
     dma_sec = nvm_cmd->n_sectors + 1;
 
+    ts = ox_lat_ts ();
     for (; c < dma_sec; c++) {
         dma_sz = (c == dma_sec - 1) ? nvm_cmd->md_sz : nvm_cmd->sec_sz;
         prp = (c == dma_sec - 1) ? nvm_cmd->md_prp : nvm_cmd->prp[c];
 
-        if (!prp) {
-            sec_map |= 1 << c;
+        if (!prp)
             continue;
-        }
-
-        /* Fix metadata per sector in case of reading single sector */
-        if (sec_map && nvm_cmd->cmdtype == MMGR_READ_PG &&
-                                            nvm_cmd->md_sz && c == dma_sec - 1)
-            volt_oob_reorder (oob_addr, sec_map);
 
         if (c == dma_sec - 1 && nvm_cmd->force_sync_md)
             direction = (nvm_cmd->cmdtype == MMGR_READ_PG)
@@ -360,6 +388,8 @@ static int volt_host_dma_helper (struct nvm_mmgr_io_cmd *nvm_cmd)
                                 nvm_cmd->sec_sz * c), prp, dma_sz, direction);
         if (ret) break;
     }
+    ox_lat_add (OX_LAT_DMA, ox_lat_op (nvm_cmd->cmdtype),
+                                                      nvm_cmd->ppa.g.ch, ts);
 
     return ret;
 }
@@ -384,7 +414,7 @@ static void volt_callback (void *opaque)
 
 OUT:
     if (nvm_cmd->cmdtype == MMGR_WRITE_PG || nvm_cmd->cmdtype == MMGR_READ_PG)
-        volt_set_prp_map(dma->prp_index, nvm_cmd->ppa.g.ch, 0x0);
+        volt_put_prp(dma, nvm_cmd->ppa.g.ch);
 
     nvm_callback(nvm_cmd);
 }
@@ -401,13 +431,45 @@ static void volt_nand_dma (void *paddr, void *buf, size_t sz, uint8_t dir)
     }
 }
 
+/* Copies the requested sectors of a page to the DMA slot. OOB of the
+ * requested sectors is gathered in sector order after the data, as expected
+ * by the FTLs for partial page reads. Full pages are copied at once. */
+static void volt_read_secs (VoltPage *pg, struct nvm_mmgr_io_cmd *cmd,
+                                                        struct volt_dma *dma)
+{
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
+    uint32_t oob_sz = geo->sec_oob_sz;
+    uint32_t full = (1 << cmd->n_sectors) - 1;
+    uint8_t *oob_dst = dma->virt_addr + cmd->sec_sz * cmd->n_sectors;
+    uint8_t *oob_src = pg->data + geo->pg_size;
+    uint32_t sec, n = 0;
+
+    /* No data sector requested (OOB only), or full page */
+    if (!dma->sec_map || dma->sec_map == full) {
+        if (dma->sec_map)
+            memcpy (dma->virt_addr, pg->data, cmd->sec_sz * cmd->n_sectors);
+        memcpy (oob_dst, oob_src, oob_sz * geo->sec_per_pg);
+        return;
+    }
+
+    for (sec = 0; sec < cmd->n_sectors; sec++) {
+        if (!(dma->sec_map & (1 << sec)))
+            continue;
+        memcpy (dma->virt_addr + cmd->sec_sz * sec,
+                                 pg->data + cmd->sec_sz * sec, cmd->sec_sz);
+        memcpy (oob_dst + oob_sz * n, oob_src + oob_sz * sec, oob_sz);
+        n++;
+    }
+    memset (oob_dst + oob_sz * n, 0, oob_sz * (geo->sec_per_pg - n));
+}
+
 static int volt_process_io (struct nvm_mmgr_io_cmd *cmd)
 {
     VoltBlock *blk;
     uint8_t dir;
     struct volt_dma *dma = (struct volt_dma *) cmd->rsvd;
-    uint32_t pg_size = volt_mmgr.geometry->pg_size +
-            (volt_mmgr.geometry->sec_oob_sz * volt_mmgr.geometry->sec_per_pg);
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
+    uint32_t pg_size = geo->pg_size + (geo->sec_oob_sz * geo->sec_per_pg);
     int pg_i;
 
     blk = volt_get_block(cmd->ppa);
@@ -416,7 +478,8 @@ static int volt_process_io (struct nvm_mmgr_io_cmd *cmd)
 
     switch (cmd->cmdtype) {
         case MMGR_READ_PG:
-            dir = VOLT_DMA_READ;
+            volt_read_secs (&blk->pages[cmd->ppa.g.pg], cmd, dma);
+            break;
         case MMGR_WRITE_PG:
             volt_nand_dma (blk->pages[cmd->ppa.g.pg].data,
                                                 dma->virt_addr, pg_size, dir);
@@ -428,7 +491,7 @@ static int volt_process_io (struct nvm_mmgr_io_cmd *cmd)
                 dma->status = 0;
                 return -1;
             }
-            for (pg_i = 0; pg_i < volt_mmgr.geometry->pg_per_blk; pg_i++)
+            for (pg_i = 0; pg_i < geo->pg_per_blk; pg_i++)
                 memset(blk->pages[pg_i].data, 0xff, pg_size);
 
             break;
@@ -452,8 +515,14 @@ static void volt_execute_io (struct ox_mq_entry *req)
     struct nvm_mmgr_io_cmd *cmd = (struct nvm_mmgr_io_cmd *) req->opaque;
     int ret, retry;
 
+    cmd->ts_media = ox_lat_add (OX_LAT_MMGR_QUEUE, ox_lat_op (cmd->cmdtype),
+                                                cmd->ppa.g.ch, cmd->ts_queue);
+
     ret = volt_process_io(cmd);
 
+    ox_lat_add (OX_LAT_MEDIA, ox_lat_op (cmd->cmdtype), cmd->ppa.g.ch,
+                                                               cmd->ts_media);
+
     if (ret && core.debug) {
         log_err ("[volt: Cmd 0x%x NOT completed. (%d/%d/%d/%d/%d)]\n",
                 cmd->cmdtype, cmd->ppa.g.ch, cmd->ppa.g.lun, cmd->ppa.g.blk,
@@ -467,7 +536,7 @@ static void volt_execute_io (struct ox_mq_entry *req)
 COMPLETE:
     retry = NVM_QUEUE_RETRY;
     do {
-        ret = ox_mq_complete_req(volt->mq, req);
+        ret = ox_mq_complete_req(volt_st.volt->mq, req);
         if (ret) {
             retry--;
             usleep (NVM_QUEUE_RETRY_SLEEP);
@@ -479,9 +548,12 @@ static int volt_enqueue_io (struct nvm_mmgr_io_cmd *io)
 {
     int ret, retry;
 
+    /* Write data is already transferred, only the queue wait is traced */
+    io->ts_queue = ox_lat_ts ();
+
     retry = 16;
     do {
-        ret = ox_mq_submit_req(volt->mq, io->ppa.g.ch, io);
+        ret = ox_mq_submit_req(volt_st.volt->mq, io->ppa.g.ch, io);
     	if (ret < 0)
             retry--;
         else if (core.debug)
@@ -498,29 +570,33 @@ static int volt_enqueue_io (struct nvm_mmgr_io_cmd *io)
 static int volt_prepare_rw (struct nvm_mmgr_io_cmd *cmd_nvm)
 {
     struct volt_dma *dma = (struct volt_dma *) cmd_nvm->rsvd;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
+    uint32_t i;
 
-    uint32_t sec_sz = volt_mmgr.geometry->pg_size /
-                                                volt_mmgr.geometry->sec_per_pg;
-    uint32_t pg_sz  = volt_mmgr.geometry->pg_size;
-    uint32_t oob_sz = volt_mmgr.geometry->sec_oob_sz *
-                                                volt_mmgr.geometry->sec_per_pg;
+    uint32_t sec_sz = geo->pg_size / geo->sec_per_pg;
+    uint32_t pg_sz  = geo->pg_size;
+    uint32_t oob_sz = geo->sec_oob_sz * geo->sec_per_pg;
+
+    /* No slot is held until volt_get_next_prp */
+    memset(dma, 0, sizeof(struct volt_dma));
 
     // For now we only accept up to 16K page size and 4K sector size + 1K OOB
     if (cmd_nvm->pg_sz > pg_sz || cmd_nvm->sec_sz != sec_sz ||
                                                     cmd_nvm->md_sz > oob_sz)
         return -1;
 
-    memset(dma, 0, sizeof(struct volt_dma));
-
-    uint32_t prp_map = volt_get_next_prp(dma, cmd_nvm->ppa.g.ch);
+    uint32_t slot = volt_get_next_prp(dma, cmd_nvm->ppa.g.ch);
 
-    dma->virt_addr = dma_buf[(cmd_nvm->ppa.g.ch * VOLT_DMA_SLOT_CH) + prp_map];
-
-    if (cmd_nvm->cmdtype == MMGR_READ_PG)
-        memset(dma->virt_addr, 0, pg_sz + sec_sz);
+    dma->virt_addr =
+                volt_st.dma_buf[(cmd_nvm->ppa.g.ch * VOLT_DMA_SLOT_CH) + slot];
 
     cmd_nvm->n_sectors = cmd_nvm->pg_sz / sec_sz;
 
+    /* Reads only move the sectors with a PRP */
+    for (i = 0; i < cmd_nvm->n_sectors; i++)
+        if (cmd_nvm->prp[i])
+            dma->sec_map |= 1 << i;
+
     if (cmd_nvm->cmdtype == MMGR_WRITE_PG) {
         if (volt_host_dma_helper (cmd_nvm))
             return -1;
@@ -543,7 +619,7 @@ static int volt_read_page (struct nvm_mmgr_io_cmd *cmd_nvm)
 
 CLEAN:
     log_err("[MMGR Read ERROR: NVM  returned -1]\n");
-    volt_set_prp_map(dma->prp_index, cmd_nvm->ppa.g.ch, 0x0);
+    volt_put_prp(dma, cmd_nvm->ppa.g.ch);
     cmd_nvm->status = NVM_IO_FAIL;
     return -1;
 }
@@ -562,7 +638,7 @@ static int volt_write_page (struct nvm_mmgr_io_cmd *cmd_nvm)
 
 CLEAN:
     log_err("[MMGR Write ERROR: DMA or NVM returned -1]\n");
-    volt_set_prp_map(dma->prp_index, cmd_nvm->ppa.g.ch, 0x0);
+    volt_put_prp(dma, cmd_nvm->ppa.g.ch);
     cmd_nvm->status = NVM_IO_FAIL;
     return -1;
 }
@@ -589,11 +665,12 @@ static int volt_get_ch_info (struct nvm_channel *ch, uint16_t nc)
 {
     int i, n, pl, nsp = 0, trsv;
     struct nvm_ppa_addr *ppa;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
 
     for(i = 0; i < nc; i++){
         ch[i].ch_mmgr_id = i;
-        ch[i].mmgr = &volt_mmgr;
-        ch[i].geometry = volt_mmgr.geometry;
+        ch[i].mmgr = &volt_st.volt_mmgr;
+        ch[i].geometry = volt_st.volt_mmgr.geometry;
 
         if (ch[i].i.in_use != NVM_CH_IN_USE) {
             ch[i].i.ns_id = 0x0;
@@ -602,13 +679,13 @@ static int volt_get_ch_info (struct nvm_channel *ch, uint16_t nc)
             ch[i].i.in_use = 0x0;
         }
 
-        ch[i].ns_pgs = VOLT_VIRTUAL_LUNS *
-                       VOLT_BLOCK_COUNT *
-                       VOLT_PLANE_COUNT *
-                       VOLT_PAGE_COUNT;
+        ch[i].ns_pgs = (uint64_t) geo->lun_per_ch *
+                       geo->blk_per_lun *
+                       geo->n_of_planes *
+                       geo->pg_per_blk;
 
         ch[i].mmgr_rsv = VOLT_RSV_BLK;
-        trsv = ch[i].mmgr_rsv * VOLT_PLANE_COUNT;
+        trsv = ch[i].mmgr_rsv * geo->n_of_planes;
         ch[i].mmgr_rsv_list = g_malloc (trsv * sizeof(struct nvm_ppa_addr));
 
         if (!ch[i].mmgr_rsv_list)
@@ -617,8 +694,8 @@ static int volt_get_ch_info (struct nvm_channel *ch, uint16_t nc)
         memset (ch[i].mmgr_rsv_list, 0, trsv * sizeof(struct nvm_ppa_addr));
 
         for (n = 0; n < ch[i].mmgr_rsv; n++) {
-            for (pl = 0; pl < VOLT_PLANE_COUNT; pl++) {
-                ppa = &ch[i].mmgr_rsv_list[VOLT_PLANE_COUNT * n + pl];
+            for (pl = 0; pl < geo->n_of_planes; pl++) {
+                ppa = &ch[i].mmgr_rsv_list[geo->n_of_planes * n + pl];
                 ppa->g.ch = ch[i].ch_mmgr_id;
                 ppa->g.lun = 0;
                 ppa->g.blk = n;
@@ -654,13 +731,13 @@ static void volt_req_timeout (void **opaque, int counter)
         /* During request timeout dma->prp_index is freed and
          * dma->virt_addr is redirected to the emergency pointer */
         if (cmd->cmdtype == MMGR_WRITE_PG || cmd->cmdtype == MMGR_READ_PG) {
-            dma->virt_addr = volt->edma;
-            volt_set_prp_map(dma->prp_index, cmd->ppa.g.ch, 0x0);
+            dma->virt_addr = volt_st.volt->edma;
+            volt_put_prp(dma, cmd->ppa.g.ch);
         }
     }
 }
 
-struct ox_mq_config volt_mq = {
+static const struct ox_mq_config volt_mq = {
     .n_queues   = VOLT_CHIP_COUNT,
     .q_size     = VOLT_QUEUE_SIZE,
     .sq_fn      = volt_execute_io,
@@ -670,31 +747,19 @@ struct ox_mq_config volt_mq = {
     .flags      = 0x0
 };
 
-/* DEBUG (disabled): Thread to show multi-queue statistics */
-static void *volt_queue_show (void *arg)
-{
-    /*
-    while (1) {
-        usleep (200000);
-        ox_mq_show_stats(volt->mq);
-    }
-    */
-
-    return NULL;
-}
-
 static int volt_disk_flush (void)
 {
     FILE *file;
     uint32_t blk_i, pg_i;
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
     uint32_t pg_sz = geo->pg_size + (geo->sec_oob_sz * geo->sec_per_pg);
     uint32_t tot_blk = geo->n_of_planes * geo->blk_per_lun * geo->lun_per_ch *
                                                                    geo->n_of_ch;
-    file = fopen(volt_disk, "w+");
+    file = fopen(volt_st.volt_disk, "w+");
     for (blk_i = 0; blk_i < tot_blk; blk_i++) {
         for (pg_i = 0; pg_i < geo->pg_per_blk; pg_i++) {
-            if (fwrite(volt->blocks[blk_i].pages[pg_i].data, pg_sz, 1, file)<1){
+            if (fwrite(volt_st.volt->blocks[blk_i].pages[pg_i].data,
+                                                       pg_sz, 1, file) < 1) {
                 fclose (file);
                 return -1;
             }
@@ -709,14 +774,15 @@ static int volt_disk_load (void)
 {
     FILE *file;
     uint32_t blk_i, pg_i;
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
     uint32_t pg_sz = geo->pg_size + (geo->sec_oob_sz * geo->sec_per_pg);
     uint32_t tot_blk = geo->n_of_planes * geo->blk_per_lun * geo->lun_per_ch *
                                                                    geo->n_of_ch;
-    file = fopen(volt_disk, "r");
+    file = fopen(volt_st.volt_disk, "r");
     for (blk_i = 0; blk_i < tot_blk; blk_i++) {
         for (pg_i = 0; pg_i < geo->pg_per_blk; pg_i++) {
-            if (fread(volt->blocks[blk_i].pages[pg_i].data, pg_sz, 1, file)<1) {
+            if (fread(volt_st.volt->blocks[blk_i].pages[pg_i].data,
+                                                       pg_sz, 1, file) < 1) {
                 fclose (file);
                 return -1;
             }
@@ -731,7 +797,7 @@ static int volt_init_disk (void)
 {
     FILE *file;
 
-    file = fopen(volt_disk, "r");
+    file = fopen(volt_st.volt_disk, "r");
     if (!file){
         printf(" [volt: Creating disk...]\n");
 
@@ -749,7 +815,7 @@ static int volt_init_disk (void)
     return 0;
 
 WERR:
-    remove (volt_disk);
+    remove (volt_st.volt_disk);
     printf(" [volt: Disk creation failed!]\n");
     return -1;
 RERR:
@@ -768,27 +834,40 @@ static void volt_exit (struct nvm_mmgr *mmgr)
     }
 
     volt_clean_mem();
-    volt->status.active = 0;
-    ox_mq_destroy(volt->mq);
+    volt_st.volt->status.active = 0;
+    ox_mq_destroy(volt_st.volt->mq);
+    volt_free_prp_map();
     for (i = 0; i < mmgr->geometry->n_of_ch; i++) {
-        pthread_mutex_destroy(&prpmap_mutex[i]);
         g_free(mmgr->ch_info[i].mmgr_rsv_list);
         free(mmgr->ch_info[i].ftl_rsv_list);
     }
-    g_free (volt);
+    g_free (volt_st.volt);
+    volt_st.volt = NULL;
+    g_free (volt_st.volt_disk);
+    volt_st.volt_disk = NULL;
+}
+
+/* Returns the memory allocated by VOLT in bytes, 0 if not running */
+uint64_t mmgr_volt_mem_usage (void)
+{
+    VoltCtrl *volt = volt_st.volt;
+
+    return (volt && volt->status.ready) ? volt->status.allocated_memory : 0;
 }
 
 static int volt_init(void)
 {
-    struct nvm_mmgr_geometry *geo = volt_mmgr.geometry;
+    struct ox_mq_config mq_config;
+    struct nvm_mmgr_geometry *geo = volt_st.volt_mmgr.geometry;
     int tot_blk = geo->n_of_planes * geo->blk_per_lun * geo->lun_per_ch *
                                                                    geo->n_of_ch;
 
-    volt = g_malloc (sizeof (VoltCtrl));
-    if (!volt)
+    volt_st.volt = g_malloc (sizeof (VoltCtrl));
+    if (!volt_st.volt)
         return -1;
 
-    volt->status.allocated_memory = 0;
+    volt_st.volt->status.allocated_memory = 0;
+    volt_st.volt->status.ready = 0;
 
     if (volt_start_prp_map())
         goto OUT;
@@ -816,30 +895,30 @@ static int volt_init(void)
         goto OUT;
     }
 
-    sprintf(volt_mq.name, "%s", "VOLT_MMGR");
-    volt->mq = ox_mq_init(&volt_mq);
-    if (!volt->mq) {
+    memcpy (&mq_config, &volt_mq, sizeof (struct ox_mq_config));
+    sprintf(mq_config.name, "%s", "VOLT_MMGR");
+    mq_config.n_queues = geo->n_of_ch;
+    volt_st.volt->mq = ox_mq_init(&mq_config);
+    if (!volt_st.volt->mq) {
         volt_clean_mem();
         goto OUT;
     }
 
-    /* DEBUG: Thread to show multi-queue statistics */
-    pthread_t debug_th;
-    pthread_create(&debug_th,NULL,volt_queue_show,NULL);
-
-    volt->status.ready = 1; /* ready to use */
+    volt_st.volt->status.ready = 1; /* ready to use */
 
     log_info(" [volt: Volatile memory usage: %lu Mb]\n",
-                                      volt->status.allocated_memory / 1048576);
+                              volt_st.volt->status.allocated_memory / 1048576);
     printf(" [volt: Volatile memory usage: %lu Mb]\n",
-                                      volt->status.allocated_memory / 1048576);
+                              volt_st.volt->status.allocated_memory / 1048576);
     return 0;
 
 OUT:
-    g_free (volt);
     printf(" [volt: Not initialized! Memory allocation failed.]\n");
     printf(" [volt: Volatile memory usage: %lu bytes.]\n",
-                                                volt->status.allocated_memory);
+                                        volt_st.volt->status.allocated_memory);
+    volt_free_prp_map();
+    g_free (volt_st.volt);
+    volt_st.volt = NULL;
     return -1;
 }
 
@@ -852,7 +931,7 @@ struct nvm_mmgr_ops volt_ops = {
     .set_ch_info    = volt_set_ch_info,
 };
 
-struct nvm_mmgr_geometry volt_geo = {
+static const struct nvm_mmgr_geometry volt_geo_default = {
     .n_of_ch        = VOLT_CHIP_COUNT,
     .lun_per_ch     = VOLT_VIRTUAL_LUNS,
     .blk_per_lun    = VOLT_BLOCK_COUNT,
@@ -863,19 +942,44 @@ struct nvm_mmgr_geometry volt_geo = {
     .sec_oob_sz     = VOLT_OOB_SIZE / VOLT_SECTOR_COUNT
 };
 
+/* Geometry set by the ox-ctrl properties, validated in ox_realize. The disk
+ * file of a non-volatile device is named after the device id */
+static void volt_set_geometry (QemuOxCtrl *qemu)
+{
+    const char *id = (qemu) ? DEVICE(qemu)->id : NULL;
+
+    memcpy (&volt_st.volt_geo, &volt_geo_default,
+                                        sizeof (struct nvm_mmgr_geometry));
+    g_free (volt_st.volt_disk);
+    volt_st.volt_disk = (id) ? g_strdup_printf ("volt_disk.%s", id) :
+                                                    g_strdup ("volt_disk");
+    if (!qemu)
+        return;
+
+    volt_st.volt_geo.n_of_ch     = qemu->channels;
+    volt_st.volt_geo.lun_per_ch  = qemu->luns;
+    volt_st.volt_geo.blk_per_lun = qemu->blocks;
+    volt_st.volt_geo.pg_per_blk  = qemu->pages;
+    volt_st.volt_geo.n_of_planes = qemu->planes;
+}
+
 int mmgr_volt_init(void)
 {
     int ret = 0;
 
-    volt_mmgr.name     = "VOLT";
-    volt_mmgr.ops      = &volt_ops;
-    volt_mmgr.geometry = &volt_geo;
+    volt_set_geometry (core.qemu);
+
+    volt_st.volt_mmgr.name     = "VOLT";
+    volt_st.volt_mmgr.ops      = &volt_ops;
+    volt_st.volt_mmgr.geometry = &volt_st.volt_geo;
 
     ret = volt_init();
     if(ret) {
         log_err(" [volt: Not possible to start VOLT.]\n");
+        g_free (volt_st.volt_disk);
+        volt_st.volt_disk = NULL;
         return -1;
     }
 
-    return nvm_register_mmgr(&volt_mmgr);
+    return nvm_register_mmgr(&volt_st.volt_mmgr);
 }
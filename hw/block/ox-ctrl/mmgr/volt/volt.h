@@ -9,6 +9,8 @@
 #define VOLT_MEM_OK         1
 #define VOLT_SECOND         1000000 /* from u-seconds */
 
+/* Default geometry, channels, LUNs, blocks, pages and planes can be changed
+ * by the ox-ctrl properties */
 #define VOLT_CHIP_COUNT      8
 #define VOLT_VIRTUAL_LUNS    4
 #define VOLT_BLOCK_COUNT     64
@@ -20,7 +22,6 @@
 #define VOLT_OOB_SIZE        0x40
 
 #define VOLT_DMA_SLOT_CH     32
-#define VOLT_DMA_SLOT_INDEX  VOLT_DMA_SLOT_CH * VOLT_CHIP_COUNT
 #define VOLT_DMA_READ        0x1
 #define VOLT_DMA_WRITE       0x2
 
@@ -47,7 +48,7 @@ typedef struct VoltPage {
 } VoltPage;
 
 typedef struct VoltBlock {
-    uint16_t        id;
+    uint32_t        id;
     uint16_t        life; /* available writes before die */
     VoltPage        *next_pg;
     VoltPage        *pages;
@@ -73,6 +74,7 @@ typedef struct VoltCtrl {
 struct volt_dma {
     uint8_t         *virt_addr;
     uint32_t        prp_index;
+    uint32_t        sec_map;  /* sectors with a PRP, bit per sector */
     uint8_t         status; /* nand status */
 };
 
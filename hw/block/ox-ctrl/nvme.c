@@ -11,14 +11,14 @@
 #include "hw/block/ox-ctrl/include/nvme.h"
 #include "hw/block/ox-ctrl/include/ox-ndp.h"
 #include <hw/pci/pci.h>
+#include "qemu/atomic.h"
 
 #include "hw/block/ox-ctrl/include/lightnvm.h"
 
-extern struct core_struct core;
-static uint64_t           nvm_ns_size;
-static NvmeCtrl           *nvm_nvme_ctrl;
 
-static void nvme_process_sq (void *);
+static void nvme_arb_add_sq (NvmeCtrl *n, NvmeSQ *sq);
+static void nvme_arb_del_sq (NvmeCtrl *n, NvmeSQ *sq);
+static void nvme_arb_reset (NvmeCtrl *n);
 
 static void nvme_set_default (NvmeCtrl *n)
 {
@@ -108,7 +108,12 @@ static int nvme_init_ctrl (NvmeCtrl *n)
     id->sqes = (n->max_sqes << 4) | 0x6;
     id->cqes = (n->max_cqes << 4) | 0x4;
     id->nn = cpu_to_le32(n->num_namespaces);
-    id->oncs = cpu_to_le16(NVME_ONCS_FEATURES);
+    id->oncs = NVME_ONCS_FEATURES;
+    if (!core.lnvm)
+        id->oncs |= NVME_ONCS_COMPARE;
+    if (nvm_ftl_cap_support (FTL_CAP_DEALLOC))
+        id->oncs |= NVME_ONCS_DSM | NVME_ONCS_WRITE_ZEROS;
+    id->oncs = cpu_to_le16(id->oncs);
     id->fuses = cpu_to_le16(0);
     id->fna = 0;
     id->vwc = 0;
@@ -191,8 +196,47 @@ static int nvme_init_ctrl (NvmeCtrl *n)
     return 0;
 }
 
+/* In AppNVM mode the global LBA space is split in namespaces, each one
+ * covering the LBAs that nvm_submit_ftl schedules to a set of channels.
+ * Open-channel mode exposes the device geometry and a single namespace */
+static int nvme_init_ns_size (NvmeCtrl *n)
+{
+    uint32_t i, ch_ns, ch;
+    uint64_t ch_sz;
+
+    n->num_namespaces = (core.lnvm) ? 1 : core.nvm_ns_count;
+    if (!n->num_namespaces)
+        n->num_namespaces = 1;
+
+    if (n->num_namespaces > core.nvm_ch_count ||
+                                   n->num_namespaces > NVME_MAX_NUM_NAMESPACES) {
+        log_err ("[nvm: %d namespaces, only %d channels available]\n",
+                                      n->num_namespaces, core.nvm_ch_count);
+        return -1;
+    }
+
+    n->ns_size = (uint64_t *)calloc(n->num_namespaces, sizeof(uint64_t));
+    if (!n->ns_size)
+        return EMEM;
+
+    ch_ns = core.nvm_ch_count / n->num_namespaces;
+    ch_sz = core.nvm_ns_size / core.nvm_ch_count;
+    ch_sz -= ch_sz % NVME_KERNEL_PG_SIZE;
+
+    for (i = 0; i < n->num_namespaces; i++) {
+        /* The last namespace takes the remaining channels */
+        ch = (i == n->num_namespaces - 1) ?
+                          core.nvm_ch_count - ch_ns * i : ch_ns;
+        n->ns_size[i] = (n->num_namespaces == 1) ? core.nvm_ns_size :
+                                                                 ch_sz * ch;
+    }
+
+    return 0;
+}
+
 static int nvme_init_namespaces (NvmeCtrl *n)
 {
+    uint64_t start_block = 0;
     int i, j, k, lba_index;
     uint16_t oob_sz, ch_oobsz, sec_sz;
     NvmeNamespace *ns;
@@ -235,7 +279,7 @@ static int nvme_init_namespaces (NvmeCtrl *n)
 	}
 
         lba_index = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
-	blks = n->ns_size[0] / ((1 << id_ns->lbaf[lba_index].ds));
+	blks = n->ns_size[i] / ((1 << id_ns->lbaf[lba_index].ds));
 
 	id_ns->nuse = id_ns->ncap = id_ns->nsze = cpu_to_le64(blks);
 
@@ -246,11 +290,16 @@ static int nvme_init_namespaces (NvmeCtrl *n)
 
         ns->id = i + 1;
 	ns->ctrl = n;
-	ns->start_block = 0;
+	ns->start_block = start_block;
+        start_block += blks;
 
         /* To be checked */
         memcpy (id_ns->eui64, "ox-ns\0", 6);
         memcpy (id_ns->nguid, "ox-ctrl-lnvm-ns\0", 16);
+        if (n->num_namespaces > 1) {
+            id_ns->eui64[7] = ns->id;
+            id_ns->nguid[15] = ns->id;
+        }
 
         /* Field not defined yet */
         id_ns->nmic = 0;
@@ -291,7 +340,8 @@ static int nvme_check_constraints (NvmeCtrl *n)
 				     (1 << ((n->dps & DPS_TYPE_MASK) - 1)))) ||
 	(n->mpsmax > 0xf || n->mpsmax < n->mpsmin) ||
 	(n->id_ctrl.oacs & ~(NVME_OACS_FORMAT)) ||
-	(n->id_ctrl.oncs & ~(NVME_ONCS_FEATURES))) {
+	(n->id_ctrl.oncs & ~(NVME_ONCS_FEATURES | NVME_ONCS_DSM |
+                          NVME_ONCS_COMPARE | NVME_ONCS_WRITE_ZEROS))) {
         return -1;
     }
     return 0;
@@ -300,7 +350,10 @@ static int nvme_check_constraints (NvmeCtrl *n)
 static void nvme_isr_notify(void *opaque)
 {
     NvmeCQ *cq = opaque;
+    struct ox_instance *prev = ox_inst_enter(cq->ctrl->inst);
+
     core.nvm_pcie->ops->isr_notify(cq);
+    ox_inst_leave(prev);
 }
 
 uint16_t nvme_init_cq (NvmeCQ *cq, NvmeCtrl *n, uint64_t dma_addr,
@@ -367,22 +420,8 @@ uint16_t nvme_init_sq (NvmeSQ *sq, NvmeCtrl *n, uint64_t dma_addr,
         TAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
 
-    switch (prio) {
-    case NVME_Q_PRIO_URGENT:
-        sq->arb_burst = (1 << NVME_ARB_AB(n->features.arbitration));
-        break;
-    case NVME_Q_PRIO_HIGH:
-        sq->arb_burst = NVME_ARB_HPW(n->features.arbitration) + 1;
-        break;
-    case NVME_Q_PRIO_NORMAL:
-        sq->arb_burst = NVME_ARB_MPW(n->features.arbitration) + 1;
-        break;
-    case NVME_Q_PRIO_LOW:
-    default:
-        sq->arb_burst = NVME_ARB_LPW(n->features.arbitration) + 1;
-        break;
-    }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    /* Burst and weights are read by the arbiter, see nvme_arb_run */
+    sq->prio = prio;
     sq->db_addr = 0;
     sq->eventidx_addr = 0;
 
@@ -390,6 +429,7 @@ uint16_t nvme_init_sq (NvmeSQ *sq, NvmeCtrl *n, uint64_t dma_addr,
     cq = n->cq[cqid];
     TAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
+    nvme_arb_add_sq (n, sq);
 
     log_info("\n[nvme: init SQ qid: %d\n", sqid);
 
@@ -453,6 +493,7 @@ void nvme_free_sq (NvmeSQ *sq, NvmeCtrl *n)
     for (i = 0; i < sq->size; i++)
         pthread_mutex_destroy (&sq->io_req[i].nvm_io.mutex);
 
+    nvme_arb_del_sq (n, sq);
     n->sq[sq->sqid] = NULL;
     FREE_VALID (sq->io_req);
     FREE_VALID (sq->prp_list);
@@ -500,6 +541,8 @@ static void nvme_clear_ctrl (NvmeCtrl *n)
             if (n->cq[i] != NULL)
 		nvme_free_cq (n->cq[i], n);
 
+    nvme_arb_reset (n);
+
     pthread_mutex_lock(&n->aer_req_mutex);
     while((event = (NvmeAsyncEvent *)TAILQ_FIRST(&n->aer_queue)) != NULL) {
         TAILQ_REMOVE(&n->aer_queue, event, entry);
@@ -688,12 +731,102 @@ int nvme_check_sqid (NvmeCtrl *n, uint16_t sqid)
     return sqid < n->num_queues && n->sq[sqid] != NULL ? 0 : -1;
 }
 
+static uint8_t nvme_lat_op (NvmeRequest *req)
+{
+    if (!req->sq->sqid)
+        return OX_LAT_OP_OTHER;
+
+    switch (req->cmd.opcode) {
+        case NVME_CMD_READ:
+        case LNVM_CMD_PHYS_READ:
+            return OX_LAT_OP_READ;
+        case NVME_CMD_WRITE:
+        case LNVM_CMD_HYBRID_WRITE:
+        case LNVM_CMD_PHYS_WRITE:
+            return OX_LAT_OP_WRITE;
+        default:
+            return OX_LAT_OP_OTHER;
+    }
+}
+
+/* Arbitration state per I/O SQ (sqid > 0), bit (sqid - 1) of:
+ *  mask_regs[prio]   - SQ created with this priority
+ *  shadow_regs[prio] - doorbell rung, the SQ may have commands */
+static inline uint64_t nvme_arb_bit (NvmeSQ *sq)
+{
+    return 1ULL << ((sq->sqid - 1) & (SHADOW_REG_SZ - 1));
+}
+
+static void nvme_arb_add_sq (NvmeCtrl *n, NvmeSQ *sq)
+{
+    NvmeQSched *qs = &n->qsched;
+
+    if (!sq->sqid || sq->sqid > NVME_ARB_MAX_SQS)
+        return;
+
+    qs->SQID[(sq->sqid - 1) >> 5] |= 1UL << ((sq->sqid - 1) & 31);
+    qs->mask_regs[sq->prio][(sq->sqid - 1) >> 6] |= nvme_arb_bit (sq);
+    qs->prio_avail[sq->prio]++;
+    qs->n_active_iosqs++;
+}
+
+static void nvme_arb_del_sq (NvmeCtrl *n, NvmeSQ *sq)
+{
+    NvmeQSched *qs = &n->qsched;
+
+    if (!sq->sqid || sq->sqid > NVME_ARB_MAX_SQS ||
+                !(qs->mask_regs[sq->prio][(sq->sqid - 1) >> 6] &
+                                                        nvme_arb_bit (sq)))
+        return;
+
+    qs->SQID[(sq->sqid - 1) >> 5] &= ~(1UL << ((sq->sqid - 1) & 31));
+    qs->mask_regs[sq->prio][(sq->sqid - 1) >> 6] &= ~nvme_arb_bit (sq);
+    qs->shadow_regs[sq->prio][(sq->sqid - 1) >> 6] &= ~nvme_arb_bit (sq);
+    qs->prio_avail[sq->prio]--;
+    qs->n_active_iosqs--;
+}
+
+static inline void nvme_arb_set_pending (NvmeCtrl *n, NvmeSQ *sq)
+{
+    if (sq->sqid && sq->sqid <= NVME_ARB_MAX_SQS)
+        n->qsched.shadow_regs[sq->prio][(sq->sqid - 1) >> 6] |=
+                                                            nvme_arb_bit (sq);
+}
+
+static inline void nvme_arb_clear_pending (NvmeCtrl *n, NvmeSQ *sq)
+{
+    if (sq->sqid && sq->sqid <= NVME_ARB_MAX_SQS)
+        n->qsched.shadow_regs[sq->prio][(sq->sqid - 1) >> 6] &=
+                                                           ~nvme_arb_bit (sq);
+}
+
+static void nvme_arb_kick (NvmeCtrl *n, int64_t delay_ns)
+{
+    if (n->qsched.timer && !timer_pending (n->qsched.timer))
+        timer_mod (n->qsched.timer,
+                            qemu_clock_get_ns (QEMU_CLOCK_VIRTUAL) + delay_ns);
+}
+
+/* Commands in flight at a controller reset are no longer counted, their late
+ * completion must not wrap the counter */
+void nvme_arb_put_inflight (NvmeCtrl *n)
+{
+    uint32_t cur;
+
+    do {
+        cur = atomic_read (&n->qsched.inflight);
+        if (!cur)
+            return;
+    } while (atomic_cmpxchg (&n->qsched.inflight, cur, cur - 1) != cur);
+}
+
 static void nvme_post_cqe (NvmeCQ *cq, NvmeRequest *req)
 {
     NvmeCtrl *n = cq->ctrl;
     NvmeSQ *sq = req->sq;
     NvmeCqe *cqe = &req->cqe;
     uint8_t phase = cq->phase;
+    uint8_t lat_op;
     uint64_t addr;
 
     if (core.lnvm) {
@@ -723,11 +856,26 @@ static void nvme_post_cqe (NvmeCQ *cq, NvmeRequest *req)
 
     nvme_inc_cq_tail (cq);
 
+    if (ox_lat_enabled) {
+        lat_op = nvme_lat_op (req);
+        ox_lat_add (OX_LAT_CQ_POST, lat_op, sq->sqid, req->nvm_io.ts_complete);
+        ox_lat_add (OX_LAT_TOTAL, lat_op, sq->sqid, req->nvm_io.ts_fetch);
+    }
+
     /* In case of timeout request, we have to avoid reusing the same structure
      * TODO: Replace structures in case of timeout */
 
     TAILQ_INSERT_TAIL (&sq->req_list, req, entry);
     if (cq->hold_sqs) cq->hold_sqs = 0;
+
+    if (sq->sqid)
+        nvme_arb_put_inflight (n);
+
+    /* The arbiter waits for a free request, CQ entry or in-flight slot */
+    if (atomic_read (&n->qsched.stalled)) {
+        atomic_set (&n->qsched.stalled, 0);
+        nvme_arb_kick (n, NVME_ARB_DELAY_NS);
+    }
 }
 
 void nvme_enqueue_req_completion (NvmeCQ *cq, NvmeRequest *req)
@@ -789,7 +937,7 @@ void nvme_enqueue_event (NvmeCtrl *n, uint8_t event_type,
 
 void nvme_post_cqes (void *opaque)
 {
-    NvmeCtrl *n = nvm_nvme_ctrl;
+    NvmeCtrl *n = core.nvm_nvme_ctrl;
     NvmeCQ *cq = opaque;
     NvmeRequest *req;
 
@@ -841,16 +989,18 @@ uint16_t nvme_admin_cmd (NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 
         /* Near-data processing */
         case NDP_ADM_CMD_INFO:
-            return NVME_SUCCESS;
+            return ndp_info (n, cmd);
         case NDP_ADM_CMD_INST_DAEM:
-            return NVME_SUCCESS;
+            return ndp_install (n, cmd, req);
         case NDP_ADM_CMD_DEL_DAEM:
-            return NVME_SUCCESS;
+            return ndp_delete (n, cmd);
 
         case LNVM_ADM_CMD_IDENTITY:
             return lnvm_identity(n, cmd);
         case LNVM_ADM_CMD_GET_L2P_TBL:
             return lnvm_get_l2p_tbl(n, cmd, req);
+        case LNVM_ADM_CMD_SET_L2P_TBL:
+            return lnvm_set_l2p_tbl(n, cmd, req);
         case LNVM_ADM_CMD_GET_BB_TBL:
             return lnvm_get_bb_tbl(n, cmd, req);
         case LNVM_ADM_CMD_SET_BB_TBL:
@@ -909,11 +1059,18 @@ static uint16_t nvme_io_cmd (NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
                 return lnvm_erase_sync(n, ns, cmd, req);
             return NVME_INVALID_OPCODE | NVME_DNR;
 
+        case LNVM_CMD_VECT_COPY:
+            if (core.lnvm && lnvm_dev(n))
+                return lnvm_copy(n, ns, cmd, req);
+            return NVME_INVALID_OPCODE | NVME_DNR;
+
         /* Near-data processing */
         case NDP_EXEC_RUN_JOB:
-            return NVME_SUCCESS;
+            if (!core.lnvm)
+                return ndp_run_job (n, ns, cmd, req);
+            return NVME_INVALID_OPCODE | NVME_DNR;
         case NDP_EXEC_DAEM_REQ:
-            return NVME_SUCCESS;
+            return ndp_kernel_req (n, cmd);
 
         /* Commands not supported yet */
 
@@ -927,6 +1084,7 @@ static uint16_t nvme_io_cmd (NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
             if (NVME_ONCS_DSM & n->id_ctrl.oncs) {
                 return nvme_dsm(n, ns, cmd, req);
             }
+            return NVME_INVALID_OPCODE | NVME_DNR;
 
 	case NVME_CMD_COMPARE:
             if (NVME_ONCS_COMPARE & n->id_ctrl.oncs) {
@@ -961,13 +1119,24 @@ void nvme_rw_cb (void *opaque)
 
     /* TODO: Calculate here n->stats like bytes read/written */
 
+    if (req->cmp_buf)
+        nvme_compare_cb (req);
+
+    /* Vector copy continues with the write phase */
+    if (req->copy_buf && lnvm_copy_cb (req))
+        return;
+
+    /* NDP jobs read the next segment until the range is processed */
+    if (req->ndp_job && ndp_job_cb (req))
+        return;
+
     nvme_enqueue_req_completion (cq, req);
 }
 
-static void nvme_process_sq (void *opaque)
+/* Fetches and submits up to 'max' commands. Returns the number of commands
+ * processed, or -1 if the controller was restarted by a flush. */
+static int nvme_process_sq (NvmeSQ *sq, int max)
 {
-    NvmeSQ *sq = (NvmeSQ *) opaque;
-
     NvmeCtrl *n = sq->ctrl;
     NvmeCQ *cq = n->cq[sq->cqid];
     char err[100];
@@ -976,7 +1145,7 @@ static void nvme_process_sq (void *opaque)
         cq->hold_sqs = 1;
 	log_info("[nvme: Process-SQ %d with CQ %d delayed]\n",
                                                            sq->sqid, sq->cqid);
-	return;
+	return 0;
     }
 
     uint16_t status;
@@ -984,11 +1153,12 @@ static void nvme_process_sq (void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
     int processed = 0;
+    uint64_t ts_fetch;
 
     nvme_update_sq_tail (sq);
 
     while (!(nvme_sq_empty(sq) || TAILQ_EMPTY (&sq->req_list))
-			&&	processed < sq->arb_burst) {
+			&&	processed < max) {
 	++sq->posted;
 	if (sq->phys_contig) {
             addr = sq->dma_addr + sq->head * n->sqe_size;
@@ -998,6 +1168,7 @@ static void nvme_process_sq (void *opaque)
 
         if (addr == 0) continue;
 
+        ts_fetch = ox_lat_ts ();
         nvme_addr_read (n, addr, (void *)&cmd, sizeof (NvmeCmd));
 	nvme_inc_sq_head (sq);
 
@@ -1011,11 +1182,23 @@ static void nvme_process_sq (void *opaque)
 	TAILQ_INSERT_TAIL (&sq->out_req_list, req, entry);
 	pthread_mutex_unlock(&n->req_mutex);
 
+        if (sq->sqid)
+            __sync_fetch_and_add (&n->qsched.inflight, 1);
+
 	memset (&req->cqe, 0, sizeof (req->cqe));
 	req->cqe.cid = cmd.cid;
 
         memcpy (&req->cmd, &cmd, sizeof(NvmeCmd));
 
+        /* Requests are reused, commands completed without the FTL rely on
+         * a fresh status to be enqueued below */
+        req->nvm_io.status.status = NVM_IO_NEW;
+        req->cmp_buf = NULL;
+        req->copy_buf = NULL;
+        req->ndp_job = NULL;
+        req->nvm_io.ts_fetch = ts_fetch;
+        req->nvm_io.ts_complete = 0;
+
 	status = sq->sqid ?
             nvme_io_cmd (n, &cmd, req) : nvme_admin_cmd (n, &cmd, req);
 
@@ -1041,7 +1224,7 @@ static void nvme_process_sq (void *opaque)
             req->status = status;
             nvme_enqueue_req_completion (cq, req);
             nvm_restart();
-            return;
+            return -1;
         }
 
         /* Enqueue completion in case of admin command */
@@ -1065,9 +1248,198 @@ static void nvme_process_sq (void *opaque)
     nvme_update_sq_tail (sq);
 
     sq->completed += processed;
-    if (!nvme_sq_empty(sq)) {
-        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+
+    return processed;
+}
+
+/* Returns the next SQ of the class (or of all classes if prio < 0) with
+ * commands, in round robin order. SQs in 'skip' are not selected. */
+static NvmeSQ *nvme_arb_next_sq (NvmeCtrl *n, int prio, uint64_t *skip)
+{
+    NvmeQSched *qs = &n->qsched;
+    unsigned int *next = &qs->prio_lvl_next_q[(prio < 0) ? 0 : prio];
+    uint64_t pend;
+    uint32_t i, bit, nbits;
+    int p;
+
+    nbits = MIN (n->num_queues - 1, NVME_ARB_MAX_SQS);
+    for (i = 0; i < nbits; i++) {
+        bit = (*next + i) % nbits;
+
+        pend = 0;
+        for (p = 0; p < NVME_MAX_PRIORITY; p++)
+            if (prio < 0 || p == prio)
+                pend |= qs->shadow_regs[p][bit >> 6];
+        pend &= ~skip[bit >> 6];
+
+        if ((pend & (1ULL << (bit & (SHADOW_REG_SZ - 1)))) && n->sq[bit + 1]) {
+            *next = (bit + 1) % nbits;
+            return n->sq[bit + 1];
+        }
+    }
+
+    return NULL;
+}
+
+static int nvme_arb_pending (NvmeCtrl *n, int prio, uint64_t *skip)
+{
+    NvmeQSched *qs = &n->qsched;
+    int p, w;
+
+    for (p = 0; p < NVME_MAX_PRIORITY; p++) {
+        if (prio >= 0 && p != prio)
+            continue;
+        for (w = 0; w < 2; w++)
+            if (qs->shadow_regs[p][w] & ~skip[w])
+                return 1;
+    }
+
+    return 0;
+}
+
+/* Services up to 'max' commands of an I/O SQ. SQs that cannot fetch (full
+ * CQ or no free request) are skipped until the next arbitration round. */
+static int nvme_arb_service (NvmeCtrl *n, NvmeSQ *sq, int max,
+                                               uint64_t *skip, int *budget)
+{
+    int ret;
+
+    ret = nvme_process_sq (sq, max);
+    if (ret < 0)
+        return ret;
+
+    *budget -= ret;
+    if (nvme_sq_empty (sq))
+        nvme_arb_clear_pending (n, sq);
+    else if (ret < max)
+        skip[(sq->sqid - 1) >> 6] |= nvme_arb_bit (sq);
+
+    return ret;
+}
+
+/* NVMe arbitration (spec 1.2, section 4.11). The admin SQ has the highest
+ * priority. With round robin (CC.AMS = 0) each I/O SQ with commands is
+ * serviced in turn, up to the arbitration burst. With weighted round robin
+ * the urgent class has strict priority over the high, medium and low
+ * classes, which share each round by their weights (in commands, from the
+ * Arbitration feature). I/O commands are only fetched while the number of
+ * commands in flight is under the budget. */
+static void nvme_arb_run (NvmeCtrl *n)
+{
+    NvmeQSched *qs = &n->qsched;
+    uint32_t arb = n->features.arbitration;
+    uint64_t skip[2] = { 0, 0 };
+    uint32_t weight[NVME_MAX_PRIORITY], inflight;
+    int burst, budget, quota, ret, p, i, refill, admin = 0;
+    NvmeSQ *sq;
+
+    burst = (NVME_ARB_AB(arb) == 7) ? n->max_q_ents + 1 : 1 << NVME_ARB_AB(arb);
+    weight[NVME_Q_PRIO_URGENT] = 0;
+    weight[NVME_Q_PRIO_HIGH] = NVME_ARB_HPW(arb) + 1;
+    weight[NVME_Q_PRIO_NORMAL] = NVME_ARB_MPW(arb) + 1;
+    weight[NVME_Q_PRIO_LOW] = NVME_ARB_LPW(arb) + 1;
+
+    atomic_set (&qs->stalled, 0);
+
+    if (n->sq && n->sq[0]) {
+        admin = nvme_process_sq (n->sq[0], burst);
+        if (admin < 0)
+            return;
     }
+
+    inflight = atomic_read (&qs->inflight);
+    budget = (inflight < qs->max_inflight) ? qs->max_inflight - inflight : 0;
+
+    if (!qs->WRR) {
+        for (i = 0; i < qs->n_active_iosqs && budget > 0; i++) {
+            sq = nvme_arb_next_sq (n, -1, skip);
+            if (!sq)
+                break;
+            if (nvme_arb_service (n, sq, MIN (burst, budget),
+                                                        skip, &budget) < 0)
+                return;
+        }
+        goto OUT;
+    }
+
+    /* Urgent class, one burst per SQ per round */
+    for (i = 0; i < qs->prio_avail[NVME_Q_PRIO_URGENT] && budget > 0; i++) {
+        sq = nvme_arb_next_sq (n, NVME_Q_PRIO_URGENT, skip);
+        if (!sq)
+            break;
+        if (nvme_arb_service (n, sq, MIN (burst, budget), skip, &budget) < 0)
+            return;
+    }
+    if (nvme_arb_pending (n, NVME_Q_PRIO_URGENT, skip))
+        goto OUT;
+
+    /* A new round starts when no weighted class can be serviced */
+    refill = 1;
+    for (p = NVME_Q_PRIO_HIGH; p <= NVME_Q_PRIO_LOW; p++)
+        if (qs->credits[p] && nvme_arb_pending (n, p, skip))
+            refill = 0;
+    if (refill)
+        for (p = NVME_Q_PRIO_HIGH; p <= NVME_Q_PRIO_LOW; p++)
+            qs->credits[p] = weight[p];
+
+    for (p = NVME_Q_PRIO_HIGH; p <= NVME_Q_PRIO_LOW; p++) {
+        while (qs->credits[p] && budget > 0) {
+            sq = nvme_arb_next_sq (n, p, skip);
+            if (!sq)
+                break;
+            quota = MIN (MIN (burst, budget), qs->credits[p]);
+            ret = nvme_arb_service (n, sq, quota, skip, &budget);
+            if (ret < 0)
+                return;
+            qs->credits[p] -= ret;
+        }
+    }
+
+OUT:
+    /* Commands left behind by the burst, weights or budget */
+    if ((budget > 0 && nvme_arb_pending (n, -1, skip)) || admin == burst) {
+        nvme_arb_kick (n, NVME_ARB_DELAY_NS);
+    } else if (budget <= 0 || skip[0] || skip[1] ||
+                                (n->sq[0] && !nvme_sq_empty (n->sq[0]))) {
+        /* Completions restart the arbiter, the timer covers a completion
+         * posted before the flag was set */
+        atomic_set (&qs->stalled, 1);
+        nvme_arb_kick (n, NVME_ARB_STALL_NS);
+    }
+}
+
+/* Arbiter timer callback, runs in the controller's instance */
+void nvme_q_scheduler (void *opaque)
+{
+    NvmeCtrl *n = (NvmeCtrl *) opaque;
+    struct ox_instance *prev = ox_inst_enter (n->inst);
+
+    nvme_arb_run (n);
+    ox_inst_leave (prev);
+}
+
+/* Controller reset (CC.EN = 0), called once the queues are freed. Commands
+ * still in flight never complete to the arbiter, the budget starts over */
+static void nvme_arb_reset (NvmeCtrl *n)
+{
+    NvmeQSched *qs = &n->qsched;
+
+    if (qs->timer)
+        timer_del (qs->timer);
+
+    atomic_set (&qs->inflight, 0);
+    atomic_set (&qs->stalled, 0);
+    memset (qs->credits, 0x0, sizeof (qs->credits));
+    memset (qs->prio_lvl_next_q, 0x0, sizeof (qs->prio_lvl_next_q));
+}
+
+static int nvme_init_q_scheduler (NvmeCtrl *n)
+{
+    memset (&n->qsched, 0x0, sizeof (NvmeQSched));
+    n->qsched.max_inflight = NVME_ARB_INFLIGHT;
+    n->qsched.timer = timer_new_ns (QEMU_CLOCK_VIRTUAL, nvme_q_scheduler, n);
+
+    return 0;
 }
 
 void nvme_process_db (NvmeCtrl *n, uint64_t addr, uint64_t val)
@@ -1109,13 +1481,8 @@ void nvme_process_db (NvmeCtrl *n, uint64_t addr, uint64_t val)
             cq->head = new_val;
         }
         if (start_sqs) {
-            NvmeSQ *sq;
-            TAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                if (!timer_pending(sq->timer)) {
-                    timer_mod(sq->timer, qemu_clock_get_ns(
-                                            QEMU_CLOCK_VIRTUAL) + 500);
-                }
-            }
+            /* SQs of this CQ are still pending in the arbiter */
+            nvme_arb_kick (n, NVME_ARB_DELAY_NS);
             nvme_post_cqes(cq);
         } else if (cq->tail != cq->head) {
             nvme_isr_notify(cq);
@@ -1139,16 +1506,22 @@ void nvme_process_db (NvmeCtrl *n, uint64_t addr, uint64_t val)
         if (!sq->db_addr) {
             sq->tail = new_val;
         }
-        if (!timer_pending(sq->timer)) {
-            timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
-        }
+        nvme_arb_set_pending (n, sq);
+        nvme_arb_kick (n, NVME_ARB_DELAY_NS);
     }
 }
 
 void nvme_exit(void)
 {
-    NvmeCtrl *n = nvm_nvme_ctrl;
+    NvmeCtrl *n = core.nvm_nvme_ctrl;
     nvme_clear_ctrl (n);
+
+    if (n->qsched.timer) {
+        timer_del (n->qsched.timer);
+        timer_free (n->qsched.timer);
+        n->qsched.timer = NULL;
+    }
+
     FREE_VALID (n->sq);
     FREE_VALID (n->cq);
     FREE_VALID (n->aer_reqs);
@@ -1159,6 +1532,8 @@ void nvme_exit(void)
     if (core.lnvm && lnvm_dev(n))
         lightnvm_exit(n);
 
+    ndp_exit();
+
     pthread_mutex_destroy(&n->req_mutex);
     pthread_mutex_destroy(&n->qs_req_mutex);
     pthread_mutex_destroy(&n->aer_req_mutex);
@@ -1168,23 +1543,19 @@ void nvme_exit(void)
 
 int nvme_init(NvmeCtrl *n)
 {
-    nvm_ns_size = core.nvm_ns_size;
-    nvm_nvme_ctrl = core.nvm_nvme_ctrl;
+    n->inst = ox_inst;
+    ndp_init ();
     nvme_set_default (n);
     n->start_time = time (NULL);
 
-    /* For now only 1 namespace */
-    n->ns_size = (uint64_t *)calloc(1, sizeof(uint64_t));
-    if (!n->ns_size)
-        return EMEM;
-
-    n->ns_size[0] = nvm_ns_size;
+    if (nvme_init_ns_size (n))
+        return ENVME_REGISTER;
 
     if(nvme_init_ctrl(n))
         return ENVME_REGISTER;
 
-    if(nvme_check_constraints(n) || nvme_init_namespaces(n) /*||
-                                                    nvme_init_q_scheduler (n)*/)
+    if(nvme_check_constraints(n) || nvme_init_namespaces(n) ||
+                                                    nvme_init_q_scheduler (n))
         return ENVME_REGISTER;
 
     if (core.lnvm && lnvm_dev(n) && lnvm_init(n))
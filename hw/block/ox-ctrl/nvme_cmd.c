@@ -9,8 +9,6 @@
 #include "hw/block/ox-ctrl/include/lightnvm.h"
 #include "hw/block/ox-ctrl/include/nvme.h"
 
-extern struct core_struct core;
-
 static void nvme_debug_print_io (NvmeRwCmd *cmd, uint32_t bs, uint64_t dt_sz,
         uint64_t md_sz, uint64_t elba, uint64_t *prp)
 {
@@ -38,6 +36,7 @@ uint16_t nvme_identify (NvmeCtrl *n, NvmeCmd *cmd)
     uint32_t nsid = c->nsid;
     uint64_t prp1 = c->prp1;
     uint32_t ns_list[1024];
+    uint32_t i, j;
 
     switch (cns) {
         case 1:
@@ -57,9 +56,10 @@ uint16_t nvme_identify (NvmeCtrl *n, NvmeCmd *cmd)
             if (nsid == 0xfffffffe || nsid == 0xffffffff)
                 return NVME_INVALID_NSID | NVME_DNR;
 
-            /* For now, only 1 valid namespace */
-            if (nsid == 0)
-                ns_list[0] = 0x1;
+            /* Active namespaces with an id greater than nsid */
+            memset (ns_list, 0x0, sizeof (ns_list));
+            for (i = nsid, j = 0; i < n->num_namespaces && j < 1024; i++, j++)
+                ns_list[j] = i + 1;
 
             if (prp1)
                 return nvme_write_to_host(&ns_list, prp1, 4096);
@@ -99,19 +99,13 @@ uint16_t nvme_del_sq (NvmeCtrl *n, NvmeCmd *cmd)
             if (req->sq == sq) {
                 TAILQ_REMOVE (&cq->req_list, req, entry);
                 TAILQ_INSERT_TAIL (&sq->req_list, req, entry);
+                nvme_arb_put_inflight (n);
                 if (cq->hold_sqs) cq->hold_sqs = 0;
             }
         }
         pthread_mutex_unlock(&n->req_mutex);
     }
-    n->qsched.SQID[(qid - 1) >> 5] &= (~(1UL << ((qid - 1) & 31)));
-    n->qsched.prio_avail[sq->prio] = n->qsched.prio_avail[sq->prio] - 1;
-    n->qsched.mask_regs[sq->prio][(qid - 1) >> 6] &=
-                                (~(1UL << ((qid - 1) & (SHADOW_REG_SZ - 1))));
-    n->qsched.shadow_regs[sq->prio][(qid -1) >> 6] &=
-                                (~(1UL << ((qid - 1) & (SHADOW_REG_SZ - 1))));
-    n->qsched.n_active_iosqs--;
-
+    /* The queue is removed from the arbiter in nvme_free_sq */
     nvme_free_sq (sq, n);
     return NVME_SUCCESS;
 }
@@ -415,6 +409,10 @@ inline uint16_t nvme_get_log(NvmeCtrl *n, NvmeCmd *cmd)
             return nvme_smart_info (n, cmd, len);
 	case NVME_LOG_FW_SLOT_INFO:
             return nvme_fw_log_info (n, cmd, len);
+	case LNVM_LOG_CHUNK_INFO:
+            if (core.lnvm && core.ocssd2 && lnvm_dev(n))
+                return lnvm_get_chunk_info (n, cmd);
+            return NVME_INVALID_LOG_ID | NVME_DNR;
 	default:
             return NVME_INVALID_LOG_ID | NVME_DNR;
     }
@@ -548,6 +546,111 @@ reset, the commands are aborted.
     return NVME_NO_COMPLETE;
 }
 
+static uint16_t nvme_rw_check (NvmeCtrl *n, NvmeNamespace *ns, NvmeRwCmd *rw)
+{
+    uint32_t nlb  = rw->nlb + 1;
+    uint64_t slba = rw->slba;
+    uint64_t nsze = le64_to_cpu(ns->id_ns.nsze);
+
+    const uint8_t lba_index = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
+    const uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
+    uint64_t data_size = nlb << data_shift;
+
+    /* slba + nlb may wrap, compare against the remaining namespace size */
+    if (slba >= nsze || nlb > nsze - slba)
+	return NVME_LBA_RANGE | NVME_DNR;
+
+    if (n->id_ctrl.mdts && data_size > n->page_size * (1 << n->id_ctrl.mdts))
+	return NVME_LBA_RANGE | NVME_DNR;
+
+    if (nlb > 256)
+	return NVME_INVALID_FIELD | NVME_DNR;
+
+    /* Metadata disabled
+    const uint16_t ms = ns->id_ns.lbaf[lba_index].ms;
+    uint64_t meta_size = nlb * ms;
+    if (meta_size)
+        return NVME_INVALID_FIELD | NVME_DNR;
+    */
+
+    /* End-to-end Data protection disabled
+    if ((ctrl & NVME_RW_PRINFO_PRACT) && !(ns->id_ns.dps & DPS_TYPE_MASK))
+        return NVME_INVALID_FIELD | NVME_DNR;
+    */
+
+    /* TODO: Map PRPs for SGL addresses */
+    switch (rw->psdt) {
+        case CMD_PSDT_PRP:
+        case CMD_PSDT_RSV:
+            break;
+        case CMD_PSDT_SGL:
+        case CMD_PSDT_SGL_MD:
+            return NVME_INVALID_FORMAT;
+    }
+
+    return NVME_SUCCESS;
+}
+
+static void nvme_rw_map_prp (NvmeRwCmd *rw, uint64_t *prp)
+{
+    uint32_t nlb  = rw->nlb + 1;
+
+    prp[0] = rw->prp1;
+
+    if (nlb == 2)
+        prp[1] = rw->prp2;
+    else if (nlb > 2)
+        nvme_read_from_host((void *)(&prp[1]), rw->prp2,
+                                                 (nlb - 1) * sizeof(uint64_t));
+}
+
+/* PRPs must be set in req->nvm_io before calling this function */
+uint16_t nvme_rw_submit (NvmeNamespace *ns, NvmeRwCmd *rw,
+                                          NvmeRequest *req, uint8_t cmdtype)
+{
+    int i;
+
+    uint32_t nlb  = rw->nlb + 1;
+    uint64_t slba = rw->slba;
+
+    const uint64_t elba = slba + nlb;
+    const uint8_t lba_index = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
+    const uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
+    uint64_t data_size = nlb << data_shift;
+
+    req->slba = slba;
+    req->meta_size = 0;
+    req->status = NVME_SUCCESS;
+    req->nlb = nlb;
+    req->ns = ns;
+    req->lba_index = lba_index;
+
+    req->nvm_io.cid = rw->cid;
+    req->nvm_io.sec_sz = NVME_KERNEL_PG_SIZE;
+    req->nvm_io.md_sz = 0;
+    req->nvm_io.cmdtype = cmdtype;
+    req->nvm_io.n_sec = nlb;
+    req->nvm_io.req = (void *) req;
+    req->nvm_io.slba = slba + ns->start_block;
+
+    req->nvm_io.status.pg_errors = 0;
+    req->nvm_io.status.ret_t = 0;
+    req->nvm_io.status.total_pgs = 0;
+    req->nvm_io.status.pgs_p = 0;
+    req->nvm_io.status.pgs_s = 0;
+    req->nvm_io.status.status = NVM_IO_NEW;
+
+    for (i = 0; i < 8; i++) {
+        req->nvm_io.status.pg_map[i] = 0;
+    }
+
+    if (core.debug)
+        nvme_debug_print_io (rw, req->nvm_io.sec_sz, data_size,
+                                     req->nvm_io.md_sz, elba, req->nvm_io.prp);
+
+    return nvm_submit_ftl(&req->nvm_io);
+}
+
 uint16_t nvme_write_uncor(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
 		NvmeRequest *req)
 {
@@ -576,7 +679,56 @@ uint16_t nvme_dsm (NvmeCtrl *n,NvmeNamespace *ns,NvmeCmd *cmd,NvmeRequest *req)
  are used. If the command uses SGLs for the data transfer, then the SGL Entry 1
  field is used. All other command specific fields are reserved.
  */
-    /* TODO: Not implemented yet */
+    NvmeDsmCmd *dsm = (NvmeDsmCmd *)cmd;
+    NvmeDsmRange range[256];
+    struct nvm_ftl_cap_dealloc_st dealloc;
+    uint32_t nr, i;
+    uint64_t len, trans;
+    uint64_t nsze = le64_to_cpu(ns->id_ns.nsze);
+
+    /* Only deallocate is supported, other attributes are advisory */
+    if (!(dsm->attributes & NVME_DSMGMT_AD))
+        return NVME_SUCCESS;
+
+    switch (dsm->psdt) {
+        case CMD_PSDT_PRP:
+        case CMD_PSDT_RSV:
+            break;
+        case CMD_PSDT_SGL:
+        case CMD_PSDT_SGL_MD:
+            return NVME_INVALID_FORMAT;
+    }
+
+    nr = (dsm->nr & 0xff) + 1;
+    len = nr * sizeof (NvmeDsmRange);
+
+    /* The range list may cross a memory page boundary */
+    trans = n->page_size - (dsm->prp1 & (n->page_size - 1));
+    trans = MIN(trans, len);
+    if (nvme_read_from_host (range, dsm->prp1, trans))
+        return NVME_INVALID_FIELD | NVME_DNR;
+    if (len > trans && nvme_read_from_host ((uint8_t *) range + trans,
+                                                     dsm->prp2, len - trans))
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    for (i = 0; i < nr; i++) {
+        dealloc.slba = le64_to_cpu(range[i].slba);
+        dealloc.nlb = le32_to_cpu(range[i].nlb);
+
+        if (!dealloc.nlb)
+            continue;
+
+        if (dealloc.slba >= nsze || dealloc.nlb > nsze - dealloc.slba)
+            return NVME_LBA_RANGE | NVME_DNR;
+        dealloc.slba += ns->start_block;
+
+        if (core.debug)
+            printf("  DSM deallocate range %d: slba: %lu, nlb: %d\n",
+                                                i, dealloc.slba, dealloc.nlb);
+
+        if (nvm_ftl_cap_exec (FTL_CAP_DEALLOC, &dealloc))
+            return NVME_INTERNAL_DEV_ERROR;
+    }
 
     return NVME_SUCCESS;
 }
@@ -611,9 +763,71 @@ used. If the command uses SGLs for the data transfer, then the Metadata SGL
 Segment Pointer and SGL Entry 1 fields are used. All other command specific
 fields are reserved.
 */
-    /* TODO: Not implemented yet */
+    NvmeRwCmd *rw = (NvmeRwCmd *)cmd;
+    uint32_t nlb = rw->nlb + 1;
+    uint64_t data_size = nlb * NVME_KERNEL_PG_SIZE;
+    uint64_t *prp = req->nvm_io.prp;
+    uint8_t *host_buf;
+    uint32_t i, j;
+    uint16_t ret;
 
-    return NVME_SUCCESS;
+    req->nvm_io.status.status = NVM_IO_NEW;
+    req->is_write = 0;
+
+    ret = nvme_rw_check (n, ns, rw);
+    if (ret)
+        return ret;
+
+    /* Data read from NVM is placed in the first half of the buffer and the
+     * host data in the second half. Both are compared in a single memcmp
+     * when the read completes, see nvme_compare_cb */
+    req->cmp_buf = g_malloc (data_size * 2);
+    host_buf = req->cmp_buf + data_size;
+
+    nvme_rw_map_prp (rw, prp);
+
+    /* Physically contiguous host pages are transferred at once */
+    for (i = 0; i < nlb; i = j) {
+        for (j = i + 1; j < nlb; j++)
+            if (prp[j] != prp[j - 1] + NVME_KERNEL_PG_SIZE)
+                break;
+
+        if (nvme_read_from_host (host_buf + i * NVME_KERNEL_PG_SIZE, prp[i],
+                                             (j - i) * NVME_KERNEL_PG_SIZE)) {
+            ret = NVME_INVALID_FIELD | NVME_DNR;
+            goto FREE;
+        }
+    }
+
+    /* The FTL reads into controller memory instead of host memory */
+    for (i = 0; i < nlb; i++)
+        prp[i] = ((uint64_t) (req->cmp_buf + i * NVME_KERNEL_PG_SIZE)) |
+                                                                 NVM_PRP_LOCAL;
+
+    ret = nvme_rw_submit (ns, rw, req, MMGR_READ_PG);
+
+    /* If the buffer was not released by the callback, the cmd is not queued */
+    if (ret != NVME_NO_COMPLETE && req->cmp_buf)
+        goto FREE;
+
+    return ret;
+
+FREE:
+    g_free (req->cmp_buf);
+    req->cmp_buf = NULL;
+    return ret;
+}
+
+void nvme_compare_cb (NvmeRequest *req)
+{
+    uint64_t data_size = req->nlb * NVME_KERNEL_PG_SIZE;
+
+    if (req->status == NVME_SUCCESS &&
+                    memcmp (req->cmp_buf, req->cmp_buf + data_size, data_size))
+        req->status = NVME_CMP_FAILURE;
+
+    g_free (req->cmp_buf);
+    req->cmp_buf = NULL;
 }
 
 uint16_t nvme_write_zeros(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
@@ -628,7 +842,21 @@ protection information is updated based on CDW12.PRINFO. The fields used are
 Command Dword 10, Command Dword 11, Command Dword 12, Command Dword 14, and
 Command Dword 15 fields
 */
-    /* TODO: Not implemented yet */
+    NvmeRwCmd *rw = (NvmeRwCmd *)cmd;
+    struct nvm_ftl_cap_dealloc_st dealloc;
+    uint64_t nsze = le64_to_cpu(ns->id_ns.nsze);
+
+    /* Zeroes are not written, the LBAs are unmapped in the FTL and unmapped
+     * LBAs are read as zeroes. No data is transferred and no NVM is written */
+    dealloc.slba = rw->slba;
+    dealloc.nlb = rw->nlb + 1;
+
+    if (dealloc.slba >= nsze || dealloc.nlb > nsze - dealloc.slba)
+        return NVME_LBA_RANGE | NVME_DNR;
+    dealloc.slba += ns->start_block;
+
+    if (nvm_ftl_cap_exec (FTL_CAP_DEALLOC, &dealloc))
+        return NVME_INTERNAL_DEV_ERROR;
 
     return NVME_SUCCESS;
 }
@@ -637,89 +865,18 @@ uint16_t nvme_rw (NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
                                                              NvmeRequest *req)
 {
     NvmeRwCmd *rw = (NvmeRwCmd *)cmd;
-    int i;
-
-    uint32_t nlb  = rw->nlb + 1;
-    uint64_t slba = rw->slba;
-    uint64_t prp1 = rw->prp1;
-    uint64_t prp2 = rw->prp2;
-
-    const uint64_t elba = slba + nlb;
-    const uint8_t lba_index = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
-    const uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
-    uint64_t data_size = nlb << data_shift;
+    uint16_t ret;
 
     req->nvm_io.status.status = NVM_IO_NEW;
 
     req->is_write = rw->opcode == NVME_CMD_WRITE;
 
-    if (elba > (ns->id_ns.nsze))
-	return NVME_LBA_RANGE | NVME_DNR;
-
-    if (n->id_ctrl.mdts && data_size > n->page_size * (1 << n->id_ctrl.mdts))
-	return NVME_LBA_RANGE | NVME_DNR;
-
-    if (nlb > 256)
-	return NVME_INVALID_FIELD | NVME_DNR;
-
-    /* Metadata disabled
-    const uint16_t ms = ns->id_ns.lbaf[lba_index].ms;
-    uint64_t meta_size = nlb * ms;
-    if (meta_size)
-        return NVME_INVALID_FIELD | NVME_DNR;
-    */
-
-    /* End-to-end Data protection disabled
-    if ((ctrl & NVME_RW_PRINFO_PRACT) && !(ns->id_ns.dps & DPS_TYPE_MASK))
-        return NVME_INVALID_FIELD | NVME_DNR;
-    */
-
-    /* TODO: Map PRPs for SGL addresses */
-    switch (rw->psdt) {
-        case CMD_PSDT_PRP:
-        case CMD_PSDT_RSV:
-            req->nvm_io.prp[0] = prp1;
-
-            if (nlb == 2)
-                req->nvm_io.prp[1] = prp2;
-            else if (nlb > 2)
-                nvme_read_from_host((void *)(&req->nvm_io.prp[1]), prp2,
-                                                 (nlb - 1) * sizeof(uint64_t));
-            break;
-        case CMD_PSDT_SGL:
-        case CMD_PSDT_SGL_MD:
-            return NVME_INVALID_FORMAT;
-    }
-
-    req->slba = slba;
-    req->meta_size = 0;
-    req->status = NVME_SUCCESS;
-    req->nlb = nlb;
-    req->ns = ns;
-    req->lba_index = lba_index;
-
-    req->nvm_io.cid = rw->cid;
-    req->nvm_io.sec_sz = NVME_KERNEL_PG_SIZE;
-    req->nvm_io.md_sz = 0;
-    req->nvm_io.cmdtype = (req->is_write) ? MMGR_WRITE_PG : MMGR_READ_PG;
-    req->nvm_io.n_sec = nlb;
-    req->nvm_io.req = (void *) req;
-    req->nvm_io.slba = slba;
+    ret = nvme_rw_check (n, ns, rw);
+    if (ret)
+        return ret;
 
-    req->nvm_io.status.pg_errors = 0;
-    req->nvm_io.status.ret_t = 0;
-    req->nvm_io.status.total_pgs = 0;
-    req->nvm_io.status.pgs_p = 0;
-    req->nvm_io.status.pgs_s = 0;
-    req->nvm_io.status.status = NVM_IO_NEW;
-
-    for (i = 0; i < 8; i++) {
-        req->nvm_io.status.pg_map[i] = 0;
-    }
+    nvme_rw_map_prp (rw, req->nvm_io.prp);
 
-    if (core.debug)
-        nvme_debug_print_io (rw, req->nvm_io.sec_sz, data_size,
-                                     req->nvm_io.md_sz, elba, req->nvm_io.prp);
-
-    return nvm_submit_ftl(&req->nvm_io);
-}
\ No newline at end of file
+    return nvme_rw_submit (ns, rw, req,
+                             (req->is_write) ? MMGR_WRITE_PG : MMGR_READ_PG);
+}
@@ -0,0 +1,609 @@
+/* OX: OpenChannel NVM Express SSD Controller
+ *
+ * Copyright (C) 2016, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * This code is licensed under the GNU GPL v2 or later.
+ *
+ * I/O benchmark. Each thread owns 'qd' requests and keeps them in flight
+ * until the op count, shared by all threads, or the time limit is reached.
+ * FTL and NVMe requests complete in the FTL completion thread
+ * (nvm_complete_to_host), where the latency is added to the per thread
+ * histograms and the request is given back to its thread. The media manager
+ * layer is driven by synchronous page reads, one per thread at a time.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#include <time.h>
+#include "hw/block/ox-ctrl/include/ssd.h"
+#include "hw/block/ox-ctrl/include/nvme.h"
+#include "hw/block/ox-ctrl/include/ox-bench.h"
+
+struct ox_bench_stats {
+    uint64_t            errors;
+    uint64_t            bytes;
+    struct ox_lat_hist  lat;    /* successful I/Os only */
+};
+
+struct ox_bench_th;
+
+struct ox_bench_io {
+    NvmeRequest         req;    /* first, completions only get the request */
+    struct ox_bench_th  *th;
+    uint16_t            id;
+    uint8_t             is_write;
+    int                 inflight;
+    uint64_t            tstart;
+    uint8_t             *buf;
+};
+
+struct ox_bench;
+
+struct ox_bench_th {
+    uint16_t            id;
+    pthread_t           tid;
+    struct ox_bench     *b;
+    uint64_t            rng;
+    uint64_t            seq_next;
+    uint64_t            seq_start;
+    uint64_t            seq_end;
+    struct ox_bench_io  *io;
+    uint16_t            *free_io;
+    uint16_t            n_free;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    struct ox_bench_stats st[2]; /* read, write */
+};
+
+struct ox_bench {
+    struct nvm_init_arg *args;
+    uint8_t             layer;
+    uint32_t            bs;
+    uint32_t            bs_secs;
+    uint32_t            md_sz;      /* OOB, mmgr layer only */
+    uint16_t            qd;
+    uint64_t            n_items;    /* blocks of 'bs' bytes or flash pages */
+    uint64_t            deadline;
+    uint64_t            issued;     /* all threads, bounded by 'bench_ops' */
+    NvmeNamespace       *ns;
+    struct NvmeSQ       sq;
+    struct ox_bench_th  *th;
+
+    /* Zipfian generator, Gray et al., "Quickly generating billion-record
+     * synthetic databases", SIGMOD 1994 */
+    double              zetan;
+    double              zeta2;
+    double              alpha;
+    double              eta;
+};
+
+static const char *bench_layer_name[] = { "auto", "mmgr", "ftl", "nvme" };
+static const char *bench_pattern_name[] = { "rand", "seq", "zipf" };
+
+static uint64_t ox_bench_ts (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, one state per thread */
+static uint64_t ox_bench_rand (uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform in [0, 1) */
+static double ox_bench_rand_unit (uint64_t *state)
+{
+    return (ox_bench_rand (state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void ox_bench_zipf_init (struct ox_bench *b)
+{
+    double theta = b->args->bench_theta;
+    uint64_t i;
+
+    b->zetan = 0.0;
+    for (i = 1; i <= b->n_items; i++)
+        b->zetan += 1.0 / pow ((double) i, theta);
+
+    b->zeta2 = 1.0 + pow (0.5, theta);
+    b->alpha = 1.0 / (1.0 - theta);
+    b->eta = (1.0 - pow (2.0 / b->n_items, 1.0 - theta)) /
+                                                   (1.0 - b->zeta2 / b->zetan);
+}
+
+static uint64_t ox_bench_zipf_next (struct ox_bench *b, uint64_t *state)
+{
+    double u = ox_bench_rand_unit (state);
+    double uz = u * b->zetan;
+    uint64_t item;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < b->zeta2)
+        return 1;
+
+    item = (uint64_t) (b->n_items * pow (b->eta * u - b->eta + 1.0, b->alpha));
+
+    return (item < b->n_items) ? item : b->n_items - 1;
+}
+
+static uint64_t ox_bench_next_item (struct ox_bench_th *th)
+{
+    struct ox_bench *b = th->b;
+    uint64_t item;
+
+    switch (b->args->bench_pattern) {
+        case OX_BENCH_SEQ:
+            item = th->seq_next++;
+            if (th->seq_next == th->seq_end)
+                th->seq_next = th->seq_start;
+            return item;
+        case OX_BENCH_ZIPF:
+            return ox_bench_zipf_next (b, &th->rng);
+        case OX_BENCH_RAND:
+        default:
+            return ox_bench_rand (&th->rng) % b->n_items;
+    }
+}
+
+static uint8_t ox_bench_is_write (struct ox_bench_th *th)
+{
+    return (ox_bench_rand (&th->rng) % 100) >= th->b->args->bench_read_pct;
+}
+
+/* Takes one I/O from the total op count, shared by all threads */
+static int ox_bench_done (struct ox_bench *b)
+{
+    if (b->args->bench_ops &&
+              __sync_fetch_and_add (&b->issued, 1) >= b->args->bench_ops)
+        return 1;
+
+    return (b->deadline && ox_bench_ts () >= b->deadline);
+}
+
+static void ox_bench_account (struct ox_bench_th *th, uint8_t is_write,
+                                  uint16_t status, uint64_t lat, uint32_t bytes)
+{
+    struct ox_bench_stats *st = &th->st[is_write];
+
+    if (status != NVME_SUCCESS) {
+        __sync_fetch_and_add (&st->errors, 1);
+        return;
+    }
+
+    ox_lat_hist_add (&st->lat, lat);
+    __sync_fetch_and_add (&st->bytes, bytes);
+}
+
+static void ox_bench_put_io (struct ox_bench_io *io)
+{
+    struct ox_bench_th *th = io->th;
+
+    ox_bench_account (th, io->is_write, io->req.status,
+                                 ox_bench_ts () - io->tstart, th->b->bs);
+
+    pthread_mutex_lock (&th->mutex);
+    th->free_io[th->n_free++] = io->id;
+    pthread_cond_signal (&th->cond);
+    pthread_mutex_unlock (&th->mutex);
+}
+
+static struct ox_bench_io *ox_bench_get_io (struct ox_bench_th *th)
+{
+    struct ox_bench_io *io;
+
+    pthread_mutex_lock (&th->mutex);
+    while (!th->n_free)
+        pthread_cond_wait (&th->cond, &th->mutex);
+    io = &th->io[th->free_io[--th->n_free]];
+    pthread_mutex_unlock (&th->mutex);
+
+    return io;
+}
+
+/* Called by nvm_complete_to_host while RUN_BENCH is set */
+void ox_bench_complete_io (NvmeRequest *req)
+{
+    struct ox_bench_io *io = (struct ox_bench_io *) req;
+
+    if (!__sync_bool_compare_and_swap (&io->inflight, 1, 0))
+        return;
+
+    ox_bench_put_io (io);
+}
+
+/* Same as nvme_rw_submit, without namespace translation */
+static uint16_t ox_bench_ftl_submit (struct ox_bench *b, NvmeRequest *req,
+                                               uint64_t slba, uint8_t cmdtype)
+{
+    int i;
+
+    req->slba = slba;
+    req->nlb = b->bs_secs;
+    req->status = NVME_SUCCESS;
+
+    req->nvm_io.cid = req->cmd.cid;
+    req->nvm_io.sec_sz = NVME_KERNEL_PG_SIZE;
+    req->nvm_io.md_sz = 0;
+    req->nvm_io.cmdtype = cmdtype;
+    req->nvm_io.n_sec = b->bs_secs;
+    req->nvm_io.req = (void *) req;
+    req->nvm_io.slba = slba;
+
+    req->nvm_io.status.pg_errors = 0;
+    req->nvm_io.status.ret_t = 0;
+    req->nvm_io.status.total_pgs = 0;
+    req->nvm_io.status.pgs_p = 0;
+    req->nvm_io.status.pgs_s = 0;
+    req->nvm_io.status.status = NVM_IO_NEW;
+
+    for (i = 0; i < 8; i++)
+        req->nvm_io.status.pg_map[i] = 0;
+
+    return nvm_submit_ftl (&req->nvm_io);
+}
+
+static void ox_bench_submit (struct ox_bench_th *th, struct ox_bench_io *io)
+{
+    struct ox_bench *b = th->b;
+    NvmeRequest *req = &io->req;
+    NvmeRwCmd rw;
+    uint64_t slba;
+    uint16_t ret;
+    uint8_t cmdtype;
+    uint32_t i;
+
+    slba = ox_bench_next_item (th) * b->bs_secs;
+    io->is_write = ox_bench_is_write (th);
+    cmdtype = (io->is_write) ? MMGR_WRITE_PG : MMGR_READ_PG;
+
+    req->sq = &b->sq;
+    req->is_write = io->is_write;
+    req->cmd.opcode = (io->is_write) ? NVME_CMD_WRITE : NVME_CMD_READ;
+    req->cmd.cid = io->id;
+    req->cmd.nsid = 1;
+
+    for (i = 0; i < b->bs_secs; i++)
+        req->nvm_io.prp[i] = ((uint64_t) (io->buf +
+                                  i * NVME_KERNEL_PG_SIZE)) | NVM_PRP_LOCAL;
+
+    io->inflight = 1;
+    io->tstart = ox_bench_ts ();
+
+    if (b->layer == OX_BENCH_NVME) {
+        memset (&rw, 0, sizeof (NvmeRwCmd));
+        rw.opcode = req->cmd.opcode;
+        rw.cid = req->cmd.cid;
+        rw.nsid = req->cmd.nsid;
+        rw.slba = slba;
+        rw.nlb = b->bs_secs - 1;
+        ret = nvme_rw_submit (b->ns, &rw, req, cmdtype);
+    } else {
+        ret = ox_bench_ftl_submit (b, req, slba, cmdtype);
+    }
+
+    /* Not queued and not completed by the core (FTL queue full) */
+    if (ret != NVME_NO_COMPLETE &&
+                         __sync_bool_compare_and_swap (&io->inflight, 1, 0)) {
+        req->status = (ret == NVME_SUCCESS) ? NVME_CMD_ABORT_REQ : ret;
+        ox_bench_put_io (io);
+    }
+}
+
+static void *ox_bench_async_th (void *arg)
+{
+    struct ox_bench_th *th = (struct ox_bench_th *) arg;
+
+    while (!ox_bench_done (th->b))
+        ox_bench_submit (th, ox_bench_get_io (th));
+
+    /* Wait for the requests in flight */
+    pthread_mutex_lock (&th->mutex);
+    while (th->n_free < th->b->qd)
+        pthread_cond_wait (&th->cond, &th->mutex);
+    pthread_mutex_unlock (&th->mutex);
+
+    return NULL;
+}
+
+/* Flash pages are numbered plane first, then page, block, lun and channel */
+static struct nvm_channel *ox_bench_ppa (uint64_t item,
+                                                     struct nvm_ppa_addr *ppa)
+{
+    struct nvm_mmgr_geometry *g = core.nvm_ch[0]->geometry;
+
+    ppa->ppa = 0;
+    ppa->g.pl = item % g->n_of_planes;
+    item /= g->n_of_planes;
+    ppa->g.pg = item % g->pg_per_blk;
+    item /= g->pg_per_blk;
+    ppa->g.blk = item % g->blk_per_lun;
+    item /= g->blk_per_lun;
+    ppa->g.lun = item % g->lun_per_ch;
+
+    return core.nvm_ch[item / g->lun_per_ch];
+}
+
+static void *ox_bench_sync_th (void *arg)
+{
+    struct ox_bench_th *th = (struct ox_bench_th *) arg;
+    struct nvm_mmgr_io_cmd *cmd;
+    struct nvm_channel *ch;
+    uint64_t tstart;
+    int ret;
+
+    cmd = g_malloc (sizeof (struct nvm_mmgr_io_cmd));
+
+    while (!ox_bench_done (th->b)) {
+        memset (cmd, 0x0, sizeof (struct nvm_mmgr_io_cmd));
+        ch = ox_bench_ppa (ox_bench_next_item (th), &cmd->ppa);
+
+        tstart = ox_bench_ts ();
+        ret = nvm_submit_sync_io (ch, cmd, th->io[0].buf, MMGR_READ_PG);
+
+        ox_bench_account (th, 0, (ret) ? NVME_CMD_ABORT_REQ : NVME_SUCCESS,
+                                            ox_bench_ts () - tstart, th->b->bs);
+    }
+
+    g_free (cmd);
+    return NULL;
+}
+
+static void ox_bench_th_free (struct ox_bench *b, struct ox_bench_th *th)
+{
+    uint16_t i;
+
+    if (th->io) {
+        for (i = 0; i < b->qd; i++)
+            g_free (th->io[i].buf);
+        g_free (th->io);
+    }
+    g_free (th->free_io);
+    pthread_cond_destroy (&th->cond);
+    pthread_mutex_destroy (&th->mutex);
+}
+
+static void ox_bench_th_init (struct ox_bench *b, struct ox_bench_th *th,
+                                                    uint16_t id, uint64_t seed)
+{
+    uint64_t per_th = b->n_items / b->args->bench_threads;
+    uint16_t i;
+
+    th->id = id;
+    th->b = b;
+    th->rng = (seed ^ (0x9E3779B97F4A7C15ULL * (id + 1))) | 1;
+    th->seq_start = per_th * id;
+    th->seq_end = (id == b->args->bench_threads - 1) ?
+                                         b->n_items : th->seq_start + per_th;
+    th->seq_next = th->seq_start;
+
+    pthread_mutex_init (&th->mutex, NULL);
+    pthread_cond_init (&th->cond, NULL);
+
+    th->io = g_malloc0 (sizeof (struct ox_bench_io) * b->qd);
+    th->free_io = g_malloc (sizeof (uint16_t) * b->qd);
+
+    for (i = 0; i < b->qd; i++) {
+        th->io[i].th = th;
+        th->io[i].id = i;
+        th->io[i].buf = g_malloc (b->bs + b->md_sz);
+        memset (th->io[i].buf, 0xa5 ^ i, b->bs + b->md_sz);
+        th->free_io[i] = i;
+    }
+    th->n_free = b->qd;
+}
+
+static void ox_bench_print_op (FILE *f, const char *name,
+                               struct ox_bench_stats *st, uint64_t runtime_ns)
+{
+    struct ox_lat_hist *h = &st->lat;
+    double sec = runtime_ns / 1000000000.0;
+
+    fprintf (f, "  \"%s\": {\"ios\": %lu, \"errors\": %lu, \"bytes\": %lu, "
+                "\"iops\": %.1f, \"bw_bytes\": %.1f, \"lat_ns\": {\"mean\": "
+                "%.1f, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p999\": %lu,"
+                " \"max\": %lu}}", name, h->count, st->errors, st->bytes,
+                (sec > 0) ? h->count / sec : 0.0,
+                (sec > 0) ? st->bytes / sec : 0.0,
+                (h->count) ? (double) h->sum / h->count : 0.0,
+                ox_lat_hist_percentile (h, 50.0),
+                ox_lat_hist_percentile (h, 90.0),
+                ox_lat_hist_percentile (h, 99.0),
+                ox_lat_hist_percentile (h, 99.9), h->max);
+}
+
+static int ox_bench_report (struct ox_bench *b, uint64_t runtime_ns)
+{
+    struct nvm_init_arg *args = b->args;
+    struct ox_bench_stats st[3];
+    FILE *f = stdout;
+    uint16_t t;
+    int op;
+
+    memset (st, 0x0, sizeof (st));
+    for (t = 0; t < args->bench_threads; t++) {
+        for (op = 0; op < 2; op++) {
+            st[op].errors += b->th[t].st[op].errors;
+            st[op].bytes += b->th[t].st[op].bytes;
+            ox_lat_hist_merge (&st[op].lat, &b->th[t].st[op].lat);
+        }
+    }
+    for (op = 0; op < 2; op++) {
+        st[2].errors += st[op].errors;
+        st[2].bytes += st[op].bytes;
+        ox_lat_hist_merge (&st[2].lat, &st[op].lat);
+    }
+
+    if (args->bench_out[0]) {
+        f = fopen (args->bench_out, "w");
+        if (!f) {
+            log_err ("[ox-bench: cannot open %s]\n", args->bench_out);
+            return -1;
+        }
+    }
+
+    fprintf (f, "{\n  \"layer\": \"%s\", \"pattern\": \"%s\", \"theta\": %.3f, "
+                "\"bs\": %u, \"qd\": %u, \"threads\": %u, \"read_pct\": %u, "
+                "\"items\": %lu, \"runtime_ns\": %lu,\n",
+                bench_layer_name[b->layer],
+                bench_pattern_name[args->bench_pattern],
+                (args->bench_pattern == OX_BENCH_ZIPF) ? args->bench_theta : 0,
+                b->bs, b->qd, args->bench_threads, args->bench_read_pct,
+                b->n_items, runtime_ns);
+    ox_bench_print_op (f, "read", &st[0], runtime_ns);
+    fprintf (f, ",\n");
+    ox_bench_print_op (f, "write", &st[1], runtime_ns);
+    fprintf (f, ",\n");
+    ox_bench_print_op (f, "total", &st[2], runtime_ns);
+    fprintf (f, "\n}\n");
+
+    if (f != stdout)
+        fclose (f);
+
+    printf (" Benchmark: %lu I/Os, %lu errors, %.1f IOPS\n", st[2].lat.count,
+                    st[2].errors, (runtime_ns) ?
+                    st[2].lat.count / (runtime_ns / 1000000000.0) : 0.0);
+
+    return 0;
+}
+
+static int ox_bench_setup (struct ox_bench *b)
+{
+    struct nvm_init_arg *args = b->args;
+    struct nvm_mmgr_geometry *g;
+    uint64_t n_lbas;
+
+    if (b->layer == OX_BENCH_AUTO)
+        b->layer = (core.lnvm) ? OX_BENCH_MMGR : OX_BENCH_NVME;
+
+    switch (b->layer) {
+        case OX_BENCH_MMGR:
+            if (args->bench_read_pct != 100) {
+                log_err ("[ox-bench: mmgr layer is read only, writes would "
+                                                    "overwrite FTL metadata]\n");
+                return -1;
+            }
+            g = core.nvm_ch[0]->geometry;
+            b->bs = g->pg_size;
+            b->bs_secs = g->sec_per_pg;
+            b->md_sz = g->sec_oob_sz * g->sec_per_pg;
+            b->qd = 1;
+            b->n_items = (uint64_t) core.nvm_ch_count * g->lun_per_ch *
+                         g->blk_per_lun * g->pg_per_blk * g->n_of_planes;
+            return 0;
+        case OX_BENCH_FTL:
+        case OX_BENCH_NVME:
+            if (core.lnvm) {
+                log_err ("[ox-bench: %s layer needs AppNVM mode]\n",
+                                                  bench_layer_name[b->layer]);
+                return -1;
+            }
+            b->bs = args->bench_bs;
+            b->bs_secs = args->bench_bs / NVME_KERNEL_PG_SIZE;
+            b->qd = args->bench_qd;
+
+            if (b->layer == OX_BENCH_NVME) {
+                if (!core.nvm_nvme_ctrl ||
+                                    !core.nvm_nvme_ctrl->num_namespaces) {
+                    log_err ("[ox-bench: no namespace available]\n");
+                    return -1;
+                }
+                b->ns = &core.nvm_nvme_ctrl->namespaces[0];
+                n_lbas = b->ns->id_ns.nsze;
+            } else {
+                n_lbas = core.nvm_ns_size / NVME_KERNEL_PG_SIZE;
+            }
+
+            b->n_items = n_lbas / b->bs_secs;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+int ox_bench_run (struct nvm_init_arg *args)
+{
+    struct ox_bench b;
+    uint64_t tstart, tend;
+    uint16_t t, n_th = args->bench_threads;
+    int ret = -1;
+
+    memset (&b, 0x0, sizeof (struct ox_bench));
+    b.args = args;
+    b.layer = args->bench_layer;
+
+    if (ox_bench_setup (&b))
+        return -1;
+
+    if (b.n_items < n_th) {
+        log_err ("[ox-bench: span of %lu blocks is too small for %d "
+                                               "threads]\n", b.n_items, n_th);
+        return -1;
+    }
+
+    if (args->bench_pattern == OX_BENCH_ZIPF)
+        ox_bench_zipf_init (&b);
+
+    b.th = g_malloc0 (sizeof (struct ox_bench_th) * n_th);
+
+    tstart = ox_bench_ts ();
+    for (t = 0; t < n_th; t++)
+        ox_bench_th_init (&b, &b.th[t], t, tstart);
+
+    printf (" Benchmark started: layer %s, pattern %s, bs %d, qd %d, "
+                "threads %d, read %d%%\n", bench_layer_name[b.layer],
+                bench_pattern_name[args->bench_pattern], b.bs, b.qd, n_th,
+                args->bench_read_pct);
+    log_info ("[ox-bench: started, layer %s]\n", bench_layer_name[b.layer]);
+
+    tstart = ox_bench_ts ();
+    if (args->bench_time)
+        b.deadline = tstart + (uint64_t) args->bench_time * 1000000000ULL;
+
+    for (t = 0; t < n_th; t++) {
+        if (ox_thread_create (&b.th[t].tid, (b.layer == OX_BENCH_MMGR) ?
+                              ox_bench_sync_th : ox_bench_async_th, &b.th[t]))
+            break;
+    }
+
+    /* Threads already started stop at the op count or at the deadline */
+    if (t < n_th) {
+        log_err ("[ox-bench: failed to create thread %d]\n", t);
+        b.deadline = tstart;
+        n_th = t;
+    }
+
+    for (t = 0; t < n_th; t++)
+        pthread_join (b.th[t].tid, NULL);
+    tend = ox_bench_ts ();
+
+    if (n_th == args->bench_threads)
+        ret = ox_bench_report (&b, tend - tstart);
+
+    for (t = 0; t < args->bench_threads; t++)
+        ox_bench_th_free (&b, &b.th[t]);
+    g_free (b.th);
+
+    log_info ("[ox-bench: finished]\n");
+
+    return ret;
+}
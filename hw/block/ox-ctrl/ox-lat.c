@@ -0,0 +1,242 @@
+/* OX: OpenChannel NVM Express SSD Controller
+ *
+ * Copyright (C) 2016, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * This code is licensed under the GNU GPL v2 or later.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "include/ox-lat.h"
+#include "include/ssd.h"
+
+uint8_t ox_lat_enabled = 0;
+
+static struct ox_lat_hist lat_hist[OX_LAT_STAGE_COUNT][OX_LAT_OP_COUNT]
+                                                                [OX_LAT_QUEUES];
+
+static const char *lat_stage_name[OX_LAT_STAGE_COUNT] = {
+    "sq_fetch", "ftl_queue", "map", "mmgr_queue",
+    "media", "dma", "cq_post", "total"
+};
+
+static const char *lat_op_name[OX_LAT_OP_COUNT] = {
+    "read", "write", "other"
+};
+
+static inline uint32_t ox_lat_bucket (uint64_t ns)
+{
+    uint32_t msb;
+
+    if (ns < OX_LAT_SUB)
+        return ns;
+
+    msb = 63 - __builtin_clzll (ns);
+    if (msb >= OX_LAT_MAX_BITS)
+        return OX_LAT_BUCKETS - 1;
+
+    return (msb - OX_LAT_SUB_BITS + 1) * OX_LAT_SUB +
+                   ((ns >> (msb - OX_LAT_SUB_BITS)) & (OX_LAT_SUB - 1));
+}
+
+/* Lowest latency (ns) accounted in the bucket */
+static uint64_t ox_lat_bucket_low (uint32_t b)
+{
+    if (b < OX_LAT_SUB)
+        return b;
+
+    return (uint64_t) (OX_LAT_SUB + (b % OX_LAT_SUB)) << (b / OX_LAT_SUB - 1);
+}
+
+void ox_lat_hist_add (struct ox_lat_hist *h, uint64_t lat)
+{
+    uint64_t max;
+
+    __sync_fetch_and_add (&h->bucket[ox_lat_bucket (lat)], 1);
+    __sync_fetch_and_add (&h->sum, lat);
+    __sync_fetch_and_add (&h->count, 1);
+
+    max = h->max;
+    while (lat > max && !__sync_bool_compare_and_swap (&h->max, max, lat))
+        max = h->max;
+}
+
+/* Adds the time elapsed since 'start' to the histogram and returns the
+ * current timestamp, so consecutive stages can be chained. */
+uint64_t ox_lat_add (uint8_t stage, uint8_t op, uint16_t qid, uint64_t start)
+{
+    uint64_t now, lat;
+
+    if (!start || stage >= OX_LAT_STAGE_COUNT || op >= OX_LAT_OP_COUNT)
+        return 0;
+
+    now = ox_lat_ts ();
+    if (!now)
+        return 0;
+
+    lat = (now > start) ? now - start : 0;
+    ox_lat_hist_add (&lat_hist[stage][op][qid % OX_LAT_QUEUES], lat);
+
+    return now;
+}
+
+uint8_t ox_lat_op (uint8_t cmdtype)
+{
+    switch (cmdtype) {
+        case MMGR_READ_PG:
+            return OX_LAT_OP_READ;
+        case MMGR_WRITE_PG:
+            return OX_LAT_OP_WRITE;
+        default:
+            return OX_LAT_OP_OTHER;
+    }
+}
+
+/* Concurrent updates during a reset may leave a few samples behind */
+void ox_lat_reset (void)
+{
+    memset (lat_hist, 0x0, sizeof (lat_hist));
+}
+
+void ox_lat_hist_merge (struct ox_lat_hist *dst, struct ox_lat_hist *src)
+{
+    uint32_t b;
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+
+    for (b = 0; b < OX_LAT_BUCKETS; b++)
+        dst->bucket[b] += src->bucket[b];
+}
+
+/* Returns the upper bound (ns) of the bucket containing the percentile */
+uint64_t ox_lat_hist_percentile (struct ox_lat_hist *h, double pct)
+{
+    uint64_t target, acc = 0, high;
+    uint32_t b;
+
+    if (!h->count)
+        return 0;
+
+    target = (uint64_t) (h->count * pct / 100.0);
+    if (target < h->count * pct / 100.0 || !target)
+        target++;
+
+    for (b = 0; b < OX_LAT_BUCKETS; b++) {
+        acc += h->bucket[b];
+        if (acc >= target)
+            break;
+    }
+
+    if (b >= OX_LAT_BUCKETS - 1)
+        return h->max;
+
+    high = ox_lat_bucket_low (b + 1) - 1;
+    return (high < h->max) ? high : h->max;
+}
+
+void ox_lat_print (FILE *f, fprintf_function print)
+{
+    struct ox_lat_hist h;
+    int s, o, q, rows = 0;
+
+    print (f, "OX: latency tracing is %s (values in usec)\n",
+                                             ox_lat_enabled ? "on" : "off");
+    print (f, " %-10s %-5s %10s %10s %10s %10s %10s %10s %10s\n", "stage",
+            "op", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+    for (s = 0; s < OX_LAT_STAGE_COUNT; s++) {
+        for (o = 0; o < OX_LAT_OP_COUNT; o++) {
+            memset (&h, 0x0, sizeof (struct ox_lat_hist));
+            for (q = 0; q < OX_LAT_QUEUES; q++)
+                ox_lat_hist_merge (&h, &lat_hist[s][o][q]);
+
+            if (!h.count)
+                continue;
+
+            print (f, " %-10s %-5s %10" PRIu64 " %10.2f %10.2f %10.2f %10.2f "
+                    "%10.2f %10.2f\n", lat_stage_name[s], lat_op_name[o],
+                    h.count,
+                    (double) h.sum / h.count / 1000.0,
+                    ox_lat_hist_percentile (&h, 50.0) / 1000.0,
+                    ox_lat_hist_percentile (&h, 90.0) / 1000.0,
+                    ox_lat_hist_percentile (&h, 99.0) / 1000.0,
+                    ox_lat_hist_percentile (&h, 99.9) / 1000.0,
+                    h.max / 1000.0);
+            rows++;
+        }
+    }
+
+    if (!rows)
+        print (f, " No samples.\n");
+}
+
+void ox_lat_print_json (FILE *f, fprintf_function print)
+{
+    struct ox_lat_hist h;
+    int s, o, q, first = 1, first_b;
+    uint32_t b;
+
+    print (f, "{\"enabled\": %d, \"unit\": \"ns\", \"histograms\": [",
+                                                               ox_lat_enabled);
+
+    for (s = 0; s < OX_LAT_STAGE_COUNT; s++) {
+        for (o = 0; o < OX_LAT_OP_COUNT; o++) {
+            for (q = 0; q < OX_LAT_QUEUES; q++) {
+
+                /* Snapshot, the histogram may be updated while printing */
+                memcpy (&h, &lat_hist[s][o][q], sizeof (struct ox_lat_hist));
+                if (!h.count)
+                    continue;
+
+                print (f, "%s\n  {\"stage\": \"%s\", \"op\": \"%s\", "
+                        "\"queue\": %d, \"count\": %" PRIu64 ", \"sum\": %" PRIu64
+                        ", \"max\": %" PRIu64 ", \"p50\": %" PRIu64
+                        ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64
+                        ", \"p999\": %" PRIu64 ", \"buckets\": [",
+                        first ? "" : ",", lat_stage_name[s], lat_op_name[o],
+                        q, h.count, h.sum, h.max,
+                        ox_lat_hist_percentile (&h, 50.0),
+                        ox_lat_hist_percentile (&h, 90.0),
+                        ox_lat_hist_percentile (&h, 99.0),
+                        ox_lat_hist_percentile (&h, 99.9));
+                first = 0;
+
+                /* Only non-empty buckets: [lowest ns, samples] */
+                first_b = 1;
+                for (b = 0; b < OX_LAT_BUCKETS; b++) {
+                    if (!h.bucket[b])
+                        continue;
+                    print (f, "%s[%" PRIu64 ", %" PRIu64 "]",
+                                         first_b ? "" : ", ",
+                                         ox_lat_bucket_low (b), h.bucket[b]);
+                    first_b = 0;
+                }
+                print (f, "]}");
+            }
+        }
+    }
+
+    print (f, "\n]}\n");
+}
+
+int ox_lat_dump_json (const char *path)
+{
+    FILE *f;
+
+    f = fopen (path, "w");
+    if (!f)
+        return -1;
+
+    ox_lat_print_json (f, fprintf);
+    fclose (f);
+
+    return 0;
+}
@@ -9,8 +9,10 @@
 #include "include/ox-mq.h"
 #include "include/ssd.h"
 
+/* Multi-queues of every instance, each one is only visible to its owner */
 static int mq_count = 0;
 LIST_HEAD(mq_list, ox_mq) mq_head = LIST_HEAD_INITIALIZER(mq_head);
+static pthread_mutex_t mq_list_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 int ox_mq_get_status (struct ox_mq *mq, struct ox_mq_stats *st, uint16_t qid)
 {
@@ -35,6 +37,16 @@ int ox_mq_used_count (struct ox_mq *mq, uint16_t qid)
     return u_atomic_read(&mq->queues[qid].stats.sq_used);
 }
 
+/* Requests queued or being processed by the queue */
+int ox_mq_load (struct ox_mq *mq, uint16_t qid)
+{
+    if (!mq || !mq->config || qid >= mq->config->n_queues)
+        return -1;
+
+    return u_atomic_read(&mq->queues[qid].stats.sq_used) +
+                                u_atomic_read(&mq->queues[qid].stats.sq_wait);
+}
+
 void ox_mq_show_mq (struct ox_mq *mq)
 {
     int i;
@@ -60,14 +72,28 @@ void ox_mq_show_all (void)
 {
     struct ox_mq *mq;
     LIST_FOREACH (mq, &mq_head, entry) {
-        ox_mq_show_mq (mq);
+        if (mq->inst == ox_inst)
+            ox_mq_show_mq (mq);
+    }
+}
+
+/* Calls 'fn' for every multi-queue, queues are not destroyed meanwhile */
+void ox_mq_walk (ox_mq_walk_fn *fn, void *arg)
+{
+    struct ox_mq *mq;
+
+    pthread_mutex_lock (&mq_list_mutex);
+    LIST_FOREACH (mq, &mq_head, entry) {
+        if (mq->inst == ox_inst)
+            fn (mq, arg);
     }
+    pthread_mutex_unlock (&mq_list_mutex);
 }
 
 struct ox_mq *ox_mq_get (const char *name) {
     struct ox_mq *mq;
     LIST_FOREACH(mq, &mq_head, entry){
-        if(!strcmp (mq->config->name, name))
+        if(mq->inst == ox_inst && !strcmp (mq->config->name, name))
             return mq;
     }
     return NULL;
@@ -227,11 +253,14 @@ static void ox_mq_free_queues (struct ox_mq *mq, uint32_t n_queues)
     int i, j;
     struct ox_mq_queue *q;
 
+    /* Threads may steal from other queues, all of them are stopped first */
+    for (i = 0; i < n_queues; i++)
+        mq->queues[i].running = 0;
+
     for (i = 0; i < n_queues; i++) {
         q = &mq->queues[i];
 
         /* Wake threads if queue was empty and stop it */
-        q->running = 0;
         pthread_mutex_lock (&q->sq_used_mutex);
         if (TAILQ_EMPTY (&q->sq_used)) {
             pthread_mutex_lock (&q->sq_cond_m);
@@ -250,6 +279,10 @@ static void ox_mq_free_queues (struct ox_mq *mq, uint32_t n_queues)
 
         pthread_join(q->sq_tid, NULL);
         pthread_join(q->cq_tid, NULL);
+    }
+
+    for (i = 0; i < n_queues; i++) {
+        q = &mq->queues[i];
 
         for (j = 0; j < mq->config->q_size; j++) {
             pthread_mutex_destroy (&q->sq_entries[j].entry_mutex);
@@ -284,17 +317,81 @@ static void ox_mq_free_queues (struct ox_mq *mq, uint32_t n_queues)
         pthread_mutex_unlock ((mutex));                             \
 } while (/*CONSTCOND*/0)
 
+/* Processes the oldest request of the busiest queue in the steal group. The
+ * entry stays in its own queue, the completion is posted there */
+static int ox_mq_steal_req (struct ox_mq_queue *q)
+{
+    struct ox_mq_queue *vq, *victim = NULL;
+    struct ox_mq_entry *req;
+    int i, used, max = 0;
+
+    for (i = 0; i < q->steal_n; i++) {
+        vq = &q->steal_q[i];
+        if (vq == q || !vq->running)
+            continue;
+
+        used = u_atomic_read(&vq->stats.sq_used);
+        if (used > max) {
+            max = used;
+            victim = vq;
+        }
+    }
+
+    if (!victim)
+        return 0;
+
+    pthread_mutex_lock (&victim->sq_used_mutex);
+    req = TAILQ_FIRST (&victim->sq_used);
+    if (req) {
+        TAILQ_REMOVE (&victim->sq_used, req, entry);
+        u_atomic_dec(&victim->stats.sq_used);
+    }
+    pthread_mutex_unlock (&victim->sq_used_mutex);
+
+    if (!req)
+        return 0;
+
+    gettimeofday(&req->wtime, NULL);
+
+    req->status = OX_MQ_WAITING;
+    OX_MQ_ENQUEUE (&victim->sq_wait, req, &victim->sq_wait_mutex,
+                                                     &victim->stats.sq_wait);
+    victim->sq_fn (req);
+
+    return 1;
+}
+
+/* Wakes an idle queue of the group to steal from a backlogged queue */
+static void ox_mq_wake_thief (struct ox_mq_queue *q)
+{
+    struct ox_mq_queue *tq;
+    int i;
+
+    for (i = 0; i < q->steal_n; i++) {
+        tq = &q->steal_q[i];
+        if (tq == q || u_atomic_read(&tq->stats.sq_used) ||
+                                          u_atomic_read(&tq->stats.sq_wait))
+            continue;
+
+        pthread_mutex_lock (&tq->sq_cond_m);
+        pthread_cond_signal(&tq->sq_cond);
+        pthread_mutex_unlock (&tq->sq_cond_m);
+        return;
+    }
+}
+
 static void *ox_mq_sq_thread (void *arg)
 {
     struct ox_mq_queue *q = (struct ox_mq_queue *) arg;
     struct ox_mq_entry *req;
     struct timespec ts;
     struct timeval tv;
+    int stolen = 0;
 
     while (q->running) {
         pthread_mutex_lock(&q->sq_cond_m);
 
-        if (TAILQ_EMPTY (&q->sq_used)) {
+        if (TAILQ_EMPTY (&q->sq_used) && !stolen) {
             gettimeofday(&tv, NULL);
             ts.tv_sec = tv.tv_sec + 1; /* 1 second timeout */
             ts.tv_nsec = tv.tv_usec * 1000;
@@ -306,8 +403,11 @@ static void *ox_mq_sq_thread (void *arg)
         if (!q->running)
             pthread_exit(NULL);
 
-        if (TAILQ_EMPTY (&q->sq_used))
+        if (TAILQ_EMPTY (&q->sq_used)) {
+            stolen = (q->steal_n) ? ox_mq_steal_req (q) : 0;
             continue;
+        }
+        stolen = 0;
 
         OX_MQ_DEQUEUE_H(&q->sq_used, req, &q->sq_used_mutex, &q->stats.sq_used);
 
@@ -364,10 +464,10 @@ static void *ox_mq_cq_thread (void *arg)
 
 static int ox_mq_start_thread (struct ox_mq_queue *q)
 {
-    if (pthread_create(&q->sq_tid, NULL, ox_mq_sq_thread, q))
+    if (ox_thread_create(&q->sq_tid, ox_mq_sq_thread, q))
         return -1;
 
-    if (pthread_create(&q->cq_tid, NULL, ox_mq_cq_thread, q))
+    if (ox_thread_create(&q->cq_tid, ox_mq_cq_thread, q))
         return -1;
 
     return 0;
@@ -420,6 +520,10 @@ int ox_mq_submit_req (struct ox_mq *mq, uint32_t qid, void *opaque)
     }
     pthread_mutex_unlock (&q->sq_used_mutex);
 
+    /* Consumer thread is busy, let an idle one help */
+    if (!wake && q->steal_n)
+        ox_mq_wake_thief (q);
+
     return 0;
 }
 
@@ -646,7 +750,7 @@ static int ox_mq_start_to (struct ox_mq *mq)
 {
     LIST_INIT (&mq->ext_list);
 
-    if (pthread_create(&mq->to_tid, NULL, ox_mq_to_thread, mq))
+    if (ox_thread_create(&mq->to_tid, ox_mq_to_thread, mq))
         return -1;
 
     return 0;
@@ -655,6 +759,7 @@ static int ox_mq_start_to (struct ox_mq *mq)
 struct ox_mq *ox_mq_init (struct ox_mq_config *config)
 {
     int i;
+    uint32_t grp = 0;
 
     if (config->q_size < 1 || config->q_size > 0x10000 ||
                             config->n_queues < 1 || config->n_queues > 0x10000)
@@ -671,6 +776,13 @@ struct ox_mq *ox_mq_init (struct ox_mq_config *config)
 
     ox_mq_init_stats(&mq->stats);
     mq->stop = 0;
+    mq->inst = ox_inst;
+
+    if (config->flags & OX_MQ_WORK_STEAL) {
+        grp = (config->steal_group) ? config->steal_group : config->n_queues;
+        if (config->n_queues % grp)
+            goto FREE_Q;
+    }
 
     for (i = 0; i < config->n_queues; i++) {
         if (ox_mq_init_queue (&mq->queues[i], config->q_size,
@@ -679,6 +791,11 @@ struct ox_mq *ox_mq_init (struct ox_mq_config *config)
             goto FREE_Q;
         }
 
+        if (config->flags & OX_MQ_WORK_STEAL && grp > 1) {
+            mq->queues[i].steal_q = &mq->queues[i - (i % grp)];
+            mq->queues[i].steal_n = grp;
+        }
+
         if (ox_mq_start_thread (&mq->queues[i])) {
             ox_mq_free_queues (mq, i + 1);
             goto FREE_Q;
@@ -694,11 +811,13 @@ struct ox_mq *ox_mq_init (struct ox_mq_config *config)
     if (mq->config->to_usec && ox_mq_start_to(mq))
         goto FREE_ALL;
 
+    pthread_mutex_lock (&mq_list_mutex);
     if (!mq_count)
         LIST_INIT(&mq_head);
 
     LIST_INSERT_HEAD(&mq_head, mq, entry);
     mq_count++;
+    pthread_mutex_unlock (&mq_list_mutex);
 
     log_info (" [ox-mq (%s): Multi queue started (nq: %d, qs: %d)]\n",
                            mq->config->name, config->n_queues, config->q_size);
@@ -728,6 +847,11 @@ static void ox_mq_free_ext_list (struct ox_mq *mq)
 
 void ox_mq_destroy (struct ox_mq *mq)
 {
+    pthread_mutex_lock (&mq_list_mutex);
+    LIST_REMOVE(mq, entry);
+    mq_count--;
+    pthread_mutex_unlock (&mq_list_mutex);
+
     mq->stop = 1;
     if (mq->config->to_usec) {
         pthread_cancel(mq->to_tid);
@@ -736,9 +860,6 @@ void ox_mq_destroy (struct ox_mq *mq)
     }
     ox_mq_free_queues(mq, mq->config->n_queues);
 
-    LIST_REMOVE(mq, entry);
-    mq_count--;
-
     log_info (" [ox-mq (%s): Multi queue stopped]\n", mq->config->name);
 
     free (mq->queues);
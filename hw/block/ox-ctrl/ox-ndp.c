@@ -0,0 +1,470 @@
+/* OX: OpenChannel NVM Express SSD Controller
+ *
+ * Copyright (C) 2016, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * This code is licensed under the GNU GPL v2 or later.
+ *
+ * Near-data processing job engine. A job reads its LBA range through the
+ * standard FTL in segments of NDP_SEG_SECS sectors, using the NVMe request
+ * of the job. Segments are read into controller memory (NVM_PRP_LOCAL) and
+ * the kernel runs in the FTL completion thread before the next segment is
+ * submitted. Only the result is written to the host.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "hw/block/ox-ctrl/include/ssd.h"
+#include "hw/block/ox-ctrl/include/nvme.h"
+#include "hw/block/ox-ctrl/include/ox-ndp.h"
+#include "qemu/bswap.h"
+#include "qemu/crc32c.h"
+
+struct ndp_kernel {
+    uint8_t                  in_use;
+    struct ndp_kernel_param  param;
+    struct ndp_kernel_stats  stats;
+};
+
+struct ndp_job {
+    uint32_t                 kid;
+    struct ndp_kernel_param  k;       /* copy, the kernel may be deleted */
+    uint64_t                 lba;     /* first LBA of the next segment */
+    uint64_t                 elba;
+    uint64_t                 prp;     /* host result buffer */
+    uint64_t                 tstart;
+    uint32_t                 seg_nlb; /* sectors in the current segment */
+    uint32_t                 carry_len;
+    uint8_t                  carry[NDP_PAT_MAX * 2];
+    struct ndp_job_result    res;
+    uint8_t                  *buf;
+};
+
+struct ndp_state {
+    struct ndp_kernel   ndp_kern[NDP_MAX_KERNELS];
+    pthread_mutex_t     ndp_mutex;
+};
+
+#define ndp_st (*(struct ndp_state *) ox_state (OX_ST_NDP, \
+                                                sizeof (struct ndp_state)))
+
+static uint64_t ndp_ts (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t ndp_field (uint8_t *rec, uint8_t sz)
+{
+    switch (sz) {
+        case 1:
+            return ldub_p (rec);
+        case 2:
+            return lduw_le_p (rec);
+        case 4:
+            return ldl_le_p (rec);
+        default:
+            return ldq_le_p (rec);
+    }
+}
+
+static int ndp_pred (uint8_t op, uint64_t v, uint64_t ref)
+{
+    switch (op) {
+        case NDP_OP_EQ:
+            return v == ref;
+        case NDP_OP_NE:
+            return v != ref;
+        case NDP_OP_LT:
+            return v < ref;
+        case NDP_OP_LE:
+            return v <= ref;
+        case NDP_OP_GT:
+            return v > ref;
+        default:
+            return v >= ref;
+    }
+}
+
+static int ndp_rec_empty (uint8_t *rec, uint32_t sz)
+{
+    return !rec[0] && !memcmp (rec, rec + 1, sz - 1);
+}
+
+/* Counts pattern positions starting before 'lim' */
+static uint64_t ndp_grep (uint8_t *buf, uint64_t len, uint64_t lim,
+                                                  uint8_t *pat, uint16_t plen)
+{
+    uint8_t *p = buf;
+    uint64_t count = 0;
+
+    while ((uint64_t) (p - buf) < lim && (uint64_t) (p - buf) + plen <= len) {
+        p = memmem (p, len - (p - buf), pat, plen);
+        if (!p || (uint64_t) (p - buf) >= lim)
+            break;
+        count++;
+        p++;
+    }
+
+    return count;
+}
+
+static void ndp_job_exec (struct ndp_job *job, uint8_t *buf, uint64_t len)
+{
+    struct ndp_kernel_param *k = &job->k;
+    struct ndp_job_result *res = &job->res;
+    uint64_t off, v;
+    uint32_t head;
+
+    switch (k->builtin) {
+        case NDP_KERN_SCAN:
+            for (off = 0; off < len; off += k->rec_sz) {
+                v = ndp_field (buf + off + k->field_off, k->field_sz);
+                if (ndp_pred (k->op, v, k->value)) {
+                    res->matches++;
+                    res->sum += v;
+                }
+            }
+            res->records += len / k->rec_sz;
+            break;
+
+        case NDP_KERN_COUNT:
+            for (off = 0; off < len; off += k->rec_sz)
+                if (!ndp_rec_empty (buf + off, k->rec_sz))
+                    res->matches++;
+            res->records += len / k->rec_sz;
+            break;
+
+        case NDP_KERN_CHECKSUM:
+            res->crc32c = crc32c (res->crc32c, buf, len);
+            break;
+
+        case NDP_KERN_GREP:
+            /* Matches across the segment boundary, starting in the tail of
+             * the previous segment */
+            if (job->carry_len) {
+                head = MIN (k->pat_len - 1, len);
+                memcpy (job->carry + job->carry_len, buf, head);
+                res->matches += ndp_grep (job->carry, job->carry_len + head,
+                                      job->carry_len, k->pattern, k->pat_len);
+            }
+            res->matches += ndp_grep (buf, len, len, k->pattern, k->pat_len);
+
+            job->carry_len = MIN (k->pat_len - 1, len);
+            memcpy (job->carry, buf + len - job->carry_len, job->carry_len);
+            break;
+    }
+
+    res->bytes += len;
+}
+
+static uint16_t ndp_job_submit (NvmeRequest *req)
+{
+    struct ndp_job *job = (struct ndp_job *) req->ndp_job;
+    NvmeRwCmd rw;
+    uint32_t i;
+
+    memset (&rw, 0, sizeof (NvmeRwCmd));
+    job->seg_nlb = MIN (NDP_SEG_SECS, job->elba - job->lba);
+
+    rw.opcode = req->cmd.opcode;
+    rw.cid = req->cmd.cid;
+    rw.nsid = req->cmd.nsid;
+    rw.slba = job->lba;
+    rw.nlb = job->seg_nlb - 1;
+
+    for (i = 0; i < job->seg_nlb; i++)
+        req->nvm_io.prp[i] = ((uint64_t) (job->buf +
+                                  i * NVME_KERNEL_PG_SIZE)) | NVM_PRP_LOCAL;
+
+    req->is_write = 0;
+
+    return nvme_rw_submit (req->ns, &rw, req, MMGR_READ_PG);
+}
+
+static void ndp_job_free (NvmeRequest *req)
+{
+    struct ndp_job *job = (struct ndp_job *) req->ndp_job;
+
+    g_free (job->buf);
+    g_free (job);
+    req->ndp_job = NULL;
+}
+
+static void ndp_job_finish (NvmeRequest *req)
+{
+    struct ndp_job *job = (struct ndp_job *) req->ndp_job;
+    struct ndp_kernel *kern = &ndp_st.ndp_kern[job->kid];
+
+    job->res.time_ns = ndp_ts () - job->tstart;
+    if (job->k.builtin == NDP_KERN_CHECKSUM)
+        job->res.crc32c = ~job->res.crc32c;
+
+    if (req->status == NVME_SUCCESS && nvme_write_to_host (&job->res,
+                                 job->prp, sizeof (struct ndp_job_result)))
+        req->status = NVME_DATA_TRAS_ERROR;
+
+    if (req->status == NVME_SUCCESS)
+        req->cqe.n.result = (uint32_t) job->res.matches;
+
+    pthread_mutex_lock (&ndp_st.ndp_mutex);
+    if (kern->in_use) {
+        kern->stats.jobs++;
+        if (req->status != NVME_SUCCESS)
+            kern->stats.failed++;
+        kern->stats.bytes += job->res.bytes;
+        kern->stats.matches += job->res.matches;
+        kern->stats.time_ns += job->res.time_ns;
+    }
+    pthread_mutex_unlock (&ndp_st.ndp_mutex);
+
+    ndp_job_free (req);
+}
+
+/* Called when a segment is read. Returns 1 if the next segment was submitted,
+ * the completion is then posted when the job finishes. */
+int ndp_job_cb (NvmeRequest *req)
+{
+    struct ndp_job *job = (struct ndp_job *) req->ndp_job;
+    uint16_t ret;
+
+    if (req->status != NVME_SUCCESS)
+        goto FINISH;
+
+    ndp_job_exec (job, job->buf, (uint64_t) job->seg_nlb *
+                                                         NVME_KERNEL_PG_SIZE);
+    job->lba += job->seg_nlb;
+
+    if (job->lba < job->elba) {
+        ret = ndp_job_submit (req);
+
+        /* Queued, or completed with error by the FTL (job already freed) */
+        if (ret == NVME_NO_COMPLETE || !req->ndp_job)
+            return 1;
+
+        req->status = ret;
+    }
+
+FINISH:
+    ndp_job_finish (req);
+    return 0;
+}
+
+uint16_t ndp_run_job (NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
+                                                             NvmeRequest *req)
+{
+    struct ndp_job *job;
+    uint64_t slba = ((uint64_t) cmd->cdw11 << 32) | cmd->cdw10;
+    uint64_t nlb = (uint64_t) cmd->cdw12 + 1;
+    uint64_t nsze = le64_to_cpu(ns->id_ns.nsze);
+    uint32_t kid = cmd->cdw13;
+    uint16_t ret;
+
+    req->nvm_io.status.status = NVM_IO_NEW;
+
+    /* slba + nlb may wrap around */
+    if (slba > nsze || nlb > nsze - slba)
+        return NVME_LBA_RANGE | NVME_DNR;
+
+    if (!cmd->prp1 || kid >= NDP_MAX_KERNELS)
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    job = g_malloc0 (sizeof (struct ndp_job));
+
+    pthread_mutex_lock (&ndp_st.ndp_mutex);
+    if (!ndp_st.ndp_kern[kid].in_use) {
+        pthread_mutex_unlock (&ndp_st.ndp_mutex);
+        g_free (job);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+    memcpy (&job->k, &ndp_st.ndp_kern[kid].param, sizeof (struct ndp_kernel_param));
+    pthread_mutex_unlock (&ndp_st.ndp_mutex);
+
+    job->buf = g_malloc (NDP_SEG_SECS * NVME_KERNEL_PG_SIZE);
+    job->kid = kid;
+    job->lba = slba;
+    job->elba = slba + nlb;
+    job->prp = cmd->prp1;
+    job->tstart = ndp_ts ();
+    job->res.kernel_id = kid;
+    job->res.slba = slba;
+    job->res.nlb = nlb;
+    job->res.crc32c = 0xffffffff;
+
+    req->ns = ns;
+    req->ndp_job = (void *) job;
+
+    if (core.debug)
+        printf (" [ndp: job kernel %d, slba %" PRIu64 ", nlb %" PRIu64 "]\n",
+                                                              kid, slba, nlb);
+
+    ret = ndp_job_submit (req);
+
+    /* If the job was not released by the callback, the cmd is not queued */
+    if (ret != NVME_NO_COMPLETE && req->ndp_job)
+        ndp_job_free (req);
+
+    return ret;
+}
+
+static int ndp_pow2 (uint32_t v)
+{
+    return v && !(v & (v - 1));
+}
+
+static int ndp_check_param (struct ndp_kernel_param *k)
+{
+    switch (k->builtin) {
+        case NDP_KERN_SCAN:
+            if (k->field_sz != 1 && k->field_sz != 2 && k->field_sz != 4 &&
+                                                            k->field_sz != 8)
+                return -1;
+            if (k->op > NDP_OP_GE ||
+                         (uint64_t) k->field_off + k->field_sz > k->rec_sz)
+                return -1;
+            /* fall through */
+        case NDP_KERN_COUNT:
+            if (!ndp_pow2 (k->rec_sz) || k->rec_sz > NVME_KERNEL_PG_SIZE)
+                return -1;
+            return 0;
+        case NDP_KERN_CHECKSUM:
+            return 0;
+        case NDP_KERN_GREP:
+            return (!k->pat_len || k->pat_len > NDP_PAT_MAX) ? -1 : 0;
+        default:
+            return -1;
+    }
+}
+
+uint16_t ndp_install (NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
+{
+    struct ndp_kernel_param param;
+    uint32_t kid;
+
+    if (!cmd->prp1 || nvme_read_from_host (&param, cmd->prp1,
+                                            sizeof (struct ndp_kernel_param)))
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    if (ndp_check_param (&param))
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    pthread_mutex_lock (&ndp_st.ndp_mutex);
+    for (kid = 0; kid < NDP_MAX_KERNELS; kid++)
+        if (!ndp_st.ndp_kern[kid].in_use)
+            break;
+
+    if (kid == NDP_MAX_KERNELS) {
+        pthread_mutex_unlock (&ndp_st.ndp_mutex);
+        log_err ("[ndp: No free kernel slot]\n");
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    memcpy (&ndp_st.ndp_kern[kid].param, &param, sizeof (struct ndp_kernel_param));
+    memset (&ndp_st.ndp_kern[kid].stats, 0x0, sizeof (struct ndp_kernel_stats));
+    ndp_st.ndp_kern[kid].stats.kernel_id = kid;
+    ndp_st.ndp_kern[kid].in_use = 1;
+    pthread_mutex_unlock (&ndp_st.ndp_mutex);
+
+    req->cqe.n.result = kid;
+    log_info ("[ndp: kernel %d installed, built-in 0x%x]\n", kid,
+                                                               param.builtin);
+
+    return NVME_SUCCESS;
+}
+
+/* Running jobs keep their own copy of the kernel */
+uint16_t ndp_delete (NvmeCtrl *n, NvmeCmd *cmd)
+{
+    uint32_t kid = cmd->cdw10;
+
+    if (kid >= NDP_MAX_KERNELS)
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    pthread_mutex_lock (&ndp_st.ndp_mutex);
+    if (!ndp_st.ndp_kern[kid].in_use) {
+        pthread_mutex_unlock (&ndp_st.ndp_mutex);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+    ndp_st.ndp_kern[kid].in_use = 0;
+    pthread_mutex_unlock (&ndp_st.ndp_mutex);
+
+    log_info ("[ndp: kernel %d deleted]\n", kid);
+
+    return NVME_SUCCESS;
+}
+
+void ndp_init (void)
+{
+    pthread_mutex_init (&ndp_st.ndp_mutex, NULL);
+}
+
+/* Installed kernels do not survive the controller, a new one starts empty */
+void ndp_exit (void)
+{
+    pthread_mutex_lock (&ndp_st.ndp_mutex);
+    memset (ndp_st.ndp_kern, 0x0, sizeof (ndp_st.ndp_kern));
+    pthread_mutex_unlock (&ndp_st.ndp_mutex);
+    pthread_mutex_destroy (&ndp_st.ndp_mutex);
+}
+
+uint16_t ndp_info (NvmeCtrl *n, NvmeCmd *cmd)
+{
+    struct ndp_info info;
+    uint32_t kid;
+
+    if (!cmd->prp1)
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    memset (&info, 0x0, sizeof (struct ndp_info));
+    info.version = NDP_VERSION;
+    info.max_kernels = NDP_MAX_KERNELS;
+    info.seg_secs = NDP_SEG_SECS;
+    info.builtins = (1 << NDP_KERN_SCAN) | (1 << NDP_KERN_COUNT) |
+                             (1 << NDP_KERN_CHECKSUM) | (1 << NDP_KERN_GREP);
+
+    pthread_mutex_lock (&ndp_st.ndp_mutex);
+    for (kid = 0; kid < NDP_MAX_KERNELS; kid++) {
+        if (!ndp_st.ndp_kern[kid].in_use)
+            continue;
+        info.n_kernels++;
+        info.kernels |= 1 << kid;
+        info.builtin_of[kid] = ndp_st.ndp_kern[kid].param.builtin;
+    }
+    pthread_mutex_unlock (&ndp_st.ndp_mutex);
+
+    if (nvme_write_to_host (&info, cmd->prp1, sizeof (struct ndp_info)))
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    return NVME_SUCCESS;
+}
+
+uint16_t ndp_kernel_req (NvmeCtrl *n, NvmeCmd *cmd)
+{
+    struct ndp_kernel_stats stats;
+    uint32_t kid = cmd->cdw10;
+
+    if (!cmd->prp1 || kid >= NDP_MAX_KERNELS)
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    pthread_mutex_lock (&ndp_st.ndp_mutex);
+    if (!ndp_st.ndp_kern[kid].in_use) {
+        pthread_mutex_unlock (&ndp_st.ndp_mutex);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+    memcpy (&stats, &ndp_st.ndp_kern[kid].stats, sizeof (struct ndp_kernel_stats));
+    pthread_mutex_unlock (&ndp_st.ndp_mutex);
+
+    if (nvme_write_to_host (&stats, cmd->prp1,
+                                            sizeof (struct ndp_kernel_stats)))
+        return NVME_INVALID_FIELD | NVME_DNR;
+
+    return NVME_SUCCESS;
+}
@@ -19,15 +19,23 @@
 #include "hw/pci/pci.h"
 #include "qemu/host-utils.h"
 
-extern struct core_struct core;
+struct pcie_dfc_state {
+    struct nvm_pcie     pcie_dfc;
+};
+
+#define pcie_st (*(struct pcie_dfc_state *) ox_state (OX_ST_PCIE, \
+                                            sizeof (struct pcie_dfc_state)))
 
 static void *dfcpcie_req_processor (void *arg)
 {
     return NULL;
 }
 
+/* MMIO callbacks run in the vCPU thread, opaque is the device */
 static uint64_t ox_mmio_read(void *opaque, hwaddr addr, unsigned size)
 {
+    QemuOxCtrl *qemu = opaque;
+    struct ox_instance *prev = ox_inst_enter(qemu->inst);
     NvmeCtrl *n = core.nvm_nvme_ctrl;
     uint8_t *ptr = (uint8_t *)&n->nvme_regs.vBar;
     uint64_t val = 0;
@@ -35,12 +43,15 @@ static uint64_t ox_mmio_read(void *opaque, hwaddr addr, unsigned size)
     if (addr < sizeof(n->nvme_regs.vBar)) {
         memcpy(&val, ptr + addr, size);
     }
+    ox_inst_leave(prev);
     return val;
 }
 
 static void ox_mmio_write(void *opaque, hwaddr addr, uint64_t data,
     unsigned size)
 {
+    QemuOxCtrl *qemu = opaque;
+    struct ox_instance *prev = ox_inst_enter(qemu->inst);
     NvmeCtrl *n = core.nvm_nvme_ctrl;
 
     if (addr < sizeof(n->nvme_regs.vBar)) {
@@ -48,6 +59,7 @@ static void ox_mmio_write(void *opaque, hwaddr addr, uint64_t data,
     } else if (addr >= 0x1000) {
         nvme_process_db(n, addr, data);
     }
+    ox_inst_leave(prev);
 }
 
 static const MemoryRegionOps ox_mmio_ops = {
@@ -63,14 +75,17 @@ static const MemoryRegionOps ox_mmio_ops = {
 static void ox_cmb_write(void *opaque, hwaddr addr, uint64_t data,
     unsigned size)
 {
-    NvmeCtrl *n = core.nvm_nvme_ctrl;
+    QemuOxCtrl *qemu = opaque;
+    NvmeCtrl *n = qemu->inst->core_st.nvm_nvme_ctrl;
+
     memcpy(&n->cmbuf[addr], &data, size);
 }
 
 static uint64_t ox_cmb_read(void *opaque, hwaddr addr, unsigned size)
 {
     uint64_t val;
-    NvmeCtrl *n = core.nvm_nvme_ctrl;
+    QemuOxCtrl *qemu = opaque;
+    NvmeCtrl *n = qemu->inst->core_st.nvm_nvme_ctrl;
 
     memcpy(&val, &n->cmbuf[addr], size);
     return val;
@@ -133,10 +148,6 @@ static int pcie_init_pci (struct pci_ctrl *ctrl)
     return 0;
 }
 
-struct nvm_pcie pcie_dfc = {
-    .name           = "PCI_LS2085",
-};
-
 static void dfcpcie_isr_notify (void *opaque)
 {
     NvmeCQ *cq = opaque;
@@ -164,9 +175,12 @@ static void dfcpcie_reset (void)
 }
 
 static void dfcpcie_exit(void) {
-    struct pci_ctrl *pcie = (struct pci_ctrl *) pcie_dfc.ctrl;
+    struct pci_ctrl *pcie = (struct pci_ctrl *) pcie_st.pcie_dfc.ctrl;
     msix_uninit_exclusive_bar(core.qemu->pci_dev);
+    msi_uninit(core.qemu->pci_dev);
     memory_region_unref(&core.qemu->iomem);
+    g_free(core.nvm_nvme_ctrl->cmbuf);
+    core.nvm_nvme_ctrl->cmbuf = NULL;
     free(pcie);
 }
 
@@ -179,15 +193,16 @@ struct nvm_pcie_ops pcidfc_ops = {
 
 int dfcpcie_init(void)
 {
-    pcie_dfc.ctrl = (void *)calloc(sizeof(struct pci_ctrl), 1);
+    pcie_st.pcie_dfc.name = "PCI_LS2085";
+    pcie_st.pcie_dfc.ctrl = (void *)calloc(sizeof(struct pci_ctrl), 1);
 
-    if (!pcie_dfc.ctrl)
+    if (!pcie_st.pcie_dfc.ctrl)
         return EMEM;
 
-    if(pcie_init_pci(pcie_dfc.ctrl))
+    if(pcie_init_pci(pcie_st.pcie_dfc.ctrl))
         return EPCIE_REGISTER;
 
-    pcie_dfc.ops = &pcidfc_ops;
+    pcie_st.pcie_dfc.ops = &pcidfc_ops;
 
-    return nvm_register_pcie_handler(&pcie_dfc);
+    return nvm_register_pcie_handler(&pcie_st.pcie_dfc);
 }
@@ -8,42 +8,332 @@
 #include "qapi/error.h"
 #include "qapi/visitor.h"
 #include "sysemu/block-backend.h"
+#include "qmp-commands.h"
+#include "qemu/error-report.h"
 #include "hw/block/ox-ctrl/include/ssd.h"
+#include "hw/block/ox-ctrl/mmgr/volt/volt.h"
+#include "hw/block/ox-ctrl/ftl/appnvm/appnvm.h"
 
-extern struct core_struct core;
-QemuOxCtrl *qemuOxCtrl;
+/* Realized ox-ctrl devices, each one runs its own controller instance */
+static QLIST_HEAD(, QemuOxCtrl) ox_devices = QLIST_HEAD_INITIALIZER(ox_devices);
 
-static int ox_init(PCIDevice *pci_dev)
+/* Media geometry must fit the PPA fields, the per channel bad block
+ * table must fit in a flash page and the AppNVM block metadata must hold
+ * the sectors of a block */
+static int ox_check_geometry(QemuOxCtrl *qemu, Error **errp)
 {
-    int argc = 2;
-    char **argv = malloc (sizeof(char *) * argc);
+    uint64_t blks = (uint64_t) qemu->luns * qemu->blocks * qemu->planes;
+
+    if (!qemu->channels || qemu->channels > (1 << LNVM_CH_BITS) ||
+            !qemu->luns || qemu->luns > (1 << LNVM_LUN_BITS) ||
+            qemu->blocks <= VOLT_RSV_BLK || qemu->blocks > (1 << LNVM_BLK_BITS) ||
+            !qemu->pages || qemu->pages > (1 << LNVM_PG_BITS) ||
+            (qemu->planes != 1 && qemu->planes != 2 && qemu->planes != 4)) {
+        error_setg(errp, "ox-ctrl: invalid geometry, limits: channels %d, "
+                "luns %d, blocks %d, pages %d, planes 1, 2 or 4",
+                1 << LNVM_CH_BITS, 1 << LNVM_LUN_BITS, 1 << LNVM_BLK_BITS,
+                1 << LNVM_PG_BITS);
+        return -1;
+    }
+
+    if (blks > VOLT_PAGE_SIZE) {
+        error_setg(errp, "ox-ctrl: luns * blocks * planes must not exceed %d",
+                                                              VOLT_PAGE_SIZE);
+        return -1;
+    }
+
+    /* AppNVM keeps the sector state of a block in a fixed size array */
+    if (!qemu->lnvm && qemu->pages * qemu->planes > APP_PG_STATE_SZ) {
+        error_setg(errp, "ox-ctrl: pages * planes must not exceed %d with "
+                                                "lnvm=0", APP_PG_STATE_SZ);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Non-volatile devices keep their media in 'volt_disk.<id>' */
+static int ox_check_disk(QemuOxCtrl *qemu, Error **errp)
+{
+    const char *id = DEVICE(qemu)->id;
+    QemuOxCtrl *dev;
+
+    if (qemu->volt) {
+        return 0;
+    }
+
+    QLIST_FOREACH(dev, &ox_devices, next) {
+        if (!dev->volt && !g_strcmp0(DEVICE(dev)->id, id)) {
+            error_setg(errp, "ox-ctrl: 'volt_disk%s%s' is used by another "
+                       "device with volt=0, give each device its own id",
+                       id ? "." : "", id ? id : "");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void ox_realize(PCIDevice *pci_dev, Error **errp)
+{
+    QemuOxCtrl *qemu = OXCTRL(pci_dev);
+    struct ox_instance *prev;
+    int argc = 2, i, ret;
+    char **argv, **bench = NULL;
+
+    if (ox_check_geometry(qemu, errp) || ox_check_disk(qemu, errp))
+        return;
+
+    /* 'bench' holds the options of 'ox-ctrl bench', separated by spaces */
+    if (qemu->bench) {
+        bench = g_strsplit(qemu->bench, " ", -1);
+        for (i = 0; bench[i]; i++)
+            if (strlen(bench[i]))
+                argc++;
+    }
+
+    argv = malloc (sizeof(char *) * argc);
     argv[0] = malloc (8);
     argv[1] = malloc (6);
     memcpy(argv[0], "ox-ctrl\0", 8);
-    memcpy(argv[1], (qemuOxCtrl->debug) ? "debug\0" : "start\0", 6);
+    memcpy(argv[1], (bench) ? "bench\0" : (qemu->debug) ?
+                                                 "debug\0" : "start\0", 6);
+
+    if (bench) {
+        argc = 2;
+        for (i = 0; bench[i]; i++)
+            if (strlen(bench[i]))
+                argv[argc++] = bench[i];
+    }
 
-    memset (&core, 0x0, sizeof (struct core_struct));
+    /* The device state starts zeroed, threads started by the controller
+     * serve this instance */
+    qemu->inst = ox_inst_new();
+    prev = ox_inst_enter(qemu->inst);
 
-    if (qemuOxCtrl->lnvm) {
+    if (qemu->lnvm) {
         core.lnvm = 1;
+        core.ocssd2 = (qemu->ocssd2) ? 1 : 0;
         core.std_ftl = FTL_ID_LNVM;
     } else {
         core.std_ftl = FTL_ID_APPNVM;
     }
 
-    core.volt = qemuOxCtrl->volt;
+    core.volt = qemu->volt;
+    core.nvm_ns_count = qemu->namespaces;
 
-    blkconf_serial(&qemuOxCtrl->conf, &qemuOxCtrl->serial);
+    /* Latency histograms are shared by all devices */
+    if (qemu->lat) {
+        ox_lat_enabled = 1;
+    }
 
-    qemuOxCtrl->pci_dev = pci_dev;
-    nvm_init_ctrl (argc, argv, qemuOxCtrl);
+    blkconf_serial(&qemu->conf, &qemu->serial);
 
-    return 0;
+    qemu->pci_dev = pci_dev;
+    ret = nvm_init_ctrl (argc, argv, qemu);
+
+    /* argv[2..] point into the split 'bench' string */
+    free (argv[0]);
+    free (argv[1]);
+    free (argv);
+    g_strfreev (bench);
+
+    if (ret) {
+        if (ret == -EINVAL)
+            error_setg(errp, "ox-ctrl: invalid 'bench' options '%s'",
+                                                                  qemu->bench);
+        else
+            error_setg(errp, "ox-ctrl: controller failed to start, "
+                                                        "check the log file");
+        nvm_exit_ctrl();
+        ox_inst_leave(prev);
+        ox_inst_free(qemu->inst);
+        qemu->inst = NULL;
+        return;
+    }
+
+    ox_inst_leave(prev);
+    QLIST_INSERT_HEAD(&ox_devices, qemu, next);
 }
 
 static void ox_exit(PCIDevice *pci_dev)
 {
+    QemuOxCtrl *qemu = OXCTRL(pci_dev);
+    struct ox_instance *prev;
+
+    prev = ox_inst_enter(qemu->inst);
+    nvm_exit_ctrl();
+    ox_inst_leave(prev);
+
+    QLIST_REMOVE(qemu, next);
+    ox_inst_free(qemu->inst);
+    qemu->inst = NULL;
+}
+
+/* Calls 'fn' for every device, with the device instance entered */
+void ox_foreach(void (*fn)(QemuOxCtrl *, void *), void *opaque)
+{
+    struct ox_instance *prev;
+    QemuOxCtrl *qemu;
 
+    QLIST_FOREACH(qemu, &ox_devices, next) {
+        prev = ox_inst_enter(qemu->inst);
+        fn(qemu, opaque);
+        ox_inst_leave(prev);
+    }
+}
+
+static void ox_query_mq(struct ox_mq *mq, void *arg)
+{
+    OxMqInfoList **head = (OxMqInfoList **) arg;
+    OxMqInfoList *entry;
+    OxMqQueueInfoList *q_entry;
+    OxMqQueueInfo *q;
+    OxMqInfo *info;
+    struct ox_mq_stats *st;
+    int qid;
+
+    info = g_new0(OxMqInfo, 1);
+    info->name = g_strdup(mq->config->name);
+    info->queue_size = mq->config->q_size;
+    info->ext_list = u_atomic_read(&mq->stats.ext_list);
+    info->timeout = u_atomic_read(&mq->stats.timeout);
+    info->timeout_back = u_atomic_read(&mq->stats.to_back);
+
+    for (qid = mq->config->n_queues - 1; qid >= 0; qid--) {
+        st = &mq->queues[qid].stats;
+        q = g_new0(OxMqQueueInfo, 1);
+        q->id = qid;
+        q->sq_free = u_atomic_read(&st->sq_free);
+        q->sq_used = u_atomic_read(&st->sq_used);
+        q->sq_wait = u_atomic_read(&st->sq_wait);
+        q->cq_free = u_atomic_read(&st->cq_free);
+        q->cq_used = u_atomic_read(&st->cq_used);
+
+        q_entry = g_new0(OxMqQueueInfoList, 1);
+        q_entry->value = q;
+        q_entry->next = info->queues;
+        info->queues = q_entry;
+    }
+
+    entry = g_new0(OxMqInfoList, 1);
+    entry->value = info;
+    entry->next = *head;
+    *head = entry;
+}
+
+static void ox_query_ftl(OxInfo *info)
+{
+    struct nvm_ftl_cap_stats_st st;
+    OxChannelInfoList *entry;
+    OxChannelInfo *ch;
+    int ch_i;
+
+    memset(&st, 0x0, sizeof(struct nvm_ftl_cap_stats_st));
+    st.n_ch = core.nvm_ch_count;
+    st.ch = g_new0(struct nvm_ftl_ch_stats, st.n_ch);
+
+    if (nvm_ftl_cap_exec(FTL_CAP_GET_STATS, &st)) {
+        g_free(st.ch);
+        return;
+    }
+
+    for (ch_i = st.n_ch - 1; ch_i >= 0; ch_i--) {
+        ch = g_new0(OxChannelInfo, 1);
+        ch->id = st.ch[ch_i].ch_id;
+        ch->active = st.ch[ch_i].active;
+        ch->need_gc = st.ch[ch_i].need_gc;
+        ch->free_blocks = st.ch[ch_i].free_blks;
+        ch->used_blocks = st.ch[ch_i].used_blks;
+        ch->open_blocks = st.ch[ch_i].open_blks;
+        ch->map_cache_used = st.ch[ch_i].map_cache_used;
+        ch->map_cache_free = st.ch[ch_i].map_cache_free;
+        ch->map_cache_hits = st.ch[ch_i].map_cache_hits;
+        ch->map_cache_misses = st.ch[ch_i].map_cache_misses;
+        ch->map_cache_evictions = st.ch[ch_i].map_cache_evictions;
+
+        entry = g_new0(OxChannelInfoList, 1);
+        entry->value = ch;
+        entry->next = info->channels;
+        info->channels = entry;
+    }
+    info->has_channels = true;
+
+    info->has_gc = true;
+    info->gc = g_new0(OxGcInfo, 1);
+    info->gc->recycled_blocks = st.gc.recycled_blks;
+    info->gc->moved_sectors = st.gc.moved_sec;
+    info->gc->padding_sectors = st.gc.pad_sec;
+    info->gc->failed_sectors = st.gc.err_sec;
+    info->gc->unknown_sectors = st.gc.wro_sec;
+    info->gc->map_pages = st.gc.map_pgs;
+
+    g_free(st.ch);
+}
+
+static OxInfo *ox_query_info(QemuOxCtrl *qemu, Error **errp)
+{
+    OxInfo *info;
+    uint64_t mem;
+
+    if (!(core.run_flag & RUN_NVME)) {
+        error_setg(errp, "OX controller is not running");
+        return NULL;
+    }
+
+    info = g_new0(OxInfo, 1);
+    info->lnvm = core.lnvm;
+    if (DEVICE(qemu)->id) {
+        info->has_id = true;
+        info->id = g_strdup(DEVICE(qemu)->id);
+    }
+
+    ox_mq_walk(ox_query_mq, &info->mq);
+
+    if (nvm_ftl_cap_support(FTL_CAP_GET_STATS))
+        ox_query_ftl(info);
+
+    mem = mmgr_volt_mem_usage();
+    if (mem) {
+        info->has_volt_memory = true;
+        info->volt_memory = mem;
+    }
+
+    return info;
+}
+
+OxInfo *qmp_query_ox(bool has_id, const char *id, Error **errp)
+{
+    struct ox_instance *prev;
+    QemuOxCtrl *qemu, *found = NULL;
+    OxInfo *info;
+
+    QLIST_FOREACH(qemu, &ox_devices, next) {
+        if (has_id && g_strcmp0(DEVICE(qemu)->id, id)) {
+            continue;
+        }
+        if (found) {
+            error_setg(errp, "several ox-ctrl devices are present, "
+                                                    "select one with 'id'");
+            return NULL;
+        }
+        found = qemu;
+    }
+
+    if (!found) {
+        if (has_id) {
+            error_setg(errp, "ox-ctrl device '%s' not found", id);
+        } else {
+            error_setg(errp, "OX controller is not running");
+        }
+        return NULL;
+    }
+
+    prev = ox_inst_enter(found->inst);
+    info = ox_query_info(found, errp);
+    ox_inst_leave(prev);
+
+    return info;
 }
 
 static Property ox_props[] = {
@@ -52,6 +342,15 @@ static Property ox_props[] = {
     DEFINE_PROP_UINT8("debug", QemuOxCtrl, debug, 0),
     DEFINE_PROP_UINT8("lnvm", QemuOxCtrl, lnvm, 1),
     DEFINE_PROP_UINT8("volt", QemuOxCtrl, volt, 1),
+    DEFINE_PROP_UINT8("lat", QemuOxCtrl, lat, 0),
+    DEFINE_PROP_UINT8("ocssd2", QemuOxCtrl, ocssd2, 0),
+    DEFINE_PROP_UINT8("namespaces", QemuOxCtrl, namespaces, 1),
+    DEFINE_PROP_UINT8("channels", QemuOxCtrl, channels, VOLT_CHIP_COUNT),
+    DEFINE_PROP_UINT8("luns", QemuOxCtrl, luns, VOLT_VIRTUAL_LUNS),
+    DEFINE_PROP_UINT16("blocks", QemuOxCtrl, blocks, VOLT_BLOCK_COUNT),
+    DEFINE_PROP_UINT16("pages", QemuOxCtrl, pages, VOLT_PAGE_COUNT),
+    DEFINE_PROP_UINT8("planes", QemuOxCtrl, planes, VOLT_PLANE_COUNT),
+    DEFINE_PROP_STRING("bench", QemuOxCtrl, bench),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -65,7 +364,7 @@ static void ox_class_init(ObjectClass *oc, void *data)
     DeviceClass *dc = DEVICE_CLASS(oc);
     PCIDeviceClass *pc = PCI_DEVICE_CLASS(oc);
 
-    pc->init = ox_init;
+    pc->realize = ox_realize;
     pc->exit = ox_exit;
     pc->class_id = PCI_CLASS_STORAGE_EXPRESS;
     pc->vendor_id = PCI_VENDOR_ID_LNVM;
@@ -114,8 +413,6 @@ out:
 
 static void ox_instance_init(Object *obj)
 {
-    qemuOxCtrl = OXCTRL(obj);
-
     object_property_add(obj, "bootindex", "int32",
                         ox_get_bootindex,
                         ox_set_bootindex, NULL, NULL, NULL);
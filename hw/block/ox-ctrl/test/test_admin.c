@@ -4,8 +4,6 @@
 #include "../include/tests.h"
 #include "../include/ssd.h"
 
-extern struct core_struct core;
-
 static void oxadmin_show_all ()
 {
     printf(" \nAvailable OX Admin Tasks: \n");
@@ -7,7 +7,6 @@
 #include "../include/nvme.h"
 
 static struct tests_ctrl tests_u;
-extern struct core_struct core;
 
 atomic_t         pgs_ok;
 pthread_mutex_t  pgs_ok_mutex;
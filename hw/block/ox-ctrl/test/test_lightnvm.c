@@ -5,8 +5,6 @@
 #include "../include/lightnvm.h"
 #include "../include/uatomic.h"
 
-extern struct core_struct core;
-
 static void ***wbuf;
 static void ***rbuf;
 extern atomic_t         pgs_ok;
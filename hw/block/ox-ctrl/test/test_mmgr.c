@@ -8,7 +8,6 @@
 #include <string.h>
 #include <time.h>
 
-extern struct core_struct core;
 pthread_t               *threads;
 static int              thread_err;
 static void             ***wbuf;
@@ -490,7 +489,7 @@ ERASE:
         sync_args[ch_i].total_pgs = total_pgs;
         sync_args[ch_i].n_pl = n_pl;
 
-        pthread_create(&threads[ch_i], NULL,&tests_io_thread, &sync_args[ch_i]);
+        ox_thread_create(&threads[ch_i], &tests_io_thread, &sync_args[ch_i]);
 
         n_pgs += total_pgs * n_pl;
         n_th++;
@@ -1855,15 +1855,30 @@ static void virtio_queue_host_notifier_aio_read(EventNotifier *n)
     }
 }
 
+/* Busy polling callback, looks at the avail ring for new requests */
+static bool virtio_queue_host_notifier_aio_poll(void *opaque)
+{
+    EventNotifier *n = opaque;
+    VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
+
+    if (!vq->vring.desc || !vq->handle_aio_output || virtio_queue_empty(vq)) {
+        return false;
+    }
+
+    virtio_queue_notify_aio_vq(vq);
+    return true;
+}
+
 void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
                                                 VirtIOHandleOutput handle_output)
 {
     if (handle_output) {
         vq->handle_aio_output = handle_output;
         aio_set_event_notifier(ctx, &vq->host_notifier, true,
-                               virtio_queue_host_notifier_aio_read);
+                               virtio_queue_host_notifier_aio_read,
+                               virtio_queue_host_notifier_aio_poll);
     } else {
-        aio_set_event_notifier(ctx, &vq->host_notifier, true, NULL);
+        aio_set_event_notifier(ctx, &vq->host_notifier, true, NULL, NULL);
         /* Test and clear notifier before after disabling event,
          * in case poll callback didn't have time to run. */
         virtio_queue_host_notifier_aio_read(&vq->host_notifier);
@@ -1886,14 +1901,14 @@ void virtio_queue_set_host_notifier_fd_handler(VirtQueue *vq, bool assign,
     if (assign && set_handler) {
         if (vq->use_aio) {
             aio_set_event_notifier(ctx, &vq->host_notifier, true,
-                                   virtio_queue_host_notifier_read);
+                                   virtio_queue_host_notifier_read, NULL);
         } else {
             event_notifier_set_handler(&vq->host_notifier, true,
                                        virtio_queue_host_notifier_read);
         }
     } else {
         if (vq->use_aio) {
-            aio_set_event_notifier(ctx, &vq->host_notifier, true, NULL);
+            aio_set_event_notifier(ctx, &vq->host_notifier, true, NULL, NULL);
         } else {
             event_notifier_set_handler(&vq->host_notifier, true, NULL);
         }
@@ -47,8 +47,14 @@ typedef struct AioHandler AioHandler;
 typedef void QEMUBHFunc(void *opaque);
 typedef void IOHandler(void *opaque);
 
+/* Busy polling callback, see aio_set_fd_handler().  Returns true if progress
+ * was made.
+ */
+typedef bool AioPollFn(void *opaque);
+
 struct ThreadPool;
 struct LinuxAioState;
+struct LuringState;
 
 struct AioContext {
     GSource source;
@@ -122,6 +128,10 @@ struct AioContext {
     /* Thread pool for performing work and receiving completion callbacks */
     struct ThreadPool *thread_pool;
 
+    /* Bounds on the number of thread pool workers */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+
 #ifdef CONFIG_LINUX_AIO
     /* State for native Linux AIO.  Uses aio_context_acquire/release for
      * locking.
@@ -129,11 +139,27 @@ struct AioContext {
     struct LinuxAioState *linux_aio;
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    /* State for Linux io_uring, without and with a SQPOLL kernel thread.
+     * Uses aio_context_acquire/release for locking.
+     */
+    struct LuringState *linux_io_uring[2];
+#endif
+
     /* TimerLists for calling timers - one per clock type */
     QEMUTimerListGroup tlg;
 
     int external_disable_cnt;
 
+    /* Number of AioHandlers without .io_poll() */
+    int poll_disable_cnt;
+
+    /* Polling mode parameters */
+    int64_t poll_ns;        /* current polling time in nanoseconds */
+    int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
+    int64_t poll_grow;      /* polling time growth factor */
+    int64_t poll_shrink;    /* polling time shrink factor */
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
     bool epoll_enabled;
@@ -315,6 +341,11 @@ bool aio_poll(AioContext *ctx, bool blocking);
  * to qemu_set_fd_handler.  Unlike qemu_set_fd_handler, these callbacks will
  * be invoked when using aio_poll().
  *
+ * @io_poll checks from userspace whether there is work to do, e.g. by looking
+ * at a ring in memory, and does it.  Before blocking, aio_poll() calls the
+ * @io_poll callbacks in a loop for a while.  Handlers without @io_poll disable
+ * busy polling in the AioContext, since their events would be missed.
+ *
  * Code that invokes AIO completion functions should rely on this function
  * instead of qemu_set_fd_handler[2].
  */
@@ -323,6 +354,7 @@ void aio_set_fd_handler(AioContext *ctx,
                         bool is_external,
                         IOHandler *io_read,
                         IOHandler *io_write,
+                        AioPollFn *io_poll,
                         void *opaque);
 
 /* Register an event notifier and associated callbacks.  Behaves very similarly
@@ -335,7 +367,8 @@ void aio_set_fd_handler(AioContext *ctx,
 void aio_set_event_notifier(AioContext *ctx,
                             EventNotifier *notifier,
                             bool is_external,
-                            EventNotifierHandler *io_read);
+                            EventNotifierHandler *io_read,
+                            AioPollFn *io_poll);
 
 /* Return a GSource that lets the main loop poll the file descriptors attached
  * to this AioContext.
@@ -348,6 +381,11 @@ struct ThreadPool *aio_get_thread_pool(AioContext *ctx);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
+/* Return the io_uring ring bound to this AioContext, NULL if the kernel
+ * cannot set it up
+ */
+struct LuringState *aio_get_linux_io_uring(AioContext *ctx, bool sqpoll);
+
 /**
  * aio_timer_new:
  * @ctx: the aio context
@@ -454,4 +492,32 @@ static inline bool aio_node_check(AioContext *ctx, bool is_external)
  */
 void aio_context_setup(AioContext *ctx);
 
+/**
+ * aio_context_set_poll_params:
+ * @ctx: the aio context
+ * @max_ns: how long to busy poll for, in nanoseconds
+ * @grow: polling time growth factor
+ * @shrink: polling time shrink factor
+ *
+ * Poll mode can be disabled by setting poll_max_ns to 0.  The polling time
+ * starts at 0 and adapts to the time aio_poll() waits for events: it grows
+ * while events arrive within @max_ns and shrinks when they do not.  A zero
+ * @grow doubles the time and a zero @shrink stops polling at once.
+ */
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink,
+                                 Error **errp);
+
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: the aio context
+ * @min: number of workers that are kept even when idle
+ * @max: maximum number of workers
+ *
+ * Workers are created on demand up to @max and exit after being idle for a
+ * while, except for the first @min ones.
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp);
+
 #endif
@@ -24,9 +24,15 @@ typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+/* Default of AioContext.thread_pool_max */
+#define THREAD_POOL_MAX_THREADS_DEFAULT 64
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
+/* Applies the thread_pool_min and thread_pool_max of ctx to the pool */
+void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
         BlockCompletionFunc *cb, void *opaque);
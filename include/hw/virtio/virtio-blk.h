@@ -34,6 +34,7 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    char *iothreads;            /* ':' separated ids, vring work per vq */
     char *serial;
     uint32_t scsi;
     uint32_t config_wce;
@@ -70,6 +71,7 @@ typedef struct VirtIOBlockReq {
     struct VirtIOBlockReq *next;
     struct VirtIOBlockReq *mr_next;
     BlockAcctCookie acct;
+    bool push_deferred;     /* pushed and freed by the virtqueue iothread */
 } VirtIOBlockReq;
 
 #define VIRTIO_BLK_MAX_MERGE_REQS 32
@@ -83,6 +85,7 @@ typedef struct MultiReqBuffer {
 void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
                              VirtIOBlockReq *req);
 void virtio_blk_free_request(VirtIOBlockReq *req);
+VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq);
 
 void virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb);
 
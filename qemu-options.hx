@@ -518,7 +518,7 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -561,7 +561,9 @@ These options have the same definition as they have in @option{-hdachs}.
 @item cache=@var{cache}
 @var{cache} is "none", "writeback", "unsafe", "directsync" or "writethrough" and controls how the host cache is used to access block data.
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread based disk I/O, native Linux AIO and Linux io_uring.
+With "io_uring", the file driver options @option{io-uring-fixed-files=on} (registered files) and
+@option{io-uring-sqpoll=on} (kernel submission thread, Linux 5.11 or later) are available.
 @item discard=@var{discard}
 @var{discard} is one of "ignore" (or "off") or "unmap" (or "on") and controls whether @dfn{discard} (also known as @dfn{trim} or @dfn{unmap}) requests are ignored or passed to the filesystem.  Some machine types may not support discard requests.
 @item format=@var{format}
@@ -3887,6 +3889,23 @@ Dump the network traffic on netdev @var{dev} to the file specified by
 The file format is libpcap, so it can be analyzed with tools such as tcpdump
 or Wireshark.
 
+@item -object iothread,id=@var{id}[,poll-max-ns=@var{ns}][,poll-grow=@var{factor}][,poll-shrink=@var{factor}][,thread-pool-min=@var{n}][,thread-pool-max=@var{n}]
+
+Creates a dedicated event loop thread that devices can be assigned to.
+Before blocking, the thread busy polls virtqueues and I/O completions for up
+to @var{poll-max-ns} nanoseconds (32768 by default, 0 disables polling).
+The polling time adapts to how long the thread waits for events: it is
+multiplied by @var{poll-grow} (2 if 0) while events arrive within
+@var{poll-max-ns} and divided by @var{poll-shrink} (reset if 0) otherwise.
+
+The thread pool of the iothread, used for example by the @code{threads} AIO
+engine and by flushes, keeps at least @var{thread-pool-min} workers (0 by
+default) and creates up to @var{thread-pool-max} workers (64 by default).
+Workers are created by the iothread and inherit its CPU affinity, so pinning
+the iothread keeps them on its NUMA node.
+
+The parameters can be changed at run time with @code{qom-set}.
+
 @item -object secret,id=@var{id},data=@var{string},format=@var{raw|base64}[,keyid=@var{secretid},iv=@var{string}]
 @item -object secret,id=@var{id},file=@var{filename},format=@var{raw|base64}[,keyid=@var{secretid},iv=@var{string}]
 
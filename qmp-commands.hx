@@ -2941,6 +2941,9 @@ Return a json-array. Each iothread is represented by a json-object, which contai
 
 - "id": name of iothread (json-str)
 - "thread-id": ID of the underlying host thread (json-int)
+- "poll-max-ns": maximum polling time in ns, 0 if polling is disabled (json-int)
+- "poll-grow": polling time growth factor (json-int)
+- "poll-shrink": polling time shrink factor (json-int)
 
 Example:
 
@@ -2949,11 +2952,17 @@ Example:
       "return":[
          {
             "id":"iothread0",
-            "thread-id":3134
+            "thread-id":3134,
+            "poll-max-ns":32768,
+            "poll-grow":0,
+            "poll-shrink":0
          },
          {
             "id":"iothread1",
-            "thread-id":3135
+            "thread-id":3135,
+            "poll-max-ns":0,
+            "poll-grow":0,
+            "poll-shrink":0
          }
       ]
    }
@@ -5039,3 +5048,50 @@ Example for pc machine type started with
             "props": {"core-id": 0, "socket-id": 0, "thread-id": 0}
          }
        ]}
+
+EQMP
+
+    {
+        .name       = "query-ox",
+        .args_type  = "id:s?",
+        .mhandler.cmd_new = qmp_marshal_query_ox,
+    },
+
+SQMP
+query-ox
+--------
+
+Show the runtime state of the OX controller: multi-queue occupancy and
+timeouts, per channel block provisioning and mapping cache counters, garbage
+collection counters and VOLT memory usage. Channel and GC information is
+only present when OX runs the AppNVM FTL (lnvm=0).
+
+Arguments:
+
+- "id": ox-ctrl device id, required when several devices are present
+        (json-string, optional)
+
+Example:
+
+-> { "execute": "query-ox" }
+<- { "return": {
+       "id": "ox0",
+       "lnvm": false,
+       "mq": [
+         { "name": "VOLT_MMGR", "queue-size": 2048, "ext-list": 0,
+           "timeout": 0, "timeout-back": 0,
+           "queues": [ { "id": 0, "sq-free": 2048, "sq-used": 0,
+                         "sq-wait": 0, "cq-free": 2048, "cq-used": 0 } ] }
+       ],
+       "channels": [
+         { "id": 0, "active": true, "need-gc": false, "free-blocks": 240,
+           "used-blocks": 12, "open-blocks": 4, "map-cache-used": 8,
+           "map-cache-free": 120, "map-cache-hits": 10233,
+           "map-cache-misses": 8, "map-cache-evictions": 0 }
+       ],
+       "gc": { "recycled-blocks": 0, "moved-sectors": 0,
+               "padding-sectors": 0, "failed-sectors": 0,
+               "unknown-sectors": 0, "map-pages": 0 },
+       "volt-memory": 2214592512 } }
+
+EQMP
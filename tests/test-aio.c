@@ -122,7 +122,7 @@ static void *test_acquire_thread(void *opaque)
 static void set_event_notifier(AioContext *ctx, EventNotifier *notifier,
                                EventNotifierHandler *handler)
 {
-    aio_set_event_notifier(ctx, notifier, false, handler);
+    aio_set_event_notifier(ctx, notifier, false, handler, NULL);
 }
 
 static void dummy_notifier_read(EventNotifier *unused)
@@ -382,7 +382,7 @@ static void test_aio_external_client(void)
     for (i = 1; i < 3; i++) {
         EventNotifierTestData data = { .n = 0, .active = 10, .auto_set = true };
         event_notifier_init(&data.e, false);
-        aio_set_event_notifier(ctx, &data.e, true, event_ready_cb);
+        aio_set_event_notifier(ctx, &data.e, true, event_ready_cb, NULL);
         event_notifier_set(&data.e);
         for (j = 0; j < i; j++) {
             aio_disable_external(ctx);
@@ -504,6 +504,158 @@ static void test_timer_schedule(void)
     timer_del(&data.timer);
 }
 
+#ifdef CONFIG_POSIX
+typedef struct {
+    EventNotifier e;
+    int n;
+    int poll_n;
+    bool ready;
+} PollTestData;
+
+static void poll_read_cb(EventNotifier *e)
+{
+    PollTestData *data = container_of(e, PollTestData, e);
+    g_assert(event_notifier_test_and_clear(e));
+    data->n++;
+}
+
+static bool poll_test_cb(void *opaque)
+{
+    PollTestData *data = container_of(opaque, PollTestData, e);
+
+    if (!data->ready) {
+        return false;
+    }
+    data->ready = false;
+    data->poll_n++;
+    return true;
+}
+
+static void poll_timer_cb(void *opaque)
+{
+    bool *fired = opaque;
+    *fired = true;
+}
+
+/* Block in aio_poll() once, until a timer @ns nanoseconds from now fires */
+static void poll_wait_timer(int64_t ns)
+{
+    bool fired = false;
+    QEMUTimer *timer = aio_timer_new(ctx, QEMU_CLOCK_REALTIME, SCALE_NS,
+                                     poll_timer_cb, &fired);
+
+    timer_mod(timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + ns);
+    g_assert(aio_poll(ctx, true));
+    g_assert(fired);
+    timer_free(timer);
+}
+
+static void test_poll_handler_progress(void)
+{
+    PollTestData data = { .n = 0 };
+
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, false, poll_read_cb, poll_test_cb);
+    g_assert_cmpint(ctx->poll_disable_cnt, ==, 0);
+
+    aio_context_set_poll_params(ctx, 50 * SCALE_MS, 0, 0, &error_abort);
+    ctx->poll_ns = ctx->poll_max_ns;
+
+    /* Progress is made by the poll handler alone, without the notifier */
+    data.ready = true;
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.poll_n, ==, 1);
+    g_assert_cmpint(data.n, ==, 0);
+    g_assert(!data.ready);
+
+    /* Non-blocking aio_poll() never busy polls */
+    data.ready = true;
+    g_assert(!aio_poll(ctx, false));
+    g_assert_cmpint(data.poll_n, ==, 1);
+    data.ready = false;
+
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+    aio_set_event_notifier(ctx, &data.e, false, NULL, NULL);
+    event_notifier_cleanup(&data.e);
+}
+
+static void test_poll_disable_cnt(void)
+{
+    PollTestData data = { .n = 0 };
+    PollTestData dummy = { .n = 0 };
+    int cnt = ctx->poll_disable_cnt;
+
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, false, poll_read_cb, poll_test_cb);
+    g_assert_cmpint(ctx->poll_disable_cnt, ==, cnt);
+
+    /* A handler without io_poll disables busy polling... */
+    event_notifier_init(&dummy.e, false);
+    aio_set_event_notifier(ctx, &dummy.e, false, poll_read_cb, NULL);
+    g_assert_cmpint(ctx->poll_disable_cnt, ==, cnt + 1);
+
+    aio_context_set_poll_params(ctx, 50 * SCALE_MS, 0, 0, &error_abort);
+    ctx->poll_ns = ctx->poll_max_ns;
+
+    data.ready = true;
+    event_notifier_set(&dummy.e);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(dummy.n, ==, 1);
+    g_assert_cmpint(data.poll_n, ==, 0);
+
+    /* ... until it gains one... */
+    aio_set_event_notifier(ctx, &dummy.e, false, poll_read_cb, poll_test_cb);
+    g_assert_cmpint(ctx->poll_disable_cnt, ==, cnt);
+    aio_set_event_notifier(ctx, &dummy.e, false, poll_read_cb, NULL);
+    g_assert_cmpint(ctx->poll_disable_cnt, ==, cnt + 1);
+
+    /* ... or is removed */
+    aio_set_event_notifier(ctx, &dummy.e, false, NULL, NULL);
+    event_notifier_cleanup(&dummy.e);
+    g_assert_cmpint(ctx->poll_disable_cnt, ==, cnt);
+
+    ctx->poll_ns = ctx->poll_max_ns;
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.poll_n, ==, 1);
+
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+    aio_set_event_notifier(ctx, &data.e, false, NULL, NULL);
+    event_notifier_cleanup(&data.e);
+}
+
+static void test_poll_adjust(void)
+{
+    PollTestData data = { .n = 0 };
+
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, false, poll_read_cb, poll_test_cb);
+
+    aio_context_set_poll_params(ctx, 50 * SCALE_MS, 2, 2, &error_abort);
+    g_assert_cmpint(ctx->poll_ns, ==, 0);
+
+    /* Events that arrive within poll_max_ns grow the polling time */
+    poll_wait_timer(SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, ==, 4000);
+    poll_wait_timer(SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, ==, 8000);
+
+    /* Blocking for longer than poll_max_ns shrinks it */
+    poll_wait_timer(100 * SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, ==, 4000);
+
+    /* Without a shrink factor, polling stops at once */
+    aio_context_set_poll_params(ctx, 50 * SCALE_MS, 2, 0, &error_abort);
+    poll_wait_timer(SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, ==, 4000);
+    poll_wait_timer(100 * SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, ==, 0);
+
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+    aio_set_event_notifier(ctx, &data.e, false, NULL, NULL);
+    event_notifier_cleanup(&data.e);
+}
+#endif
+
 /* Now the same tests, using the context as a GSource.  They are
  * very similar to the ones above, with g_main_context_iteration
  * replacing aio_poll.  However:
@@ -857,6 +1009,11 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/external-client",         test_aio_external_client);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+#ifdef CONFIG_POSIX
+    g_test_add_func("/aio/poll/progress",           test_poll_handler_progress);
+    g_test_add_func("/aio/poll/disable-cnt",        test_poll_disable_cnt);
+    g_test_add_func("/aio/poll/adjust",             test_poll_adjust);
+#endif
 
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
     g_test_add_func("/aio-gsource/bh/schedule",             test_source_bh_schedule);
@@ -32,6 +32,17 @@ static int long_cb(void *opaque)
     return 0;
 }
 
+static bool blockers_released;
+
+static int blocking_cb(void *opaque)
+{
+    WorkerTestData *data = opaque;
+    while (!atomic_read(&blockers_released)) {
+        g_usleep(1000);
+    }
+    return atomic_fetch_inc(&data->n);
+}
+
 static void done_cb(void *opaque, int ret)
 {
     WorkerTestData *data = opaque;
@@ -134,6 +145,39 @@ static void test_submit_many(void)
     }
 }
 
+static void test_submit_overflow(void)
+{
+    const int blockers = THREAD_POOL_MAX_THREADS_DEFAULT;
+    const int n = 2000;
+    WorkerTestData *data = g_new0(WorkerTestData, blockers + n);
+    int i;
+
+    /* Occupy every worker first, so that none of the following requests
+     * can be dequeued and more than the work queue can hold are queued
+     * at once.
+     */
+    atomic_set(&blockers_released, false);
+    for (i = 0; i < blockers; i++) {
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(pool, blocking_cb, &data[i], done_cb, &data[i]);
+    }
+    for (; i < blockers + n; i++) {
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(pool, worker_cb, &data[i], done_cb, &data[i]);
+    }
+
+    atomic_set(&blockers_released, true);
+    active = blockers + n;
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    for (i = 0; i < blockers + n; i++) {
+        g_assert_cmpint(data[i].n, ==, 1);
+        g_assert_cmpint(data[i].ret, ==, 0);
+    }
+    g_free(data);
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -167,19 +211,30 @@ static void do_test_cancel(bool sync)
     g_usleep(1000000);
     g_assert_cmpint(active, >, 50);
 
-    /* Cancel the jobs that haven't been started yet.  */
+    /* Cancel the jobs that haven't been started yet.  They are completed
+     * by the canceling thread, without waiting for a worker to dequeue
+     * them.
+     */
     num_canceled = 0;
     for (i = 0; i < 100; i++) {
         if (atomic_cmpxchg(&data[i].n, 0, 3) == 0) {
             data[i].ret = -ECANCELED;
             if (sync) {
                 bdrv_aio_cancel(data[i].aiocb);
+                g_assert(data[i].aiocb == NULL);
             } else {
                 bdrv_aio_cancel_async(data[i].aiocb);
             }
             num_canceled++;
         }
     }
+    if (!sync) {
+        for (i = 0; i < 100; i++) {
+            while (data[i].n == 3 && data[i].aiocb) {
+                aio_poll(ctx, true);
+            }
+        }
+    }
     g_assert_cmpint(active, >, 0);
     g_assert_cmpint(num_canceled, <, 100);
 
@@ -240,6 +295,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/submit-overflow", test_submit_overflow);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
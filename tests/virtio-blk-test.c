@@ -58,18 +58,18 @@ static char *drive_create(void)
     return tmp_path;
 }
 
-static QPCIBus *pci_test_start(void)
+static QPCIBus *pci_test_start_opts(const char *extra, const char *props)
 {
     char *cmdline;
     char *tmp_path;
 
     tmp_path = drive_create();
 
-    cmdline = g_strdup_printf("-drive if=none,id=drive0,file=%s,format=raw "
+    cmdline = g_strdup_printf("%s -drive if=none,id=drive0,file=%s,format=raw "
                         "-drive if=none,id=drive1,file=/dev/null,format=raw "
                         "-device virtio-blk-pci,id=drv0,drive=drive0,"
-                        "addr=%x.%x",
-                        tmp_path, PCI_SLOT, PCI_FN);
+                        "addr=%x.%x%s",
+                        extra, tmp_path, PCI_SLOT, PCI_FN, props);
     qtest_start(cmdline);
     unlink(tmp_path);
     g_free(tmp_path);
@@ -78,6 +78,11 @@ static QPCIBus *pci_test_start(void)
     return qpci_init_pc();
 }
 
+static QPCIBus *pci_test_start(void)
+{
+    return pci_test_start_opts("", "");
+}
+
 static void arm_test_start(void)
 {
     char *cmdline;
@@ -306,6 +311,39 @@ static void pci_basic(void)
     test_end();
 }
 
+/* Virtqueue 1 is served by io1, the BlockBackend by io0 */
+static void pci_iothreads(void)
+{
+    QVirtioPCIDevice *dev;
+    QPCIBus *bus;
+    QVirtQueuePCI *vqpci;
+    QGuestAllocator *alloc;
+    void *addr;
+
+    bus = pci_test_start_opts("-object iothread,id=io0 "
+                              "-object iothread,id=io1",
+                              ",num-queues=2,iothreads=io0:io1");
+    dev = virtio_blk_pci_init(bus, PCI_SLOT);
+
+    alloc = pc_alloc_init();
+    vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&qvirtio_pci, &dev->vdev,
+                                                                    alloc, 1);
+
+    /* MSI-X is not enabled */
+    addr = dev->addr + VIRTIO_PCI_CONFIG_OFF(false);
+
+    test_basic(&qvirtio_pci, &dev->vdev, alloc, &vqpci->vq,
+                                                    (uint64_t)(uintptr_t)addr);
+
+    /* End test */
+    qvirtqueue_cleanup(&qvirtio_pci, &vqpci->vq, alloc);
+    pc_alloc_uninit(alloc);
+    qvirtio_pci_device_disable(dev);
+    g_free(dev);
+    qpci_free_pc(bus);
+    test_end();
+}
+
 static void pci_indirect(void)
 {
     QVirtioPCIDevice *dev;
@@ -759,6 +797,7 @@ int main(int argc, char **argv)
 
     if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
         qtest_add_func("/virtio/blk/pci/basic", pci_basic);
+        qtest_add_func("/virtio/blk/pci/iothreads", pci_iothreads);
         qtest_add_func("/virtio/blk/pci/indirect", pci_indirect);
         qtest_add_func("/virtio/blk/pci/config", pci_config);
         qtest_add_func("/virtio/blk/pci/msix", pci_msix);
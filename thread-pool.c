@@ -26,10 +26,12 @@
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolSlot ThreadPoolSlot;
 
 enum ThreadState {
     THREAD_QUEUED,
     THREAD_ACTIVE,
+    THREAD_CANCELED,
     THREAD_DONE,
 };
 
@@ -39,18 +41,45 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is done with atomic_cmpxchg, by
+     * the worker that dequeues elem or by thread_pool_cancel.  After that,
+     * only the thread that owns elem can write to it: the worker, or
+     * thread_pool_cancel if it took elem back from the work queue.  Reads
+     * and writes of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Ring slot holding elem, NULL if it went to request_list.  Set before
+     * the slot is published, thread_pool_cancel uses it to take elem back.
+     */
+    ThreadPoolSlot *slot;
+
+    /* Access to this list and to in_list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
+    bool in_list;
+
+    /* Completed requests, pushed by the workers without locks.  */
+    QSLIST_ENTRY(ThreadPoolElement) done;
 
-    /* Access to this list is protected by the global mutex.  */
-    QLIST_ENTRY(ThreadPoolElement) all;
+    /* Only accessed from the pool's AioContext.  */
+    QSIMPLEQ_ENTRY(ThreadPoolElement) completed;
+};
+
+/* The work queue is a bounded lock-free multi-producer multi-consumer ring
+ * (Dmitry Vyukov's design).  Each slot carries a sequence number: producers
+ * may fill the slot at position pos when its sequence is pos, consumers may
+ * empty it when the sequence is pos + 1.  When the ring is full, requests go
+ * to request_list under the lock, and so do the following ones until the
+ * workers have emptied it: workers take from the ring first, so the work
+ * queue stays FIFO.  A request canceled while queued leaves an empty slot
+ * behind, see thread_pool_cancel.
+ */
+#define THREAD_POOL_RING_SIZE 1024
+
+struct ThreadPoolSlot {
+    unsigned int seq;
+    ThreadPoolElement *elem;
 };
 
 struct ThreadPool {
@@ -59,21 +88,166 @@ struct ThreadPool {
     QemuMutex lock;
     QemuCond worker_stopped;
     QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
+    /* Lock-free work queue, see thread_pool_push.  */
+    ThreadPoolSlot ring[THREAD_POOL_RING_SIZE];
+    unsigned int enqueue_pos;
+    unsigned int dequeue_pos;
+
+    /* Requests in the work queue, including request_list.  Accessed with
+     * atomic primitives.
+     */
+    int queued;
+    int idle_threads;
+
+    /* Completed requests, handed off to the completion BH in batches.  */
+    QSLIST_HEAD(, ThreadPoolElement) done;
+
     /* The following variables are only accessed from one AioContext. */
-    QLIST_HEAD(, ThreadPoolElement) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) completed;
+    int in_flight;
 
-    /* The following variables are protected by lock.  */
+    /* The following variables are protected by lock.  cur_threads,
+     * max_threads and stopping are also read without it.
+     */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    int overflow;        /* length of request_list, read without the lock */
+    int canceled;        /* removed from request_list, count still posted */
+    int min_threads;
+    int max_threads;
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     bool stopping;
 };
 
+static bool thread_pool_push(ThreadPool *pool, ThreadPoolElement *elem)
+{
+    ThreadPoolSlot *slot;
+    unsigned int pos = atomic_read(&pool->enqueue_pos);
+
+    for (;;) {
+        int diff;
+
+        slot = &pool->ring[pos % THREAD_POOL_RING_SIZE];
+        diff = (int)(atomic_mb_read(&slot->seq) - pos);
+        if (diff == 0) {
+            if (atomic_cmpxchg(&pool->enqueue_pos, pos, pos + 1) == pos) {
+                break;
+            }
+            pos = atomic_read(&pool->enqueue_pos);
+        } else if (diff < 0) {
+            return false;   /* full */
+        } else {
+            pos = atomic_read(&pool->enqueue_pos);
+        }
+    }
+
+    elem->slot = slot;
+    slot->elem = elem;
+    /* Write elem before publishing the slot.  */
+    atomic_mb_set(&slot->seq, pos + 1);
+    return true;
+}
+
+/* Returns false if the ring is empty.  *elem is NULL if the request in the
+ * slot has been canceled.
+ */
+static bool thread_pool_ring_pop(ThreadPool *pool, ThreadPoolElement **elem)
+{
+    ThreadPoolSlot *slot;
+    unsigned int pos = atomic_read(&pool->dequeue_pos);
+
+    for (;;) {
+        int diff;
+
+        slot = &pool->ring[pos % THREAD_POOL_RING_SIZE];
+        diff = (int)(atomic_mb_read(&slot->seq) - (pos + 1));
+        if (diff == 0) {
+            if (atomic_cmpxchg(&pool->dequeue_pos, pos, pos + 1) == pos) {
+                break;
+            }
+            pos = atomic_read(&pool->dequeue_pos);
+        } else if (diff < 0) {
+            return false;   /* empty */
+        } else {
+            pos = atomic_read(&pool->dequeue_pos);
+        }
+    }
+
+    /* Races with thread_pool_cancel taking elem back.  */
+    *elem = atomic_xchg(&slot->elem, NULL);
+    /* Read elem before handing the slot back to producers.  */
+    atomic_mb_set(&slot->seq, pos + THREAD_POOL_RING_SIZE);
+    return true;
+}
+
+/* Called after taking a count from the semaphore.  The count was posted
+ * after the request was queued, so there is one in the ring or in
+ * request_list, or it has been canceled.  The ring may look empty for a
+ * moment while an earlier producer publishes its slot.  Returns NULL if
+ * the request has been canceled.
+ */
+static ThreadPoolElement *thread_pool_pop(ThreadPool *pool)
+{
+    ThreadPoolElement *req;
+    bool found;
+
+    for (;;) {
+        if (thread_pool_ring_pop(pool, &req)) {
+            break;
+        }
+
+        qemu_mutex_lock(&pool->lock);
+        req = QTAILQ_FIRST(&pool->request_list);
+        found = true;
+        if (req) {
+            QTAILQ_REMOVE(&pool->request_list, req, reqs);
+            req->in_list = false;
+            atomic_set(&pool->overflow, pool->overflow - 1);
+        } else if (pool->canceled) {
+            pool->canceled--;
+        } else {
+            found = false;
+        }
+        qemu_mutex_unlock(&pool->lock);
+        if (found) {
+            break;
+        }
+    }
+
+    atomic_dec(&pool->queued);
+    return req;
+}
+
+/* Decides under the lock whether a worker exits.  A worker whose semaphore
+ * wait timed out stays if a request raced with the timeout or if the pool
+ * keeps min_threads around.  Otherwise workers above max_threads exit once
+ * they are done with a request.
+ */
+static bool worker_exit(ThreadPool *pool, bool timed_out)
+{
+    bool ret;
+
+    qemu_mutex_lock(&pool->lock);
+    if (pool->stopping) {
+        ret = true;
+    } else if (timed_out) {
+        ret = !atomic_read(&pool->queued) &&
+              pool->cur_threads > pool->min_threads;
+    } else {
+        ret = pool->cur_threads > pool->max_threads;
+    }
+    if (ret) {
+        pool->cur_threads--;
+        qemu_cond_signal(&pool->worker_stopped);
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    return ret;
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
@@ -81,42 +255,49 @@ static void *worker_thread(void *opaque)
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
     do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
 
-    while (!pool->stopping) {
+    for (;;) {
         ThreadPoolElement *req;
         int ret;
 
-        do {
-            pool->idle_threads++;
-            qemu_mutex_unlock(&pool->lock);
-            ret = qemu_sem_timedwait(&pool->sem, 10000);
-            qemu_mutex_lock(&pool->lock);
-            pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
-            break;
-        }
+        atomic_inc(&pool->idle_threads);
+        ret = qemu_sem_timedwait(&pool->sem, 10000);
+        atomic_dec(&pool->idle_threads);
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
+        if (ret == -1 || atomic_read(&pool->stopping)) {
+            if (worker_exit(pool, ret == -1)) {
+                break;
+            }
+            continue;
+        }
 
-        ret = req->func(req->arg);
+        req = thread_pool_pop(pool);
+        if (!req) {
+            continue;
+        }
+        if (atomic_cmpxchg(&req->state, THREAD_QUEUED, THREAD_ACTIVE) ==
+            THREAD_QUEUED) {
+            ret = req->func(req->arg);
+        } else {
+            /* Canceled while queued, complete it without running it */
+            ret = -ECANCELED;
+        }
 
         req->ret = ret;
         /* Write ret before state.  */
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
-
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->done, req, done);
         qemu_bh_schedule(pool->completion_bh);
+
+        if (atomic_read(&pool->cur_threads) >
+            atomic_read(&pool->max_threads) && worker_exit(pool, false)) {
+            break;
+        }
     }
 
-    pool->cur_threads--;
-    qemu_cond_signal(&pool->worker_stopped);
-    qemu_mutex_unlock(&pool->lock);
     return NULL;
 }
 
@@ -152,44 +333,66 @@ static void spawn_thread(ThreadPool *pool)
      * we don't spend time creating many threads in a loop holding a mutex or
      * starving the current vcpu.
      *
-     * If there are no idle threads, ask the main thread to create one, so we
-     * inherit the correct affinity instead of the vcpu affinity.
+     * If there are no idle threads, ask the AioContext's thread to create
+     * one, so we inherit its affinity (and NUMA node) instead of the vcpu
+     * affinity.
      */
     if (!pool->pending_threads) {
         qemu_bh_schedule(pool->new_thread_bh);
     }
 }
 
+/* Moves the requests completed by the workers to pool->completed, in the
+ * order they completed.  Workers push to the head of pool->done, so the
+ * batch is reversed.  Requests running in parallel may complete in any
+ * order, this is not the submission order.
+ */
+static void thread_pool_fetch_completions(ThreadPool *pool)
+{
+    QSLIST_HEAD(, ThreadPoolElement) done;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) batch;
+    ThreadPoolElement *elem;
+
+    QSLIST_MOVE_ATOMIC(&done, &pool->done);
+    if (QSLIST_EMPTY(&done)) {
+        return;
+    }
+
+    /* Read state and ret after the handoff.  */
+    smp_rmb();
+
+    QSIMPLEQ_INIT(&batch);
+    while ((elem = QSLIST_FIRST(&done))) {
+        QSLIST_REMOVE_HEAD(&done, done);
+        QSIMPLEQ_INSERT_HEAD(&batch, elem, completed);
+    }
+    QSIMPLEQ_CONCAT(&pool->completed, &batch);
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
-        }
+    thread_pool_fetch_completions(pool);
+
+    while ((elem = QSIMPLEQ_FIRST(&pool->completed))) {
+        assert(elem->state == THREAD_DONE);
+        QSIMPLEQ_REMOVE_HEAD(&pool->completed, completed);
+        pool->in_flight--;
 
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
-        QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
-            /* Read state before ret.  */
-            smp_rmb();
-
             /* Schedule ourselves in case elem->common.cb() calls aio_poll() to
              * wait for another request that completed at the same time.
              */
             qemu_bh_schedule(pool->completion_bh);
 
             elem->common.cb(elem->common.opaque, elem->ret);
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
 }
 
@@ -197,25 +400,41 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
     ThreadPool *pool = elem->pool;
+    bool removed = false;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    qemu_mutex_lock(&pool->lock);
-    if (elem->state == THREAD_QUEUED &&
-        /* No thread has yet started working on elem. we can try to "steal"
-         * the item from the worker if we can get a signal from the
-         * semaphore.  Because this is non-blocking, we can do it with
-         * the lock taken and ensure that elem will remain THREAD_QUEUED.
-         */
-        qemu_sem_timedwait(&pool->sem, 0) == 0) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+    if (atomic_cmpxchg(&elem->state, THREAD_QUEUED, THREAD_CANCELED) !=
+        THREAD_QUEUED) {
+        return;
+    }
 
-        elem->state = THREAD_DONE;
-        elem->ret = -ECANCELED;
+    /* No thread has started working on elem.  Take it back from the work
+     * queue and complete it here, so that canceling does not wait for a
+     * worker.  If a worker dequeued it first, the worker completes it with
+     * -ECANCELED instead of running it.
+     */
+    if (elem->slot) {
+        removed = atomic_cmpxchg(&elem->slot->elem, elem, NULL) == elem;
+    } else {
+        qemu_mutex_lock(&pool->lock);
+        if (elem->in_list) {
+            QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+            elem->in_list = false;
+            atomic_set(&pool->overflow, pool->overflow - 1);
+            /* The worker taking the semaphore count finds nothing */
+            pool->canceled++;
+            removed = true;
+        }
+        qemu_mutex_unlock(&pool->lock);
     }
 
-    qemu_mutex_unlock(&pool->lock);
+    if (removed) {
+        elem->ret = -ECANCELED;
+        elem->state = THREAD_DONE;
+        QSIMPLEQ_INSERT_TAIL(&pool->completed, elem, completed);
+        qemu_bh_schedule(pool->completion_bh);
+    }
 }
 
 static AioContext *thread_pool_get_aio_context(BlockAIOCB *acb)
@@ -242,17 +461,37 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->slot = NULL;
+    req->in_list = false;
 
-    QLIST_INSERT_HEAD(&pool->head, req, all);
+    pool->in_flight++;
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    /* Queue behind the requests that overflowed, if any.  Only this
+     * AioContext adds to request_list, so overflow may be stale here but
+     * never reads 0 while the list has requests.
+     */
+    if (atomic_read(&pool->overflow) || !thread_pool_push(pool, req)) {
+        qemu_mutex_lock(&pool->lock);
+        QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+        req->in_list = true;
+        atomic_set(&pool->overflow, pool->overflow + 1);
+        qemu_mutex_unlock(&pool->lock);
+    }
+
+    /* Count the request before looking for idle threads, pairs with
+     * worker_exit reading queued after a timed out worker leaves idle.
+     */
+    atomic_inc(&pool->queued);
+    if (atomic_read(&pool->idle_threads) == 0 &&
+        atomic_read(&pool->cur_threads) < atomic_read(&pool->max_threads)) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->cur_threads < pool->max_threads) {
+            spawn_thread(pool);
+        }
+        qemu_mutex_unlock(&pool->lock);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
     qemu_sem_post(&pool->sem);
     return &req->common;
 }
@@ -285,8 +524,27 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(pool, func, arg, NULL, NULL);
 }
 
+void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
+{
+    qemu_mutex_lock(&pool->lock);
+
+    pool->min_threads = ctx->thread_pool_min;
+    atomic_set(&pool->max_threads, ctx->thread_pool_max);
+
+    /* Workers above max_threads exit once they are done with their current
+     * request, or when they are idle long enough.
+     */
+    while (pool->cur_threads < pool->min_threads) {
+        spawn_thread(pool);
+    }
+
+    qemu_mutex_unlock(&pool->lock);
+}
+
 static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
 {
+    int i;
+
     if (!ctx) {
         ctx = qemu_get_aio_context();
     }
@@ -297,11 +555,16 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
     qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
-    QLIST_INIT(&pool->head);
+    for (i = 0; i < THREAD_POOL_RING_SIZE; i++) {
+        pool->ring[i].seq = i;
+    }
+    QSLIST_INIT(&pool->done);
+    QSIMPLEQ_INIT(&pool->completed);
     QTAILQ_INIT(&pool->request_list);
+
+    thread_pool_update_params(pool, ctx);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -317,7 +580,7 @@ void thread_pool_free(ThreadPool *pool)
         return;
     }
 
-    assert(QLIST_EMPTY(&pool->head));
+    assert(pool->in_flight == 0);
 
     qemu_mutex_lock(&pool->lock);
 
@@ -327,7 +590,7 @@ void thread_pool_free(ThreadPool *pool)
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->stopping = true;
+    atomic_set(&pool->stopping, true);
     while (pool->cur_threads > 0) {
         qemu_sem_post(&pool->sem);
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);